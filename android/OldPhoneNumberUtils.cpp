@@ -279,4 +279,40 @@ bool phone_number_compare_loose(const char* a, const char* b)
     return phone_number_compare_loose_with_minmatch(a, b, MIN_MATCH);
 }
 
+/**
+ * Writes the caller ID key of "in" to "out": the last "min_match" non-separator
+ * characters, reversed, and at most "len" of them.
+ *
+ * phone_number_compare_loose_with_minmatch() only returns true when at least
+ * min_match trailing non-separator characters match, or when both numbers have
+ * the same non-separator characters altogether, so two numbers which compare
+ * equal always have the same key. The key can therefore be indexed and used as
+ * an equality pre-filter in front of the real comparison.
+ *
+ * Tolerates nulls
+ */
+bool phone_number_key_loose_with_minmatch(const char* in, int min_match, char* out,
+                                          const int len, int *outlen)
+{
+    int out_len = 0;
+    int key_len = (min_match < len) ? min_match : len;
+
+    if (in != NULL) {
+        for (int i = strlen(in); --i >= 0 && out_len < key_len;) {
+            char c = in[i];
+            if (isNonSeparator(c)) {
+                out[out_len++] = c;
+            }
+        }
+    }
+
+    *outlen = out_len;
+    return true;
+}
+
+bool phone_number_key_loose(const char* in, char* out, const int len, int *outlen)
+{
+    return phone_number_key_loose_with_minmatch(in, MIN_MATCH, out, len, outlen);
+}
+
 }  // namespace android
@@ -189,4 +189,70 @@ TEST(OldPhoneNumberUtils, compareLooseWrongPrefix) {
     EXPECT_FALSE(phone_number_compare_loose("+14504503605", "5504503605"));
 }
 
+TEST(OldPhoneNumberUtils, keyLoose) {
+    char out[41];
+    int outlen;
+
+#define ASSERT_KEY_LOOSE(input, expected) \
+    phone_number_key_loose((input), out, sizeof(out)-1, &outlen); \
+    ASSERT_LT(outlen, sizeof(out)); \
+    out[outlen] = 0; \
+    ASSERT_STREQ((expected), (out)); \
+
+    ASSERT_KEY_LOOSE(NULL, "");
+    ASSERT_KEY_LOOSE("", "");
+    ASSERT_KEY_LOOSE("999", "999");
+    ASSERT_KEY_LOOSE("abcd", "");
+
+    // Only the last 7 characters are used, separators are skipped
+    ASSERT_KEY_LOOSE("650-253-0000", "0000352");
+    ASSERT_KEY_LOOSE("+1 650", "0561+");
+    ASSERT_KEY_LOOSE("*#06#", "#60#*");
+
+    // The key length follows min_match
+    phone_number_key_loose_with_minmatch("650-253-0000", 4, out, sizeof(out)-1, &outlen);
+    out[outlen] = 0;
+    ASSERT_STREQ("0000", out);
+}
 
+// Every number used in the comparison tests above.
+static const char* kLooseNumbers[] = {
+    "", "999", "119", "123456789", "923456789", "123456781", "1234567890", "0123456789",
+    "650-253-0000", "6502530000", "650 253 0000", "1-650-253-0000", "   1-650-253-0000",
+    "11-650-253-0000", "0-650-253-0000", "555-4141", "+1-700-555-4141", "+1 650-253-0000",
+    "001 650-253-0000", "0111 650-253-0000", "+19012345678", "+819012345678",
+    "+31771234567", "0771234567", "090-1234-5678", "090(1234)5678", "+81-90-1234-5678",
+    "+79161234567", "89161234567", "+33123456789", "+36 1 234 5678", "06 1234-5678",
+    "+52 55 1234 5678", "01 55 1234 5678", "+976 1 123 4567", "01 1 23 4567",
+    "+976 2 234 5678", "02 2 34 5678", "+818012345678", "90-1234-5678", "080-1234-5678",
+    "190-1234-5678", "890-1234-5678", "+81-090-1234-5678", "+593(800)123-1234",
+    "8001231234", "008001231234", "+66811234567", "166811234567", "650-000-3456",
+    "16500003456", "011 1 7005554141", "+17005554141", "011 11 7005554141",
+    "+44 207 792 3490", "00 207 792 3490", "16610001234", "6610001234", "abcd", "bcde",
+    "1-800-flowers", "800-flowers", "1-800-abcdefg", "1-800-356-9377", "290-1234-5678",
+    "0550-450-3605", "+15504503605", "550-450-3605", "+14504503605", "+15404503605",
+    "+15514503605", "5504503605",
+};
+
+TEST(OldPhoneNumberUtils, keyLooseMatchesCompare) {
+    const int count = sizeof(kLooseNumbers) / sizeof(kLooseNumbers[0]);
+    for (int min_match = 1; min_match <= 10; min_match++) {
+        for (int i = 0; i < count; i++) {
+            for (int j = 0; j < count; j++) {
+                const char* a = kLooseNumbers[i];
+                const char* b = kLooseNumbers[j];
+                if (!phone_number_compare_loose_with_minmatch(a, b, min_match)) {
+                    continue;
+                }
+
+                char key_a[40];
+                char key_b[40];
+                int len_a, len_b;
+                phone_number_key_loose_with_minmatch(a, min_match, key_a, sizeof(key_a), &len_a);
+                phone_number_key_loose_with_minmatch(b, min_match, key_b, sizeof(key_b), &len_b);
+                ASSERT_EQ(len_a, len_b) << a << " vs " << b;
+                EXPECT_EQ(0, memcmp(key_a, key_b, len_a)) << a << " vs " << b;
+            }
+        }
+    }
+}
@@ -15,8 +15,14 @@
  */
 
 #include <ctype.h>
+#include <stdint.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PHONE_NUMBER_BATCH_SSE 1
+#endif
+
 namespace android {
 
 /* Generated by the following Python script. Values of country calling codes
@@ -60,6 +66,11 @@ static bool two_length_country_code_map[100] = {
 
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof((a)[0]))
 
+// Number of trailing characters used by phone_number_key_strict(). This is the
+// same as the minimum match used by the loose comparison and by the Java
+// PhoneNumberUtils.toCallerIDMinMatch().
+#define STRICT_KEY_LENGTH 7
+
 /**
  * Returns true if "ccc_candidate" expresses (part of ) some country calling
  * code.
@@ -446,6 +457,51 @@ bool phone_number_compare_strict(const char* a, const char* b)
     return phone_number_compare_inter(a, b, true);
 }
 
+/**
+ * Writes the caller ID key of "in" to "out": the last STRICT_KEY_LENGTH
+ * non-separator characters following the country calling code (if any),
+ * reversed, and at most "len" of them. Numbers with fewer such characters get
+ * the empty key.
+ *
+ * phone_number_compare_strict() walks both numbers backwards from the end of
+ * their national parts and tolerates at most a trunk prefix (or the NANP "1")
+ * in front of the shorter one, so two numbers which compare equal and both have
+ * at least STRICT_KEY_LENGTH such characters always have the same key. When one
+ * of them is shorter its key is empty instead: "555" equals "1555", and both
+ * keys are empty, while "555414" equals "1555414", whose key is "4145551".
+ *
+ * Assume NULL as 0-length string.
+ */
+bool phone_number_key_strict(const char* in, char* out, const int len, int *outlen)
+{
+    const char* str = (in != NULL) ? in : "";
+    size_t str_len = strlen(str);
+    char key[STRICT_KEY_LENGTH];
+    int key_len = 0;
+
+    const char* national = NULL;
+    size_t national_len = str_len;
+    if (tryGetCountryCallingCode(str, str_len, &national, &national_len, true) >= 0) {
+        str = national;
+        str_len = national_len;
+    }
+
+    for (int i = str_len; --i >= 0 && key_len < STRICT_KEY_LENGTH;) {
+        char c = str[i];
+        if (!isSeparator(c)) {
+            key[key_len++] = c;
+        }
+    }
+
+    int out_len = 0;
+    if (key_len == STRICT_KEY_LENGTH) {
+        out_len = (key_len < len) ? key_len : len;
+        memcpy(out, key, out_len);
+    }
+    *outlen = out_len;
+    return true;
+}
+
 /**
  * Imitates the Java method PhoneNumberUtils.getStrippedReversed.
  * Used for API compatibility with Android 1.6 and earlier.
@@ -482,4 +538,183 @@ bool phone_number_stripped_reversed_inter(const char* in, char* out, const int l
     return true;
 }
 
+#ifdef PHONE_NUMBER_BATCH_SSE
+
+/**
+ * Shuffle control moving the bytes selected by each 8-bit mask to the front,
+ * in order.
+ */
+struct CompressTable {
+    uint8_t shuffle[256][8];
+
+    CompressTable() {
+        for (int mask = 0; mask < 256; mask++) {
+            int n = 0;
+            for (int i = 0; i < 8; i++) {
+                if (mask & (1 << i)) {
+                    shuffle[mask][n++] = i;
+                }
+            }
+            while (n < 8) {
+                shuffle[mask][n++] = 0x80;
+            }
+        }
+    }
+};
+
+static const CompressTable kCompressTable;
+
+/**
+ * phone_number_stripped_reversed_inter() and the country calling code of
+ * "str", 16 bytes at a time from the end of the string.
+ *
+ * Each block is loaded reversed and classified into kept characters ('0'-'9',
+ * '*', '#', 'N'), '+' and ';'/',' with byte compares. The kept characters are
+ * then packed with two table driven shuffles. A ';' or ',' discards everything
+ * after it as in the scalar loop, which only matters for blocks containing one.
+ */
+__attribute__((target("sse4.2,popcnt")))
+static void stripped_reversed_sse(const char* str, size_t str_len, char* out, const int len,
+                                  int* outlen, int* ccc)
+{
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i hash = _mm_set1_epi8('#');
+    const __m128i wild = _mm_set1_epi8('N');
+    const __m128i plus = _mm_set1_epi8('+');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i semicolon = _mm_set1_epi8(';');
+
+    int out_len = 0;
+    bool have_seen_plus = false;
+    size_t end = str_len;
+    int first_dialable = -1;
+    while (end > 0) {
+        size_t n = (end < 16) ? end : 16;
+        // rev[j] is str[top - j] for the "valid" bits j.
+        size_t top = end - 1;
+        uint32_t valid = 0xffff;
+        __m128i block;
+        if (n == 16) {
+            block = _mm_loadu_si128((const __m128i*)(str + end - 16));
+        } else if (str_len >= 16) {
+            // The head of a long string: reload its first 16 bytes and ignore
+            // the ones already processed.
+            block = _mm_loadu_si128((const __m128i*)str);
+            top = 15;
+            valid &= ~((1u << (16 - n)) - 1);
+        } else {
+            // A short string, right aligned; the padding is not kept.
+            uint8_t tmp[16] = {};
+            memcpy(tmp + 16 - n, str, n);
+            block = _mm_loadu_si128((const __m128i*)tmp);
+        }
+        __m128i rev = _mm_shuffle_epi8(block, reverse);
+
+        __m128i digits = _mm_sub_epi8(rev, zero);
+        digits = _mm_cmpeq_epi8(_mm_min_epu8(digits, nine), digits);
+        __m128i dialable = _mm_or_si128(digits, _mm_or_si128(_mm_cmpeq_epi8(rev, star),
+                                                             _mm_cmpeq_epi8(rev, hash)));
+        uint32_t keep = valid & _mm_movemask_epi8(_mm_or_si128(dialable,
+                                                               _mm_cmpeq_epi8(rev, wild)));
+        uint32_t pluses = valid & _mm_movemask_epi8(_mm_cmpeq_epi8(rev, plus));
+        uint32_t pauses = valid & _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(rev, comma),
+                                                                 _mm_cmpeq_epi8(rev, semicolon)));
+
+        if (pluses != 0 && !have_seen_plus) {
+            // Only the last '+' of the string is copied.
+            keep |= pluses & -pluses;
+            have_seen_plus = true;
+        }
+        if (pauses != 0) {
+            // Restart the output at the earliest pause of the block.
+            int last = 31 - __builtin_clz(pauses);
+            keep &= ~((2u << last) - 1);
+            out_len = 0;
+        }
+        if (n == end) {
+            uint32_t head = (valid & _mm_movemask_epi8(dialable)) | pluses;
+            if (head != 0) {
+                first_dialable = top - (31 - __builtin_clz(head));
+            }
+        }
+
+        if (keep != 0 && out_len < len) {
+            uint8_t packed[32];
+            int lo = keep & 0xff;
+            int hi = keep >> 8;
+            int lo_count = __builtin_popcount(lo);
+            __m128i lo_shuffle = _mm_loadl_epi64((const __m128i*)kCompressTable.shuffle[lo]);
+            __m128i hi_shuffle = _mm_loadl_epi64((const __m128i*)kCompressTable.shuffle[hi]);
+            _mm_storeu_si128((__m128i*)packed, _mm_shuffle_epi8(rev, lo_shuffle));
+            _mm_storeu_si128((__m128i*)(packed + lo_count),
+                             _mm_shuffle_epi8(_mm_srli_si128(rev, 8), hi_shuffle));
+            int count = lo_count + __builtin_popcount(hi);
+            if (count > len - out_len) {
+                count = len - out_len;
+            }
+            memcpy(out + out_len, packed, count);
+            out_len += count;
+        }
+        end -= n;
+    }
+
+    *outlen = out_len;
+    if (first_dialable < 0) {
+        // Nothing dialable in the first 16 characters: let the state machine
+        // skip them.
+        first_dialable = 0;
+    } else if (str[first_dialable] != '+' && str[first_dialable] != '0' &&
+               str[first_dialable] != '1') {
+        // The state machine would stop at the first dialable character.
+        *ccc = -1;
+        return;
+    }
+    *ccc = tryGetCountryCallingCode(str + first_dialable, str_len - first_dialable, NULL, NULL,
+                                    true);
+}
+
+static bool has_sse42()
+{
+    static const bool supported = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+    }();
+    return supported;
+}
+
+#endif  // PHONE_NUMBER_BATCH_SSE
+
+/**
+ * Normalizes "count" numbers at once, for bulk imports. For each in[i], writes
+ * what phone_number_stripped_reversed_inter() would to out + i * len and
+ * outlens[i], and stores the country calling code phone_number_compare_strict()
+ * would detect in cccs[i], or -1 if there is none.
+ *
+ * Assume NULL as 0-length string.
+ */
+bool phone_number_normalize_batch(const char* const* in, int count, char* out, const int len,
+                                  int* outlens, int* cccs)
+{
+#ifdef PHONE_NUMBER_BATCH_SSE
+    if (has_sse42()) {
+        for (int i = 0; i < count; i++) {
+            const char* str = (in[i] != NULL) ? in[i] : "";
+            stripped_reversed_sse(str, strlen(str), out + (size_t)i * len, len, &outlens[i],
+                                  &cccs[i]);
+        }
+        return true;
+    }
+#endif
+
+    for (int i = 0; i < count; i++) {
+        const char* str = (in[i] != NULL) ? in[i] : "";
+        phone_number_stripped_reversed_inter(str, out + (size_t)i * len, len, &outlens[i]);
+        cccs[i] = tryGetCountryCallingCode(str, strlen(str), NULL, NULL, true);
+    }
+    return true;
+}
+
 }  // namespace android
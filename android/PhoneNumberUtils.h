@@ -24,6 +24,12 @@ bool phone_number_compare_loose(const char* a, const char* b);
 bool phone_number_compare_loose_with_minmatch(const char* a, const char* b, int min_match);
 bool phone_number_compare_strict(const char* a, const char* b);
 bool phone_number_stripped_reversed_inter(const char* in, char* out, const int len, int *outlen);
+bool phone_number_key_loose(const char* in, char* out, const int len, int *outlen);
+bool phone_number_key_loose_with_minmatch(const char* in, int min_match, char* out,
+                                          const int len, int *outlen);
+bool phone_number_key_strict(const char* in, char* out, const int len, int *outlen);
+bool phone_number_normalize_batch(const char* const* in, int count, char* out, const int len,
+                                  int* outlens, int* cccs);
 
 }  // namespace android
 
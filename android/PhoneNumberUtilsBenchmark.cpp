@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PhoneNumberUtils.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+using namespace android;
+
+#define PHONE_NUMBER_BUFFER_SIZE 40
+
+// The numbers of a 50k contact vCard import, in the formats people type them.
+static std::vector<std::string> vcard_numbers(int count) {
+    static const char* kFormats[] = {
+        "+1 (%03u) %03u-%04u", "%03u-%03u-%04u", "+44 20 %04u %04u", "+81-90-%04u-%04u",
+        "0%02u %04u %04u", "(%03u) %03u %04u", "%03u.%03u.%04u;ext=%u", "+33 1 %02u %02u %02u %02u",
+    };
+    const int format_count = sizeof(kFormats) / sizeof(kFormats[0]);
+
+    std::vector<std::string> numbers;
+    numbers.reserve(count);
+    uint32_t seed = 1;
+    for (int i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 8;
+        char buf[64];
+        snprintf(buf, sizeof(buf), kFormats[r % format_count], r % 1000, (r / 7) % 1000,
+                 (r / 13) % 10000, (r / 17) % 100);
+        numbers.push_back(buf);
+    }
+    return numbers;
+}
+
+static void BM_StrippedReversed(benchmark::State& state) {
+    std::vector<std::string> numbers = vcard_numbers(state.range(0));
+    char out[PHONE_NUMBER_BUFFER_SIZE];
+    int outlen;
+    for (auto _ : state) {
+        for (const std::string& number : numbers) {
+            phone_number_stripped_reversed_inter(number.c_str(), out, sizeof(out), &outlen);
+            benchmark::DoNotOptimize(outlen);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * numbers.size());
+}
+BENCHMARK(BM_StrippedReversed)->Arg(50000);
+
+static void BM_NormalizeBatch(benchmark::State& state) {
+    std::vector<std::string> numbers = vcard_numbers(state.range(0));
+    std::vector<const char*> in;
+    for (const std::string& number : numbers) {
+        in.push_back(number.c_str());
+    }
+    std::vector<char> out(in.size() * PHONE_NUMBER_BUFFER_SIZE);
+    std::vector<int> outlens(in.size());
+    std::vector<int> cccs(in.size());
+    for (auto _ : state) {
+        phone_number_normalize_batch(in.data(), in.size(), out.data(), PHONE_NUMBER_BUFFER_SIZE,
+                                     outlens.data(), cccs.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * in.size());
+}
+BENCHMARK(BM_NormalizeBatch)->Arg(50000);
+
+BENCHMARK_MAIN();
@@ -227,3 +227,166 @@ TEST(PhoneNumberUtils, compareStrictRussianNumbers) {
 
     EXPECT_FALSE(phone_number_compare_strict("88001234567", "+88001234567"));
 }
+
+TEST(PhoneNumberUtils, keyStrict) {
+    char out[41];
+    int outlen;
+
+#define ASSERT_KEY_STRICT(input, expected) \
+    phone_number_key_strict((input), out, sizeof(out)-1, &outlen); \
+    ASSERT_LT(outlen, sizeof(out)); \
+    out[outlen] = 0; \
+    ASSERT_STREQ((expected), (out)); \
+
+    ASSERT_KEY_STRICT(NULL, "");
+    ASSERT_KEY_STRICT("", "");
+
+    // Numbers with fewer than 7 characters get the empty key
+    ASSERT_KEY_STRICT("999", "");
+    ASSERT_KEY_STRICT("555-414", "");
+    ASSERT_KEY_STRICT("555-4141", "1414555");
+
+    // Only the last 7 characters are used, separators are skipped
+    ASSERT_KEY_STRICT("650-253-0000", "0000352");
+    ASSERT_KEY_STRICT("1-800-flowers", "srewolf");
+
+    // The country calling code is not part of the key
+    ASSERT_KEY_STRICT("+1 650", "");
+    ASSERT_KEY_STRICT("+81-90-1234-5678", "8765432");
+    ASSERT_KEY_STRICT("166 811", "");
+    ASSERT_KEY_STRICT("+1 650-253-0", "0352056");
+
+    // The key is truncated to the buffer size
+    phone_number_key_strict("650-253-0000", out, 3, &outlen);
+    ASSERT_EQ(3, outlen);
+}
+
+// Every number used in the comparison tests above, and the short numbers below.
+static const char* kStrictNumbers[] = {
+    "", "999", "119", "123456789", "923456789", "123456781", "1234567890", "0123456789",
+    "650-253-0000", "6502530000", "650 253 0000", "1-650-253-0000", "   1-650-253-0000",
+    "11-650-253-0000", "0-650-253-0000", "555-4141", "+1-700-555-4141", "+1 650-253-0000",
+    "001 650-253-0000", "0111 650-253-0000", "+19012345678", "+819012345678",
+    "+31771234567", "0771234567", "090-1234-5678", "090(1234)5678", "+81-90-1234-5678",
+    "+79161234567", "89161234567", "+33123456789", "+36 1 234 5678", "06 1234-5678",
+    "+52 55 1234 5678", "01 55 1234 5678", "+976 1 123 4567", "01 1 23 4567",
+    "+976 2 234 5678", "02 2 34 5678", "90-1234-5678", "080-1234-5678", "190-1234-5678",
+    "890-1234-5678", "+81-090-1234-5678", "+593(800)123-1234", "8001231234",
+    "008001231234", "+66811234567", "166811234567", "650-000-3456", "16500003456",
+    "011 1 7005554141", "+17005554141", "011 11 7005554141", "+44 207 792 3490",
+    "00 207 792 3490", "16610001234", "6610001234", "abcd", "bcde", "1-800-flowers",
+    "800-flowers", "1-800-abcdefg", "290-1234-5678", "550-450-3605", "+14504503605",
+    "+15404503605", "+15514503605", "5504503605", "84951234567", "+84951234567",
+    "88001234567", "+88001234567", "555", "1555", "555-414", "1-555-414", "+81 90 123",
+    "090 123", "555-4141", "1-555-4141",
+};
+
+TEST(PhoneNumberUtils, keyStrictMatchesCompare) {
+    const int count = sizeof(kStrictNumbers) / sizeof(kStrictNumbers[0]);
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < count; j++) {
+            const char* a = kStrictNumbers[i];
+            const char* b = kStrictNumbers[j];
+            if (!phone_number_compare_strict(a, b)) {
+                continue;
+            }
+
+            // The keys are equal, or one of them is empty.
+            char key_a[7];
+            char key_b[7];
+            int len_a, len_b;
+            phone_number_key_strict(a, key_a, sizeof(key_a), &len_a);
+            phone_number_key_strict(b, key_b, sizeof(key_b), &len_b);
+            if (len_a == 0 || len_b == 0) {
+                continue;
+            }
+            ASSERT_EQ((int)sizeof(key_a), len_a) << a;
+            ASSERT_EQ((int)sizeof(key_b), len_b) << b;
+            EXPECT_EQ(0, memcmp(key_a, key_b, sizeof(key_a))) << a << " vs " << b;
+        }
+    }
+}
+
+TEST(PhoneNumberUtils, keyStrictShortNumbers) {
+    // Numbers with fewer than 7 characters after the country calling code may
+    // compare equal to numbers with a different key, so they get the empty key.
+    char key_a[7];
+    char key_b[7];
+    int len_a, len_b;
+
+    EXPECT_TRUE(phone_number_compare_strict("555", "1555"));
+    phone_number_key_strict("555", key_a, sizeof(key_a), &len_a);
+    phone_number_key_strict("1555", key_b, sizeof(key_b), &len_b);
+    EXPECT_EQ(0, len_a);
+    EXPECT_EQ(0, len_b);
+
+    EXPECT_TRUE(phone_number_compare_strict("+81 90 123", "090 123"));
+    phone_number_key_strict("+81 90 123", key_a, sizeof(key_a), &len_a);
+    phone_number_key_strict("090 123", key_b, sizeof(key_b), &len_b);
+    EXPECT_EQ(0, len_a);
+    EXPECT_EQ(0, len_b);
+
+    // Only the shorter number of the pair gets the empty key.
+    EXPECT_TRUE(phone_number_compare_strict("555-414", "1-555-414"));
+    phone_number_key_strict("555-414", key_a, sizeof(key_a), &len_a);
+    phone_number_key_strict("1-555-414", key_b, sizeof(key_b), &len_b);
+    EXPECT_EQ(0, len_a);
+    ASSERT_EQ(7, len_b);
+    EXPECT_EQ(0, memcmp("4145551", key_b, 7));
+
+    // With 7 characters the keys are equal.
+    EXPECT_TRUE(phone_number_compare_strict("555-4141", "1-555-4141"));
+    phone_number_key_strict("555-4141", key_a, sizeof(key_a), &len_a);
+    phone_number_key_strict("1-555-4141", key_b, sizeof(key_b), &len_b);
+    ASSERT_EQ(7, len_a);
+    ASSERT_EQ(7, len_b);
+    EXPECT_EQ(0, memcmp(key_a, key_b, sizeof(key_a)));
+}
+
+TEST(PhoneNumberUtils, normalizeBatch) {
+    static const char* kNumbers[] = {
+        NULL, "", "+81-90-1234-5678", "650-253-0000", "  (+1) 650-253-0000", "166 811",
+        "0111 650-253-0000", "1+2+", "12;34", "1A2 3?4", "123*N#",
+        "+1 (650) 253-0000, 1234 ; 5678 # +44 20 7792 3490 +33 1 23 45 67 89",
+        "0000000000111111111122222222223333333333444444444455555555556666666666",
+        "++++++++++++++++++++++++++++++++++++1", ",,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,+1",
+        "1234567890123456+,1234567890123456+", "\xe2\x98\x8e 650-253-0000",
+    };
+    const int count = sizeof(kNumbers) / sizeof(kNumbers[0]);
+
+    for (int len : {6, 40}) {
+        char out[count * 40];
+        int outlens[count];
+        int cccs[count];
+        ASSERT_TRUE(phone_number_normalize_batch(kNumbers, count, out, len, outlens, cccs));
+        for (int i = 0; i < count; i++) {
+            char expected[40];
+            int expected_len;
+            phone_number_stripped_reversed_inter(kNumbers[i] != NULL ? kNumbers[i] : "",
+                                                 expected, len, &expected_len);
+            ASSERT_EQ(expected_len, outlens[i]) << kNumbers[i];
+            EXPECT_EQ(0, memcmp(expected, out + i * len, expected_len)) << kNumbers[i];
+        }
+        EXPECT_EQ(-1, cccs[0]);
+        EXPECT_EQ(81, cccs[2]);
+        EXPECT_EQ(-1, cccs[3]);
+        EXPECT_EQ(1, cccs[4]);
+        EXPECT_EQ(66, cccs[5]);
+        EXPECT_EQ(1, cccs[6]);
+    }
+}
+
+TEST(PhoneNumberUtils, normalizeBatchMatchesStrippedReversed) {
+    const int count = sizeof(kStrictNumbers) / sizeof(kStrictNumbers[0]);
+    char out[count * 40];
+    int outlens[count];
+    int cccs[count];
+    phone_number_normalize_batch(kStrictNumbers, count, out, 40, outlens, cccs);
+    for (int i = 0; i < count; i++) {
+        char expected[40];
+        int expected_len;
+        phone_number_stripped_reversed_inter(kStrictNumbers[i], expected, 40, &expected_len);
+        ASSERT_EQ(expected_len, outlens[i]) << kStrictNumbers[i];
+        EXPECT_EQ(0, memcmp(expected, out + i * 40, expected_len)) << kStrictNumbers[i];
+    }
+}
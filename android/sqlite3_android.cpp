@@ -24,6 +24,7 @@
 #ifdef SQLITE_ENABLE_ICU
 #include <unicode/ucol.h>
 #include <unicode/uiter.h>
+#include <unicode/uset.h>
 #include <unicode/ustring.h>
 #include <unicode/utypes.h>
 #endif //SQLITE_ENABLE_ICU
@@ -75,6 +76,507 @@ static int collate8(void *p, int n1, const void *v1, int n2, const void *v2)
         return 0;
     }
 }
+
+// ASCII fast path, used by the UTF-8 collators when ANDROID_COLLATOR_ASCII_FAST_PATH
+// is passed to register_localized_collators_v2().
+//
+// For a primary strength collator, most ASCII characters map to exactly one
+// primary weight regardless of their neighbours, so two strings can be compared
+// by the ranks of those weights up to the first position where they differ.
+// Characters for which this does not hold (ignorables, expansions, members of
+// contractions or prefix contractions of the locale, digits under numeric
+// collation) have no rank. The comparison falls back to ICU as soon as it meets
+// a non-ASCII byte or a differing character without a rank.
+struct AsciiRanks {
+    // 0 if the character must be compared by ICU.
+    uint8_t rank[128];
+};
+
+static void ascii_ranks_exclude(AsciiRanks* ranks, const USet* set)
+{
+    UErrorCode status = U_ZERO_ERROR;
+    int32_t count = uset_getItemCount(set);
+    for (int32_t i = 0; i < count; i++) {
+        UChar32 start, end;
+        UChar str[64];
+        int32_t len = uset_getItem(set, i, &start, &end, str, 64, &status);
+        if (U_FAILURE(status)) {
+            // A string too long for the buffer: be conservative.
+            memset(ranks->rank, 0, sizeof(ranks->rank));
+            return;
+        }
+        if (len == 0) {
+            for (UChar32 c = start; c <= end && c < 128; c++) {
+                ranks->rank[c] = 0;
+            }
+        } else {
+            for (int32_t j = 0; j < len; j++) {
+                if (str[j] < 128) {
+                    ranks->rank[str[j]] = 0;
+                }
+            }
+        }
+    }
+}
+
+// Returns the ASCII ranks of "collator", or NULL if it is not a primary
+// strength collator.
+static AsciiRanks* ascii_ranks_open(const UCollator* collator)
+{
+    UErrorCode status = U_ZERO_ERROR;
+    if (ucol_getStrength(collator) != UCOL_PRIMARY) {
+        return NULL;
+    }
+
+    AsciiRanks* ranks = (AsciiRanks*)malloc(sizeof(AsciiRanks));
+    if (ranks == NULL) {
+        return NULL;
+    }
+
+    // Sort the characters which are not ignorable, by insertion.
+    UChar sorted[128];
+    int sorted_count = 0;
+    for (UChar c = 1; c < 128; c++) {
+        if (ucol_strcoll(collator, &c, 1, NULL, 0) == UCOL_EQUAL) {
+            continue;
+        }
+        int i = sorted_count++;
+        while (i > 0 && ucol_strcoll(collator, &sorted[i - 1], 1, &c, 1) == UCOL_GREATER) {
+            sorted[i] = sorted[i - 1];
+            i--;
+        }
+        sorted[i] = c;
+    }
+    memset(ranks->rank, 0, sizeof(ranks->rank));
+    uint8_t rank = 0;
+    for (int i = 0; i < sorted_count; i++) {
+        if (i == 0 || ucol_strcoll(collator, &sorted[i - 1], 1, &sorted[i], 1) != UCOL_EQUAL) {
+            rank++;
+        }
+        ranks->rank[sorted[i]] = rank;
+    }
+
+    USet* contractions = uset_openEmpty();
+    USet* expansions = uset_openEmpty();
+    ucol_getContractionsAndExpansions(collator, contractions, expansions, true, &status);
+    if (U_SUCCESS(status)) {
+        ascii_ranks_exclude(ranks, contractions);
+        ascii_ranks_exclude(ranks, expansions);
+    } else {
+        memset(ranks->rank, 0, sizeof(ranks->rank));
+    }
+    uset_close(contractions);
+    uset_close(expansions);
+
+    status = U_ZERO_ERROR;
+    if (ucol_getAttribute(collator, UCOL_NUMERIC_COLLATION, &status) != UCOL_OFF) {
+        for (char c = '0'; c <= '9'; c++) {
+            ranks->rank[(int)c] = 0;
+        }
+    }
+    return ranks;
+}
+
+// Compares the UTF-8 strings v1 and v2 by their ASCII ranks. Returns false if
+// the result has to come from ICU.
+static bool collate_ascii(const AsciiRanks* ranks, int n1, const void *v1, int n2,
+                          const void *v2, int* result)
+{
+    const uint8_t* s1 = (const uint8_t*)v1;
+    const uint8_t* s2 = (const uint8_t*)v2;
+    int n = (n1 < n2) ? n1 : n2;
+    int i = 0;
+
+    // Skip the common ASCII prefix eight bytes at a time. Identical characters
+    // produce identical collation elements, whether they have a rank or not:
+    // any contraction with a character after them would involve a character
+    // without a rank.
+    while (i + 8 <= n) {
+        uint64_t w1, w2;
+        memcpy(&w1, s1 + i, 8);
+        memcpy(&w2, s2 + i, 8);
+        if (w1 != w2 || (w1 & 0x8080808080808080ull) != 0) {
+            break;
+        }
+        i += 8;
+    }
+
+    for (; i < n; i++) {
+        uint8_t c1 = s1[i];
+        uint8_t c2 = s2[i];
+        if ((c1 | c2) & 0x80) {
+            return false;
+        }
+        if (c1 != c2) {
+            uint8_t r1 = ranks->rank[c1];
+            uint8_t r2 = ranks->rank[c2];
+            if (r1 == 0 || r2 == 0) {
+                return false;
+            }
+            if (r1 != r2) {
+                *result = (r1 < r2) ? -1 : 1;
+                return true;
+            }
+        }
+    }
+
+    if (n1 == n2) {
+        *result = 0;
+        return true;
+    }
+    // The longer string is greater, unless its next character is ignorable.
+    uint8_t c = (n1 > n2) ? s1[n] : s2[n];
+    if ((c & 0x80) || ranks->rank[c] == 0) {
+        return false;
+    }
+    *result = (n1 > n2) ? 1 : -1;
+    return true;
+}
+
+struct AsciiCollator {
+    UCollator* collator;
+    AsciiRanks* ranks;
+};
+
+static int collate8_ascii(void *p, int n1, const void *v1, int n2, const void *v2)
+{
+    AsciiCollator *coll = (AsciiCollator *) p;
+    int result;
+    if (collate_ascii(coll->ranks, n1, v1, n2, v2, &result)) {
+        return result;
+    }
+    return collate8(coll->collator, n1, v1, n2, v2);
+}
+
+static void ascii_collator_dtor(void *p)
+{
+    AsciiCollator *coll = (AsciiCollator *) p;
+    ucol_close(coll->collator);
+    free(coll->ranks);
+    free(coll);
+}
+
+// Sort key cache, used by the collators when ANDROID_COLLATOR_SORT_KEY_CACHE is
+// passed to register_localized_collators_v2().
+//
+// Each collator keeps the ICU sort keys of the strings it has seen recently, so
+// comparing a string again (as sorting and index searches do all the time) is a
+// hash lookup and a memcmp() instead of a walk through the collation tables.
+// The cache is bounded by SORT_KEY_CACHE_SIZE bytes and evicts the least
+// recently used keys. Strings longer than SORT_KEY_CACHE_MAX_TEXT bytes are
+// compared by ICU directly.
+//
+// Building a sort key costs about as much as two ICU comparisons, so a cache
+// that keeps missing (e.g. sorting many more distinct values than it can hold)
+// is slower than no cache at all. When more than one lookup in
+// SORT_KEY_CACHE_MAX_MISS_RATE misses over a window of SORT_KEY_CACHE_WINDOW
+// lookups, the cache is bypassed for a while. The bypass starts at
+// SORT_KEY_CACHE_MIN_BYPASS comparisons and doubles, up to
+// SORT_KEY_CACHE_MAX_BYPASS, every time the cache is still missing afterwards.
+#define SORT_KEY_CACHE_SIZE (1024 * 1024)
+#define SORT_KEY_CACHE_MAX_TEXT 256
+#define SORT_KEY_CACHE_MIN_BUCKETS 256
+#define SORT_KEY_CACHE_WINDOW 4096
+#define SORT_KEY_CACHE_MAX_MISS_RATE 16
+#define SORT_KEY_CACHE_MIN_BYPASS (16 * SORT_KEY_CACHE_WINDOW)
+#define SORT_KEY_CACHE_MAX_BYPASS (1024 * SORT_KEY_CACHE_WINDOW)
+
+struct SortKeyEntry {
+    SortKeyEntry* hash_next;
+    SortKeyEntry* lru_prev;
+    SortKeyEntry* lru_next;
+    uint32_t hash;
+    int32_t text_len;
+    int32_t key_len;
+    // Followed by text_len bytes of text and key_len bytes of sort key.
+
+    const uint8_t* text() const { return (const uint8_t*)(this + 1); }
+    const uint8_t* key() const { return text() + text_len; }
+    size_t size() const { return sizeof(SortKeyEntry) + text_len + key_len; }
+};
+
+class SortKeyCache {
+  public:
+    // Takes ownership of "collator" and "ascii", which may be NULL.
+    SortKeyCache(UCollator* collator, bool utf16, AsciiRanks* ascii)
+        : collator_(collator), utf16_(utf16), ascii_(ascii), refs_(1), hits_(0), misses_(0),
+          window_lookups_(0), window_misses_(0), bypass_(0),
+          bypass_length_(SORT_KEY_CACHE_MIN_BYPASS), buckets_(NULL), bucket_count_(0), entry_count_(0), bytes_(0),
+          lru_head_(NULL), lru_tail_(NULL) {}
+
+    ~SortKeyCache() {
+        SortKeyEntry* entry = lru_head_;
+        while (entry != NULL) {
+            SortKeyEntry* next = entry->lru_next;
+            free(entry);
+            entry = next;
+        }
+        free(buckets_);
+        free(ascii_);
+        ucol_close(collator_);
+    }
+
+    void acquire() { refs_++; }
+
+    void release() {
+        if (--refs_ == 0) {
+            delete this;
+        }
+    }
+
+    int compare(int n1, const void* v1, int n2, const void* v2);
+
+    sqlite3_int64 hits() const { return hits_; }
+    sqlite3_int64 misses() const { return misses_; }
+
+  private:
+    const SortKeyEntry* lookup(const void* text, int len);
+    SortKeyEntry* create(const void* text, int len, uint32_t hash);
+    void insert(SortKeyEntry* entry);
+    void remove(SortKeyEntry* entry);
+    bool grow();
+
+    UCollator* collator_;
+    bool utf16_;
+    AsciiRanks* ascii_;
+    int refs_;
+    sqlite3_int64 hits_;
+    sqlite3_int64 misses_;
+    int window_lookups_;
+    int window_misses_;
+    int bypass_;
+    int bypass_length_;
+    SortKeyEntry** buckets_;
+    uint32_t bucket_count_;
+    uint32_t entry_count_;
+    size_t bytes_;
+    // Most recently used first.
+    SortKeyEntry* lru_head_;
+    SortKeyEntry* lru_tail_;
+};
+
+static uint32_t sort_key_hash(const uint8_t* text, int len)
+{
+    // Eight bytes at a time, mixed with the 64-bit FNV prime.
+    uint64_t hash = 14695981039346656037ull ^ (uint64_t)len;
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, text + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    if (i < len) {
+        uint64_t word = 0;
+        memcpy(&word, text + i, len - i);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+int SortKeyCache::compare(int n1, const void* v1, int n2, const void* v2)
+{
+    if (n1 == n2 && memcmp(v1, v2, n1) == 0) {
+        return 0;
+    }
+
+    int result;
+    if (ascii_ != NULL && collate_ascii(ascii_, n1, v1, n2, v2, &result)) {
+        return result;
+    }
+
+    const SortKeyEntry* e1 = NULL;
+    const SortKeyEntry* e2 = NULL;
+    if (bypass_ > 0) {
+        bypass_--;
+    } else if (n1 <= SORT_KEY_CACHE_MAX_TEXT && n2 <= SORT_KEY_CACHE_MAX_TEXT) {
+        e1 = lookup(v1, n1);
+        if (e1 != NULL) {
+            e2 = lookup(v2, n2);
+        }
+
+        window_lookups_ += 2;
+        if (window_lookups_ >= SORT_KEY_CACHE_WINDOW) {
+            if (window_misses_ * SORT_KEY_CACHE_MAX_MISS_RATE > window_lookups_) {
+                bypass_ = bypass_length_;
+                if (bypass_length_ < SORT_KEY_CACHE_MAX_BYPASS) {
+                    bypass_length_ *= 2;
+                }
+            } else {
+                bypass_length_ = SORT_KEY_CACHE_MIN_BYPASS;
+            }
+            window_lookups_ = 0;
+            window_misses_ = 0;
+        }
+    }
+    if (e1 == NULL || e2 == NULL) {
+        return utf16_ ? collate16(collator_, n1, v1, n2, v2) : collate8(collator_, n1, v1, n2, v2);
+    }
+
+    int len = (e1->key_len < e2->key_len) ? e1->key_len : e2->key_len;
+    result = memcmp(e1->key(), e2->key(), len);
+    if (result == 0) {
+        result = e1->key_len - e2->key_len;
+    }
+    return (result < 0) ? -1 : ((result > 0) ? 1 : 0);
+}
+
+const SortKeyEntry* SortKeyCache::lookup(const void* text, int len)
+{
+    uint32_t hash = sort_key_hash((const uint8_t*)text, len);
+    if (bucket_count_ > 0) {
+        for (SortKeyEntry* entry = buckets_[hash & (bucket_count_ - 1)]; entry != NULL;
+                entry = entry->hash_next) {
+            if (entry->hash == hash && entry->text_len == len &&
+                    memcmp(entry->text(), text, len) == 0) {
+                hits_++;
+                if (entry != lru_head_) {
+                    // Move to the front of the LRU list.
+                    entry->lru_prev->lru_next = entry->lru_next;
+                    if (entry->lru_next != NULL) {
+                        entry->lru_next->lru_prev = entry->lru_prev;
+                    } else {
+                        lru_tail_ = entry->lru_prev;
+                    }
+                    entry->lru_prev = NULL;
+                    entry->lru_next = lru_head_;
+                    lru_head_->lru_prev = entry;
+                    lru_head_ = entry;
+                }
+                return entry;
+            }
+        }
+    }
+
+    misses_++;
+    window_misses_++;
+    SortKeyEntry* entry = create(text, len, hash);
+    if (entry == NULL) {
+        return NULL;
+    }
+    // Never evict the most recently used entry: it may be the other operand of
+    // the comparison in progress.
+    while (bytes_ + entry->size() > SORT_KEY_CACHE_SIZE && lru_tail_ != lru_head_) {
+        remove(lru_tail_);
+    }
+    if (entry_count_ >= bucket_count_ && !grow()) {
+        free(entry);
+        return NULL;
+    }
+    insert(entry);
+    return entry;
+}
+
+SortKeyEntry* SortKeyCache::create(const void* text, int len, uint32_t hash)
+{
+    UErrorCode status = U_ZERO_ERROR;
+    UChar stack_buffer[SORT_KEY_CACHE_MAX_TEXT];
+    const UChar* chars = (const UChar*)text;
+    int32_t char_count = len / sizeof(UChar);
+    if (!utf16_) {
+        // A UTF-8 string never has more UTF-16 units than bytes.
+        u_strFromUTF8(stack_buffer, SORT_KEY_CACHE_MAX_TEXT, &char_count, (const char*)text, len,
+                &status);
+        if (U_FAILURE(status)) {
+            return NULL;
+        }
+        chars = stack_buffer;
+    }
+
+    uint8_t key_buffer[SORT_KEY_CACHE_MAX_TEXT * 4];
+    int32_t key_len = ucol_getSortKey(collator_, chars, char_count, key_buffer,
+            sizeof(key_buffer));
+    if (key_len <= 0) {
+        return NULL;
+    }
+
+    SortKeyEntry* entry = (SortKeyEntry*)malloc(sizeof(SortKeyEntry) + len + key_len);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->text_len = len;
+    entry->key_len = key_len;
+    memcpy((uint8_t*)entry->text(), text, len);
+    if (key_len <= (int32_t)sizeof(key_buffer)) {
+        memcpy((uint8_t*)entry->key(), key_buffer, key_len);
+    } else {
+        ucol_getSortKey(collator_, chars, char_count, (uint8_t*)entry->key(), key_len);
+    }
+    return entry;
+}
+
+void SortKeyCache::insert(SortKeyEntry* entry)
+{
+    SortKeyEntry** bucket = &buckets_[entry->hash & (bucket_count_ - 1)];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head_;
+    if (lru_head_ != NULL) {
+        lru_head_->lru_prev = entry;
+    } else {
+        lru_tail_ = entry;
+    }
+    lru_head_ = entry;
+
+    entry_count_++;
+    bytes_ += entry->size();
+}
+
+void SortKeyCache::remove(SortKeyEntry* entry)
+{
+    SortKeyEntry** link = &buckets_[entry->hash & (bucket_count_ - 1)];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head_ = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail_ = entry->lru_prev;
+    }
+
+    entry_count_--;
+    bytes_ -= entry->size();
+    free(entry);
+}
+
+bool SortKeyCache::grow()
+{
+    uint32_t count = bucket_count_ ? bucket_count_ * 2 : SORT_KEY_CACHE_MIN_BUCKETS;
+    SortKeyEntry** buckets = (SortKeyEntry**)calloc(count, sizeof(SortKeyEntry*));
+    if (buckets == NULL) {
+        return false;
+    }
+    for (SortKeyEntry* entry = lru_head_; entry != NULL; entry = entry->lru_next) {
+        SortKeyEntry** bucket = &buckets[entry->hash & (count - 1)];
+        entry->hash_next = *bucket;
+        *bucket = entry;
+    }
+    free(buckets_);
+    buckets_ = buckets;
+    bucket_count_ = count;
+    return true;
+}
+
+static int collate_cached(void *p, int n1, const void *v1, int n2, const void *v2)
+{
+    return ((SortKeyCache *) p)->compare(n1, v1, n2, v2);
+}
+
+static void sort_key_cache_release(void *p)
+{
+    ((SortKeyCache *) p)->release();
+}
+
+#define SORT_KEY_CACHE_CLIENT_DATA_PREFIX "android_sort_key_cache:"
 #endif // SQLITE_ENABLE_ICU
 
 static void phone_numbers_equal(sqlite3_context * context, int argc, sqlite3_value ** argv)
@@ -129,13 +631,71 @@ static void phone_number_stripped_reversed(sqlite3_context * context, int argc,
         return;
     }
 
+    // The result is never longer than the input, so it is written straight into
+    // a buffer handed over to sqlite.
+    int len = sqlite3_value_bytes(argv[0]);
+    char* out = (char*)sqlite3_malloc64((sqlite3_uint64)len + 1);
+    if (out == NULL) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    int outlen = 0;
+    android::phone_number_stripped_reversed_inter(number, out, len, &outlen);
+    sqlite3_result_text64(context, out, outlen, sqlite3_free, SQLITE_UTF8);
+}
+
+/**
+ * PHONE_NUMBER_KEY(number, use_strict [, min_match]) returns the caller ID key
+ * of a phone number: a short, reversed run of its trailing dialable characters.
+ * Whenever PHONE_NUMBERS_EQUAL() with the same arguments is true for two full
+ * numbers, their keys are equal, so the key can be stored in an index and used
+ * to narrow a lookup before the exact comparison runs:
+ *
+ *   CREATE INDEX calls_number_key ON calls(PHONE_NUMBER_KEY(number, 0));
+ *   SELECT * FROM calls WHERE PHONE_NUMBER_KEY(number, 0) = PHONE_NUMBER_KEY(?1, 0)
+ *                         AND PHONE_NUMBERS_EQUAL(number, ?1, 0);
+ *
+ * In strict mode numbers with fewer than 7 non-separator characters after the
+ * country calling code have the empty key instead, as they may equal a number
+ * with another key: PHONE_NUMBERS_EQUAL('555414', '1555414', 1) is true. Strict
+ * lookups have to search for the empty key too, and compare a short number with
+ * every row:
+ *
+ *   SELECT * FROM calls WHERE PHONE_NUMBER_KEY(number, 1) IN (PHONE_NUMBER_KEY(?1, 1), '')
+ *                         AND PHONE_NUMBERS_EQUAL(number, ?1, 1);
+ */
+static void phone_number_key(sqlite3_context * context, int argc, sqlite3_value ** argv)
+{
+    if (argc != 2 && argc != 3) {
+        sqlite3_result_int(context, 0);
+        return;
+    }
+
+    char const * number = (char const *)sqlite3_value_text(argv[0]);
+    if (number == NULL) {
+        sqlite3_result_null(context);
+        return;
+    }
+
+    bool use_strict = (sqlite3_value_int(argv[1]) != 0);
+    int min_match = 0;
+    if (!use_strict && argc == 3) {
+        min_match = sqlite3_value_int(argv[2]);
+    }
+
     char out[PHONE_NUMBER_BUFFER_SIZE];
     int outlen = 0;
-    android::phone_number_stripped_reversed_inter(number, out, PHONE_NUMBER_BUFFER_SIZE, &outlen);
+    if (use_strict) {
+        android::phone_number_key_strict(number, out, PHONE_NUMBER_BUFFER_SIZE, &outlen);
+    } else if (min_match > 0) {
+        android::phone_number_key_loose_with_minmatch(number, min_match, out,
+                                                      PHONE_NUMBER_BUFFER_SIZE, &outlen);
+    } else {
+        android::phone_number_key_loose(number, out, PHONE_NUMBER_BUFFER_SIZE, &outlen);
+    }
     sqlite3_result_text(context, (const char*)out, outlen, SQLITE_TRANSIENT);
 }
 
-
 #if ENABLE_ANDROID_LOG
 static void android_log(sqlite3_context * context, int argc, sqlite3_value ** argv)
 {
@@ -416,6 +976,103 @@ static void tokenize(sqlite3_context * context, int argc, sqlite3_value ** argv)
 }
 #endif
 
+static void sort_key_auxdata_delete(void * data)
+{
+    ucol_close((UCollator *)data);
+}
+
+/**
+ * This function is invoked as:
+ *
+ *  SORTKEY(<text>)
+ *  SORTKEY(<text>, <locale>)
+ *
+ * It returns the primary strength ICU collation key of <text> as a BLOB, for
+ * the locale the LOCALIZED collator was registered with or for <locale>.
+ * Comparing two keys with memcmp() gives the same order as comparing their
+ * texts with the collator, so the keys can be stored in an index or a generated
+ * column and sorted or range-scanned without calling into ICU:
+ *
+ *  CREATE INDEX contacts_name_key ON contacts(SORTKEY(name));
+ *  SELECT * FROM contacts ORDER BY SORTKEY(name);
+ *
+ * SORTKEY() is registered as deterministic so that it can be used this way,
+ * but its keys depend on the locale and on the ICU version. REINDEX LOCALIZED
+ * only rebuilds indexes which use the collator, not the ones on SORTKEY(), so
+ * after registering the collators for another locale, or after an ICU update,
+ * each index on SORTKEY() has to be rebuilt by name:
+ *
+ *  REINDEX contacts_name_key;
+ *
+ * REINDEX does not recompute STORED generated columns, so keys are best kept
+ * in VIRTUAL ones. A locale which ICU does not know falls back to the root
+ * collation; SORTKEY() fails if ICU rejects the locale name altogether, and
+ * returns NULL if <text> or <locale> is NULL.
+ */
+static void sort_key(sqlite3_context * context, int argc, sqlite3_value ** argv)
+{
+    UCollator* collator = (UCollator*)sqlite3_user_data(context);
+    if (argc == 2) {
+        if (sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+            sqlite3_result_null(context);
+            return;
+        }
+        collator = (UCollator*)sqlite3_get_auxdata(context, 1);
+        if (collator == NULL) {
+            char const * locale = (char const *)sqlite3_value_text(argv[1]);
+            UErrorCode status = U_ZERO_ERROR;
+            collator = ucol_open(locale, &status);
+            if (U_SUCCESS(status)) {
+                ucol_setAttribute(collator, UCOL_STRENGTH, UCOL_PRIMARY, &status);
+            }
+            if (U_FAILURE(status)) {
+                ucol_close(collator);
+                sqlite3_result_error(context, "SORTKEY: invalid locale", -1);
+                return;
+            }
+            sqlite3_set_auxdata(context, 1, collator, sort_key_auxdata_delete);
+            // sqlite3_set_auxdata() may have deleted the collator already.
+            collator = (UCollator*)sqlite3_get_auxdata(context, 1);
+            if (collator == NULL) {
+                sqlite3_result_error_nomem(context);
+                return;
+            }
+        }
+    }
+
+    const UChar * text = (const UChar *)sqlite3_value_text16(argv[0]);
+    if (text == NULL) {
+        sqlite3_result_null(context);
+        return;
+    }
+    int32_t textLength = sqlite3_value_bytes16(argv[0]) / sizeof(UChar);
+
+    // The key length includes the terminating zero byte, which is not returned.
+    uint8_t keybuf[1024];
+    int32_t keySize = ucol_getSortKey(collator, text, textLength, keybuf, sizeof(keybuf));
+    if (keySize <= 0) {
+        // ICU reports internal errors as a zero length.
+        sqlite3_result_error(context, "SORTKEY: cannot build the collation key", -1);
+        return;
+    }
+    if (keySize <= (int32_t)sizeof(keybuf)) {
+        sqlite3_result_blob(context, keybuf, keySize - 1, SQLITE_TRANSIENT);
+        return;
+    }
+
+    uint8_t * key = (uint8_t *)sqlite3_malloc(keySize);
+    if (key == NULL) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    if (ucol_getSortKey(collator, text, textLength, key, keySize) != keySize) {
+        sqlite3_free(key);
+        sqlite3_result_error(context, "SORTKEY: cannot build the collation key", -1);
+        return;
+    }
+    sqlite3_result_blob(context, key, keySize - 1, sqlite3_free);
+}
+
 static void localized_collator_dtor(UCollator* collator)
 {
     ucol_close(collator);
@@ -426,11 +1083,70 @@ static void localized_collator_dtor(UCollator* collator)
 // This collator may be removed in the near future, so you MUST not use now.
 #define PHONEBOOK_COLLATOR_NAME "PHONEBOOK"
 
+// Registers "collator" as the collation "name", taking ownership of it.
+static int register_collator(sqlite3* handle, const char* name, UCollator* collator,
+                             int utf16Storage, int flags)
+{
+    int encoding = utf16Storage ? SQLITE_UTF16 : SQLITE_UTF8;
+    AsciiRanks* ranks = NULL;
+    if ((flags & ANDROID_COLLATOR_ASCII_FAST_PATH) && !utf16Storage) {
+        ranks = ascii_ranks_open(collator);
+    }
+
+    if (!(flags & ANDROID_COLLATOR_SORT_KEY_CACHE)) {
+        if (ranks == NULL) {
+            return sqlite3_create_collation_v2(handle, name, encoding, collator,
+                    utf16Storage ? collate16 : collate8,
+                    (void(*)(void*))localized_collator_dtor);
+        }
+        AsciiCollator* coll = (AsciiCollator*)malloc(sizeof(AsciiCollator));
+        if (coll == NULL) {
+            free(ranks);
+            ucol_close(collator);
+            return SQLITE_NOMEM;
+        }
+        coll->collator = collator;
+        coll->ranks = ranks;
+        int err = sqlite3_create_collation_v2(handle, name, encoding, coll, collate8_ascii,
+                ascii_collator_dtor);
+        if (err != SQLITE_OK) {
+            ascii_collator_dtor(coll);
+        }
+        return err;
+    }
+
+    SortKeyCache* cache = new SortKeyCache(collator, utf16Storage, ranks);
+    int err = sqlite3_create_collation_v2(handle, name, encoding, cache, collate_cached,
+            sort_key_cache_release);
+    if (err != SQLITE_OK) {
+        // sqlite3_create_collation_v2() does not call the destructor on failure.
+        cache->release();
+        return err;
+    }
+
+    // Publish the cache for get_collator_cache_stats(). The client data holds its
+    // own reference, so the counters stay valid even if the collation goes away.
+    char* key = sqlite3_mprintf(SORT_KEY_CACHE_CLIENT_DATA_PREFIX "%s", name);
+    if (key == NULL) {
+        return SQLITE_NOMEM;
+    }
+    cache->acquire();
+    err = sqlite3_set_clientdata(handle, key, cache, sort_key_cache_release);
+    sqlite3_free(key);
+    return err;
+}
 #endif // SQLITE_ENABLE_ICU
 
-extern "C" int register_localized_collators(sqlite3* handle __attribute((unused)),
-                                            const char* systemLocale __attribute((unused)),
-                                            int utf16Storage __attribute((unused)))
+extern "C" int register_localized_collators(sqlite3* handle, const char* systemLocale,
+                                            int utf16Storage)
+{
+    return register_localized_collators_v2(handle, systemLocale, utf16Storage, 0);
+}
+
+extern "C" int register_localized_collators_v2(sqlite3* handle __attribute((unused)),
+                                               const char* systemLocale __attribute((unused)),
+                                               int utf16Storage __attribute((unused)),
+                                               int flags __attribute((unused)))
 {
 // This function is no-op for the VNDK, but should exist in case when some vendor
 // module has a reference to this function.
@@ -446,15 +1162,7 @@ extern "C" int register_localized_collators(sqlite3* handle __attribute((unused)
         return -1;
     }
 
-    int err;
-    if (utf16Storage) {
-        err = sqlite3_create_collation_v2(handle, LOCALIZED_COLLATOR_NAME, SQLITE_UTF16, collator,
-                collate16, (void(*)(void*))localized_collator_dtor);
-    } else {
-        err = sqlite3_create_collation_v2(handle, LOCALIZED_COLLATOR_NAME, SQLITE_UTF8, collator,
-                collate8, (void(*)(void*))localized_collator_dtor);
-    }
-
+    int err = register_collator(handle, LOCALIZED_COLLATOR_NAME, collator, utf16Storage, flags);
     if (err != SQLITE_OK) {
         return err;
     }
@@ -488,27 +1196,76 @@ extern "C" int register_localized_collators(sqlite3* handle __attribute((unused)
         return -1;
     }
 
-    if (utf16Storage) {
-        err = sqlite3_create_collation_v2(handle, PHONEBOOK_COLLATOR_NAME, SQLITE_UTF16, collator,
-                collate16, (void(*)(void*))localized_collator_dtor);
-    } else {
-        err = sqlite3_create_collation_v2(handle, PHONEBOOK_COLLATOR_NAME, SQLITE_UTF8, collator,
-                collate8, (void(*)(void*))localized_collator_dtor);
+    err = register_collator(handle, PHONEBOOK_COLLATOR_NAME, collator, utf16Storage, flags);
+    if (err != SQLITE_OK) {
+        return err;
+    }
+    //// PHONEBOOK_COLLATOR
+
+    // Register the SORTKEY function
+    status = U_ZERO_ERROR;
+    collator = ucol_open(systemLocale, &status);
+    if (U_FAILURE(status)) {
+        return -1;
     }
 
+    ucol_setAttribute(collator, UCOL_STRENGTH, UCOL_PRIMARY, &status);
+    if (U_FAILURE(status)) {
+        return -1;
+    }
+
+    // SORTKEY() is deterministic for a given locale and ICU version; see sort_key()
+    // for the indexes which have to be rebuilt when either changes.
+    err = sqlite3_create_function_v2(handle, "SORTKEY", 1,
+            SQLITE_UTF16 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, collator, sort_key, NULL,
+            NULL, (void(*)(void*))localized_collator_dtor);
+    if (err != SQLITE_OK) {
+        return err;
+    }
+    err = sqlite3_create_function(handle, "SORTKEY", 2,
+            SQLITE_UTF16 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, NULL, sort_key, NULL, NULL);
     if (err != SQLITE_OK) {
         return err;
     }
-    //// PHONEBOOK_COLLATOR
 #endif //SQLITE_ENABLE_ICU
 
     return SQLITE_OK;
 }
 
+extern "C" int get_collator_cache_stats(sqlite3* handle __attribute((unused)),
+                                        const char* collatorName __attribute((unused)),
+                                        sqlite3_int64* hits, sqlite3_int64* misses)
+{
+    *hits = 0;
+    *misses = 0;
+#ifdef SQLITE_ENABLE_ICU
+    char* key = sqlite3_mprintf(SORT_KEY_CACHE_CLIENT_DATA_PREFIX "%s", collatorName);
+    if (key == NULL) {
+        return SQLITE_NOMEM;
+    }
+    SortKeyCache* cache = (SortKeyCache*)sqlite3_get_clientdata(handle, key);
+    sqlite3_free(key);
+    if (cache != NULL) {
+        *hits = cache->hits();
+        *misses = cache->misses();
+        return SQLITE_OK;
+    }
+#endif //SQLITE_ENABLE_ICU
+    return SQLITE_NOTFOUND;
+}
+
+extern "C" int register_android_functions(sqlite3 * handle, int utf16Storage)
+{
+    return register_android_functions_v2(handle, utf16Storage, 0);
+}
 
-extern "C" int register_android_functions(sqlite3 * handle, int utf16Storage __attribute((unused)))
+extern "C" int register_android_functions_v2(sqlite3 * handle,
+                                             int utf16Storage __attribute((unused)), int flags)
 {
     int err;
+    // Flags of the functions which only depend on their arguments.
+    int pure = (flags & ANDROID_FUNCTIONS_DETERMINISTIC) ?
+            SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS : 0;
 #ifdef SQLITE_ENABLE_ICU
     UErrorCode status = U_ZERO_ERROR;
 
@@ -540,7 +1297,7 @@ extern "C" int register_android_functions(sqlite3 * handle, int utf16Storage __a
     // Register the PHONE_NUM_EQUALS function
     err = sqlite3_create_function(
         handle, "PHONE_NUMBERS_EQUAL", 2,
-        SQLITE_UTF8, NULL, phone_numbers_equal, NULL, NULL);
+        SQLITE_UTF8 | pure, NULL, phone_numbers_equal, NULL, NULL);
     if (err != SQLITE_OK) {
         return err;
     }
@@ -548,7 +1305,7 @@ extern "C" int register_android_functions(sqlite3 * handle, int utf16Storage __a
     // Register the PHONE_NUM_EQUALS function with an additional argument "use_strict"
     err = sqlite3_create_function(
         handle, "PHONE_NUMBERS_EQUAL", 3,
-        SQLITE_UTF8, NULL, phone_numbers_equal, NULL, NULL);
+        SQLITE_UTF8 | pure, NULL, phone_numbers_equal, NULL, NULL);
     if (err != SQLITE_OK) {
         return err;
     }
@@ -556,12 +1313,32 @@ extern "C" int register_android_functions(sqlite3 * handle, int utf16Storage __a
     // Register the PHONE_NUM_EQUALS function with additional arguments "use_strict" and "min_match"
     err = sqlite3_create_function(
         handle, "PHONE_NUMBERS_EQUAL", 4,
-        SQLITE_UTF8, NULL, phone_numbers_equal, NULL, NULL);
+        SQLITE_UTF8 | pure, NULL, phone_numbers_equal, NULL, NULL);
+    if (err != SQLITE_OK) {
+        return err;
+    }
+
+    // Register the PHONE_NUMBER_KEY function. It is always deterministic so that it
+    // can be used in indexes on expressions, together with PHONE_NUMBERS_EQUAL. It
+    // is not affected by ANDROID_FUNCTIONS_DETERMINISTIC: as it never existed
+    // without the flag, schemas using it open with any registration.
+    err = sqlite3_create_function(
+        handle, "PHONE_NUMBER_KEY", 2,
+        SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, NULL, phone_number_key, NULL, NULL);
+    if (err != SQLITE_OK) {
+        return err;
+    }
+
+    // Register the PHONE_NUMBER_KEY function with an additional argument "min_match"
+    err = sqlite3_create_function(
+        handle, "PHONE_NUMBER_KEY", 3,
+        SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, NULL, phone_number_key, NULL, NULL);
     if (err != SQLITE_OK) {
         return err;
     }
 
-    // Register the _DELETE_FILE function
+    // Register the _DELETE_FILE function. It has side effects, so it is never
+    // deterministic.
     err = sqlite3_create_function(handle, "_DELETE_FILE", 1, SQLITE_UTF8, NULL, delete_file, NULL, NULL);
     if (err != SQLITE_OK) {
         return err;
@@ -578,10 +1355,12 @@ extern "C" int register_android_functions(sqlite3 * handle, int utf16Storage __a
     // Register the _PHONE_NUMBER_STRIPPED_REVERSED function, which imitates
     // PhoneNumberUtils.getStrippedReversed.  This function is used by
     // packages/providers/ContactsProvider/src/com/android/providers/contacts/LegacyApiSupport.java
-    // to provide compatibility with Android 1.6 and earlier.
+    // to provide compatibility with Android 1.6 and earlier. It is always
+    // deterministic, as it has been since before ANDROID_FUNCTIONS_DETERMINISTIC,
+    // so that schemas indexing it open with any registration.
     err = sqlite3_create_function(handle,
         "_PHONE_NUMBER_STRIPPED_REVERSED",
-        1, SQLITE_UTF8, NULL,
+        1, SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, NULL,
         phone_number_stripped_reversed,
         NULL, NULL);
     if (err != SQLITE_OK) {
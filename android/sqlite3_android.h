@@ -23,10 +23,61 @@
 extern "C" {
 #endif
 
+// Registers PHONE_NUMBERS_EQUAL(), PHONE_NUMBER_KEY(), _PHONE_NUMBER_STRIPPED_REVERSED()
+// and _DELETE_FILE(), and the UNICODE collator.
+//
+// PHONE_NUMBER_KEY(number, use_strict [, min_match]) is equal for any two numbers
+// PHONE_NUMBERS_EQUAL() accepts with the same arguments, so an index on it can
+// narrow the lookup of a number. In strict mode (use_strict != 0) numbers with
+// fewer than 7 non-separator characters after the country calling code have the
+// empty key instead, so a lookup must match the empty key as well as the key of
+// the number, and a number with the empty key must be compared with every row.
 int register_android_functions(sqlite3 * handle, int uit16Storage);
 
+// Flags for register_android_functions_v2().
+
+// Register PHONE_NUMBERS_EQUAL() as SQLITE_DETERMINISTIC and SQLITE_INNOCUOUS so
+// that it can be used in indexes on expressions and generated columns, and is
+// only evaluated once for constant arguments. Only use this for databases which
+// are always opened with this flag, as schemas using it can't be read otherwise.
+//
+// The flag does not change the other functions: PHONE_NUMBER_KEY() and
+// _PHONE_NUMBER_STRIPPED_REVERSED() are always deterministic, and _DELETE_FILE()
+// never is.
+#define ANDROID_FUNCTIONS_DETERMINISTIC 0x01
+
+int register_android_functions_v2(sqlite3 * handle, int utf16Storage, int flags);
+
+// Registers the LOCALIZED and PHONEBOOK collators and the SORTKEY() function for
+// systemLocale. REINDEX LOCALIZED does not rebuild indexes on SORTKEY(), which
+// have to be rebuilt by name when the locale changes.
 int register_localized_collators(sqlite3* handle, const char* systemLocale, int utf16Storage);
 
+// Flags for register_localized_collators_v2().
+
+// Cache the ICU sort keys of recently compared strings in each collator, so that
+// comparing the same values again only needs a memcmp() of their keys. The cache
+// holds about 1 MB of keys per collator, so it pays off when the same values are
+// compared many times, like sorting a column with a few thousand distinct names.
+// With many more distinct values, e.g. sorting or indexing 100k distinct names,
+// nearly every lookup misses and building the keys makes the comparisons a few
+// percent slower than without the cache, even though the cache turns itself off
+// while it keeps missing. get_collator_cache_stats() tells which case applies.
+#define ANDROID_COLLATOR_SORT_KEY_CACHE 0x01
+
+// Compare the ASCII prefix of UTF-8 strings with a table of the collator's primary
+// weights, and only call ICU from the first non-ASCII or context-sensitive
+// character on.
+#define ANDROID_COLLATOR_ASCII_FAST_PATH 0x02
+
+int register_localized_collators_v2(sqlite3* handle, const char* systemLocale, int utf16Storage,
+                                    int flags);
+
+// Returns the hit and miss counts of the sort key cache of the named collator,
+// or SQLITE_NOTFOUND if it was not registered with ANDROID_COLLATOR_SORT_KEY_CACHE.
+int get_collator_cache_stats(sqlite3* handle, const char* collatorName, sqlite3_int64* hits,
+                             sqlite3_int64* misses);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "sqlite3_android.h"
+
+// A contacts-like corpus of "count" names drawn from "distinct" different
+// "First Last" names, some of them with accents, in a deterministic
+// pseudo-random order.
+static std::vector<std::string> contact_names(int count, int distinct) {
+    static const char* kFirst[] = {
+        "Alice", "Ángel", "Benoît", "Bob", "Carlos", "Chloé", "David", "Dmitri", "Élodie", "Emma",
+        "François", "Grace", "Hana", "Ingrid", "Jörg", "José", "Kenji", "Liam", "Łukasz", "María",
+        "Noah", "Olivia", "Özil", "Pierre", "Quentin", "Renée", "Søren", "Sophia", "Tomás", "Zoë",
+    };
+    static const char* kLast[] = {
+        "Anderson", "Åström", "Brown", "Castañeda", "Dubois", "Fernández", "García", "Hernández",
+        "Ito", "Jackson", "Kowalski", "Lefèvre", "Martin", "Müller", "Nguyen", "O'Brien", "Peña",
+        "Quinn", "Rossi", "Schröder", "Smith", "Suzuki", "Taylor", "Vázquez", "Wójcik", "Zhang",
+    };
+    const int first_count = sizeof(kFirst) / sizeof(kFirst[0]);
+    const int last_count = sizeof(kLast) / sizeof(kLast[0]);
+
+    std::vector<std::string> names;
+    names.reserve(count);
+    uint32_t seed = 1;
+    for (int i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 8;
+        uint32_t id = r % distinct;
+        std::string name = kFirst[id % first_count];
+        name += ' ';
+        name += kLast[(id / first_count) % last_count];
+        if (id >= (uint32_t)(first_count * last_count)) {
+            name += ' ';
+            name += std::to_string(id);
+        }
+        names.push_back(name);
+    }
+    return names;
+}
+
+static sqlite3* open_contacts(int count, int distinct, int flags) {
+    sqlite3* db = NULL;
+    sqlite3_open(":memory:", &db);
+    register_localized_collators_v2(db, "en_US", 0, flags);
+    sqlite3_exec(db, "CREATE TABLE contacts(name TEXT)", NULL, NULL, NULL);
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db, "INSERT INTO contacts VALUES(?)", -1, &stmt, NULL);
+    for (const std::string& name : contact_names(count, distinct)) {
+        sqlite3_bind_text(stmt, 1, name.c_str(), name.size(), SQLITE_STATIC);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+    return db;
+}
+
+static void report_cache_stats(benchmark::State& state, sqlite3* db) {
+    sqlite3_int64 hits, misses;
+    if (get_collator_cache_stats(db, "LOCALIZED", &hits, &misses) == SQLITE_OK) {
+        state.counters["hit_rate"] = (hits + misses) ? (double)hits / (hits + misses) : 0;
+    }
+}
+
+static void BM_OrderByLocalized(benchmark::State& state) {
+    sqlite3* db = open_contacts(state.range(0), state.range(1), state.range(2));
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db, "SELECT name FROM contacts ORDER BY name COLLATE LOCALIZED", -1, &stmt,
+            NULL);
+    for (auto _ : state) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    report_cache_stats(state, db);
+    sqlite3_close(db);
+}
+BENCHMARK(BM_OrderByLocalized)
+    ->ArgNames({"rows", "distinct", "flags"})
+    ->ArgsProduct({{100000}, {1000, 100000}, {0, ANDROID_COLLATOR_SORT_KEY_CACHE,
+            ANDROID_COLLATOR_ASCII_FAST_PATH,
+            ANDROID_COLLATOR_SORT_KEY_CACHE | ANDROID_COLLATOR_ASCII_FAST_PATH}})
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_CreateIndexLocalized(benchmark::State& state) {
+    sqlite3* db = open_contacts(state.range(0), state.range(1), state.range(2));
+    for (auto _ : state) {
+        sqlite3_exec(db, "CREATE INDEX contacts_name ON contacts(name COLLATE LOCALIZED)", NULL,
+                NULL, NULL);
+        state.PauseTiming();
+        sqlite3_exec(db, "DROP INDEX contacts_name", NULL, NULL, NULL);
+        state.ResumeTiming();
+    }
+    report_cache_stats(state, db);
+    sqlite3_close(db);
+}
+BENCHMARK(BM_CreateIndexLocalized)
+    ->ArgNames({"rows", "distinct", "flags"})
+    ->ArgsProduct({{100000}, {1000, 100000}, {0, ANDROID_COLLATOR_SORT_KEY_CACHE,
+            ANDROID_COLLATOR_ASCII_FAST_PATH,
+            ANDROID_COLLATOR_SORT_KEY_CACHE | ANDROID_COLLATOR_ASCII_FAST_PATH}})
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_LookupLocalized(benchmark::State& state) {
+    sqlite3* db = open_contacts(state.range(0), state.range(1), state.range(2));
+    sqlite3_exec(db, "CREATE INDEX contacts_name ON contacts(name COLLATE LOCALIZED)", NULL, NULL,
+            NULL);
+    std::vector<std::string> probes = contact_names(1000, state.range(1));
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db, "SELECT count(*) FROM contacts WHERE name = ? COLLATE LOCALIZED", -1,
+            &stmt, NULL);
+    size_t i = 0;
+    for (auto _ : state) {
+        const std::string& probe = probes[i++ % probes.size()];
+        sqlite3_bind_text(stmt, 1, probe.c_str(), probe.size(), SQLITE_STATIC);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    report_cache_stats(state, db);
+    sqlite3_close(db);
+}
+BENCHMARK(BM_LookupLocalized)
+    ->ArgNames({"rows", "distinct", "flags"})
+    ->ArgsProduct({{100000}, {1000, 100000}, {0, ANDROID_COLLATOR_SORT_KEY_CACHE,
+            ANDROID_COLLATOR_ASCII_FAST_PATH,
+            ANDROID_COLLATOR_SORT_KEY_CACHE | ANDROID_COLLATOR_ASCII_FAST_PATH}});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sqlite3_android.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+class AndroidFunctionsTest : public testing::Test {
+  protected:
+    void SetUp() override {
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db_));
+    }
+
+    void TearDown() override {
+        sqlite3_close(db_);
+    }
+
+    int exec(const char* sql) {
+        return sqlite3_exec(db_, sql, NULL, NULL, NULL);
+    }
+
+    // Returns the details of the EXPLAIN QUERY PLAN of "sql", one per line.
+    std::string query_plan(const std::string& sql) {
+        std::string plan;
+        std::string explain = "EXPLAIN QUERY PLAN " + sql;
+        sqlite3_stmt* stmt = NULL;
+        EXPECT_EQ(SQLITE_OK, sqlite3_prepare_v2(db_, explain.c_str(), -1, &stmt, NULL))
+                << sqlite3_errmsg(db_);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            plan += (const char*)sqlite3_column_text(stmt, 3);
+            plan += '\n';
+        }
+        sqlite3_finalize(stmt);
+        return plan;
+    }
+
+    // Returns true if the query plan of "sql" searches "index" with "constraint".
+    // Whether the index is reported as covering depends on the SQLite version.
+    bool searches_index(const char* sql, const char* index, const char* constraint) {
+        std::string plan = query_plan(sql);
+        std::string search = std::string("INDEX ") + index + " (" + constraint + ")";
+        return plan.find(search) != std::string::npos;
+    }
+
+    // Returns the first column of the rows of "sql", joined by commas.
+    std::string query(const char* sql) {
+        std::string result;
+        sqlite3_stmt* stmt = NULL;
+        EXPECT_EQ(SQLITE_OK, sqlite3_prepare_v2(db_, sql, -1, &stmt, NULL)) << sqlite3_errmsg(db_);
+        int err;
+        while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+            if (!result.empty()) {
+                result += ',';
+            }
+            const char* text = (const char*)sqlite3_column_text(stmt, 0);
+            result += (text != NULL) ? text : "NULL";
+        }
+        EXPECT_EQ(SQLITE_DONE, err) << sqlite3_errmsg(db_);
+        sqlite3_finalize(stmt);
+        return result;
+    }
+
+    // Runs "sql", which returns two strings and the result of comparing them,
+    // on "expected_db" and on db_, and reports the rows where the results differ.
+    // Returns the number of rows.
+    int compare_rows(sqlite3* expected_db, const char* sql) {
+        sqlite3_stmt* expected_stmt = NULL;
+        sqlite3_stmt* stmt = NULL;
+        EXPECT_EQ(SQLITE_OK, sqlite3_prepare_v2(expected_db, sql, -1, &expected_stmt, NULL))
+                << sqlite3_errmsg(expected_db);
+        EXPECT_EQ(SQLITE_OK, sqlite3_prepare_v2(db_, sql, -1, &stmt, NULL)) << sqlite3_errmsg(db_);
+        int count = 0;
+        int mismatches = 0;
+        while (sqlite3_step(expected_stmt) == SQLITE_ROW) {
+            if (sqlite3_step(stmt) != SQLITE_ROW) {
+                ADD_FAILURE() << "missing rows";
+                break;
+            }
+            std::string s = (const char*)sqlite3_column_text(stmt, 0);
+            std::string t = (const char*)sqlite3_column_text(stmt, 1);
+            int expected = sqlite3_column_int(expected_stmt, 2);
+            int actual = sqlite3_column_int(stmt, 2);
+            if (actual != expected && mismatches++ < 10) {
+                ADD_FAILURE() << "'" << s << "' vs '" << t << "': " << actual << ", expected "
+                              << expected;
+            }
+            count++;
+        }
+        EXPECT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+        EXPECT_EQ(0, mismatches);
+        sqlite3_finalize(stmt);
+        sqlite3_finalize(expected_stmt);
+        return count;
+    }
+
+    sqlite3* db_ = NULL;
+};
+
+TEST_F(AndroidFunctionsTest, notDeterministicByDefault) {
+    ASSERT_EQ(SQLITE_OK, register_android_functions(db_, 0));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE calls(number TEXT)"));
+
+    EXPECT_EQ(SQLITE_ERROR, exec("CREATE INDEX calls_us ON calls("
+                                 "PHONE_NUMBERS_EQUAL(number, '+1 650-253-0000', 1))"));
+    EXPECT_EQ(SQLITE_ERROR, exec("CREATE TABLE numbers(number TEXT, "
+                                 "us AS (PHONE_NUMBERS_EQUAL(number, '+1 650-253-0000')))"));
+    EXPECT_EQ(SQLITE_ERROR, exec("CREATE INDEX calls_deleted ON calls(_DELETE_FILE(number))"));
+
+    // The functions still work outside of the schema.
+    ASSERT_EQ(SQLITE_OK, exec("INSERT INTO calls VALUES ('650-253-0000'), ('+1 650 253 0000')"));
+    EXPECT_EQ("2", query("SELECT count(*) FROM calls "
+                         "WHERE PHONE_NUMBERS_EQUAL(number, '650-253-0000', 1)"));
+    EXPECT_EQ("0000352056,00003520561+",
+              query("SELECT _PHONE_NUMBER_STRIPPED_REVERSED(number) FROM calls"));
+}
+
+TEST_F(AndroidFunctionsTest, phoneNumberKeyIsAlwaysDeterministic) {
+    ASSERT_EQ(SQLITE_OK, register_android_functions(db_, 0));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE calls(number TEXT, "
+                              "key TEXT AS (PHONE_NUMBER_KEY(number, 1)))"));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE INDEX calls_key ON calls(PHONE_NUMBER_KEY(number, 0))"));
+    EXPECT_TRUE(searches_index("SELECT number FROM calls "
+                               "WHERE PHONE_NUMBER_KEY(number, 0) = PHONE_NUMBER_KEY(?1, 0)",
+                               "calls_key", "<expr>=?"));
+}
+
+TEST_F(AndroidFunctionsTest, strippedReversedIsAlwaysDeterministic) {
+    // Existing schemas index it without ANDROID_FUNCTIONS_DETERMINISTIC.
+    ASSERT_EQ(SQLITE_OK, register_android_functions(db_, 0));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE calls(number TEXT)"));
+    ASSERT_EQ(SQLITE_OK, exec("INSERT INTO calls VALUES ('650-253-0000'), ('+1 650 253 0000')"));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE INDEX calls_stripped ON calls("
+                              "_PHONE_NUMBER_STRIPPED_REVERSED(number))"));
+    EXPECT_TRUE(searches_index("SELECT count(*) FROM calls "
+                               "WHERE _PHONE_NUMBER_STRIPPED_REVERSED(number) = '0000352056'",
+                               "calls_stripped", "<expr>=?"));
+    EXPECT_EQ("1", query("SELECT count(*) FROM calls "
+                         "WHERE _PHONE_NUMBER_STRIPPED_REVERSED(number) = '0000352056'"));
+}
+
+TEST_F(AndroidFunctionsTest, expressionIndex) {
+    ASSERT_EQ(SQLITE_OK, register_android_functions_v2(db_, 0, ANDROID_FUNCTIONS_DETERMINISTIC));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE calls(number TEXT)"));
+    ASSERT_EQ(SQLITE_OK, exec("INSERT INTO calls VALUES ('650-253-0000'), ('+1 650 253 0000'), "
+                              "('+44 20 7792 3490')"));
+
+    ASSERT_EQ(SQLITE_OK, exec("CREATE INDEX calls_office ON calls("
+                              "PHONE_NUMBERS_EQUAL(number, '650-253-0000', 1))"));
+    EXPECT_TRUE(searches_index("SELECT number FROM calls "
+                               "WHERE PHONE_NUMBERS_EQUAL(number, '650-253-0000', 1) = 1",
+                               "calls_office", "<expr>=?"));
+
+    ASSERT_EQ(SQLITE_OK, exec("CREATE INDEX calls_stripped ON calls("
+                              "_PHONE_NUMBER_STRIPPED_REVERSED(number))"));
+    EXPECT_TRUE(searches_index("SELECT count(*) FROM calls "
+                               "WHERE _PHONE_NUMBER_STRIPPED_REVERSED(number) = '0000352056'",
+                               "calls_stripped", "<expr>=?"));
+
+    ASSERT_EQ(SQLITE_OK, exec("CREATE INDEX calls_key ON calls(PHONE_NUMBER_KEY(number, 0))"));
+    EXPECT_TRUE(searches_index("SELECT number FROM calls "
+                               "WHERE PHONE_NUMBER_KEY(number, 0) = PHONE_NUMBER_KEY(?1, 0) "
+                               "AND PHONE_NUMBERS_EQUAL(number, ?1, 0)",
+                               "calls_key", "<expr>=?"));
+
+    sqlite3_stmt* stmt = NULL;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db_, "SELECT count(*) FROM calls "
+                                            "WHERE PHONE_NUMBERS_EQUAL(number, '650-253-0000', 1)",
+                                            -1, &stmt, NULL));
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    EXPECT_EQ(2, sqlite3_column_int(stmt, 0));
+    sqlite3_finalize(stmt);
+}
+
+TEST_F(AndroidFunctionsTest, generatedColumn) {
+    ASSERT_EQ(SQLITE_OK, register_android_functions_v2(db_, 0, ANDROID_FUNCTIONS_DETERMINISTIC));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE calls(number TEXT, "
+                              "key TEXT AS (PHONE_NUMBER_KEY(number, 1)) STORED)"));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE INDEX calls_key ON calls(key)"));
+    EXPECT_TRUE(searches_index("SELECT count(*) FROM calls WHERE key = PHONE_NUMBER_KEY(?1, 1)",
+                               "calls_key", "key=?"));
+}
+
+TEST_F(AndroidFunctionsTest, phoneNumberKeyStrictShortNumbers) {
+    ASSERT_EQ(SQLITE_OK, register_android_functions_v2(db_, 0, ANDROID_FUNCTIONS_DETERMINISTIC));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE calls(number TEXT)"));
+    ASSERT_EQ(SQLITE_OK, exec("INSERT INTO calls VALUES ('555'), ('555-414'), ('1-555-414'), "
+                              "('555-4141'), ('650-253-0000')"));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE INDEX calls_key ON calls(PHONE_NUMBER_KEY(number, 1))"));
+
+    // Numbers shorter than 7 characters have the empty key, so looking up the
+    // empty key as well finds them.
+    EXPECT_EQ("555,555-414", query("SELECT number FROM calls "
+                                   "WHERE PHONE_NUMBER_KEY(number, 1) = ''"));
+    EXPECT_TRUE(searches_index("SELECT number FROM calls "
+                               "WHERE PHONE_NUMBER_KEY(number, 1) IN (PHONE_NUMBER_KEY(?1, 1), '') "
+                               "AND PHONE_NUMBERS_EQUAL(number, ?1, 1)",
+                               "calls_key", "<expr>=?"));
+    for (const char* number : {"555", "1555", "555-414", "1-555-414", "555-4141", "1-555-4141",
+                               "+1 650-253-0000"}) {
+        SCOPED_TRACE(number);
+        std::string exact = "SELECT number FROM calls WHERE PHONE_NUMBERS_EQUAL(number, '" +
+                std::string(number) + "', 1)";
+        std::string keyed = "SELECT number FROM calls WHERE PHONE_NUMBER_KEY(number, 1) IN "
+                "(PHONE_NUMBER_KEY(?1, 1), '') AND PHONE_NUMBERS_EQUAL(number, ?1, 1)";
+        // A short number has the empty key, and has to be compared with every row.
+        if (query(("SELECT PHONE_NUMBER_KEY('" + std::string(number) + "', 1)").c_str()) == "") {
+            keyed = "SELECT number FROM calls WHERE PHONE_NUMBERS_EQUAL(number, ?1, 1)";
+        }
+        for (size_t i; (i = keyed.find("?1")) != std::string::npos;) {
+            keyed.replace(i, 2, "'" + std::string(number) + "'");
+        }
+        EXPECT_NE("", query(exact.c_str()));
+        EXPECT_EQ(query(exact.c_str()), query(keyed.c_str()));
+    }
+}
+
+TEST_F(AndroidFunctionsTest, deleteFileIsNeverDeterministic) {
+    ASSERT_EQ(SQLITE_OK, register_android_functions_v2(db_, 0, ANDROID_FUNCTIONS_DETERMINISTIC));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE files(path TEXT)"));
+
+    EXPECT_EQ(SQLITE_ERROR, exec("CREATE INDEX files_deleted ON files(_DELETE_FILE(path))"));
+}
+
+// Counts the pairs of rows of "names" which do not compare the same way by
+// SORTKEY() as with the LOCALIZED collator.
+#define SORT_KEY_MISMATCHES                                                           \
+    "SELECT count(*) FROM names a, names b WHERE "                                    \
+    "(a.name < b.name COLLATE LOCALIZED) != (SORTKEY(a.name) < SORTKEY(b.name)) OR "  \
+    "(a.name = b.name COLLATE LOCALIZED) != (SORTKEY(a.name) = SORTKEY(b.name))"
+
+TEST_F(AndroidFunctionsTest, sortKeyOrdersLikeLocalized) {
+    ASSERT_EQ(SQLITE_OK, register_localized_collators(db_, "en_US", 0));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE names(name TEXT)"));
+    ASSERT_EQ(SQLITE_OK, exec("INSERT INTO names VALUES ('alice'), ('Alice'), ('Álvaro'), "
+                              "('bob'), ('Zoë'), ('zoe'), ('Øystein'), ('Ōta'), ('abc-def'), "
+                              "('abcdef'), ('10'), ('9'), (''), ('Ärger'), ('Straße'), "
+                              "('Strasse'), ('Ольга'), ('李'), ('😀')"));
+
+    EXPECT_EQ("0", query(SORT_KEY_MISMATCHES));
+    EXPECT_EQ("0", query("SELECT count(*) FROM names a, names b WHERE "
+                         "(a.name < b.name COLLATE LOCALIZED) != "
+                         "(SORTKEY(a.name, 'en_US') < SORTKEY(b.name, 'en_US'))"));
+}
+
+TEST_F(AndroidFunctionsTest, sortKeyLocale) {
+    ASSERT_EQ(SQLITE_OK, register_localized_collators(db_, "en_US", 0));
+
+    // Swedish sorts "ö" after "z", English with "o".
+    EXPECT_EQ("1", query("SELECT SORTKEY('öl') < SORTKEY('zebra')"));
+    EXPECT_EQ("0", query("SELECT SORTKEY('öl', 'sv_SE') < SORTKEY('zebra', 'sv_SE')"));
+
+    // Unknown locales fall back to the root collation, like in ICU.
+    EXPECT_EQ("1", query("SELECT SORTKEY('öl', 'xx_YY') < SORTKEY('zebra', 'xx_YY')"));
+
+    sqlite3_stmt* stmt = NULL;
+    std::string locale(300, 'x');
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db_, "SELECT SORTKEY('a', ?1)", -1, &stmt, NULL));
+    sqlite3_bind_text(stmt, 1, locale.c_str(), -1, SQLITE_STATIC);
+    EXPECT_EQ(SQLITE_ERROR, sqlite3_step(stmt));
+    EXPECT_STREQ("SORTKEY: invalid locale", sqlite3_errmsg(db_));
+    sqlite3_finalize(stmt);
+}
+
+TEST_F(AndroidFunctionsTest, sortKeyNull) {
+    ASSERT_EQ(SQLITE_OK, register_localized_collators(db_, "en_US", 0));
+
+    EXPECT_EQ("null", query("SELECT typeof(SORTKEY(NULL))"));
+    EXPECT_EQ("null", query("SELECT typeof(SORTKEY(NULL, 'en_US'))"));
+    EXPECT_EQ("null", query("SELECT typeof(SORTKEY('a', NULL))"));
+    EXPECT_EQ("blob", query("SELECT typeof(SORTKEY(''))"));
+    EXPECT_EQ("0", query("SELECT length(SORTKEY(''))"));
+}
+
+TEST_F(AndroidFunctionsTest, sortKeyLongerThanBuffer) {
+    ASSERT_EQ(SQLITE_OK, register_localized_collators(db_, "en_US", 0));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE names(name TEXT)"));
+    // 2000 copies of the alphabet have keys much longer than the 1024 byte buffer.
+    ASSERT_EQ(SQLITE_OK, exec("INSERT INTO names SELECT replace(printf('%.2000c', 'x'), 'x', "
+                              "'abcdefghijklmnopqrstuvwxyz') || value "
+                              "FROM (SELECT 'a' AS value UNION ALL SELECT 'B' "
+                              "UNION ALL SELECT 'ä')"));
+
+    EXPECT_EQ("1", query("SELECT min(length(SORTKEY(name))) > 1024 FROM names"));
+    EXPECT_EQ("0", query(SORT_KEY_MISMATCHES));
+}
+
+TEST_F(AndroidFunctionsTest, sortKeyIndexRebuiltByName) {
+    ASSERT_EQ(SQLITE_OK, register_localized_collators(db_, "en_US", 0));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE names(name TEXT)"));
+    ASSERT_EQ(SQLITE_OK, exec("INSERT INTO names VALUES ('zebra'), ('öl'), ('apple')"));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE INDEX names_key ON names(SORTKEY(name))"));
+    const char* sql = "SELECT name FROM names INDEXED BY names_key ORDER BY SORTKEY(name)";
+    EXPECT_EQ("apple,öl,zebra", query(sql));
+
+    // The new locale only applies to the index once it is rebuilt.
+    ASSERT_EQ(SQLITE_OK, register_localized_collators(db_, "sv_SE", 0));
+    ASSERT_EQ(SQLITE_OK, exec("REINDEX names_key"));
+    EXPECT_EQ("apple,zebra,öl", query(sql));
+}
+
+// Compares pairs of strings around every pair of printable ASCII characters:
+// alone, as prefixes of each other, around the characters which start
+// contractions in some locales, past the eight byte prefix skip, and next to
+// non-ASCII characters.
+#define ASCII_PAIRS                                                              \
+    "WITH RECURSIVE chars(i) AS (SELECT 32 UNION ALL SELECT i + 1 FROM chars "   \
+    "WHERE i < 126), "                                                           \
+    "pairs(x, y) AS (SELECT char(a.i), char(b.i) FROM chars a, chars b), "       \
+    "cases(s, t) AS (SELECT x, y FROM pairs "                                    \
+    "UNION ALL SELECT x, x || y FROM pairs "                                     \
+    "UNION ALL SELECT x || y, y || x FROM pairs "                                \
+    "UNION ALL SELECT 'c' || x, 'c' || y FROM pairs "                            \
+    "UNION ALL SELECT x || 'h', y || 'h' FROM pairs "                            \
+    "UNION ALL SELECT 'a' || x, 'a' || y || 'a' FROM pairs "                     \
+    "UNION ALL SELECT 'abcdefgh' || x || 'a', 'abcdefgh' || y FROM pairs "       \
+    "UNION ALL SELECT 'Ärger ' || x, 'Ärger ' || y FROM pairs "                  \
+    "UNION ALL SELECT 'a' || x || 'é', 'a' || y || 'e' FROM pairs "              \
+    "UNION ALL SELECT x || 'ö', x || y FROM pairs "                              \
+    "UNION ALL SELECT 'Zoë ' || x || 'z', 'Zoe ' || y FROM pairs) "              \
+    "SELECT s, t, (s < t COLLATE LOCALIZED) - (s > t COLLATE LOCALIZED) FROM cases"
+
+TEST_F(AndroidFunctionsTest, asciiFastPathMatchesIcu) {
+    // Czech has the "ch" contraction and Danish "aa".
+    for (const char* locale : {"en_US", "cs_CZ", "da_DK"}) {
+        SCOPED_TRACE(locale);
+        sqlite3* icu_db = NULL;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &icu_db));
+        ASSERT_EQ(SQLITE_OK, register_localized_collators_v2(icu_db, locale, 0, 0));
+        ASSERT_EQ(SQLITE_OK, register_localized_collators_v2(db_, locale, 0,
+                                                             ANDROID_COLLATOR_ASCII_FAST_PATH));
+
+        EXPECT_EQ(11 * 95 * 95, compare_rows(icu_db, ASCII_PAIRS));
+        sqlite3_close(icu_db);
+    }
+}
+
+TEST_F(AndroidFunctionsTest, sortKeyCacheStats) {
+    sqlite3_int64 hits = -1;
+    sqlite3_int64 misses = -1;
+    ASSERT_EQ(SQLITE_OK, register_localized_collators_v2(db_, "en_US", 0, 0));
+    EXPECT_EQ(SQLITE_NOTFOUND, get_collator_cache_stats(db_, "LOCALIZED", &hits, &misses));
+    EXPECT_EQ(0, hits);
+    EXPECT_EQ(0, misses);
+
+    ASSERT_EQ(SQLITE_OK, register_localized_collators_v2(db_, "en_US", 0,
+                                                         ANDROID_COLLATOR_SORT_KEY_CACHE));
+    ASSERT_EQ(SQLITE_OK, get_collator_cache_stats(db_, "LOCALIZED", &hits, &misses));
+    EXPECT_EQ(0, hits);
+    EXPECT_EQ(0, misses);
+    EXPECT_EQ(SQLITE_NOTFOUND, get_collator_cache_stats(db_, "UNICODE", &hits, &misses));
+
+    // Both keys are built by the first comparison and found by the second one.
+    EXPECT_EQ("0", query("SELECT 'Bob' < 'alice' COLLATE LOCALIZED"));
+    ASSERT_EQ(SQLITE_OK, get_collator_cache_stats(db_, "LOCALIZED", &hits, &misses));
+    EXPECT_EQ(0, hits);
+    EXPECT_EQ(2, misses);
+    EXPECT_EQ("1", query("SELECT 'alice' < 'Bob' COLLATE LOCALIZED"));
+    ASSERT_EQ(SQLITE_OK, get_collator_cache_stats(db_, "LOCALIZED", &hits, &misses));
+    EXPECT_EQ(2, hits);
+    EXPECT_EQ(2, misses);
+
+    // Identical strings are equal without a lookup, and each collator has its own cache.
+    EXPECT_EQ("1", query("SELECT 'alice' = 'alice' COLLATE LOCALIZED"));
+    EXPECT_EQ("1", query("SELECT 'alice' < 'Bob' COLLATE PHONEBOOK"));
+    ASSERT_EQ(SQLITE_OK, get_collator_cache_stats(db_, "LOCALIZED", &hits, &misses));
+    EXPECT_EQ(2, hits);
+    EXPECT_EQ(2, misses);
+    ASSERT_EQ(SQLITE_OK, get_collator_cache_stats(db_, "PHONEBOOK", &hits, &misses));
+    EXPECT_EQ(0, hits);
+    EXPECT_EQ(2, misses);
+}
+
+TEST_F(AndroidFunctionsTest, sortKeyCacheEviction) {
+    sqlite3_int64 hits;
+    sqlite3_int64 misses;
+    ASSERT_EQ(SQLITE_OK, register_localized_collators_v2(db_, "en_US", 0,
+                                                         ANDROID_COLLATOR_SORT_KEY_CACHE));
+    // The keys of 3000 texts of about 245 letters do not fit in the 1 MB cache.
+    // Each text is compared with 16 others, which keeps the miss rate low enough
+    // for the cache to stay on.
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE big(s TEXT)"));
+    ASSERT_EQ(SQLITE_OK, exec("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n "
+                              "WHERE i < 3000) "
+                              "INSERT INTO big SELECT printf('%d%.240c', i, 'q') FROM n"));
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE hot(s TEXT)"));
+    ASSERT_EQ(SQLITE_OK, exec("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n "
+                              "WHERE i < 16) "
+                              "INSERT INTO hot SELECT printf('hot%d', i) FROM n"));
+    EXPECT_EQ("48000", query("SELECT sum(big.s < hot.s COLLATE LOCALIZED) "
+                             "FROM big CROSS JOIN hot"));
+    ASSERT_EQ(SQLITE_OK, get_collator_cache_stats(db_, "LOCALIZED", &hits, &misses));
+    EXPECT_EQ(3000 + 16, misses);
+
+    // The least recently used keys were evicted, the others are still there.
+    EXPECT_EQ("1", query("SELECT (SELECT s FROM big WHERE rowid = 1) < 'hot1' COLLATE LOCALIZED"));
+    EXPECT_EQ("1", query("SELECT (SELECT s FROM big WHERE rowid = 3000) < 'hot1' "
+                         "COLLATE LOCALIZED"));
+    sqlite3_int64 new_hits;
+    sqlite3_int64 new_misses;
+    ASSERT_EQ(SQLITE_OK, get_collator_cache_stats(db_, "LOCALIZED", &new_hits, &new_misses));
+    EXPECT_EQ(misses + 1, new_misses);
+    EXPECT_EQ(hits + 3, new_hits);
+}
+
+TEST_F(AndroidFunctionsTest, sortKeyCacheMatchesIcu) {
+    for (const char* locale : {"en_US", "de_DE"}) {
+        SCOPED_TRACE(locale);
+        sqlite3* icu_db = NULL;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &icu_db));
+        ASSERT_EQ(SQLITE_OK, register_localized_collators_v2(icu_db, locale, 0, 0));
+        ASSERT_EQ(SQLITE_OK, register_localized_collators_v2(db_, locale, 0,
+                                                             ANDROID_COLLATOR_SORT_KEY_CACHE));
+
+        // Texts over 256 bytes are compared by ICU directly.
+        const char* sql =
+                "WITH names(name) AS (VALUES ('alice'), ('Alice'), ('Álvaro'), ('bob'), "
+                "('Zoë'), ('zoe'), ('Øystein'), ('abc-def'), ('abcdef'), ('10'), ('9'), (''), "
+                "('Ärger'), ('Arger'), ('Straße'), ('Strasse'), ('Ольга'), ('李'), "
+                "(printf('%.300c', 'a')), (printf('%.300c', 'a') || 'b'), "
+                "(printf('%.255c', 'a') || 'ä'), (printf('%.256c', 'a'))) "
+                "SELECT a.name, b.name, "
+                "(a.name < b.name COLLATE LOCALIZED) - (a.name > b.name COLLATE LOCALIZED) "
+                "FROM names a, names b";
+        // The second pass compares the cached keys.
+        EXPECT_EQ(22 * 22, compare_rows(icu_db, sql));
+        EXPECT_EQ(22 * 22, compare_rows(icu_db, sql));
+
+        sqlite3_int64 hits;
+        sqlite3_int64 misses;
+        ASSERT_EQ(SQLITE_OK, get_collator_cache_stats(db_, "LOCALIZED", &hits, &misses));
+        EXPECT_GT(hits, 0);
+        EXPECT_GT(misses, 0);
+        sqlite3_close(icu_db);
+    }
+}
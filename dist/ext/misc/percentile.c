@@ -57,16 +57,86 @@
 **  (12)  The percentile(Y,P) is implemented as a single C99 source-code
 **        file that compiles into a shared-library or DLL that can be loaded
 **        into SQLite using the sqlite3_load_extension() interface.
+**
+** This file also implements percentile_approx(Y,P[,A]), an approximation
+** of percentile(Y,P) that does not remember the input values:
+**
+**   (13)  The percentile_approx(Y,P) function follows requirements (1)
+**         through (8) and (11) above, with the name percentile_approx()
+**         in error messages.
+**
+**   (14)  The optional A argument is the relative accuracy: a number
+**         between 0.0001 and 0.5 inclusive, 0.01 by default, which must be
+**         the same for every row.  The result is within a factor of 1+A
+**         of the height of the graph of requirement (10) at one of the
+**         Y values next to P*(N-1)/100, or an interpolation between two
+**         such results.
+**
+**   (15)  Values are counted in buckets whose bounds grow geometrically
+**         by a factor of (1+A)/(1-A), in pages of PCTAPPROX_PAGE buckets
+**         that are only allocated while they hold a value.  A page covers
+**         a factor of about e^(512*A), 167 for the default A, so the
+**         memory used by each group depends on the range of its values
+**         and on A, but not on the number of rows.  Buckets are never
+**         merged, so requirement (14) holds for any range of values.
+**
+**   (16)  The percentile_approx(Y,P) function can be used as a window
+**         function, in which case removing a row from the window costs
+**         the same as adding one.
+**
+** And percentiles(Y,L), which computes several percentiles in one pass:
+**
+**   (17)  L is a text list of P values separated by commas, such as
+**         '25,50,95,99', which must be the same for every row.  Each P
+**         value must be a number between 0.0 and 100.0 inclusive.
+**
+**   (18)  The percentiles(Y,L) function returns NULL if there are no
+**         non-NULL values for Y, and otherwise a JSON array holding the
+**         value percentile(Y,P) would return for each P of L, in order.
+**
+**   (19)  The percentile(Y,P) and percentiles(Y,L) functions can be used
+**         as window functions.  The Y values of the window are then kept
+**         in an order-statistic tree, so that adding or removing a row
+**         and computing a result each cost O(logN).
 */
 #include "sqlite3ext.h"
 SQLITE_EXTENSION_INIT1
 #include <assert.h>
+#include <float.h>
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 
+/* A node of the order-statistic tree holding the Y values of a window.
+** The tree is a treap: a binary search tree on y which is also a heap on
+** a pseudo-random priority, which keeps its expected depth in O(logN).
+*/
+typedef struct PercentNode PercentNode;
+struct PercentNode {
+  double y;            /* The Y value */
+  unsigned pri;        /* Not smaller than the priority of the children */
+  int nSize;           /* Number of nodes in this subtree */
+  int iLeft;           /* Subtree of smaller or equal values, or 0 */
+  int iRight;          /* Subtree of larger or equal values, or 0 */
+};
+
+/* The nodes of an order-statistic tree.  aNode[0] stands for the empty
+** subtree and always has a size of 0.
+*/
+typedef struct PercentTree PercentTree;
+struct PercentTree {
+  PercentNode *aNode;  /* Nodes of the tree, or NULL if not yet built */
+  int nAlloc;          /* Number of slots allocated for aNode[] */
+  int nUsed;           /* Number of slots ever used in aNode[] */
+  int iFree;           /* First free node, chained by iLeft, or 0 */
+  int iRoot;           /* Root of the tree, or 0 if empty */
+  unsigned iRand;      /* State of the priority generator */
+};
+
 /* The following object is the session context for a single percentile()
 ** function.  We have to remember all input Y values until the very end.
-** Those values are accumulated in the Percentile.a[] array.
+** Those values are accumulated in the Percentile.a[] array, or in the
+** Percentile.tree once the function is used as a window function.
 */
 typedef struct Percentile Percentile;
 struct Percentile {
@@ -74,6 +144,10 @@ struct Percentile {
   unsigned nUsed;      /* Number of slots actually used in a[] */
   double rPct;         /* 1.0 more than the value for P */
   double *a;           /* Array of Y values */
+  char *zPct;          /* The L argument of percentiles(), or NULL */
+  int nPct;            /* Number of values in aPct[] */
+  double *aPct;        /* The P values of L */
+  PercentTree tree;    /* Y values of a window function */
 };
 
 /*
@@ -95,56 +169,182 @@ static int sameValue(double a, double b){
 }
 
 /*
-** The "step" function for percentile(Y,P) is called once for each
-** input row.
+** Recompute the size of node i of an order-statistic tree.
 */
-static void percentStep(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
-  Percentile *p;
-  double rPct;
-  int eType;
-  double y;
-  assert( argc==2 );
+static void percentTreeFix(PercentNode *a, int i){
+  a[i].nSize = 1 + a[a[i].iLeft].nSize + a[a[i].iRight].nSize;
+}
 
-  /* Requirement 3:  P must be a number between 0 and 100 */
-  eType = sqlite3_value_numeric_type(argv[1]);
-  rPct = sqlite3_value_double(argv[1]);
-  if( (eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT)
-   || rPct<0.0 || rPct>100.0 ){
-    sqlite3_result_error(pCtx, "2nd argument to percentile() is not "
-                         "a number between 0.0 and 100.0", -1);
-    return;
+/*
+** Split the subtree t into the nodes whose value is less than y (or less
+** than or equal to y if bInclusive is true), rooted at *piLeft, and the
+** other nodes, rooted at *piRight.
+*/
+static void percentTreeSplit(
+  PercentNode *a,
+  int t,
+  double y,
+  int bInclusive,
+  int *piLeft,
+  int *piRight
+){
+  if( t==0 ){
+    *piLeft = *piRight = 0;
+  }else if( a[t].y<y || (bInclusive && a[t].y==y) ){
+    percentTreeSplit(a, a[t].iRight, y, bInclusive, &a[t].iRight, piRight);
+    percentTreeFix(a, t);
+    *piLeft = t;
+  }else{
+    percentTreeSplit(a, a[t].iLeft, y, bInclusive, piLeft, &a[t].iLeft);
+    percentTreeFix(a, t);
+    *piRight = t;
   }
+}
 
-  /* Allocate the session context. */
-  p = (Percentile*)sqlite3_aggregate_context(pCtx, sizeof(*p));
-  if( p==0 ) return;
+/*
+** Merge the subtrees l and r, where every value of l is less than or
+** equal to every value of r, and return the root of the result.
+*/
+static int percentTreeMerge(PercentNode *a, int l, int r){
+  if( l==0 ) return r;
+  if( r==0 ) return l;
+  if( a[l].pri>a[r].pri ){
+    a[l].iRight = percentTreeMerge(a, a[l].iRight, r);
+    percentTreeFix(a, l);
+    return l;
+  }else{
+    a[r].iLeft = percentTreeMerge(a, l, a[r].iLeft);
+    percentTreeFix(a, r);
+    return r;
+  }
+}
 
-  /* Remember the P value.  Throw an error if the P value is different
-  ** from any prior row, per Requirement (2). */
-  if( p->rPct==0.0 ){
-    p->rPct = rPct+1.0;
-  }else if( !sameValue(p->rPct,rPct+1.0) ){
-    sqlite3_result_error(pCtx, "2nd argument to percentile() is not the "
-                               "same for all input rows", -1);
-    return;
+/*
+** Return a new node of pTree for the value y with priority pri, or 0 on
+** an OOM.  The node is not linked into the tree.
+*/
+static int percentTreeNode(PercentTree *pTree, double y, unsigned pri){
+  int i;
+  if( pTree->iFree ){
+    i = pTree->iFree;
+    pTree->iFree = pTree->aNode[i].iLeft;
+  }else{
+    if( pTree->nUsed>=pTree->nAlloc ){
+      int n = pTree->nAlloc*2 + 250;
+      PercentNode *aNew = sqlite3_realloc64(pTree->aNode, sizeof(PercentNode)*n);
+      if( aNew==0 ) return 0;
+      pTree->aNode = aNew;
+      pTree->nAlloc = n;
+    }
+    i = pTree->nUsed++;
+  }
+  pTree->aNode[i].y = y;
+  pTree->aNode[i].pri = pri;
+  pTree->aNode[i].nSize = 1;
+  pTree->aNode[i].iLeft = 0;
+  pTree->aNode[i].iRight = 0;
+  return i;
+}
+
+/*
+** Return the next priority of pTree, from a xorshift generator.
+*/
+static unsigned percentTreeRandom(PercentTree *pTree){
+  pTree->iRand ^= pTree->iRand<<13;
+  pTree->iRand ^= pTree->iRand>>17;
+  pTree->iRand ^= pTree->iRand<<5;
+  return pTree->iRand;
+}
+
+/*
+** Add the value y to pTree.  Return SQLITE_NOMEM on an OOM.
+*/
+static int percentTreeInsert(PercentTree *pTree, double y){
+  int i, l, r;
+  i = percentTreeNode(pTree, y, percentTreeRandom(pTree));
+  if( i==0 ) return SQLITE_NOMEM;
+  percentTreeSplit(pTree->aNode, pTree->iRoot, y, 0, &l, &r);
+  l = percentTreeMerge(pTree->aNode, l, i);
+  pTree->iRoot = percentTreeMerge(pTree->aNode, l, r);
+  return SQLITE_OK;
+}
+
+/*
+** Remove one node with the value y from pTree, if there is one.
+*/
+static void percentTreeRemove(PercentTree *pTree, double y){
+  PercentNode *a = pTree->aNode;
+  int l, m, r;
+  percentTreeSplit(a, pTree->iRoot, y, 0, &l, &r);
+  percentTreeSplit(a, r, y, 1, &m, &r);
+  if( m ){
+    int iDel = m;
+    m = percentTreeMerge(a, a[m].iLeft, a[m].iRight);
+    a[iDel].iLeft = pTree->iFree;
+    pTree->iFree = iDel;
   }
+  pTree->iRoot = percentTreeMerge(a, l, percentTreeMerge(a, m, r));
+}
+
+/*
+** Return the value of rank k (counting from 0) of pTree.
+*/
+static double percentTreeRank(PercentTree *pTree, sqlite3_int64 k){
+  PercentNode *a = pTree->aNode;
+  int t = pTree->iRoot;
+  while( 1 ){
+    int nLeft = a[a[t].iLeft].nSize;
+    assert( t!=0 );
+    if( k<nLeft ){
+      t = a[t].iLeft;
+    }else if( k==nLeft ){
+      return a[t].y;
+    }else{
+      k -= nLeft+1;
+      t = a[t].iRight;
+    }
+  }
+}
+
+/*
+** Append the Y value of a row of percentile() or percentiles(), named
+** zFunc, to p.
+*/
+static void percentAppend(
+  sqlite3_context *pCtx,
+  Percentile *p,
+  sqlite3_value *pY,
+  const char *zFunc
+){
+  int eType;
+  double y;
 
   /* Ignore rows for which Y is NULL */
-  eType = sqlite3_value_type(argv[0]);
+  eType = sqlite3_value_type(pY);
   if( eType==SQLITE_NULL ) return;
 
   /* If not NULL, then Y must be numeric.  Otherwise throw an error.
   ** Requirement 4 */
   if( eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT ){
-    sqlite3_result_error(pCtx, "1st argument to percentile() is not "
-                               "numeric", -1);
+    char *zErr = sqlite3_mprintf("1st argument to %s() is not numeric", zFunc);
+    sqlite3_result_error(pCtx, zErr, -1);
+    sqlite3_free(zErr);
     return;
   }
 
   /* Throw an error if the Y value is infinity or NaN */
-  y = sqlite3_value_double(argv[0]);
+  y = sqlite3_value_double(pY);
   if( isInfinity(y) ){
-    sqlite3_result_error(pCtx, "Inf input to percentile()", -1);
+    char *zErr = sqlite3_mprintf("Inf input to %s()", zFunc);
+    sqlite3_result_error(pCtx, zErr, -1);
+    sqlite3_free(zErr);
+    return;
+  }
+
+  if( p->tree.aNode ){
+    if( percentTreeInsert(&p->tree, y) ){
+      sqlite3_result_error_nomem(pCtx);
+    }
     return;
   }
 
@@ -154,7 +354,9 @@ static void percentStep(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
     double *a = sqlite3_realloc64(p->a, sizeof(double)*n);
     if( a==0 ){
       sqlite3_free(p->a);
-      memset(p, 0, sizeof(*p));
+      p->a = 0;
+      p->nAlloc = 0;
+      p->nUsed = 0;
       sqlite3_result_error_nomem(pCtx);
       return;
     }
@@ -164,6 +366,43 @@ static void percentStep(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
   p->a[p->nUsed++] = y;
 }
 
+/*
+** The "step" function for percentile(Y,P) is called once for each
+** input row.
+*/
+static void percentStep(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
+  Percentile *p;
+  double rPct;
+  int eType;
+  assert( argc==2 );
+
+  /* Requirement 3:  P must be a number between 0 and 100 */
+  eType = sqlite3_value_numeric_type(argv[1]);
+  rPct = sqlite3_value_double(argv[1]);
+  if( (eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT)
+   || rPct<0.0 || rPct>100.0 ){
+    sqlite3_result_error(pCtx, "2nd argument to percentile() is not "
+                         "a number between 0.0 and 100.0", -1);
+    return;
+  }
+
+  /* Allocate the session context. */
+  p = (Percentile*)sqlite3_aggregate_context(pCtx, sizeof(*p));
+  if( p==0 ) return;
+
+  /* Remember the P value.  Throw an error if the P value is different
+  ** from any prior row, per Requirement (2). */
+  if( p->rPct==0.0 ){
+    p->rPct = rPct+1.0;
+  }else if( !sameValue(p->rPct,rPct+1.0) ){
+    sqlite3_result_error(pCtx, "2nd argument to percentile() is not the "
+                               "same for all input rows", -1);
+    return;
+  }
+
+  percentAppend(pCtx, p, argv[0], "percentile");
+}
+
 /*
 ** Compare to doubles for sorting using qsort()
 */
@@ -175,29 +414,748 @@ static int SQLITE_CDECL doubleCmp(const void *pA, const void *pB){
   return +1;
 }
 
+/*
+** Rearrange a[0..n-1] so that a[k] holds the value it would hold if the
+** array were sorted, with no larger value before it and no smaller value
+** after it.
+**
+** This is an introselect: a quickselect with a median-of-three pivot, which
+** has an expected O(N) cost, that falls back to qsort() when it fails to
+** converge after 2*log2(N) partitions, which bounds the worst case to
+** O(N*logN).
+*/
+static void percentSelect(double *a, sqlite3_int64 n, sqlite3_int64 k){
+  sqlite3_int64 lo = 0;
+  sqlite3_int64 hi = n-1;
+  sqlite3_int64 m;
+  int nBudget = 0;
+  assert( k>=0 && k<n );
+  for(m=n; m>1; m>>=1) nBudget += 2;
+  while( hi>lo ){
+    sqlite3_int64 i, j, mid;
+    double pivot, t;
+    if( hi-lo<16 ){
+      /* Insertion sort for short ranges */
+      for(i=lo+1; i<=hi; i++){
+        t = a[i];
+        for(j=i; j>lo && a[j-1]>t; j--) a[j] = a[j-1];
+        a[j] = t;
+      }
+      return;
+    }
+    if( nBudget--<=0 ){
+      qsort(&a[lo], hi-lo+1, sizeof(double), doubleCmp);
+      return;
+    }
+
+    /* Order a[lo], a[mid] and a[hi], which also makes a[lo] and a[hi]
+    ** sentinels for the partition loops. */
+    mid = lo + (hi-lo)/2;
+    if( a[mid]<a[lo] ){ t = a[mid]; a[mid] = a[lo]; a[lo] = t; }
+    if( a[hi]<a[lo] ){ t = a[hi]; a[hi] = a[lo]; a[lo] = t; }
+    if( a[hi]<a[mid] ){ t = a[hi]; a[hi] = a[mid]; a[mid] = t; }
+    pivot = a[mid];
+
+    /* Afterwards a[lo..j] <= pivot, a[i..hi] >= pivot, and the values
+    ** between j and i are equal to the pivot. */
+    i = lo;
+    j = hi;
+    while( i<=j ){
+      while( a[i]<pivot ) i++;
+      while( a[j]>pivot ) j--;
+      if( i<=j ){
+        t = a[i]; a[i] = a[j]; a[j] = t;
+        i++;
+        j--;
+      }
+    }
+    if( k<=j ){
+      hi = j;
+    }else if( k>=i ){
+      lo = i;
+    }else{
+      return;
+    }
+  }
+}
+
+/*
+** Return the smallest of a[0..n-1].
+*/
+static double percentMin(const double *a, sqlite3_int64 n){
+  double r = a[0];
+  sqlite3_int64 i;
+  for(i=1; i<n; i++){
+    if( a[i]<r ) r = a[i];
+  }
+  return r;
+}
+
+/*
+** Return the value of percentile(Y,rPct-1.0) for the n values of a[],
+** following requirement (10).  The values of a[] from index iFrom on
+** must be the ones that are not smaller than any value before iFrom.
+** Set *piFrom to a value that can be passed back to compute a larger
+** percentile on the same array.
+*/
+static double percentCompute(
+  double *a,
+  sqlite3_int64 n,
+  double rPct,
+  sqlite3_int64 *piFrom
+){
+  sqlite3_int64 i1, i2, iFrom = *piFrom;
+  double v1, v2;
+  double ix;
+  ix = (rPct-1.0)*(n-1)*0.01;
+  i1 = (sqlite3_int64)ix;
+  i2 = ix==(double)i1 || i1==n-1 ? i1 : i1+1;
+  assert( i1>=iFrom );
+  percentSelect(&a[iFrom], n-iFrom, i1-iFrom);
+  v1 = a[i1];
+  v2 = i2==i1 ? v1 : percentMin(&a[i2], n-i2);
+  *piFrom = i1;
+  return v1 + (v2-v1)*(ix-i1);
+}
+
+/*
+** Build the order-statistic tree of p from the values of p->a[], and
+** free p->a[].  Return SQLITE_NOMEM on an OOM.
+*/
+static int percentBuildTree(Percentile *p){
+  PercentTree *pTree = &p->tree;
+  PercentNode *a;
+  int *aStack;
+  int nStack = 0;
+  int i;
+  if( pTree->aNode ) return SQLITE_OK;
+  aStack = sqlite3_malloc64(sizeof(int)*(p->nUsed+1));
+  pTree->nAlloc = p->nUsed + 250;
+  pTree->aNode = sqlite3_malloc64(sizeof(PercentNode)*pTree->nAlloc);
+  if( aStack==0 || pTree->aNode==0 ){
+    sqlite3_free(aStack);
+    sqlite3_free(pTree->aNode);
+    pTree->aNode = 0;
+    pTree->nAlloc = 0;
+    return SQLITE_NOMEM;
+  }
+  memset(&pTree->aNode[0], 0, sizeof(PercentNode));
+  pTree->nUsed = 1;
+  pTree->iRand = 0x2545f491;
+
+  /* Build the treap from the sorted values in O(N), keeping the nodes of
+  ** its right spine on a stack.  Each new node is the largest value so
+  ** far, so it goes to the right spine, below the nodes of a higher
+  ** priority and above the others, which become its left subtree. */
+  qsort(p->a, p->nUsed, sizeof(double), doubleCmp);
+  a = pTree->aNode;
+  for(i=0; i<(int)p->nUsed; i++){
+    int iNew, iLast = 0;
+    iNew = percentTreeNode(pTree, p->a[i], percentTreeRandom(pTree));
+    while( nStack>0 && a[aStack[nStack-1]].pri<a[iNew].pri ){
+      iLast = aStack[--nStack];
+      percentTreeFix(a, iLast);
+    }
+    a[iNew].iLeft = iLast;
+    if( nStack>0 ) a[aStack[nStack-1]].iRight = iNew;
+    aStack[nStack++] = iNew;
+  }
+  pTree->iRoot = nStack>0 ? aStack[0] : 0;
+  while( nStack>0 ){
+    percentTreeFix(a, aStack[--nStack]);
+  }
+  sqlite3_free(aStack);
+
+  sqlite3_free(p->a);
+  p->a = 0;
+  p->nAlloc = 0;
+  p->nUsed = 0;
+  return SQLITE_OK;
+}
+
+/*
+** Return the number of Y values in p.
+*/
+static sqlite3_int64 percentCount(Percentile *p){
+  if( p->tree.aNode ) return p->tree.aNode[p->tree.iRoot].nSize;
+  return p->nUsed;
+}
+
+/*
+** Return the value of percentile(Y,rPct-1.0) for the values of p, which
+** must not be empty, following requirement (10).  For the values of
+** p->a[], piFrom is as for percentCompute().
+*/
+static double percentValueOf(Percentile *p, double rPct, sqlite3_int64 *piFrom){
+  sqlite3_int64 n, i1, i2;
+  double v1, v2;
+  double ix;
+  if( p->tree.aNode==0 ){
+    return percentCompute(p->a, p->nUsed, rPct, piFrom);
+  }
+  n = percentCount(p);
+  ix = (rPct-1.0)*(n-1)*0.01;
+  i1 = (sqlite3_int64)ix;
+  i2 = ix==(double)i1 || i1==n-1 ? i1 : i1+1;
+  v1 = percentTreeRank(&p->tree, i1);
+  v2 = i2==i1 ? v1 : percentTreeRank(&p->tree, i2);
+  return v1 + (v2-v1)*(ix-i1);
+}
+
+/*
+** Free all memory allocated by p.
+*/
+static void percentReset(Percentile *p){
+  sqlite3_free(p->a);
+  sqlite3_free(p->zPct);
+  sqlite3_free(p->aPct);
+  sqlite3_free(p->tree.aNode);
+  memset(p, 0, sizeof(*p));
+}
+
+/*
+** The "inverse" function for percentile(Y,P) and percentiles(Y,L)
+** removes a row that was added by the "step" function from the window.
+*/
+static void percentInverse(
+  sqlite3_context *pCtx,
+  int argc,
+  sqlite3_value **argv
+){
+  Percentile *p;
+  int eType;
+  assert( argc==2 );
+  p = (Percentile*)sqlite3_aggregate_context(pCtx, sizeof(*p));
+  if( p==0 ) return;
+
+  /* The step function has thrown an error for any other Y value */
+  eType = sqlite3_value_type(argv[0]);
+  if( eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT ) return;
+  if( percentBuildTree(p) ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  percentTreeRemove(&p->tree, sqlite3_value_double(argv[0]));
+}
+
+/*
+** Compute the current value of percentile().
+*/
+static void percentResult(sqlite3_context *pCtx, Percentile *p){
+  sqlite3_int64 iFrom = 0;
+  if( percentCount(p)>0 ){
+    sqlite3_result_double(pCtx, percentValueOf(p, p->rPct, &iFrom));
+  }
+}
+
+/*
+** The "value" function for percentile() returns the result for the
+** current window.
+*/
+static void percentValue(sqlite3_context *pCtx){
+  Percentile *p;
+  p = (Percentile*)sqlite3_aggregate_context(pCtx, 0);
+  if( p==0 ) return;
+  if( percentBuildTree(p) ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  percentResult(pCtx, p);
+}
+
 /*
 ** Called to compute the final output of percentile() and to clean
 ** up all allocated memory.
 */
 static void percentFinal(sqlite3_context *pCtx){
   Percentile *p;
-  unsigned i1, i2;
-  double v1, v2;
-  double ix, vx;
   p = (Percentile*)sqlite3_aggregate_context(pCtx, 0);
   if( p==0 ) return;
-  if( p->a==0 ) return;
-  if( p->nUsed ){
-    qsort(p->a, p->nUsed, sizeof(double), doubleCmp);
-    ix = (p->rPct-1.0)*(p->nUsed-1)*0.01;
-    i1 = (unsigned)ix;
-    i2 = ix==(double)i1 || i1==p->nUsed-1 ? i1 : i1+1;
-    v1 = p->a[i1];
-    v2 = p->a[i2];
-    vx = v1 + (v2-v1)*(ix-i1);
-    sqlite3_result_double(pCtx, vx);
+  percentResult(pCtx, p);
+  percentReset(p);
+}
+
+/*
+** Parse the L argument of percentiles() into p->aPct[].  Return 0 if
+** it is not a list of numbers between 0.0 and 100.0, or -1 on an OOM.
+*/
+static int percentParseList(Percentile *p, const char *zList){
+  const char *z = zList;
+  int n = 1;
+  for(z=zList; *z; z++){
+    if( *z==',' ) n++;
   }
-  sqlite3_free(p->a);
+  p->aPct = sqlite3_malloc64(sizeof(double)*n);
+  if( p->aPct==0 ) return -1;
+  p->nPct = 0;
+  z = zList;
+  while( 1 ){
+    char *zEnd;
+    double r;
+    while( *z==' ' ) z++;
+    r = strtod(z, &zEnd);
+    if( zEnd==z || !(r>=0.0 && r<=100.0) ) return 0;
+    p->aPct[p->nPct++] = r + 1.0;
+    z = zEnd;
+    while( *z==' ' ) z++;
+    if( *z==0 ) break;
+    if( *z!=',' ) return 0;
+    z++;
+  }
+  p->zPct = sqlite3_mprintf("%s", zList);
+  return p->zPct ? 1 : -1;
+}
+
+/*
+** The "step" function for percentiles(Y,L) is called once for each
+** input row.
+*/
+static void percentilesStep(
+  sqlite3_context *pCtx,
+  int argc,
+  sqlite3_value **argv
+){
+  Percentile *p;
+  const char *zList;
+  assert( argc==2 );
+
+  p = (Percentile*)sqlite3_aggregate_context(pCtx, sizeof(*p));
+  if( p==0 ) return;
+
+  /* Requirement 17:  L must be the same list of numbers for all rows */
+  zList = (const char*)sqlite3_value_text(argv[1]);
+  if( p->zPct==0 ){
+    int rc = zList ? percentParseList(p, zList) : 0;
+    if( rc<=0 ){
+      sqlite3_free(p->aPct);
+      p->aPct = 0;
+      p->nPct = 0;
+      if( rc<0 ){
+        sqlite3_result_error_nomem(pCtx);
+      }else{
+        sqlite3_result_error(pCtx, "2nd argument to percentiles() is not a "
+                             "list of numbers between 0.0 and 100.0", -1);
+      }
+      return;
+    }
+  }else if( zList==0 || strcmp(p->zPct, zList)!=0 ){
+    sqlite3_result_error(pCtx, "2nd argument to percentiles() is not the "
+                               "same for all input rows", -1);
+    return;
+  }
+
+  percentAppend(pCtx, p, argv[0], "percentiles");
+}
+
+/*
+** Compute the current value of percentiles().
+*/
+static void percentilesResult(sqlite3_context *pCtx, Percentile *p){
+  double *aResult;
+  int *aOrder;
+  int i, j;
+  sqlite3_int64 iFrom = 0;
+  sqlite3_str *pStr;
+  if( percentCount(p)==0 ) return;
+  aResult = sqlite3_malloc64((sizeof(double)+sizeof(int))*p->nPct);
+  if( aResult==0 ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+
+  /* Compute the percentiles in increasing order, so that each one
+  ** only selects among the values not smaller than the previous one */
+  aOrder = (int*)&aResult[p->nPct];
+  for(i=0; i<p->nPct; i++){
+    for(j=i; j>0 && p->aPct[aOrder[j-1]]>p->aPct[i]; j--){
+      aOrder[j] = aOrder[j-1];
+    }
+    aOrder[j] = i;
+  }
+  for(i=0; i<p->nPct; i++){
+    aResult[aOrder[i]] = percentValueOf(p, p->aPct[aOrder[i]], &iFrom);
+  }
+
+  pStr = sqlite3_str_new(0);
+  for(i=0; i<p->nPct; i++){
+    sqlite3_str_appendf(pStr, "%s%!.15g", i ? "," : "[", aResult[i]);
+  }
+  sqlite3_str_appendf(pStr, "]");
+  sqlite3_free(aResult);
+  if( sqlite3_str_errcode(pStr) ){
+    sqlite3_free(sqlite3_str_finish(pStr));
+    sqlite3_result_error_nomem(pCtx);
+  }else{
+    sqlite3_result_text(pCtx, sqlite3_str_finish(pStr), -1, sqlite3_free);
+  }
+}
+
+/*
+** The "value" function for percentiles() returns the result for the
+** current window.
+*/
+static void percentilesValue(sqlite3_context *pCtx){
+  Percentile *p;
+  p = (Percentile*)sqlite3_aggregate_context(pCtx, 0);
+  if( p==0 ) return;
+  if( percentBuildTree(p) ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  percentilesResult(pCtx, p);
+}
+
+/*
+** Called to compute the final output of percentiles() and to clean
+** up all allocated memory.
+*/
+static void percentilesFinal(sqlite3_context *pCtx){
+  Percentile *p;
+  p = (Percentile*)sqlite3_aggregate_context(pCtx, 0);
+  if( p==0 ) return;
+  percentilesResult(pCtx, p);
+  percentReset(p);
+}
+
+/* Number of adjacent buckets in each page of a percentile_approx() store */
+#define PCTAPPROX_PAGE 256
+
+/* The counts of PCTAPPROX_PAGE adjacent buckets of a percentile_approx()
+** sketch.  aCnt[i] is the number of values that fall in bucket
+** iPage*PCTAPPROX_PAGE+i.
+*/
+typedef struct PctApproxPage PctApproxPage;
+struct PctApproxPage {
+  int iPage;                          /* Number of this page */
+  sqlite3_int64 nCnt;                 /* Sum of aCnt[] */
+  sqlite3_int64 aCnt[PCTAPPROX_PAGE]; /* Number of values in each bucket */
+};
+
+/* Counts of the values of one sign in a percentile_approx() sketch.  Only
+** the pages holding at least one value are allocated, so the store grows
+** and shrinks with the range of the values and never merges buckets.
+*/
+typedef struct PctApproxStore PctApproxStore;
+struct PctApproxStore {
+  int nPage;              /* Number of pages in apPage[] */
+  int nAlloc;             /* Number of slots allocated for apPage[] */
+  PctApproxPage **apPage; /* Pages in increasing order of iPage */
+};
+
+/* The session context for a single percentile_approx() function. */
+typedef struct PctApprox PctApprox;
+struct PctApprox {
+  double rPct;           /* 1.0 more than the value for P */
+  double rAcc;           /* The relative accuracy A, or 0.0 before any row */
+  double rGamma;         /* Ratio between the bounds of adjacent buckets */
+  double rLogGamma;      /* log(rGamma) */
+  sqlite3_int64 nZero;   /* Number of zero Y values */
+  sqlite3_int64 nTotal;  /* Number of non-NULL Y values */
+  PctApproxStore pos;    /* Positive Y values */
+  PctApproxStore neg;    /* Absolute values of the negative Y values */
+};
+
+/*
+** Return the index in pS->apPage[] of page iPage, or of the slot where it
+** would be inserted if pS does not have it.
+*/
+static int pctApproxFind(PctApproxStore *pS, int iPage){
+  int iLo = 0;
+  int iHi = pS->nPage;
+  while( iLo<iHi ){
+    int iMid = (iLo+iHi)/2;
+    if( pS->apPage[iMid]->iPage<iPage ){
+      iLo = iMid+1;
+    }else{
+      iHi = iMid;
+    }
+  }
+  return iLo;
+}
+
+/*
+** Add iDelta to the count of bucket k of pS.  A page is allocated for the
+** bucket if needed, and freed once it holds no value.  Return SQLITE_OK,
+** or SQLITE_NOMEM if a page cannot be allocated.
+*/
+static int pctApproxAdd(PctApproxStore *pS, int k, int iDelta){
+  int iPage = k>=0 ? k/PCTAPPROX_PAGE : -1-(-1-k)/PCTAPPROX_PAGE;
+  int i = pctApproxFind(pS, iPage);
+  PctApproxPage *pPage;
+  if( i==pS->nPage || pS->apPage[i]->iPage!=iPage ){
+    assert( iDelta>0 );
+    if( pS->nPage==pS->nAlloc ){
+      int nNew = pS->nAlloc ? pS->nAlloc*2 : 4;
+      PctApproxPage **apNew;
+      apNew = sqlite3_realloc64(pS->apPage, sizeof(PctApproxPage*)*nNew);
+      if( apNew==0 ) return SQLITE_NOMEM;
+      pS->apPage = apNew;
+      pS->nAlloc = nNew;
+    }
+    pPage = sqlite3_malloc64(sizeof(PctApproxPage));
+    if( pPage==0 ) return SQLITE_NOMEM;
+    memset(pPage, 0, sizeof(PctApproxPage));
+    pPage->iPage = iPage;
+    memmove(&pS->apPage[i+1], &pS->apPage[i],
+            sizeof(PctApproxPage*)*(pS->nPage-i));
+    pS->apPage[i] = pPage;
+    pS->nPage++;
+  }
+  pPage = pS->apPage[i];
+  pPage->aCnt[k-iPage*PCTAPPROX_PAGE] += iDelta;
+  pPage->nCnt += iDelta;
+  assert( pPage->aCnt[k-iPage*PCTAPPROX_PAGE]>=0 );
+  if( pPage->nCnt==0 ){
+    sqlite3_free(pPage);
+    pS->nPage--;
+    memmove(&pS->apPage[i], &pS->apPage[i+1],
+            sizeof(PctApproxPage*)*(pS->nPage-i));
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Free all the pages of pS.
+*/
+static void pctApproxClear(PctApproxStore *pS){
+  int i;
+  for(i=0; i<pS->nPage; i++){
+    sqlite3_free(pS->apPage[i]);
+  }
+  sqlite3_free(pS->apPage);
+  memset(pS, 0, sizeof(*pS));
+}
+
+/*
+** Check the arguments of a percentile_approx() row and return its Y value
+** in *pY.  Return 0 if the row is to be ignored, 1 if it is to be counted,
+** or -1 after reporting an error.
+*/
+static int pctApproxArgs(
+  sqlite3_context *pCtx,
+  PctApprox *p,
+  int argc,
+  sqlite3_value **argv,
+  double *pY
+){
+  double rPct;
+  double rAcc = 0.01;
+  int eType;
+
+  /* Requirement 3:  P must be a number between 0 and 100 */
+  eType = sqlite3_value_numeric_type(argv[1]);
+  rPct = sqlite3_value_double(argv[1]);
+  if( (eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT)
+   || rPct<0.0 || rPct>100.0 ){
+    sqlite3_result_error(pCtx, "2nd argument to percentile_approx() is not "
+                         "a number between 0.0 and 100.0", -1);
+    return -1;
+  }
+
+  /* Requirement 14:  A must be a number between 0.0001 and 0.5 */
+  if( argc==3 ){
+    eType = sqlite3_value_numeric_type(argv[2]);
+    rAcc = sqlite3_value_double(argv[2]);
+    if( (eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT)
+     || rAcc<0.0001 || rAcc>0.5 ){
+      sqlite3_result_error(pCtx, "3rd argument to percentile_approx() is not "
+                           "a number between 0.0001 and 0.5", -1);
+      return -1;
+    }
+  }
+
+  /* Remember the P and A values, which must be the same for all rows */
+  if( p->rAcc==0.0 ){
+    p->rPct = rPct+1.0;
+    p->rAcc = rAcc;
+    p->rGamma = (1.0+rAcc)/(1.0-rAcc);
+    p->rLogGamma = log(p->rGamma);
+  }else if( !sameValue(p->rPct,rPct+1.0) ){
+    sqlite3_result_error(pCtx, "2nd argument to percentile_approx() is not "
+                               "the same for all input rows", -1);
+    return -1;
+  }else if( p->rAcc!=rAcc ){
+    sqlite3_result_error(pCtx, "3rd argument to percentile_approx() is not "
+                               "the same for all input rows", -1);
+    return -1;
+  }
+
+  /* Ignore rows for which Y is NULL */
+  eType = sqlite3_value_type(argv[0]);
+  if( eType==SQLITE_NULL ) return 0;
+
+  /* If not NULL, then Y must be numeric.  Otherwise throw an error. */
+  if( eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT ){
+    sqlite3_result_error(pCtx, "1st argument to percentile_approx() is not "
+                               "numeric", -1);
+    return -1;
+  }
+
+  /* Throw an error if the Y value is infinity or NaN */
+  *pY = sqlite3_value_double(argv[0]);
+  if( isInfinity(*pY) ){
+    sqlite3_result_error(pCtx, "Inf input to percentile_approx()", -1);
+    return -1;
+  }
+  return 1;
+}
+
+/*
+** Add iDelta to the count of the bucket of y in p.  Return SQLITE_OK or
+** SQLITE_NOMEM.
+*/
+static int pctApproxCount(PctApprox *p, double y, int iDelta){
+  int k;
+  if( y==0.0 ){
+    p->nZero += iDelta;
+    return SQLITE_OK;
+  }
+  /* Bucket k holds the values in (gamma^(k-1), gamma^k] */
+  k = (int)ceil(log(fabs(y))/p->rLogGamma);
+  return pctApproxAdd(y>0.0 ? &p->pos : &p->neg, k, iDelta);
+}
+
+/*
+** The "step" function for percentile_approx(Y,P,A) is called once for each
+** input row.
+*/
+static void pctApproxStep(
+  sqlite3_context *pCtx,
+  int argc,
+  sqlite3_value **argv
+){
+  PctApprox *p;
+  double y;
+  assert( argc==2 || argc==3 );
+  p = (PctApprox*)sqlite3_aggregate_context(pCtx, sizeof(*p));
+  if( p==0 ) return;
+  if( pctApproxArgs(pCtx, p, argc, argv, &y)<=0 ) return;
+  if( pctApproxCount(p, y, 1) ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  p->nTotal++;
+}
+
+/*
+** The "inverse" function for percentile_approx(Y,P,A) removes a row that
+** was added by the "step" function from the window.
+*/
+static void pctApproxInverse(
+  sqlite3_context *pCtx,
+  int argc,
+  sqlite3_value **argv
+){
+  PctApprox *p;
+  double y;
+  assert( argc==2 || argc==3 );
+  p = (PctApprox*)sqlite3_aggregate_context(pCtx, sizeof(*p));
+  if( p==0 ) return;
+  if( pctApproxArgs(pCtx, p, argc, argv, &y)<=0 ) return;
+  /* The page of y exists already, so this does not allocate.  It is freed
+  ** if y was its last value, which lets the range of the sketch shrink
+  ** again once an outlier has left the window. */
+  pctApproxCount(p, y, -1);
+  p->nTotal--;
+}
+
+/*
+** Return the value representing bucket k of p: the middle of its bounds
+** relative to the accuracy, 2*gamma^k/(gamma+1).  This is computed from
+** gamma^(k-1), which is smaller than the values of the bucket and so never
+** overflows, and the result is clamped to the largest finite double.
+*/
+static double pctApproxBucketValue(PctApprox *p, int k){
+  double r = pow(p->rGamma, k-1)*(2.0*p->rGamma/(p->rGamma+1.0));
+  return r>DBL_MAX ? DBL_MAX : r;
+}
+
+/*
+** Return the approximate value of rank iRank (counting from 0) in p.
+*/
+static double pctApproxRank(PctApprox *p, sqlite3_int64 iRank){
+  PctApproxPage *pPage;
+  int i, j;
+  for(i=p->neg.nPage-1; i>=0; i--){
+    pPage = p->neg.apPage[i];
+    if( iRank>=pPage->nCnt ){
+      iRank -= pPage->nCnt;
+      continue;
+    }
+    for(j=PCTAPPROX_PAGE-1; j>0; j--){
+      iRank -= pPage->aCnt[j];
+      if( iRank<0 ) break;
+    }
+    return -pctApproxBucketValue(p, pPage->iPage*PCTAPPROX_PAGE+j);
+  }
+  iRank -= p->nZero;
+  if( iRank<0 ) return 0.0;
+  for(i=0; i<p->pos.nPage; i++){
+    pPage = p->pos.apPage[i];
+    if( iRank>=pPage->nCnt ){
+      iRank -= pPage->nCnt;
+      continue;
+    }
+    for(j=0; j<PCTAPPROX_PAGE-1; j++){
+      iRank -= pPage->aCnt[j];
+      if( iRank<0 ) break;
+    }
+    return pctApproxBucketValue(p, pPage->iPage*PCTAPPROX_PAGE+j);
+  }
+  assert( 0 );
+  return 0.0;
+}
+
+/*
+** Compute the current value of percentile_approx(), following
+** requirement (10).
+*/
+static void pctApproxCompute(sqlite3_context *pCtx, PctApprox *p){
+  sqlite3_int64 i1, i2;
+  double v1, v2;
+  double ix;
+  if( p->nTotal<=0 ) return;
+  ix = (p->rPct-1.0)*(p->nTotal-1)*0.01;
+  i1 = (sqlite3_int64)ix;
+  i2 = ix==(double)i1 || i1==p->nTotal-1 ? i1 : i1+1;
+  v1 = pctApproxRank(p, i1);
+  if( i2!=i1 ){
+    v2 = pctApproxRank(p, i2);
+    if( v2!=v1 ){
+      if( isInfinity(v2-v1) ){
+        /* Values of opposite signs near DBL_MAX, whose difference
+        ** overflows */
+        v1 = v1*(1.0-(ix-i1)) + v2*(ix-i1);
+      }else{
+        v1 += (v2-v1)*(ix-i1);
+      }
+    }
+  }
+  sqlite3_result_double(pCtx, v1);
+}
+
+/*
+** The "value" function for percentile_approx() returns the result for the
+** current window.
+*/
+static void pctApproxValue(sqlite3_context *pCtx){
+  PctApprox *p;
+  p = (PctApprox*)sqlite3_aggregate_context(pCtx, 0);
+  if( p==0 ) return;
+  pctApproxCompute(pCtx, p);
+}
+
+/*
+** Called to compute the final output of percentile_approx() and to clean
+** up all allocated memory.
+*/
+static void pctApproxFinal(sqlite3_context *pCtx){
+  PctApprox *p;
+  p = (PctApprox*)sqlite3_aggregate_context(pCtx, 0);
+  if( p==0 ) return;
+  pctApproxCompute(pCtx, p);
+  pctApproxClear(&p->pos);
+  pctApproxClear(&p->neg);
   memset(p, 0, sizeof(*p));
 }
 
@@ -213,8 +1171,27 @@ int sqlite3_percentile_init(
   int rc = SQLITE_OK;
   SQLITE_EXTENSION_INIT2(pApi);
   (void)pzErrMsg;  /* Unused parameter */
-  rc = sqlite3_create_function(db, "percentile", 2,
+  rc = sqlite3_create_window_function(db, "percentile", 2,
+                               SQLITE_UTF8|SQLITE_INNOCUOUS, 0,
+                               percentStep, percentFinal, percentValue,
+                               percentInverse, 0);
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_window_function(db, "percentiles", 2,
                                SQLITE_UTF8|SQLITE_INNOCUOUS, 0,
-                               0, percentStep, percentFinal);
+                               percentilesStep, percentilesFinal,
+                               percentilesValue, percentInverse, 0);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_window_function(db, "percentile_approx", 2,
+                               SQLITE_UTF8|SQLITE_INNOCUOUS, 0,
+                               pctApproxStep, pctApproxFinal, pctApproxValue,
+                               pctApproxInverse, 0);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_window_function(db, "percentile_approx", 3,
+                               SQLITE_UTF8|SQLITE_INNOCUOUS, 0,
+                               pctApproxStep, pctApproxFinal, pctApproxValue,
+                               pctApproxInverse, 0);
+  }
   return rc;
 }
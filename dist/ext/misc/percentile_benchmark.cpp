@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <sqlite3.h>
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+extern "C" int sqlite3_percentile_init(sqlite3* db, char** pzErrMsg,
+                                       const sqlite3_api_routines* pApi);
+
+// The functions compared by each benchmark, selected by its "approx" argument.
+static const char* kFunctions[] = {"percentile", "percentile_approx"};
+
+// A table t(g, y) of "count" log-uniform values between 1e-3 and 1e6, spread
+// over "groups" groups, in a deterministic pseudo-random order.
+static sqlite3* open_values(int count, int groups) {
+    sqlite3* db = NULL;
+    sqlite3_open(":memory:", &db);
+    sqlite3_percentile_init(db, NULL, NULL);
+    sqlite3_exec(db, "CREATE TABLE t(g INTEGER, y REAL)", NULL, NULL, NULL);
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db, "INSERT INTO t VALUES(?, ?)", -1, &stmt, NULL);
+    uint32_t seed = 1;
+    for (int i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        double r = (seed >> 8) / (double)(1 << 24);
+        sqlite3_bind_int(stmt, 1, i % groups);
+        sqlite3_bind_double(stmt, 2, pow(10.0, -3.0 + 9.0 * r));
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+    return db;
+}
+
+// Returns the results of "sql", one per row.
+static std::vector<double> query_doubles(sqlite3* db, const std::string& sql) {
+    std::vector<double> results;
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        results.push_back(sqlite3_column_double(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    return results;
+}
+
+// Runs "sql" with "function" as the benchmark, and reports the largest relative
+// error of its results against the exact percentile().
+static void run_query(benchmark::State& state, sqlite3* db, const std::string& sql,
+                      const char* function) {
+    std::string query = sql;
+    for (size_t i; (i = query.find("FN")) != std::string::npos;) {
+        query.replace(i, 2, function);
+    }
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, NULL);
+    for (auto _ : state) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    std::string exact = sql;
+    for (size_t i; (i = exact.find("FN")) != std::string::npos;) {
+        exact.replace(i, 2, kFunctions[0]);
+    }
+    std::vector<double> expected = query_doubles(db, exact);
+    std::vector<double> actual = query_doubles(db, query);
+    double max_error = 0;
+    for (size_t i = 0; i < expected.size() && i < actual.size(); i++) {
+        max_error = fmax(max_error, fabs(actual[i] - expected[i]) / fabs(expected[i]));
+    }
+    state.counters["max_rel_error"] = max_error;
+}
+
+static void BM_PercentileGroupBy(benchmark::State& state) {
+    sqlite3* db = open_values(state.range(0), state.range(1));
+    run_query(state, db, "SELECT FN(y, 99) FROM t GROUP BY g", kFunctions[state.range(2)]);
+    sqlite3_close(db);
+}
+BENCHMARK(BM_PercentileGroupBy)
+    ->ArgNames({"rows", "groups", "approx"})
+    ->ArgsProduct({{1000000}, {1, 1000}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_PercentileSlidingWindow(benchmark::State& state) {
+    sqlite3* db = open_values(state.range(0), 1);
+    run_query(state, db,
+              "SELECT FN(y, 50) OVER (ORDER BY rowid ROWS " + std::to_string(state.range(1)) +
+                      " PRECEDING) FROM t",
+              kFunctions[state.range(2)]);
+    sqlite3_close(db);
+}
+BENCHMARK(BM_PercentileSlidingWindow)
+    ->ArgNames({"rows", "frame", "approx"})
+    ->ArgsProduct({{100000}, {100, 10000}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <sqlite3.h>
+#include <string.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+extern "C" int sqlite3_percentile_init(sqlite3* db, char** pzErrMsg,
+                                       const sqlite3_api_routines* pApi);
+
+class PercentileTest : public testing::Test {
+  protected:
+    void SetUp() override {
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db_));
+        ASSERT_EQ(SQLITE_OK, sqlite3_percentile_init(db_, NULL, NULL));
+        // 2000 rows of random values, with NULLs and many duplicates.
+        ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE t(i INTEGER PRIMARY KEY, y REAL)"));
+        ASSERT_EQ(SQLITE_OK, exec("WITH RECURSIVE s(x) AS (SELECT 1 UNION ALL "
+                                  "SELECT x+1 FROM s WHERE x<2000) "
+                                  "INSERT INTO t SELECT x, CASE WHEN x%17=0 THEN NULL "
+                                  "WHEN x%5=0 THEN x%3 "
+                                  "ELSE (abs(random())%100000)/100.0 END FROM s"));
+    }
+
+    void TearDown() override {
+        sqlite3_close(db_);
+    }
+
+    int exec(const char* sql) {
+        return sqlite3_exec(db_, sql, NULL, NULL, NULL);
+    }
+
+    // Returns the first column of the single row returned by "sql".
+    sqlite3_int64 query_int(const std::string& sql) {
+        sqlite3_stmt* stmt = NULL;
+        EXPECT_EQ(SQLITE_OK, sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL))
+                << sqlite3_errmsg(db_);
+        EXPECT_EQ(SQLITE_ROW, sqlite3_step(stmt)) << sqlite3_errmsg(db_);
+        sqlite3_int64 result = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+        return result;
+    }
+
+    // Returns the number of rows of t for which "window", computed over "frame",
+    // differs from "aggregate" computed from scratch over the rows of t2 that
+    // "where" selects.
+    sqlite3_int64 window_mismatches(const std::string& window, const std::string& aggregate,
+                                    const std::string& frame, const std::string& where) {
+        return query_int("SELECT sum(w IS NOT r) FROM (SELECT " + window + " OVER (" + frame +
+                         ") w, (SELECT " + aggregate + " FROM t t2 WHERE " + where +
+                         ") r FROM t)");
+    }
+
+    sqlite3* db_ = NULL;
+};
+
+TEST_F(PercentileTest, matchesSortedValues) {
+    // Requirement (10), with the order statistics read from an ORDER BY.
+    EXPECT_EQ(0, query_int(
+            "WITH RECURSIVE ps(p) AS (SELECT 0 UNION ALL SELECT p+2.5 FROM ps WHERE p<100), "
+            "srt AS (SELECT row_number() OVER (ORDER BY y)-1 rn, y FROM t WHERE y NOT NULL), "
+            "n(n) AS (SELECT count(*) FROM srt), "
+            "r AS (SELECT p, p*(n-1)*0.01 ix, n FROM ps, n), "
+            "ref AS (SELECT p, ix, (SELECT y FROM srt WHERE rn=CAST(ix AS INT)) v1, "
+            "(SELECT y FROM srt WHERE rn=min(CAST(ix AS INT)+1, n-1)) v2 FROM r) "
+            "SELECT sum(abs((SELECT percentile(y,p) FROM t) - "
+            "(v1+(v2-v1)*(ix-CAST(ix AS INT)))) > 1e-9) FROM ref"));
+}
+
+TEST_F(PercentileTest, percentiles) {
+    EXPECT_EQ(1, query_int("SELECT percentiles(y, '0,25, 50 ,95,99,100,12.5') = "
+                           "json_array(percentile(y,0), percentile(y,25), percentile(y,50), "
+                           "percentile(y,95), percentile(y,99), percentile(y,100), "
+                           "percentile(y,12.5)) FROM t"));
+    EXPECT_EQ(SQLITE_ERROR, exec("SELECT percentiles(y, '1,,2') FROM t"));
+    EXPECT_EQ(SQLITE_ERROR, exec("SELECT percentiles(y, '101') FROM t"));
+    EXPECT_EQ(SQLITE_ERROR, exec("SELECT percentiles(y, CASE WHEN i%2 THEN '1' ELSE '2' END) "
+                                 "FROM t"));
+}
+
+TEST_F(PercentileTest, slidingWindow) {
+    EXPECT_EQ(0, window_mismatches("percentile(y, 90)", "percentile(y, 90)",
+                                   "ORDER BY i ROWS 100 PRECEDING",
+                                   "t2.i BETWEEN t.i-100 AND t.i"));
+    EXPECT_EQ(0, window_mismatches("percentile(y, 33.3)", "percentile(y, 33.3)",
+                                   "ORDER BY i ROWS BETWEEN 7 PRECEDING AND 3 FOLLOWING",
+                                   "t2.i BETWEEN t.i-7 AND t.i+3"));
+    EXPECT_EQ(0, window_mismatches("percentile(y, 75)", "percentile(y, 75)",
+                                   "PARTITION BY i%3 ORDER BY i "
+                                   "ROWS BETWEEN 50 PRECEDING AND 1 PRECEDING",
+                                   "t2.i%3=t.i%3 AND t2.i BETWEEN t.i-150 AND t.i-1"));
+    EXPECT_EQ(0, window_mismatches("percentiles(y, '10,50,99')", "percentiles(y, '10,50,99')",
+                                   "ORDER BY i ROWS BETWEEN 200 PRECEDING AND 200 FOLLOWING",
+                                   "t2.i BETWEEN t.i-200 AND t.i+200"));
+}
+
+TEST_F(PercentileTest, growingWindow) {
+    EXPECT_EQ(0, window_mismatches("percentile(y, 50)", "percentile(y, 50)", "ORDER BY i",
+                                   "t2.i <= t.i"));
+}
+
+TEST_F(PercentileTest, approxWindow) {
+    EXPECT_EQ(0, window_mismatches("percentile_approx(y, 90)", "percentile_approx(y, 90)",
+                                   "ORDER BY i ROWS 100 PRECEDING",
+                                   "t2.i BETWEEN t.i-100 AND t.i"));
+    EXPECT_EQ(0, window_mismatches("percentile_approx(y, 10, 0.05)",
+                                   "percentile_approx(y, 10, 0.05)",
+                                   "ORDER BY i ROWS BETWEEN 500 PRECEDING AND 3 FOLLOWING",
+                                   "t2.i BETWEEN t.i-500 AND t.i+3"));
+}
+
+TEST_F(PercentileTest, approxAccuracy) {
+    // Values of 1 and more, so that the relative error is meaningful.
+    EXPECT_EQ(0, query_int("WITH RECURSIVE ps(p) AS (SELECT 0 UNION ALL SELECT p+5 FROM ps "
+                           "WHERE p<100) SELECT sum(abs(a-e) > 0.01*e) FROM (SELECT "
+                           "(SELECT percentile_approx(y+1, p) FROM t) a, "
+                           "(SELECT percentile(y+1, p) FROM t) e FROM ps)"));
+}
+
+TEST_F(PercentileTest, approxWindowTransientOutlier) {
+    // One huge value must not affect the frames it has left.
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE o(i INTEGER PRIMARY KEY, y REAL)"));
+    ASSERT_EQ(SQLITE_OK, exec("WITH RECURSIVE s(x) AS (SELECT 1 UNION ALL "
+                              "SELECT x+1 FROM s WHERE x<1000) "
+                              "INSERT INTO o SELECT x, CASE WHEN x=100 THEN 1e30 "
+                              "ELSE 250+(x*7)%20 END FROM s"));
+    EXPECT_EQ(0, query_int("SELECT count(*) FROM (SELECT "
+                           "percentile_approx(y, 50) OVER w a, percentile(y, 50) OVER w e "
+                           "FROM o WINDOW w AS (ORDER BY i ROWS 20 PRECEDING)) "
+                           "WHERE abs(a-e) > 0.01*e"));
+    EXPECT_EQ(0, query_int("SELECT count(*) FROM (SELECT "
+                           "percentile_approx(-y, 50) OVER w a, percentile(-y, 50) OVER w e "
+                           "FROM o WINDOW w AS (ORDER BY i ROWS 20 PRECEDING)) "
+                           "WHERE abs(a-e) > -0.01*e"));
+}
+
+TEST_F(PercentileTest, approxNearDoubleMax) {
+    // The bucket values of the largest doubles do not overflow.
+    for (const char* y : {"1e308", "1.7e308", "1.7976931348623157e308"}) {
+        SCOPED_TRACE(y);
+        for (const char* sign : {"", "-"}) {
+            std::string v = std::string(sign) + y;
+            EXPECT_EQ(1, query_int("SELECT abs(percentile_approx(" + v + ", 50) - " + v +
+                                   ") <= 0.01*abs(" + v + ")"));
+        }
+    }
+    // Interpolating between opposite values near DBL_MAX.
+    EXPECT_EQ(1, query_int("SELECT abs(percentile_approx(y, 50)) < 1e306 "
+                           "FROM (SELECT -1.7e308 y UNION ALL SELECT 1.7e308)"));
+    EXPECT_EQ(1, query_int("SELECT abs(percentile_approx(y, 75) - 8.5e307) < 0.01*8.5e307 "
+                           "FROM (SELECT -1.7e308 y UNION ALL SELECT 1.7e308)"));
+}
+
+TEST_F(PercentileTest, approxAccuracyWideRange) {
+    // 2001 values, so that every multiple of 5 is an exact rank and the bound
+    // is not blurred by interpolation: log-uniform magnitudes between 1e-300
+    // and 1e300 with random signs, and some zeros.
+    ASSERT_EQ(SQLITE_OK, exec("CREATE TABLE w(y REAL)"));
+    sqlite3_stmt* stmt = NULL;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db_, "INSERT INTO w VALUES(?)", -1, &stmt, NULL));
+    uint32_t seed = 1;
+    for (int i = 0; i < 2001; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 8;
+        double y = i % 50 == 0 ? 0.0 : pow(10.0, -300.0 + 600.0 * (r % 1000000) / 1e6);
+        sqlite3_bind_double(stmt, 1, r & 0x800000 ? -y : y);
+        ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    for (const char* accuracy : {"0.01", "0.5", "0.05", "0.001", "0.0001"}) {
+        SCOPED_TRACE(accuracy);
+        std::string approx = std::string("percentile_approx(y, p") +
+                (strcmp(accuracy, "0.01") ? std::string(", ") + accuracy : "") + ")";
+        // The exact bound, with a little slack for the rounding of the
+        // bucket values.
+        EXPECT_EQ(0, query_int("WITH RECURSIVE ps(p) AS (SELECT 0 UNION ALL SELECT p+5 FROM ps "
+                               "WHERE p<100) SELECT sum(abs(a-e) > " + std::string(accuracy) +
+                               "*abs(e)*1.000001) FROM (SELECT (SELECT " + approx +
+                               " FROM w) a, (SELECT percentile(y, p) FROM w) e FROM ps)"));
+        // The zeros, and the negative and positive halves on their own.
+        EXPECT_EQ(1, query_int("SELECT " + approx + " = 0 FROM (SELECT 0 y, 50 p "
+                               "UNION ALL SELECT 0, 50 UNION ALL SELECT 0, 50)"));
+        for (const char* where : {"y < 0", "y > 0"}) {
+            SCOPED_TRACE(where);
+            EXPECT_EQ(0, query_int("WITH RECURSIVE ps(p) AS (SELECT 0 UNION ALL SELECT p+10 "
+                                   "FROM ps WHERE p<100) SELECT sum(abs(a-e) > " +
+                                   std::string(accuracy) + "*abs(e)*1.000001) FROM (SELECT "
+                                   "(SELECT " + approx + " FROM w WHERE " + where + ") a, "
+                                   "(SELECT percentile(y, p) FROM w WHERE " + where +
+                                   ") e FROM ps)"));
+        }
+    }
+}
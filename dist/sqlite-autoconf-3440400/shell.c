@@ -131,6 +131,22 @@ typedef unsigned char u8;
 #ifndef NO_ANDROID_FUNCS
 #include <sqlite3_android.h>
 #endif
+/* Worker threads for ".import --threads", ".clone --jobs", ".sha3sum --jobs",
+** ".dump --jobs", ".restore --jobs" and the zipfile extension */
+#if !defined(_WIN32) && !defined(WIN32) && !defined(SQLITE_SHELL_FIDDLE)
+# include <pthread.h>
+# define SHELL_THREADS 1
+#endif
+/* Buffered output of query results, see exec_prepared_stmt_buffered() */
+#if !defined(_WIN32) && !defined(WIN32) && !defined(SQLITE_SHELL_FIDDLE)
+# define SHELL_OUT_BUFFER 1
+#endif
+/* Memory-mapped reads of zip archives, see zipfileMapOpen() */
+#if !defined(_WIN32) && !defined(WIN32) && !defined(SQLITE_SHELL_FIDDLE)
+# include <fcntl.h>
+# include <sys/mman.h>
+# define SHELL_MMAP 1
+#endif
 // End Android Add
 
 #if !defined(_WIN32) && !defined(WIN32)
@@ -1440,6 +1456,20 @@ static void endTimer(void){
 #define HAS_TIMER 0
 #endif
 
+// Begin Android Add
+#include <time.h>
+
+/* Return a monotonic clock in microseconds, for ".timer histogram" */
+static sqlite3_int64 timerMicros(void){
+#if defined(CLOCK_MONOTONIC) && !defined(_WIN32) && !defined(WIN32)
+  struct timespec t;
+  if( clock_gettime(CLOCK_MONOTONIC, &t)==0 ){
+    return t.tv_sec*(sqlite3_int64)1000000 + t.tv_nsec/1000;
+  }
+#endif
+  return timeOfDay()*1000;
+}
+// End Android Add
 /*
 ** Used to prevent warnings about unused parameters
 */
@@ -3680,7 +3710,11 @@ struct Decimal {
   char isInit;      /* True upon initialization */
   int nDigit;       /* Total number of digits */
   int nFrac;        /* Number of digits to the right of the decimal point */
-  signed char *a;   /* Array of digits.  Most significant first. */
+// Begin Android Add
+  int nLimb;        /* Limbs in use in a[], without leading zero limbs */
+  int nAlloc;       /* Limbs allocated for a[] */
+  u32 *a;           /* Base DECIMAL_BASE limbs.  Least significant first. */
+// End Android Add
 };
 
 /*
@@ -3700,41 +3734,191 @@ static void decimal_free(Decimal *p){
   }
 }
 
+// Begin Android Add
 /*
-** Allocate a new Decimal object initialized to the text in zIn[].
-** Return NULL if any kind of error occurs.
+** The digits of a Decimal are held as an integer in base 10^9 limbs, so
+** that addition and multiplication work on nine digits at a time. The
+** value is that integer divided by 10^nFrac. nDigit is the number of
+** digits the value is written with, counting any leading zeros, exactly
+** as when each digit took one byte. It is kept for decimal_result() and
+** decimal_cmp() so that their output does not change.
 */
-static Decimal *decimalNewFromText(const char *zIn, int n){
-  Decimal *p = 0;
+#define DECIMAL_BASE        1000000000  /* Value of one limb */
+#define DECIMAL_LIMB_DIGITS 9           /* Digits per limb */
+#define DECIMAL_KARATSUBA   32          /* Karatsuba at this many limbs */
+
+static const u32 aDecimalPow10[DECIMAL_LIMB_DIGITS] = {
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+};
+
+/*
+** Make sure p->a[] has room for at least nLimb limbs. Set p->oom and
+** return non-zero if memory cannot be allocated.
+*/
+static int decimal_reserve(Decimal *p, int nLimb){
+  if( nLimb>p->nAlloc ){
+    int nNew = nLimb + p->nAlloc/2 + 2;
+    u32 *aNew = (u32*)sqlite3_realloc64(p->a, nNew*sizeof(u32));
+    if( aNew==0 ){
+      p->oom = 1;
+      return 1;
+    }
+    p->a = aNew;
+    p->nAlloc = nNew;
+  }
+  return 0;
+}
+
+/*
+** Drop leading zero limbs from p->a[].
+*/
+static void decimal_normalize(Decimal *p){
+  while( p->nLimb>0 && p->a[p->nLimb-1]==0 ) p->nLimb--;
+}
+
+/*
+** Return the number of significant digits in p->a[].
+*/
+static int decimal_sig_digits(const Decimal *p){
+  u32 x;
+  int n;
+  if( p->nLimb==0 ) return 0;
+  x = p->a[p->nLimb-1];
+  for(n=1; n<DECIMAL_LIMB_DIGITS && x>=aDecimalPow10[n]; n++){}
+  return (p->nLimb-1)*DECIMAL_LIMB_DIGITS + n;
+}
+
+/*
+** Return digit i of p, counting from 0 at the most significant of its
+** nDigit digits.
+*/
+static int decimal_digit(const Decimal *p, int i){
+  int k = p->nDigit - 1 - i;
+  if( k<0 || k/DECIMAL_LIMB_DIGITS>=p->nLimb ) return 0;
+  return (p->a[k/DECIMAL_LIMB_DIGITS] / aDecimalPow10[k%DECIMAL_LIMB_DIGITS])
+         % 10;
+}
+
+/*
+** Write the nDigit digits of p, most significant first, into z[] as
+** ASCII characters.
+*/
+static void decimal_digits(const Decimal *p, char *z){
+  int i = p->nDigit;
+  int iLimb;
+  for(iLimb=0; iLimb<p->nLimb && i>0; iLimb++){
+    u32 x = p->a[iLimb];
+    int j;
+    for(j=0; j<DECIMAL_LIMB_DIGITS && i>0; j++){
+      z[--i] = '0' + x%10;
+      x /= 10;
+    }
+  }
+  while( i>0 ) z[--i] = '0';
+}
+
+/*
+** Multiply the integer in p->a[] by 10^n.
+*/
+static void decimal_shift_left(Decimal *p, int n){
+  int nShift = n/DECIMAL_LIMB_DIGITS;
+  u32 m = aDecimalPow10[n%DECIMAL_LIMB_DIGITS];
+  if( p->nLimb==0 || n==0 ) return;
+  if( decimal_reserve(p, p->nLimb+nShift+1) ) return;
+  if( m>1 ){
+    u64 carry = 0;
+    int i;
+    for(i=0; i<p->nLimb; i++){
+      u64 t = (u64)p->a[i]*m + carry;
+      p->a[i] = (u32)(t % DECIMAL_BASE);
+      carry = t / DECIMAL_BASE;
+    }
+    if( carry ) p->a[p->nLimb++] = (u32)carry;
+  }
+  if( nShift ){
+    memmove(&p->a[nShift], p->a, p->nLimb*sizeof(u32));
+    memset(p->a, 0, nShift*sizeof(u32));
+    p->nLimb += nShift;
+  }
+}
+
+/*
+** Divide the integer in p->a[] by 10^n, which must divide it exactly.
+*/
+static void decimal_shift_right(Decimal *p, int n){
+  int nShift = n/DECIMAL_LIMB_DIGITS;
+  u32 m = aDecimalPow10[n%DECIMAL_LIMB_DIGITS];
+  if( nShift>=p->nLimb ){
+    p->nLimb = 0;
+    return;
+  }
+  if( nShift ){
+    memmove(p->a, &p->a[nShift], (p->nLimb-nShift)*sizeof(u32));
+    p->nLimb -= nShift;
+  }
+  if( m>1 ){
+    u64 rem = 0;
+    int i;
+    for(i=p->nLimb-1; i>=0; i--){
+      u64 t = rem*DECIMAL_BASE + p->a[i];
+      p->a[i] = (u32)(t / m);
+      rem = t % m;
+    }
+    decimal_normalize(p);
+  }
+}
+
+/*
+** Return the number of trailing zero digits of the non-zero integer in
+** p->a[].
+*/
+static int decimal_trailing_zeros(const Decimal *p){
+  int n = 0;
+  int i;
+  u32 x;
+  for(i=0; p->a[i]==0; i++) n += DECIMAL_LIMB_DIGITS;
+  for(x=p->a[i]; x%10==0; x/=10) n++;
+  return n;
+}
+
+/*
+** Set p to the number in text zIn[0..n-1], reusing the memory of p->a[].
+** nDigit and nFrac are set as the digit-per-byte parser set them: leading
+** zeros of the integer part are dropped, all other digits are counted,
+** and characters other than digits, '.' and an exponent are ignored.
+** p->oom is set if memory runs out.
+*/
+static void decimal_parse(Decimal *p, const char *zIn, int n){
   int i;
+  int iFirst;                     /* First digit of the significand */
+  int iEnd;                       /* End of the significand */
   int iExp = 0;
+  int k;
 
-  p = sqlite3_malloc( sizeof(*p) );
-  if( p==0 ) goto new_from_text_failed;
   p->sign = 0;
   p->oom = 0;
-  p->isInit = 1;
   p->isNull = 0;
+  p->isInit = 1;
   p->nDigit = 0;
   p->nFrac = 0;
-  p->a = sqlite3_malloc64( n+1 );
-  if( p->a==0 ) goto new_from_text_failed;
-  for(i=0; isspace(zIn[i]); i++){}
-  if( zIn[i]=='-' ){
+  p->nLimb = 0;
+  for(i=0; i<n && isspace((unsigned char)zIn[i]); i++){}
+  if( i<n && zIn[i]=='-' ){
     p->sign = 1;
     i++;
-  }else if( zIn[i]=='+' ){
+  }else if( i<n && zIn[i]=='+' ){
     i++;
   }
   while( i<n && zIn[i]=='0' ) i++;
-  while( i<n ){
-    char c = zIn[i];
+  iFirst = i;
+  for(iEnd=i; iEnd<n; iEnd++){
+    char c = zIn[iEnd];
     if( c>='0' && c<='9' ){
-      p->a[p->nDigit++] = c - '0';
+      p->nDigit++;
     }else if( c=='.' ){
       p->nFrac = p->nDigit + 1;
     }else if( c=='e' || c=='E' ){
-      int j = i+1;
+      int j = iEnd+1;
       int neg = 0;
       if( j>=n ) break;
       if( zIn[j]=='-' ){
@@ -3752,8 +3936,24 @@ static Decimal *decimalNewFromText(const char *zIn, int n){
       if( neg ) iExp = -iExp;
       break;
     }
-    i++;
   }
+
+  /* Gather the digits into limbs, least significant first */
+  if( decimal_reserve(p, (p->nDigit+DECIMAL_LIMB_DIGITS-1)/DECIMAL_LIMB_DIGITS) ){
+    return;
+  }
+  p->nLimb = (p->nDigit+DECIMAL_LIMB_DIGITS-1)/DECIMAL_LIMB_DIGITS;
+  if( p->nLimb ) memset(p->a, 0, p->nLimb*sizeof(u32));
+  for(i=iEnd-1, k=0; i>=iFirst; i--){
+    char c = zIn[i];
+    if( c>='0' && c<='9' ){
+      p->a[k/DECIMAL_LIMB_DIGITS] +=
+          (c - '0') * aDecimalPow10[k%DECIMAL_LIMB_DIGITS];
+      k++;
+    }
+  }
+  decimal_normalize(p);
+
   if( p->nFrac ){
     p->nFrac = p->nDigit - (p->nFrac - 1);
   }
@@ -3767,10 +3967,8 @@ static Decimal *decimalNewFromText(const char *zIn, int n){
         p->nFrac = 0;
       }
     }
-    if( iExp>0 ){   
-      p->a = sqlite3_realloc64(p->a, p->nDigit + iExp + 1 );
-      if( p->a==0 ) goto new_from_text_failed;
-      memset(p->a+p->nDigit, 0, iExp);
+    if( iExp>0 ){
+      decimal_shift_left(p, iExp);
       p->nDigit += iExp;
     }
   }else if( iExp<0 ){
@@ -3787,24 +3985,203 @@ static Decimal *decimalNewFromText(const char *zIn, int n){
       }
     }
     if( iExp>0 ){
-      p->a = sqlite3_realloc64(p->a, p->nDigit + iExp + 1 );
-      if( p->a==0 ) goto new_from_text_failed;
-      memmove(p->a+iExp, p->a, p->nDigit);
-      memset(p->a, 0, iExp);
+      /* Leading zeros take no space in a[] */
       p->nDigit += iExp;
       p->nFrac += iExp;
     }
   }
+}
+
+/*
+** Set p to the value of pIn, reusing the memory of p->a[]. Any value is
+** interpreted as text, except that integers are converted directly.
+*/
+static void decimal_from_value(Decimal *p, sqlite3_value *pIn){
+  if( sqlite3_value_type(pIn)==SQLITE_INTEGER ){
+    sqlite3_int64 v = sqlite3_value_int64(pIn);
+    u64 x = v<0 ? ~(u64)v + 1 : (u64)v;
+    p->sign = v<0;
+    p->oom = 0;
+    p->isNull = 0;
+    p->isInit = 1;
+    p->nFrac = 0;
+    p->nLimb = 0;
+    if( decimal_reserve(p, 3) ) return;
+    while( x ){
+      p->a[p->nLimb++] = (u32)(x % DECIMAL_BASE);
+      x /= DECIMAL_BASE;
+    }
+    p->nDigit = decimal_sig_digits(p);
+  }else{
+    const char *zIn = (const char*)sqlite3_value_text(pIn);
+    if( zIn==0 ){
+      p->oom = 1;
+    }else{
+      decimal_parse(p, zIn, sqlite3_value_bytes(pIn));
+    }
+  }
+}
+
+/*
+** Allocate a new Decimal object initialized to the text in zIn[].
+** Return NULL if any kind of error occurs.
+*/
+static Decimal *decimalNewFromText(const char *zIn, int n){
+  Decimal *p = sqlite3_malloc( sizeof(*p) );
+  if( p==0 ) return 0;
+  memset(p, 0, sizeof(*p));
+  decimal_parse(p, zIn, n);
+  if( p->oom ){
+    decimal_free(p);
+    return 0;
+  }
   return p;
+}
 
-new_from_text_failed:
-  if( p ){
-    if( p->a ) sqlite3_free(p->a);
-    sqlite3_free(p);
+/*
+** Add aX[0..nX-1] into aR[0..nR-1], propagating the carry. The sum must
+** fit in nR limbs.
+*/
+static void decimal_limb_add(u32 *aR, int nR, const u32 *aX, int nX){
+  u32 carry = 0;
+  int i;
+  for(i=0; i<nX; i++){
+    u32 x = aR[i] + aX[i] + carry;
+    carry = x>=DECIMAL_BASE;
+    aR[i] = carry ? x - DECIMAL_BASE : x;
+  }
+  for(; carry && i<nR; i++){
+    carry = ++aR[i]==DECIMAL_BASE;
+    if( carry ) aR[i] = 0;
+  }
+}
+
+/*
+** Subtract aX[0..nX-1] from aR[0..nR-1], propagating the borrow. aR[]
+** must not be less than aX[].
+*/
+static void decimal_limb_sub(u32 *aR, int nR, const u32 *aX, int nX){
+  u32 borrow = 0;
+  int i;
+  for(i=0; i<nX; i++){
+    u32 y = aX[i] + borrow;
+    borrow = aR[i]<y;
+    aR[i] = borrow ? aR[i] + DECIMAL_BASE - y : aR[i] - y;
+  }
+  for(; borrow && i<nR; i++){
+    borrow = aR[i]==0;
+    aR[i] = borrow ? DECIMAL_BASE-1 : aR[i]-1;
+  }
+}
+
+/*
+** Compare the integers in pA->a[] and pB->a[].
+*/
+static int decimal_limb_cmp(const Decimal *pA, const Decimal *pB){
+  int i;
+  if( pA->nLimb!=pB->nLimb ) return pA->nLimb<pB->nLimb ? -1 : +1;
+  for(i=pA->nLimb-1; i>=0; i--){
+    if( pA->a[i]!=pB->a[i] ) return pA->a[i]<pB->a[i] ? -1 : +1;
   }
   return 0;
 }
 
+/*
+** Set aR[0..nX+nY-1] to the product of aX[0..nX-1] and aY[0..nY-1].
+** aR[] must be zeroed by the caller and may not overlap either input.
+**
+** Operands of DECIMAL_KARATSUBA limbs or more are split in two halves,
+** X = X1*B^m + X0 and Y = Y1*B^m + Y0, and multiplied using three half
+** size products instead of four:
+**
+**   X*Y = Z2*B^2m + (Z1 - Z2 - Z0)*B^m + Z0
+**
+** where Z2 = X1*Y1, Z0 = X0*Y0 and Z1 = (X1+X0)*(Y1+Y0). Return
+** SQLITE_NOMEM if scratch space cannot be allocated.
+*/
+static int decimal_limb_mul(
+  u32 *aR,
+  const u32 *aX, int nX,
+  const u32 *aY, int nY
+){
+  u32 *aTmp;
+  int rc = SQLITE_OK;
+  int m;
+
+  if( nX<nY ){
+    const u32 *aSwap = aX;
+    int nSwap = nX;
+    aX = aY;
+    nX = nY;
+    aY = aSwap;
+    nY = nSwap;
+  }
+  if( nY<DECIMAL_KARATSUBA ){
+    int i, j;
+    for(j=0; j<nY; j++){
+      u64 y = aY[j];
+      u64 carry = 0;
+      if( y==0 ) continue;
+      for(i=0; i<nX; i++){
+        u64 t = aX[i]*y + aR[i+j] + carry;
+        aR[i+j] = (u32)(t % DECIMAL_BASE);
+        carry = t / DECIMAL_BASE;
+      }
+      aR[nX+j] = (u32)carry;
+    }
+    return SQLITE_OK;
+  }
+
+  if( 2*nY<=nX ){
+    /* Unbalanced operands. Multiply Y by each nY limb slice of X. */
+    int i;
+    aTmp = (u32*)sqlite3_malloc64(2*nY*sizeof(u32));
+    if( aTmp==0 ) return SQLITE_NOMEM;
+    for(i=0; rc==SQLITE_OK && i<nX; i+=nY){
+      int n = nX-i<nY ? nX-i : nY;
+      memset(aTmp, 0, (n+nY)*sizeof(u32));
+      rc = decimal_limb_mul(aTmp, &aX[i], n, aY, nY);
+      decimal_limb_add(&aR[i], nX+nY-i, aTmp, n+nY);
+    }
+    sqlite3_free(aTmp);
+    return rc;
+  }
+
+  /* Here nX/2 < nY <= nX, so both operands have at least m limbs */
+  m = (nX+1)/2;
+  aTmp = (u32*)sqlite3_malloc64((4*m+4)*sizeof(u32));
+  if( aTmp==0 ) return SQLITE_NOMEM;
+  {
+    u32 *aSumX = aTmp;            /* X1+X0, m+1 limbs */
+    u32 *aSumY = &aTmp[m+1];      /* Y1+Y0, m+1 limbs */
+    u32 *aZ1 = &aTmp[2*m+2];      /* Z1, 2*m+2 limbs */
+    int nZ1 = 2*m+2;
+
+    rc = decimal_limb_mul(aR, aX, m, aY, m);
+    if( rc==SQLITE_OK ){
+      rc = decimal_limb_mul(&aR[2*m], &aX[m], nX-m, &aY[m], nY-m);
+    }
+    if( rc==SQLITE_OK ){
+      memcpy(aSumX, aX, m*sizeof(u32));
+      aSumX[m] = 0;
+      decimal_limb_add(aSumX, m+1, &aX[m], nX-m);
+      memcpy(aSumY, aY, m*sizeof(u32));
+      aSumY[m] = 0;
+      decimal_limb_add(aSumY, m+1, &aY[m], nY-m);
+      memset(aZ1, 0, nZ1*sizeof(u32));
+      rc = decimal_limb_mul(aZ1, aSumX, m+1, aSumY, m+1);
+    }
+    if( rc==SQLITE_OK ){
+      decimal_limb_sub(aZ1, nZ1, aR, 2*m);
+      decimal_limb_sub(aZ1, nZ1, &aR[2*m], nX+nY-2*m);
+      while( nZ1>0 && aZ1[nZ1-1]==0 ) nZ1--;
+      decimal_limb_add(&aR[m], nX+nY-m, aZ1, nZ1);
+    }
+  }
+  sqlite3_free(aTmp);
+  return rc;
+}
+// End Android Add
 /* Forward reference */
 static Decimal *decimalFromDouble(double);
 
@@ -3832,10 +4209,17 @@ static Decimal *decimal_new(
   switch( eType ){
     case SQLITE_TEXT:
     case SQLITE_INTEGER: {
-      const char *zIn = (const char*)sqlite3_value_text(pIn);
-      int n = sqlite3_value_bytes(pIn);
-      p = decimalNewFromText(zIn, n);
+// Begin Android Add
+      p = sqlite3_malloc( sizeof(*p) );
       if( p==0 ) goto new_failed;
+      memset(p, 0, sizeof(*p));
+      decimal_from_value(p, pIn);
+      if( p->oom ){
+        decimal_free(p);
+        p = 0;
+        goto new_failed;
+      }
+// End Android Add
       break;
     }
 
@@ -3877,6 +4261,9 @@ new_failed:
 */
 static void decimal_result(sqlite3_context *pCtx, Decimal *p){
   char *z;
+// Begin Android Add
+  char *zDigit;
+// End Android Add
   int i, j;
   int n;
   if( p==0 || p->oom ){
@@ -3892,8 +4279,14 @@ static void decimal_result(sqlite3_context *pCtx, Decimal *p){
     sqlite3_result_error_nomem(pCtx);
     return;
   }
+// Begin Android Add
+  /* The digits are written to the tail of z[]. At most three characters
+  ** (a sign, a leading '0' and a '.') are added in front of them, so each
+  ** digit is read before its slot in z[] is overwritten. */
+  zDigit = &z[3];
+  decimal_digits(p, zDigit);
   i = 0;
-  if( p->nDigit==0 || (p->nDigit==1 && p->a[0]==0) ){
+  if( p->nDigit==0 || (p->nDigit==1 && zDigit[0]=='0') ){
     p->sign = 0;
   }
   if( p->sign ){
@@ -3905,22 +4298,23 @@ static void decimal_result(sqlite3_context *pCtx, Decimal *p){
     z[i++] = '0';
   }
   j = 0;
-  while( n>1 && p->a[j]==0 ){
+  while( n>1 && zDigit[j]=='0' ){
     j++;
     n--;
   }
   while( n>0  ){
-    z[i++] = p->a[j] + '0';
+    z[i++] = zDigit[j];
     j++;
     n--;
   }
   if( p->nFrac ){
     z[i++] = '.';
     do{
-      z[i++] = p->a[j] + '0';
+      z[i++] = zDigit[j];
       j++;
     }while( j<p->nDigit );
   }
+// End Android Add
   z[i] = 0;
   sqlite3_result_text(pCtx, z, i, sqlite3_free);
 }
@@ -3937,8 +4331,9 @@ static void decimal_result_sci(sqlite3_context *pCtx, Decimal *p){
   int nDigit;    /* Number of digits not counting trailing zeros */
   int nFrac;     /* Digits to the right of the decimal point */
   int exp;       /* Exponent value */
-  signed char zero;     /* Zero value */
-  signed char *a;       /* Array of digits */
+// Begin Android Add
+  char *zDigit;         /* The nDigit digits of p, as text */
+  const char *a;        /* Array of digits */
 
   if( p==0 || p->oom ){
     sqlite3_result_error_nomem(pCtx);
@@ -3948,41 +4343,49 @@ static void decimal_result_sci(sqlite3_context *pCtx, Decimal *p){
     sqlite3_result_null(pCtx);
     return;
   }
-  for(nDigit=p->nDigit; nDigit>0 && p->a[nDigit-1]==0; nDigit--){}
-  for(nZero=0; nZero<nDigit && p->a[nZero]==0; nZero++){}
+  zDigit = sqlite3_malloc( p->nDigit+1 );
+  if( zDigit==0 ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  decimal_digits(p, zDigit);
+  for(nDigit=p->nDigit; nDigit>0 && zDigit[nDigit-1]=='0'; nDigit--){}
+  for(nZero=0; nZero<nDigit && zDigit[nZero]=='0'; nZero++){}
   nFrac = p->nFrac + (nDigit - p->nDigit);
   nDigit -= nZero;
   z = sqlite3_malloc( nDigit+20 );
   if( z==0 ){
+    sqlite3_free(zDigit);
     sqlite3_result_error_nomem(pCtx);
     return;
   }
   if( nDigit==0 ){
-    zero = 0;
-    a = &zero;
+    a = "0";
     nDigit = 1;
     nFrac = 0;
   }else{
-    a = &p->a[nZero];
+    a = &zDigit[nZero];
   }
   if( p->sign && nDigit>0 ){
     z[0] = '-';
   }else{
     z[0] = '+';
   }
-  z[1] = a[0]+'0';
+  z[1] = a[0];
   z[2] = '.';
   if( nDigit==1 ){
     z[3] = '0';
     i = 4;
   }else{
     for(i=1; i<nDigit; i++){
-      z[2+i] = a[i]+'0';
+      z[2+i] = a[i];
     }
     i = nDigit+2;
   }
   exp = nDigit - nFrac - 1;
   sqlite3_snprintf(nDigit+20-i, &z[i], "e%+03d", exp);
+  sqlite3_free(zDigit);
+// End Android Add
   sqlite3_result_text(pCtx, z, -1, sqlite3_free);
 }
 
@@ -3999,6 +4402,9 @@ static void decimal_result_sci(sqlite3_context *pCtx, Decimal *p){
 */
 static int decimal_cmp(const Decimal *pA, const Decimal *pB){
   int nASig, nBSig, rc, n;
+// Begin Android Add
+  int i;
+// End Android Add
   if( pA->sign!=pB->sign ){
     return pA->sign ? -1 : +1;
   }
@@ -4014,7 +4420,12 @@ static int decimal_cmp(const Decimal *pA, const Decimal *pB){
   }
   n = pA->nDigit;
   if( n>pB->nDigit ) n = pB->nDigit;
-  rc = memcmp(pA->a, pB->a, n);
+// Begin Android Add
+  rc = 0;
+  for(i=0; i<n && rc==0; i++){
+    rc = decimal_digit(pA, i) - decimal_digit(pB, i);
+  }
+// End Android Add
   if( rc==0 ){
     rc = pA->nDigit - pB->nDigit;
   }
@@ -4060,21 +4471,15 @@ static void decimal_expand(Decimal *p, int nDigit, int nFrac){
   nAddFrac = nFrac - p->nFrac;
   nAddSig = (nDigit - p->nDigit) - nAddFrac;
   if( nAddFrac==0 && nAddSig==0 ) return;
-  p->a = sqlite3_realloc64(p->a, nDigit+1);
-  if( p->a==0 ){
-    p->oom = 1;
-    return;
-  }
-  if( nAddSig ){
-    memmove(p->a+nAddSig, p->a, p->nDigit);
-    memset(p->a, 0, nAddSig);
-    p->nDigit += nAddSig;
-  }
+// Begin Android Add
+  /* Leading zeros take no space in a[]. Trailing zeros scale it. */
   if( nAddFrac ){
-    memset(p->a+p->nDigit, 0, nAddFrac);
-    p->nDigit += nAddFrac;
-    p->nFrac += nAddFrac;
+    decimal_shift_left(p, nAddFrac);
+    if( p->oom ) return;
   }
+  p->nDigit = nDigit;
+  p->nFrac = nFrac;
+// End Android Add
 }
 
 /*
@@ -4084,7 +4489,6 @@ static void decimal_expand(Decimal *p, int nDigit, int nFrac){
 */
 static void decimal_add(Decimal *pA, Decimal *pB){
   int nSig, nFrac, nDigit;
-  int i, rc;
   if( pA==0 ){
     return;
   }
@@ -4097,7 +4501,9 @@ static void decimal_add(Decimal *pA, Decimal *pB){
     return;
   }
   nSig = pA->nDigit - pA->nFrac;
-  if( nSig && pA->a[0]==0 ) nSig--;
+// Begin Android Add
+  if( nSig && decimal_sig_digits(pA)<pA->nDigit ) nSig--;
+// End Android Add
   if( nSig<pB->nDigit-pB->nFrac ){
     nSig = pB->nDigit - pB->nFrac;
   }
@@ -4108,43 +4514,32 @@ static void decimal_add(Decimal *pA, Decimal *pB){
   decimal_expand(pB, nDigit, nFrac);
   if( pA->oom || pB->oom ){
     pA->oom = 1;
+// Begin Android Add
+  }else if( pA->sign==pB->sign ){
+    int nLimb = (pA->nLimb>pB->nLimb ? pA->nLimb : pB->nLimb) + 1;
+    if( decimal_reserve(pA, nLimb) ) return;
+    memset(&pA->a[pA->nLimb], 0, (nLimb-pA->nLimb)*sizeof(u32));
+    pA->nLimb = nLimb;
+    decimal_limb_add(pA->a, nLimb, pB->a, pB->nLimb);
+    decimal_normalize(pA);
+  }else if( decimal_limb_cmp(pA, pB)>=0 ){
+    decimal_limb_sub(pA->a, pA->nLimb, pB->a, pB->nLimb);
+    decimal_normalize(pA);
   }else{
-    if( pA->sign==pB->sign ){
-      int carry = 0;
-      for(i=nDigit-1; i>=0; i--){
-        int x = pA->a[i] + pB->a[i] + carry;
-        if( x>=10 ){
-          carry = 1;
-          pA->a[i] = x - 10;
-        }else{
-          carry = 0;
-          pA->a[i] = x;
-        }
-      }
-    }else{
-      signed char *aA, *aB;
-      int borrow = 0;
-      rc = memcmp(pA->a, pB->a, nDigit);
-      if( rc<0 ){
-        aA = pB->a;
-        aB = pA->a;
-        pA->sign = !pA->sign;
-      }else{
-        aA = pA->a;
-        aB = pB->a;
-      }
-      for(i=nDigit-1; i>=0; i--){
-        int x = aA[i] - aB[i] - borrow;
-        if( x<0 ){
-          pA->a[i] = x+10;
-          borrow = 1;
-        }else{
-          pA->a[i] = x;
-          borrow = 0;
-        }
-      }
+    /* A := B - A, computed in place in pA->a[] */
+    u32 borrow = 0;
+    int i;
+    if( decimal_reserve(pA, pB->nLimb) ) return;
+    for(i=0; i<pB->nLimb; i++){
+      u32 y = (i<pA->nLimb ? pA->a[i] : 0) + borrow;
+      borrow = pB->a[i]<y;
+      pA->a[i] = borrow ? pB->a[i] + DECIMAL_BASE - y : pB->a[i] - y;
     }
+    pA->nLimb = pB->nLimb;
+    pA->sign = !pA->sign;
+    decimal_normalize(pA);
   }
+// End Android Add
 }
 
 /*
@@ -4156,8 +4551,11 @@ static void decimal_add(Decimal *pA, Decimal *pB){
 ** either the number of digits in either input.
 */
 static void decimalMul(Decimal *pA, Decimal *pB){
-  signed char *acc = 0;
-  int i, j, k;
+// Begin Android Add
+  u32 *acc = 0;
+  int nAcc;
+  int nTrim;
+// End Android Add
   int minFrac;
 
   if( pA==0 || pA->oom || pA->isNull
@@ -4165,36 +4563,40 @@ static void decimalMul(Decimal *pA, Decimal *pB){
   ){
     goto mul_end;
   }
-  acc = sqlite3_malloc64( pA->nDigit + pB->nDigit + 2 );
+// Begin Android Add
+  nAcc = pA->nLimb + pB->nLimb;
+  acc = (u32*)sqlite3_malloc64( (nAcc+1)*sizeof(u32) );
   if( acc==0 ){
     pA->oom = 1;
     goto mul_end;
   }
-  memset(acc, 0, pA->nDigit + pB->nDigit + 2);
+  memset(acc, 0, (nAcc+1)*sizeof(u32));
+  if( decimal_limb_mul(acc, pA->a, pA->nLimb, pB->a, pB->nLimb) ){
+    pA->oom = 1;
+    goto mul_end;
+  }
   minFrac = pA->nFrac;
   if( pB->nFrac<minFrac ) minFrac = pB->nFrac;
-  for(i=pA->nDigit-1; i>=0; i--){
-    signed char f = pA->a[i];
-    int carry = 0, x;
-    for(j=pB->nDigit-1, k=i+j+3; j>=0; j--, k--){
-      x = acc[k] + f*pB->a[j] + carry;
-      acc[k] = x%10;
-      carry = x/10;
-    }
-    x = acc[k] + carry;
-    acc[k] = x%10;
-    acc[k-1] += x/10;
-  }
   sqlite3_free(pA->a);
   pA->a = acc;
+  pA->nAlloc = nAcc+1;
+  pA->nLimb = nAcc;
   acc = 0;
+  decimal_normalize(pA);
   pA->nDigit += pB->nDigit + 2;
   pA->nFrac += pB->nFrac;
   pA->sign ^= pB->sign;
-  while( pA->nFrac>minFrac && pA->a[pA->nDigit-1]==0 ){
-    pA->nFrac--;
-    pA->nDigit--;
+  nTrim = pA->nFrac - minFrac;
+  if( pA->nLimb>0 ){
+    int nZero = decimal_trailing_zeros(pA);
+    if( nZero<nTrim ) nTrim = nZero;
+  }
+  if( nTrim>0 ){
+    decimal_shift_right(pA, nTrim);
+    pA->nFrac -= nTrim;
+    pA->nDigit -= nTrim;
   }
+// End Android Add
 
 mul_end:
   sqlite3_free(acc);
@@ -4379,58 +4781,74 @@ static void decimalSubFunc(
 ** Works like sum() except that it uses decimal arithmetic for unlimited
 ** precision.
 */
+// Begin Android Add
+/*
+** The aggregate context holds the running total and a Decimal that each
+** argument is parsed into. Reusing the latter means a step only
+** allocates memory when an argument has more digits than any before it.
+*/
+typedef struct DecimalSum DecimalSum;
+struct DecimalSum {
+  Decimal sum;      /* Running total */
+  Decimal arg;      /* Most recent argument */
+};
+// End Android Add
 static void decimalSumStep(
   sqlite3_context *context,
   int argc,
   sqlite3_value **argv
 ){
+// Begin Android Add
+  DecimalSum *pSum;
   Decimal *p;
-  Decimal *pArg;
   UNUSED_PARAMETER(argc);
-  p = sqlite3_aggregate_context(context, sizeof(*p));
-  if( p==0 ) return;
+  pSum = sqlite3_aggregate_context(context, sizeof(*pSum));
+  if( pSum==0 ) return;
+  p = &pSum->sum;
   if( !p->isInit ){
     p->isInit = 1;
-    p->a = sqlite3_malloc(2);
-    if( p->a==0 ){
-      p->oom = 1;
-    }else{
-      p->a[0] = 0;
-    }
+    p->nLimb = 0;
     p->nDigit = 1;
     p->nFrac = 0;
   }
   if( sqlite3_value_type(argv[0])==SQLITE_NULL ) return;
-  pArg = decimal_new(context, argv[0], 1);
-  decimal_add(p, pArg);
-  decimal_free(pArg);
+  decimal_from_value(&pSum->arg, argv[0]);
+  if( pSum->arg.oom ) sqlite3_result_error_nomem(context);
+  decimal_add(p, &pSum->arg);
+// End Android Add
 }
 static void decimalSumInverse(
   sqlite3_context *context,
   int argc,
   sqlite3_value **argv
 ){
-  Decimal *p;
-  Decimal *pArg;
+// Begin Android Add
+  DecimalSum *pSum;
   UNUSED_PARAMETER(argc);
-  p = sqlite3_aggregate_context(context, sizeof(*p));
-  if( p==0 ) return;
+  pSum = sqlite3_aggregate_context(context, sizeof(*pSum));
+  if( pSum==0 ) return;
   if( sqlite3_value_type(argv[0])==SQLITE_NULL ) return;
-  pArg = decimal_new(context, argv[0], 1);
-  if( pArg ) pArg->sign = !pArg->sign;
-  decimal_add(p, pArg);
-  decimal_free(pArg);
+  decimal_from_value(&pSum->arg, argv[0]);
+  if( pSum->arg.oom ) sqlite3_result_error_nomem(context);
+  pSum->arg.sign = !pSum->arg.sign;
+  decimal_add(&pSum->sum, &pSum->arg);
+// End Android Add
 }
 static void decimalSumValue(sqlite3_context *context){
-  Decimal *p = sqlite3_aggregate_context(context, 0);
-  if( p==0 ) return;
-  decimal_result(context, p);
+// Begin Android Add
+  DecimalSum *pSum = sqlite3_aggregate_context(context, 0);
+  if( pSum==0 ) return;
+  decimal_result(context, &pSum->sum);
+// End Android Add
 }
 static void decimalSumFinalize(sqlite3_context *context){
-  Decimal *p = sqlite3_aggregate_context(context, 0);
-  if( p==0 ) return;
-  decimal_result(context, p);
-  decimal_clear(p);
+// Begin Android Add
+  DecimalSum *pSum = sqlite3_aggregate_context(context, 0);
+  if( pSum==0 ) return;
+  decimal_result(context, &pSum->sum);
+  decimal_clear(&pSum->sum);
+  decimal_clear(&pSum->arg);
+// End Android Add
 }
 
 /*
@@ -6342,6 +6760,13 @@ struct ReInput {
   int mx;                  /* EOF when i>=mx */
 };
 
+// Begin Android Add
+/* Limits on the literals that re_compile() finds every match must contain */
+#define RE_NREQ     4          /* Most literals kept in ReCompiled.azReq[] */
+#define RE_REQ_MAX  32         /* Most bytes kept of each literal */
+#define RE_REQ_MAX_STATES 500  /* Skip the search in larger programs */
+
+// End Android Add
 /* A compiled NFA (or an NFA that is in the process of being compiled) is
 ** an instance of the following object.
 */
@@ -6356,6 +6781,12 @@ struct ReCompiled {
   int nInit;                  /* Number of bytes in zInit */
   unsigned nState;            /* Number of entries in aOp[] and aArg[] */
   unsigned nAlloc;            /* Slots allocated for aOp[] and aArg[] */
+// Begin Android Add
+  struct ReDfa *pDfa;         /* DFA built so far by re_match(), or NULL */
+  int nReq;                   /* Number of literals in azReq[] */
+  int anReq[RE_NREQ];         /* Length in bytes of each of azReq[] */
+  unsigned char azReq[RE_NREQ][RE_REQ_MAX];  /* Literals every match has */
+// End Android Add
 };
 
 /* Add a state to the given state set if it is not already there */
@@ -6417,27 +6848,392 @@ static int re_space_char(int c){
   return c==' ' || c=='\t' || c=='\n' || c=='\r' || c=='\v' || c=='\f';
 }
 
-/* Run a compiled regular expression on the zero-terminated input
-** string zIn[].  Return true on a match and false if there is no match.
-*/
-static int re_match(ReCompiled *pRe, const unsigned char *zIn, int nIn){
-  ReStateSet aStateSet[2], *pThis, *pNext;
-  ReStateNumber aSpace[100];
-  ReStateNumber *pToFree;
-  unsigned int i = 0;
-  unsigned int iSwap = 0;
-  int c = RE_START;
-  int cPrev = 0;
-  int rc = 0;
-  ReInput in;
+// Begin Android Add
+/*
+** re_match() runs a DFA that it builds lazily from the NFA, one state and
+** one transition at a time as the input needs them.  The DFA is kept with
+** the ReCompiled, which re_sql_func() keeps across rows with
+** sqlite3_set_auxdata(), so that after the first few rows most characters
+** cost one table lookup instead of a pass over every active NFA state.
+**
+** A DFA state is the set of NFA states that re_match() would have in
+** pNext, in increasing order, together with as much of the previous
+** character as RE_OP_ATSTART and RE_OP_BOUNDARY look at.  Transitions on
+** characters below RE_DFA_NCHAR are remembered in aNext[]; transitions on
+** other characters are worked out again each time they are needed.  Once
+** the DFA has RE_DFA_MAX_STATES states it is abandoned and re_match() goes
+** back to simulating the NFA for this and all later inputs.
+*/
+#define RE_DFA_NCHAR        128    /* Characters with remembered transitions */
+#define RE_DFA_MAX_STATES   1024   /* Give up on the DFA past this many states */
+#define RE_DFA_NHASH        2048   /* Slots in ReDfa.aHash[] */
+
+/* Values in ReDfaState.aNext[] other than state numbers */
+#define RE_DFA_UNKNOWN      (-1)   /* Transition not worked out yet */
+#define RE_DFA_ACCEPT       (-2)   /* The input matches */
+#define RE_DFA_FAILED       (-3)   /* Out of states or memory */
+
+/* Values for ReDfaState.ePrev */
+#define RE_DFA_PREV_NONWORD 0      /* Previous character is not a word char */
+#define RE_DFA_PREV_WORD    1      /* Previous character is a word char */
+#define RE_DFA_PREV_START   2      /* No previous character */
+
+typedef struct ReDfaState ReDfaState;
+struct ReDfaState {
+  int aNext[RE_DFA_NCHAR];    /* Next state for each character, or RE_DFA_* */
+  ReStateNumber *aSet;        /* NFA states, in increasing order */
+  unsigned nSet;              /* Number of entries in aSet[] */
+  unsigned h;                 /* Hash of aSet[] and ePrev */
+  int iHashNext;              /* Next state in the same hash chain, or -1 */
+  unsigned char ePrev;        /* One of the RE_DFA_PREV_* values */
+  unsigned char bAccept;      /* True if the input may end in this state */
+};
 
-  in.z = zIn;
-  in.i = 0;
-  in.mx = nIn>=0 ? nIn : (int)strlen((char const*)zIn);
+typedef struct ReDfa ReDfa;
+struct ReDfa {
+  ReDfaState **apState;       /* All states of the DFA */
+  int nState;                 /* Number of entries in apState[] */
+  int nAlloc;                 /* Slots allocated for apState[] */
+  int bFailed;                /* Too many states.  Use the NFA instead */
+  int aStart[3];              /* Start state for each ePrev, or -1 */
+  int aHash[RE_DFA_NHASH];    /* First state of each hash chain, or -1 */
+  unsigned char aFold[0x80];  /* What xNextChar() returns for ASCII bytes */
+  ReStateNumber *aWork;       /* Space for two ReStateSets of the NFA */
+};
 
-  /* Look for the initial prefix match, if there is one. */
-  if( pRe->nInit ){
-    unsigned char x = pRe->zInit[0];
+/* Free a DFA and all of its states */
+static void re_dfa_free(ReDfa *pDfa){
+  if( pDfa ){
+    int i;
+    for(i=0; i<pDfa->nState; i++) sqlite3_free(pDfa->apState[i]);
+    sqlite3_free(pDfa->apState);
+    sqlite3_free(pDfa->aWork);
+    sqlite3_free(pDfa);
+  }
+}
+
+/* Allocate the DFA for pRe.  Return NULL if out of memory. */
+static ReDfa *re_dfa_new(ReCompiled *pRe){
+  ReDfa *pDfa = sqlite3_malloc64( sizeof(*pDfa) );
+  int i;
+  if( pDfa==0 ) return 0;
+  memset(pDfa, 0, sizeof(*pDfa));
+  for(i=0; i<3; i++) pDfa->aStart[i] = -1;
+  for(i=0; i<RE_DFA_NHASH; i++) pDfa->aHash[i] = -1;
+  for(i=0; i<0x80; i++){
+    pDfa->aFold[i] = (unsigned char)i;
+    if( pRe->xNextChar==re_next_char_nocase && i>='A' && i<='Z' ){
+      pDfa->aFold[i] += 'a' - 'A';
+    }
+  }
+  pDfa->aWork = sqlite3_malloc64( sizeof(ReStateNumber)*2*pRe->nState );
+  if( pDfa->aWork==0 ){
+    sqlite3_free(pDfa);
+    return 0;
+  }
+  return pDfa;
+}
+
+/* Run one step of the NFA of pRe on input character c, where the previous
+** character was cPrev.  pThis holds the states before the step and may
+** grow as epsilon transitions are followed.  The states after the step
+** are added to pNext.  Return 1 if the NFA reaches RE_OP_ACCEPT.  This is
+** the same as the body of the main loop in re_match().
+*/
+static int re_dfa_step(
+  ReCompiled *pRe,
+  ReStateSet *pThis,
+  ReStateSet *pNext,
+  int c,
+  int cPrev
+){
+  unsigned int i;
+  for(i=0; i<pThis->nState; i++){
+    int x = pThis->aState[i];
+    switch( pRe->aOp[x] ){
+      case RE_OP_MATCH: {
+        if( pRe->aArg[x]==c ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_ATSTART: {
+        if( cPrev==RE_START ) re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_ANY: {
+        if( c!=0 ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_WORD: {
+        if( re_word_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_NOTWORD: {
+        if( !re_word_char(c) && c!=0 ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_DIGIT: {
+        if( re_digit_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_NOTDIGIT: {
+        if( !re_digit_char(c) && c!=0 ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_SPACE: {
+        if( re_space_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_NOTSPACE: {
+        if( !re_space_char(c) && c!=0 ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_BOUNDARY: {
+        if( re_word_char(c)!=re_word_char(cPrev) ) re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_ANYSTAR: {
+        re_add_state(pNext, x);
+        re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_FORK: {
+        re_add_state(pThis, x+pRe->aArg[x]);
+        re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_GOTO: {
+        re_add_state(pThis, x+pRe->aArg[x]);
+        break;
+      }
+      case RE_OP_ACCEPT: {
+        return 1;
+      }
+      case RE_OP_CC_EXC:
+      case RE_OP_CC_INC: {
+        int j;
+        int n = pRe->aArg[x];
+        int hit = 0;
+        if( c==0 && pRe->aOp[x]==RE_OP_CC_EXC ) break;
+        for(j=1; j>0 && j<n; j++){
+          if( pRe->aOp[x+j]==RE_OP_CC_VALUE ){
+            if( pRe->aArg[x+j]==c ){
+              hit = 1;
+              j = -1;
+            }
+          }else{
+            if( pRe->aArg[x+j]<=c && pRe->aArg[x+j+1]>=c ){
+              hit = 1;
+              j = -1;
+            }else{
+              j++;
+            }
+          }
+        }
+        if( pRe->aOp[x]==RE_OP_CC_EXC ) hit = !hit;
+        if( hit ) re_add_state(pNext, x+n);
+        break;
+      }
+    }
+  }
+  return 0;
+}
+
+/* Return the number of the DFA state for the NFA states aSet[0..nSet-1]
+** with previous character class ePrev, adding it if it is new.  aSet[] is
+** sorted in place.  Return RE_DFA_FAILED if the DFA has run out of states
+** or memory.
+*/
+static int re_dfa_state(
+  ReCompiled *pRe,
+  ReDfa *pDfa,
+  ReStateNumber *aSet,
+  unsigned nSet,
+  int ePrev
+){
+  ReDfaState *p;
+  unsigned h = (unsigned)ePrev;
+  unsigned i, j;
+  int iState;
+
+  for(i=1; i<nSet; i++){
+    ReStateNumber x = aSet[i];
+    for(j=i; j>0 && aSet[j-1]>x; j--) aSet[j] = aSet[j-1];
+    aSet[j] = x;
+  }
+  for(i=0; i<nSet; i++) h = h*1000003 + aSet[i];
+  for(iState=pDfa->aHash[h%RE_DFA_NHASH]; iState>=0; iState=p->iHashNext){
+    p = pDfa->apState[iState];
+    if( p->h==h && p->ePrev==ePrev && p->nSet==nSet
+     && memcmp(p->aSet, aSet, nSet*sizeof(aSet[0]))==0
+    ){
+      return iState;
+    }
+  }
+  if( pDfa->nState>=RE_DFA_MAX_STATES ){
+    pDfa->bFailed = 1;
+    return RE_DFA_FAILED;
+  }
+  if( pDfa->nState>=pDfa->nAlloc ){
+    int nNew = pDfa->nAlloc ? pDfa->nAlloc*2 : 16;
+    ReDfaState **apNew;
+    apNew = sqlite3_realloc64(pDfa->apState, nNew*sizeof(apNew[0]));
+    if( apNew==0 ){
+      pDfa->bFailed = 1;
+      return RE_DFA_FAILED;
+    }
+    pDfa->apState = apNew;
+    pDfa->nAlloc = nNew;
+  }
+  p = sqlite3_malloc64( sizeof(*p) + nSet*sizeof(aSet[0]) );
+  if( p==0 ){
+    pDfa->bFailed = 1;
+    return RE_DFA_FAILED;
+  }
+  memset(p->aNext, 0xff, sizeof(p->aNext));
+  p->aSet = (ReStateNumber*)&p[1];
+  memcpy(p->aSet, aSet, nSet*sizeof(aSet[0]));
+  p->nSet = nSet;
+  p->h = h;
+  p->ePrev = (unsigned char)ePrev;
+  p->bAccept = 0;
+  for(i=0; i<nSet; i++){
+    int x = aSet[i];
+    while( pRe->aOp[x]==RE_OP_GOTO ) x += pRe->aArg[x];
+    if( pRe->aOp[x]==RE_OP_ACCEPT ){ p->bAccept = 1; break; }
+  }
+  iState = pDfa->nState++;
+  p->iHashNext = pDfa->aHash[h%RE_DFA_NHASH];
+  pDfa->aHash[h%RE_DFA_NHASH] = iState;
+  pDfa->apState[iState] = p;
+  return iState;
+}
+
+/* Work out the transition out of DFA state iState on character c, and
+** remember it if c is small enough.  Return the next state or one of
+** RE_DFA_ACCEPT or RE_DFA_FAILED.
+*/
+static int re_dfa_next(ReCompiled *pRe, ReDfa *pDfa, int iState, int c){
+  ReDfaState *p = pDfa->apState[iState];
+  ReStateSet sThis, sNext;
+  int cPrev;
+  int iNext;
+
+  switch( p->ePrev ){
+    case RE_DFA_PREV_START: cPrev = RE_START;   break;
+    case RE_DFA_PREV_WORD:  cPrev = 'a';        break;
+    default:                cPrev = RE_START-1; break;
+  }
+  sThis.aState = pDfa->aWork;
+  sThis.nState = p->nSet;
+  memcpy(sThis.aState, p->aSet, p->nSet*sizeof(p->aSet[0]));
+  sNext.aState = &pDfa->aWork[pRe->nState];
+  sNext.nState = 0;
+  if( re_dfa_step(pRe, &sThis, &sNext, c, cPrev) ){
+    iNext = RE_DFA_ACCEPT;
+  }else{
+    iNext = re_dfa_state(pRe, pDfa, sNext.aState, sNext.nState,
+                         re_word_char(c) ? RE_DFA_PREV_WORD : RE_DFA_PREV_NONWORD);
+    if( iNext==RE_DFA_FAILED ) return iNext;
+  }
+  if( c<RE_DFA_NCHAR ) pDfa->apState[iState]->aNext[c] = iNext;
+  return iNext;
+}
+
+/* Match the rest of pIn against pRe using the DFA, where c is RE_START at
+** the start of the input or RE_START-1 after a prefix match.  Return 1 on
+** a match, 0 if there is none, or RE_DFA_FAILED if the caller should use
+** the NFA instead.
+*/
+static int re_dfa_match(ReCompiled *pRe, ReInput *pIn, int c){
+  ReDfa *pDfa = pRe->pDfa;
+  int ePrev = c==RE_START ? RE_DFA_PREV_START : RE_DFA_PREV_NONWORD;
+  int iState;
+
+  if( pDfa==0 ){
+    pDfa = pRe->pDfa = re_dfa_new(pRe);
+    if( pDfa==0 ) return RE_DFA_FAILED;
+  }
+  if( pDfa->bFailed ) return RE_DFA_FAILED;
+  iState = pDfa->aStart[ePrev];
+  if( iState<0 ){
+    ReStateNumber x = 0;
+    iState = re_dfa_state(pRe, pDfa, &x, 1, ePrev);
+    if( iState<0 ) return RE_DFA_FAILED;
+    pDfa->aStart[ePrev] = iState;
+  }
+  while( 1 ){
+    ReDfaState *p = pDfa->apState[iState];
+    int iNext;
+    if( p->nSet==0 ) return 0;
+    if( pIn->i<pIn->mx && pIn->z[pIn->i]<0x80 ){
+      c = pDfa->aFold[pIn->z[pIn->i++]];
+      iNext = p->aNext[c];
+    }else{
+      c = pRe->xNextChar(pIn);
+      iNext = c<RE_DFA_NCHAR ? p->aNext[c] : RE_DFA_UNKNOWN;
+    }
+    if( iNext==RE_DFA_UNKNOWN ) iNext = re_dfa_next(pRe, pDfa, iState, c);
+    if( iNext<0 ) return iNext==RE_DFA_ACCEPT ? 1 : RE_DFA_FAILED;
+    iState = iNext;
+    if( c==RE_EOF ) return pDfa->apState[iState]->bAccept;
+  }
+}
+
+/* Return the offset of the first copy of zLit[0..nLit-1] in z[0..n-1], or
+** -1 if there is none.  memchr() and memcmp() are vectorized by the C
+** library, which makes this much faster than a byte-at-a-time loop.
+*/
+static int re_find(
+  const unsigned char *z,
+  int n,
+  const unsigned char *zLit,
+  int nLit
+){
+  const unsigned char *p = z;
+  const unsigned char *zEnd;
+  if( nLit>n ) return -1;
+  zEnd = &z[n-nLit+1];
+  while( p<zEnd ){
+    p = memchr(p, zLit[0], zEnd-p);
+    if( p==0 ) return -1;
+    if( memcmp(p+1, zLit+1, nLit-1)==0 ) return (int)(p-z);
+    p++;
+  }
+  return -1;
+}
+
+// End Android Add
+/* Run a compiled regular expression on the zero-terminated input
+** string zIn[].  Return true on a match and false if there is no match.
+*/
+static int re_match(ReCompiled *pRe, const unsigned char *zIn, int nIn){
+  ReStateSet aStateSet[2], *pThis, *pNext;
+  ReStateNumber aSpace[100];
+  ReStateNumber *pToFree;
+  unsigned int i = 0;
+  unsigned int iSwap = 0;
+  int c = RE_START;
+  int cPrev = 0;
+  int rc = 0;
+  ReInput in;
+
+  in.z = zIn;
+  in.i = 0;
+  in.mx = nIn>=0 ? nIn : (int)strlen((char const*)zIn);
+
+// Begin Android Add
+  /* Reject inputs that lack one of the literals every match contains. */
+  for(i=0; i<(unsigned)pRe->nReq; i++){
+    if( re_find(zIn, in.mx, pRe->azReq[i], pRe->anReq[i])<0 ) return 0;
+  }
+// End Android Add
+  /* Look for the initial prefix match, if there is one. */
+  if( pRe->nInit ){
+    unsigned char x = pRe->zInit[0];
+// Begin Android Add
+    in.i = re_find(zIn, in.mx, pRe->zInit, pRe->nInit);
+    if( in.i<0 ) return 0;
+// End Android Add
     while( in.i+pRe->nInit<=in.mx 
      && (zIn[in.i]!=x ||
          strncmp((const char*)zIn+in.i, (const char*)pRe->zInit, pRe->nInit)!=0)
@@ -6448,6 +7244,15 @@ static int re_match(ReCompiled *pRe, const unsigned char *zIn, int nIn){
     c = RE_START-1;
   }
 
+// Begin Android Add
+  if( pRe->pDfa==0 || !pRe->pDfa->bFailed ){
+    int iStart = in.i;
+    rc = re_dfa_match(pRe, &in, c);
+    if( rc!=RE_DFA_FAILED ) return rc;
+    in.i = iStart;
+    rc = 0;
+  }
+// End Android Add
   if( pRe->nState<=(sizeof(aSpace)/(sizeof(aSpace[0])*2)) ){
     pToFree = 0;
     aStateSet[0].aState = aSpace;
@@ -6856,12 +7661,156 @@ static const char *re_subcompile_string(ReCompiled *p){
 */
 static void re_free(ReCompiled *pRe){
   if( pRe ){
+// Begin Android Add
+    re_dfa_free(pRe->pDfa);
+// End Android Add
     sqlite3_free(pRe->aOp);
     sqlite3_free(pRe->aArg);
     sqlite3_free(pRe);
   }
 }
 
+// Begin Android Add
+/* Return true if RE_OP_ACCEPT can be reached from state 0 of pRe without
+** passing through state iSkip.  aStack[] and aSeen[] each have room for
+** pRe->nState entries.
+*/
+static int re_reaches_accept(
+  ReCompiled *pRe,
+  int iSkip,
+  int *aStack,
+  unsigned char *aSeen
+){
+  int nStack = 0;
+  if( iSkip==0 ) return 0;
+  memset(aSeen, 0, pRe->nState);
+  aSeen[0] = 1;
+  aStack[nStack++] = 0;
+  while( nStack>0 ){
+    int x = aStack[--nStack];
+    int aNext[2];
+    int nNext = 0;
+    int k;
+    switch( pRe->aOp[x] ){
+      case RE_OP_ACCEPT: {
+        return 1;
+      }
+      case RE_OP_FORK: {
+        aNext[nNext++] = x+pRe->aArg[x];
+        aNext[nNext++] = x+1;
+        break;
+      }
+      case RE_OP_GOTO:
+      case RE_OP_CC_INC:
+      case RE_OP_CC_EXC: {
+        aNext[nNext++] = x+pRe->aArg[x];
+        break;
+      }
+      default: {
+        aNext[nNext++] = x+1;
+        break;
+      }
+    }
+    for(k=0; k<nNext; k++){
+      int y = aNext[k];
+      if( y!=iSkip && y>=0 && y<(int)pRe->nState && !aSeen[y] ){
+        aSeen[y] = 1;
+        aStack[nStack++] = y;
+      }
+    }
+  }
+  return 0;
+}
+
+/* Remember literal zLit[0..nLit-1] in pRe->azReq[], keeping the longest
+** RE_NREQ literals.
+*/
+static void re_add_required(ReCompiled *pRe, const unsigned char *zLit, int nLit){
+  int i = pRe->nReq;
+  if( i>=RE_NREQ ){
+    int j;
+    for(i=0, j=1; j<RE_NREQ; j++){
+      if( pRe->anReq[j]<pRe->anReq[i] ) i = j;
+    }
+    if( pRe->anReq[i]>=nLit ) return;
+  }else{
+    pRe->nReq++;
+  }
+  memcpy(pRe->azReq[i], zLit, nLit);
+  pRe->anReq[i] = nLit;
+}
+
+/* Find runs of literal characters that every match of pRe contains and
+** record them in pRe->azReq[], so that re_match() can reject most inputs
+** that do not match with re_find() before running the automaton.
+**
+** A state is required if RE_OP_ACCEPT cannot be reached without passing
+** through it.  Consecutive required RE_OP_MATCH states match consecutive
+** characters of the input.  Letters end a run when noCase is true, since
+** the input is only folded to lower case after it is decoded, and so does
+** U+FFFD, which also stands for invalid UTF-8.  Programs of more than
+** RE_REQ_MAX_STATES states are skipped as the search is quadratic.
+*/
+static void re_find_required(ReCompiled *pRe, int noCase){
+  unsigned char zLit[RE_REQ_MAX];
+  int nLit = 0;
+  int iStart = 0;
+  int *aStack;
+  unsigned char *aSeen;
+  int x;
+
+  if( pRe->nState>RE_REQ_MAX_STATES ) return;
+  aStack = sqlite3_malloc64( pRe->nState*(sizeof(int)+1) );
+  if( aStack==0 ) return;
+  aSeen = (unsigned char*)&aStack[pRe->nState];
+  for(x=0; x<=(int)pRe->nState; x++){
+    unsigned char zChar[4];
+    int nChar = 0;
+    if( x<(int)pRe->nState && pRe->aOp[x]==RE_OP_MATCH ){
+      unsigned c = pRe->aArg[x];
+      if( c==0 || c==0xfffd || c>0x10ffff ){
+        nChar = 0;
+      }else if( noCase && ((c>='a' && c<='z') || (c>='A' && c<='Z')) ){
+        nChar = 0;
+      }else if( c<=0x7f ){
+        zChar[nChar++] = (unsigned char)c;
+      }else if( c<=0x7ff ){
+        zChar[nChar++] = (unsigned char)(0xc0 | (c>>6));
+        zChar[nChar++] = 0x80 | (c&0x3f);
+      }else if( c<=0xffff ){
+        zChar[nChar++] = (unsigned char)(0xe0 | (c>>12));
+        zChar[nChar++] = 0x80 | ((c>>6)&0x3f);
+        zChar[nChar++] = 0x80 | (c&0x3f);
+      }else{
+        zChar[nChar++] = (unsigned char)(0xf0 | (c>>18));
+        zChar[nChar++] = 0x80 | ((c>>12)&0x3f);
+        zChar[nChar++] = 0x80 | ((c>>6)&0x3f);
+        zChar[nChar++] = 0x80 | (c&0x3f);
+      }
+      if( nChar>0 && re_reaches_accept(pRe, x, aStack, aSeen) ) nChar = 0;
+    }
+    if( nChar>0 && nLit+nChar<=RE_REQ_MAX ){
+      if( nLit==0 ) iStart = x;
+      memcpy(&zLit[nLit], zChar, nChar);
+      nLit += nChar;
+      continue;
+    }
+    /* The zInit[] search in re_match() already checks for a literal that
+    ** starts right after the initial RE_OP_ANYSTAR. */
+    if( nLit>0 && (iStart!=1 || nLit>pRe->nInit) ){
+      re_add_required(pRe, zLit, nLit);
+    }
+    nLit = 0;
+    if( nChar>0 ){
+      iStart = x;
+      memcpy(zLit, zChar, nChar);
+      nLit = nChar;
+    }
+  }
+  sqlite3_free(aStack);
+}
+
+// End Android Add
 /*
 ** Compile a textual regular expression in zIn[] into a compiled regular
 ** expression suitable for us by re_match() and return a pointer to the
@@ -6932,6 +7881,9 @@ static const char *re_compile(ReCompiled **ppRe, const char *zIn, int noCase){
     if( j>0 && pRe->zInit[j-1]==0 ) j--;
     pRe->nInit = j;
   }
+// Begin Android Add
+  re_find_required(pRe, noCase);
+// End Android Add
   return pRe->zErr;
 }
 
@@ -6974,7 +7926,14 @@ static void re_sql_func(
   }
   zStr = (const unsigned char*)sqlite3_value_text(argv[1]);
   if( zStr!=0 ){
-    sqlite3_result_int(context, re_match(pRe, zStr, -1));
+// Begin Android Add
+    /* Stop at the first NUL, like the automaton, so that the literal
+    ** searches in re_match() do not look past it. */
+    int nStr = sqlite3_value_bytes(argv[1]);
+    const unsigned char *zNul = memchr(zStr, 0, nStr);
+    if( zNul ) nStr = (int)(zNul - zStr);
+    sqlite3_result_int(context, re_match(pRe, zStr, nStr));
+// End Android Add
   }
   if( setAux ){
     sqlite3_set_auxdata(context, 0, pRe, (void(*)(void*))re_free);
@@ -9561,6 +10520,60 @@ struct ZipfileEntry {
   ZipfileEntry *pNext;       /* Next element in in-memory CDS */
 };
 
+// Begin Android Add
+#ifdef SHELL_MMAP
+/*
+** Outside of write transactions an archive named by a file is mapped
+** into memory and its central directory parsed once into a ZipfileMap.
+** Each ZipfileMapEntry refers to one CDS record. The entries are linked
+** into hash chains on the exact name, and aSort[] orders them by name
+** with ASCII case folded, so that "name = ?" and "name GLOB/LIKE 'x*'"
+** constraints are answered without a scan of the whole directory.
+**
+** The mapping is reused by later queries for as long as stat() reports
+** that the file is unchanged. Data of stored entries is returned
+** straight from the mapping using SQLITE_STATIC, so a mapping is only
+** unmapped once every cursor that may have read from it is closed.
+*/
+typedef struct ZipfileMapEntry ZipfileMapEntry;
+struct ZipfileMapEntry {
+  i64 iOff;                  /* Offset of CDS record in file */
+  int nName;                 /* Bytes of name (up to first nul) */
+  int iHashNext;             /* Next entry in hash chain, or -1 */
+};
+
+typedef struct ZipfileMap ZipfileMap;
+struct ZipfileMap {
+  int nRef;                  /* Number of pointers to this object */
+  char *zFile;               /* Name of mapped file */
+  struct stat st;            /* stat() of file when it was mapped */
+  u8 *aMap;                  /* Mapped file image */
+  i64 nMap;                  /* Size of aMap[] in bytes */
+  int nEntry;                /* Number of entries in aEntry[] */
+  ZipfileMapEntry *aEntry;   /* One entry per CDS record, in file order */
+  int *aHash;                /* Hash table heads, -1 for an empty slot */
+  int nHash;                 /* Number of slots in aHash[], a power of 2 */
+  int *aSort;                /* Indexes into aEntry[], ordered by name */
+  i64 iCorrupt;              /* Offset of unreadable CDS record, or -1 */
+  u8 bShort;                 /* True if that record is cut short by EOF */
+};
+
+/*
+** Drop a reference to ZipfileMap object p. Unmap and free it when the
+** last reference is gone.
+*/
+static void zipfileMapRelease(ZipfileMap *p){
+  if( p && --p->nRef==0 ){
+    munmap(p->aMap, (size_t)p->nMap);
+    sqlite3_free(p->zFile);
+    sqlite3_free(p->aEntry);
+    sqlite3_free(p->aHash);
+    sqlite3_free(p->aSort);
+    sqlite3_free(p);
+  }
+}
+#endif
+// End Android Add
 /* 
 ** Cursor type for zipfile tables.
 */
@@ -9575,12 +10588,27 @@ struct ZipfileCsr {
   FILE *pFile;               /* Zip file */
   i64 iNextOff;              /* Offset of next record in central directory */
   ZipfileEOCD eocd;          /* Parse of central directory record */
+// Begin Android Add
+#ifdef SHELL_MMAP
+  ZipfileMap *pMap;          /* Mapped archive being scanned, or NULL */
+  int *aiRow;                /* Entries to visit, or NULL to visit them all */
+  int nRow;                  /* Number of entries to visit */
+  int iRow;                  /* Index of next entry to visit */
+  ZipfileMap **apUsed;       /* Every archive mapped since zipfileOpen() */
+  int nUsed;                 /* Number of entries in apUsed[] */
+#endif
+// End Android Add
 
   ZipfileEntry *pFreeEntry;  /* Free this list when cursor is closed or reset */
   ZipfileEntry *pCurrent;    /* Current entry */
   ZipfileCsr *pCsrNext;      /* Next cursor on same virtual table */
 };
 
+// Begin Android Add
+#ifdef SHELL_THREADS
+typedef struct ZipfilePool ZipfilePool;
+#endif
+// End Android Add
 typedef struct ZipfileTab ZipfileTab;
 struct ZipfileTab {
   sqlite3_vtab base;         /* Base class - must be first */
@@ -9597,8 +10625,23 @@ struct ZipfileTab {
   FILE *pWriteFd;            /* File handle open on zip archive */
   i64 szCurrent;             /* Current size of zip archive */
   i64 szOrig;                /* Size of archive at start of transaction */
+// Begin Android Add
+#ifdef SHELL_THREADS
+  ZipfilePool *pPool;        /* Workers compressing new entries, or NULL */
+  u8 bPoolTried;             /* True once zipfilePoolNew() has been tried */
+#endif
+#ifdef SHELL_MMAP
+  ZipfileMap *pMap;          /* Most recently mapped archive, or NULL */
+#endif
+// End Android Add
 };
 
+// Begin Android Add
+#ifdef SHELL_THREADS
+static void zipfilePoolFree(ZipfilePool*);
+static int zipfileTabDrain(ZipfileTab*, int);
+#endif
+// End Android Add
 /*
 ** Set the error message contained in context ctx to the results of
 ** vprintf(zFmt, ...).
@@ -9710,6 +10753,13 @@ static void zipfileCleanupTransaction(ZipfileTab *pTab){
   ZipfileEntry *pEntry;
   ZipfileEntry *pNext;
 
+// Begin Android Add
+#ifdef SHELL_THREADS
+  zipfilePoolFree(pTab->pPool);
+  pTab->pPool = 0;
+  pTab->bPoolTried = 0;
+#endif
+// End Android Add
   if( pTab->pWriteFd ){
     fclose(pTab->pWriteFd);
     pTab->pWriteFd = 0;
@@ -9729,6 +10779,11 @@ static void zipfileCleanupTransaction(ZipfileTab *pTab){
 */
 static int zipfileDisconnect(sqlite3_vtab *pVtab){
   zipfileCleanupTransaction((ZipfileTab*)pVtab);
+// Begin Android Add
+#ifdef SHELL_MMAP
+  zipfileMapRelease(((ZipfileTab*)pVtab)->pMap);
+#endif
+// End Android Add
   sqlite3_free(pVtab);
   return SQLITE_OK;
 }
@@ -9766,6 +10821,20 @@ static void zipfileResetCursor(ZipfileCsr *pCsr){
     zipfileEntryFree(pCsr->pCurrent);
     pCsr->pCurrent = 0;
   }
+// Begin Android Add
+#ifdef SHELL_MMAP
+  if( pCsr->pMap ){
+    /* The reference is held in apUsed[] until the cursor is closed */
+    pCsr->pMap = 0;
+    zipfileEntryFree(pCsr->pCurrent);
+    pCsr->pCurrent = 0;
+  }
+  sqlite3_free(pCsr->aiRow);
+  pCsr->aiRow = 0;
+  pCsr->nRow = 0;
+  pCsr->iRow = 0;
+#endif
+// End Android Add
 
   for(p=pCsr->pFreeEntry; p; p=pNext){
     pNext = p->pNext;
@@ -9781,6 +10850,14 @@ static int zipfileClose(sqlite3_vtab_cursor *cur){
   ZipfileTab *pTab = (ZipfileTab*)(pCsr->base.pVtab);
   ZipfileCsr **pp;
   zipfileResetCursor(pCsr);
+// Begin Android Add
+#ifdef SHELL_MMAP
+  while( pCsr->nUsed>0 ){
+    zipfileMapRelease(pCsr->apUsed[--pCsr->nUsed]);
+  }
+  sqlite3_free(pCsr->apUsed);
+#endif
+// End Android Add
 
   /* Remove this cursor from the ZipfileTab.pCsrList list. */
   for(pp=&pTab->pCsrList; *pp!=pCsr; pp=&((*pp)->pCsrNext));
@@ -10194,6 +11271,79 @@ static int zipfileGetEntry(
   return rc;
 }
 
+// Begin Android Add
+#ifdef SHELL_MMAP
+/*
+** Create a ZipfileEntry object for entry iEntry of mapped archive pMap.
+** This is zipfileGetEntry() for a mapped file, except that every read is
+** bounds-checked and ZipfileEntry.aData points into the mapping instead
+** of at a copy of the compressed data. aData is left NULL if the data
+** does not lie within the file.
+*/
+static int zipfileMapEntry(
+  ZipfileTab *pTab,               /* Store any error message here */
+  ZipfileMap *pMap,               /* Mapped archive */
+  int iEntry,                     /* Index of entry in pMap->aEntry[] */
+  ZipfileEntry **ppEntry          /* OUT: Pointer to new object */
+){
+  i64 iOff = pMap->aEntry[iEntry].iOff;
+  u8 *aRead = &pMap->aMap[iOff];
+  char **pzErr = &pTab->base.zErrMsg;
+  int rc = SQLITE_OK;
+  ZipfileEntry *pNew;
+
+  /* The fixed and variable parts of the CDS record were checked to lie
+  ** within the file by zipfileMapOpen() */
+  int nFile = zipfileGetU16(&aRead[ZIPFILE_CDS_NFILE_OFF]);
+  int nExtra = zipfileGetU16(&aRead[ZIPFILE_CDS_NFILE_OFF+2]);
+  nExtra += zipfileGetU16(&aRead[ZIPFILE_CDS_NFILE_OFF+4]);
+
+  pNew = (ZipfileEntry*)sqlite3_malloc64(sizeof(ZipfileEntry) + nExtra);
+  if( pNew==0 ) return SQLITE_NOMEM;
+  memset(pNew, 0, sizeof(ZipfileEntry));
+  rc = zipfileReadCDS(aRead, &pNew->cds);
+  if( rc!=SQLITE_OK ){
+    *pzErr = sqlite3_mprintf("failed to read CDS at offset %lld", iOff);
+  }else{
+    aRead += ZIPFILE_CDS_FIXED_SZ;
+    pNew->cds.zFile = sqlite3_mprintf("%.*s", nFile, aRead);
+    pNew->aExtra = (u8*)&pNew[1];
+    memcpy(pNew->aExtra, &aRead[nFile], nExtra);
+    if( pNew->cds.zFile==0 ){
+      rc = SQLITE_NOMEM;
+    }else if( 0==zipfileScanExtra(pNew->aExtra, pNew->cds.nExtra,
+                                  &pNew->mUnixTime) ){
+      pNew->mUnixTime = zipfileMtime(&pNew->cds);
+    }
+  }
+
+  if( rc==SQLITE_OK ){
+    ZipfileLFH lfh;
+    i64 iLfh = pNew->cds.iOffset;
+    if( iLfh+ZIPFILE_LFH_FIXED_SZ>pMap->nMap ){
+      rc = SQLITE_ERROR;
+    }else{
+      rc = zipfileReadLFH(&pMap->aMap[iLfh], &lfh);
+    }
+    if( rc==SQLITE_OK ){
+      pNew->iDataOff = iLfh + ZIPFILE_LFH_FIXED_SZ + lfh.nFile + lfh.nExtra;
+      if( pNew->iDataOff+pNew->cds.szCompressed<=pMap->nMap ){
+        pNew->aData = &pMap->aMap[pNew->iDataOff];
+      }
+    }else{
+      *pzErr = sqlite3_mprintf("failed to read LFH at offset %d", (int)iLfh);
+    }
+  }
+
+  if( rc!=SQLITE_OK ){
+    zipfileEntryFree(pNew);
+  }else{
+    *ppEntry = pNew;
+  }
+  return rc;
+}
+#endif
+// End Android Add
 /*
 ** Advance an ZipfileCsr to its next row of output.
 */
@@ -10201,6 +11351,35 @@ static int zipfileNext(sqlite3_vtab_cursor *cur){
   ZipfileCsr *pCsr = (ZipfileCsr*)cur;
   int rc = SQLITE_OK;
 
+// Begin Android Add
+#ifdef SHELL_MMAP
+  if( pCsr->pMap ){
+    ZipfileMap *pMap = pCsr->pMap;
+    ZipfileTab *pTab = (ZipfileTab*)(cur->pVtab);
+    zipfileEntryFree(pCsr->pCurrent);
+    pCsr->pCurrent = 0;
+    if( pCsr->iRow<pCsr->nRow ){
+      int iEntry = pCsr->aiRow ? pCsr->aiRow[pCsr->iRow] : pCsr->iRow;
+      pCsr->iRow++;
+      rc = zipfileMapEntry(pTab, pMap, iEntry, &pCsr->pCurrent);
+    }else if( pMap->iCorrupt>=0 ){
+      /* Report a damaged central directory once the readable part of it
+      ** has been returned, as the fread() based scan below would */
+      if( pMap->bShort ){
+        pTab->base.zErrMsg = sqlite3_mprintf("error in fread()");
+      }else{
+        pTab->base.zErrMsg = sqlite3_mprintf(
+            "failed to read CDS at offset %lld", pMap->iCorrupt
+        );
+      }
+      rc = SQLITE_ERROR;
+    }else{
+      pCsr->bEof = 1;
+    }
+    return rc;
+  }
+#endif
+// End Android Add
   if( pCsr->pFile ){
     i64 iEof = pCsr->eocd.iOffset + pCsr->eocd.nSize;
     zipfileEntryFree(pCsr->pCurrent);
@@ -10328,16 +11507,314 @@ static int zipfileDeflate(
 }
 
 
+// Begin Android Add
+#ifdef SHELL_THREADS
+/*
+** Worker threads that deflate or inflate archive entries while the caller
+** carries on reading input.  INSERT INTO a zipfile table, the zipfile()
+** aggregate and ".archive --extract" use them.  Jobs are handed back to
+** the caller in the order they were submitted, so local file headers and
+** the central directory are written in the same order, and as the same
+** bytes, as without workers.
+*/
+#define ZIPFILE_JOB_NONE     0     /* Nothing to compute */
+#define ZIPFILE_JOB_STORE    1     /* Compute the crc32 of aIn[] */
+#define ZIPFILE_JOB_DEFLATE  2     /* Deflate aIn[] and compute its crc32 */
+#define ZIPFILE_JOB_AUTO     3     /* As DEFLATE, but store if not smaller */
+#define ZIPFILE_JOB_INFLATE  4     /* Inflate aIn[] into nOut bytes */
+
+#define ZIPFILE_POOL_MAXJOB   64         /* Most unfinished jobs per thread */
+#define ZIPFILE_POOL_MAXBYTE  (64<<20)   /* Most input bytes not taken back */
+
+typedef struct ZipfileJob ZipfileJob;
+struct ZipfileJob {
+  int eJob;                  /* One of the ZIPFILE_JOB_* values */
+  ZipfileEntry *pEntry;      /* Archive entry this job is for */
+  u8 bFreeEntry;             /* True if the job owns pEntry */
+  u8 bNoData;                /* True if the entry has no data at all */
+  u8 *aIn;                   /* Input data, part of this allocation */
+  int nIn;                   /* Size of aIn[] in bytes */
+  u8 *aOut;                  /* Output data, from sqlite3_malloc() */
+  int nOut;                  /* Size of aOut[] in bytes */
+  u32 iCrc32;                /* crc32 of the uncompressed data */
+  int rc;                    /* SQLite error code */
+  char *zErr;                /* Error message, from sqlite3_malloc() */
+  int bDone;                 /* True once a worker has finished the job */
+  ZipfileJob *pNext;         /* Next job in submission order */
+};
+
+struct ZipfilePool {
+  pthread_mutex_t mutex;     /* Protects everything below */
+  pthread_cond_t condWork;   /* Signalled when a job is submitted */
+  pthread_cond_t condDone;   /* Signalled when a job is finished */
+  pthread_t *aThread;        /* Worker threads */
+  int nThread;               /* Number of entries in aThread[] */
+  int bShutdown;             /* True to ask the workers to exit */
+  ZipfileJob *pFirst;        /* Oldest job not yet taken back */
+  ZipfileJob *pLast;         /* Newest job */
+  ZipfileJob *pTodo;         /* Oldest job that no worker has started */
+  int nJob;                  /* Jobs not yet taken back */
+  i64 nByte;                 /* Input bytes of jobs not yet taken back */
+};
+
 /*
-** Return values of columns for the row at which the series_cursor
-** is currently pointing.
+** Number of worker threads, or 0 for one per online CPU.  ".archive
+** --jobs N" sets this for the duration of the command.
 */
-static int zipfileColumn(
-  sqlite3_vtab_cursor *cur,   /* The cursor */
-  sqlite3_context *ctx,       /* First argument to sqlite3_result_...() */
-  int i                       /* Which column to return */
-){
-  ZipfileCsr *pCsr = (ZipfileCsr*)cur;
+static int zipfileNJob = 0;
+
+/*
+** Inflate the nIn bytes at aIn into a new buffer of exactly nOut bytes and
+** set *paOut to point to it.  Return SQLITE_OK, or an error code after
+** setting *pzErr to an error message.
+*/
+static int zipfileInflateBuffer(
+  const u8 *aIn, int nIn,         /* Compressed data */
+  int nOut,                       /* Expected uncompressed size */
+  u8 **paOut,                     /* OUT: Uncompressed data */
+  char **pzErr                    /* OUT: Error message */
+){
+  int rc = SQLITE_OK;
+  u8 *aOut = sqlite3_malloc(nOut>0 ? nOut : 1);
+  if( aOut==0 ){
+    rc = SQLITE_NOMEM;
+  }else{
+    int err;
+    z_stream str;
+    memset(&str, 0, sizeof(str));
+    str.next_in = (Byte*)aIn;
+    str.avail_in = nIn;
+    str.next_out = (Byte*)aOut;
+    str.avail_out = nOut;
+    err = inflateInit2(&str, -15);
+    if( err!=Z_OK ){
+      *pzErr = sqlite3_mprintf("inflateInit2() failed (%d)", err);
+      rc = SQLITE_ERROR;
+    }else{
+      err = inflate(&str, Z_NO_FLUSH);
+      if( err!=Z_STREAM_END ){
+        *pzErr = sqlite3_mprintf("inflate() failed (%d)", err);
+        rc = SQLITE_ERROR;
+      }
+      inflateEnd(&str);
+    }
+  }
+  if( rc==SQLITE_OK ){
+    *paOut = aOut;
+  }else{
+    sqlite3_free(aOut);
+  }
+  return rc;
+}
+
+/*
+** Allocate a job of type eJob for entry pEntry, with a copy of the nIn
+** bytes at aIn as its input.  Return NULL if out of memory.
+*/
+static ZipfileJob *zipfileJobNew(
+  int eJob,
+  ZipfileEntry *pEntry,
+  const u8 *aIn,
+  int nIn
+){
+  ZipfileJob *pJob = sqlite3_malloc64(sizeof(ZipfileJob) + nIn);
+  if( pJob ){
+    memset(pJob, 0, sizeof(ZipfileJob));
+    pJob->eJob = eJob;
+    pJob->pEntry = pEntry;
+    pJob->aIn = (u8*)&pJob[1];
+    pJob->nIn = nIn;
+    if( nIn>0 ) memcpy(pJob->aIn, aIn, nIn);
+  }
+  return pJob;
+}
+
+static void zipfileJobFree(ZipfileJob *pJob){
+  if( pJob ){
+    if( pJob->bFreeEntry ) zipfileEntryFree(pJob->pEntry);
+    sqlite3_free(pJob->aOut);
+    sqlite3_free(pJob->zErr);
+    sqlite3_free(pJob);
+  }
+}
+
+/* Do the work of a job.  This runs on a worker thread. */
+static void zipfileJobRun(ZipfileJob *pJob){
+  switch( pJob->eJob ){
+    case ZIPFILE_JOB_STORE:
+      pJob->iCrc32 = crc32(0, pJob->aIn, pJob->nIn);
+      break;
+    case ZIPFILE_JOB_DEFLATE:
+    case ZIPFILE_JOB_AUTO:
+      pJob->iCrc32 = crc32(0, pJob->aIn, pJob->nIn);
+      pJob->rc = zipfileDeflate(pJob->aIn, pJob->nIn,
+          &pJob->aOut, &pJob->nOut, &pJob->zErr
+      );
+      break;
+    case ZIPFILE_JOB_INFLATE:
+      pJob->rc = zipfileInflateBuffer(pJob->aIn, pJob->nIn, pJob->nOut,
+          &pJob->aOut, &pJob->zErr
+      );
+      break;
+  }
+}
+
+/*
+** Set *paData and *pnData to the bytes to store in the archive for the
+** entry of finished job pJob, and return its compression method.
+*/
+static int zipfileJobData(ZipfileJob *pJob, const u8 **paData, int *pnData){
+  if( pJob->eJob==ZIPFILE_JOB_DEFLATE
+   || (pJob->eJob==ZIPFILE_JOB_AUTO && pJob->nOut<pJob->nIn)
+  ){
+    *paData = pJob->aOut;
+    *pnData = pJob->nOut;
+    return 8;
+  }
+  *paData = pJob->aIn;
+  *pnData = pJob->nIn;
+  return 0;
+}
+
+static void *zipfilePoolWorker(void *pArg){
+  ZipfilePool *pPool = (ZipfilePool*)pArg;
+  pthread_mutex_lock(&pPool->mutex);
+  while( 1 ){
+    ZipfileJob *pJob;
+    while( !pPool->bShutdown && pPool->pTodo==0 ){
+      pthread_cond_wait(&pPool->condWork, &pPool->mutex);
+    }
+    if( pPool->bShutdown ) break;
+    pJob = pPool->pTodo;
+    pPool->pTodo = pJob->pNext;
+    pthread_mutex_unlock(&pPool->mutex);
+    zipfileJobRun(pJob);
+    pthread_mutex_lock(&pPool->mutex);
+    pJob->bDone = 1;
+    pthread_cond_broadcast(&pPool->condDone);
+  }
+  pthread_mutex_unlock(&pPool->mutex);
+  return 0;
+}
+
+/*
+** Start a pool of zipfileNJob worker threads.  Return NULL if that would
+** be a single thread, or if the pool cannot be started, in which case the
+** caller does the work itself.
+*/
+static ZipfilePool *zipfilePoolNew(void){
+  ZipfilePool *pPool;
+  int nThread = zipfileNJob;
+  int i;
+  if( nThread<=0 ){
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    nThread = n>0 ? (int)n : 1;
+  }
+  if( nThread<=1 ) return 0;
+  pPool = sqlite3_malloc64(sizeof(ZipfilePool) + nThread*sizeof(pthread_t));
+  if( pPool==0 ) return 0;
+  memset(pPool, 0, sizeof(ZipfilePool));
+  pPool->aThread = (pthread_t*)&pPool[1];
+  pthread_mutex_init(&pPool->mutex, 0);
+  pthread_cond_init(&pPool->condWork, 0);
+  pthread_cond_init(&pPool->condDone, 0);
+  for(i=0; i<nThread; i++){
+    if( pthread_create(&pPool->aThread[i], 0, zipfilePoolWorker, pPool) ){
+      break;
+    }
+  }
+  pPool->nThread = i;
+  if( i==0 ){
+    pthread_cond_destroy(&pPool->condDone);
+    pthread_cond_destroy(&pPool->condWork);
+    pthread_mutex_destroy(&pPool->mutex);
+    sqlite3_free(pPool);
+    pPool = 0;
+  }
+  return pPool;
+}
+
+/* Queue job pJob, which now belongs to the pool, behind all others. */
+static void zipfilePoolSubmit(ZipfilePool *pPool, ZipfileJob *pJob){
+  pthread_mutex_lock(&pPool->mutex);
+  if( pPool->pLast ){
+    pPool->pLast->pNext = pJob;
+  }else{
+    pPool->pFirst = pJob;
+  }
+  pPool->pLast = pJob;
+  if( pPool->pTodo==0 ) pPool->pTodo = pJob;
+  pPool->nJob++;
+  pPool->nByte += pJob->nIn;
+  pthread_cond_signal(&pPool->condWork);
+  pthread_mutex_unlock(&pPool->mutex);
+}
+
+/*
+** Remove the oldest job from pPool and return it once it is finished.  If
+** the oldest job is not finished, wait for it if bWait is true or if too
+** many jobs are queued, and otherwise return NULL.  Also return NULL if
+** there are no jobs at all.
+*/
+static ZipfileJob *zipfilePoolTake(ZipfilePool *pPool, int bWait){
+  ZipfileJob *pJob;
+  pthread_mutex_lock(&pPool->mutex);
+  if( pPool->nJob>=ZIPFILE_POOL_MAXJOB*pPool->nThread
+   || pPool->nByte>=ZIPFILE_POOL_MAXBYTE
+  ){
+    bWait = 1;
+  }
+  while( (pJob = pPool->pFirst)!=0 && !pJob->bDone && bWait ){
+    pthread_cond_wait(&pPool->condDone, &pPool->mutex);
+  }
+  if( pJob && pJob->bDone ){
+    pPool->pFirst = pJob->pNext;
+    if( pPool->pFirst==0 ) pPool->pLast = 0;
+    pPool->nJob--;
+    pPool->nByte -= pJob->nIn;
+    pJob->pNext = 0;
+  }else{
+    pJob = 0;
+  }
+  pthread_mutex_unlock(&pPool->mutex);
+  return pJob;
+}
+
+/* Stop the workers of pPool and free it along with any jobs left. */
+static void zipfilePoolFree(ZipfilePool *pPool){
+  if( pPool ){
+    ZipfileJob *pJob;
+    ZipfileJob *pNext;
+    int i;
+    pthread_mutex_lock(&pPool->mutex);
+    pPool->bShutdown = 1;
+    pthread_cond_broadcast(&pPool->condWork);
+    pthread_mutex_unlock(&pPool->mutex);
+    for(i=0; i<pPool->nThread; i++){
+      pthread_join(pPool->aThread[i], 0);
+    }
+    for(pJob=pPool->pFirst; pJob; pJob=pNext){
+      pNext = pJob->pNext;
+      zipfileJobFree(pJob);
+    }
+    pthread_cond_destroy(&pPool->condDone);
+    pthread_cond_destroy(&pPool->condWork);
+    pthread_mutex_destroy(&pPool->mutex);
+    sqlite3_free(pPool);
+  }
+}
+#endif /* SHELL_THREADS */
+// End Android Add
+/*
+** Return values of columns for the row at which the series_cursor
+** is currently pointing.
+*/
+static int zipfileColumn(
+  sqlite3_vtab_cursor *cur,   /* The cursor */
+  sqlite3_context *ctx,       /* First argument to sqlite3_result_...() */
+  int i                       /* Which column to return */
+){
+  ZipfileCsr *pCsr = (ZipfileCsr*)cur;
   ZipfileCDS *pCDS = &pCsr->pCurrent->cds;
   int rc = SQLITE_OK;
   switch( i ){
@@ -10370,6 +11847,15 @@ static int zipfileColumn(
           u8 *aFree = 0;
           if( pCsr->pCurrent->aData ){
             aBuf = pCsr->pCurrent->aData;
+// Begin Android Add
+#ifdef SHELL_MMAP
+          }else if( pCsr->pMap ){
+            /* Data runs past the end of the mapped file */
+            aBuf = 0;
+            zipfileCursorErr(pCsr, "error in fread()");
+            rc = SQLITE_ERROR;
+#endif
+// End Android Add
           }else{
             aBuf = aFree = sqlite3_malloc64(sz);
             if( aBuf==0 ){
@@ -10387,6 +11873,14 @@ static int zipfileColumn(
           if( rc==SQLITE_OK ){
             if( i==5 && pCDS->iCompression ){
               zipfileInflate(ctx, aBuf, sz, szFinal);
+// Begin Android Add
+#ifdef SHELL_MMAP
+            }else if( pCsr->pMap ){
+              /* The mapping outlives the cursor's use of it, see
+              ** zipfileMapFilter() */
+              sqlite3_result_blob(ctx, aBuf, sz, SQLITE_STATIC);
+#endif
+// End Android Add
             }else{
               sqlite3_result_blob(ctx, aBuf, sz, SQLITE_TRANSIENT);
             }
@@ -10545,6 +12039,358 @@ static int zipfileLoadDirectory(ZipfileTab *pTab, const u8 *aBlob, int nBlob){
   return rc;
 }
 
+// Begin Android Add
+/*
+** Bits of the xBestIndex idxNum value. ZIPFILE_IDX_FILE means the "file"
+** argument is in argv[0]. At most one of the others is set, in which
+** case the value compared with column "name" follows it in argv[].
+*/
+#define ZIPFILE_IDX_FILE  0x01    /* file = ? */
+#define ZIPFILE_IDX_EQ    0x02    /* name = ? */
+#define ZIPFILE_IDX_GLOB  0x04    /* name GLOB ? */
+#define ZIPFILE_IDX_LIKE  0x08    /* name LIKE ? */
+
+#ifdef SHELL_MMAP
+/*
+** Return a pointer to the name of entry iEntry of mapped archive pMap.
+*/
+static const char *zipfileMapName(ZipfileMap *pMap, int iEntry){
+  return (const char*)&pMap->aMap[pMap->aEntry[iEntry].iOff
+                                  + ZIPFILE_CDS_FIXED_SZ];
+}
+
+/*
+** Return a hash of the n byte name z.
+*/
+static u32 zipfileMapHash(const u8 *z, int n){
+  u32 h = 2166136261u;
+  int i;
+  for(i=0; i<n; i++){
+    h = (h ^ z[i]) * 16777619u;
+  }
+  return h;
+}
+
+/*
+** Compare the name of entry iEntry with the n byte string z, folding the
+** case of ASCII characters. Return negative, zero or positive if the name
+** sorts before, the same as or after z.
+*/
+static int zipfileMapCompare(ZipfileMap *pMap, int iEntry, const u8 *z, int n){
+  int nName = pMap->aEntry[iEntry].nName;
+  int c = sqlite3_strnicmp(zipfileMapName(pMap, iEntry), (const char*)z,
+                           MIN(nName, n));
+  return c ? c : nName - n;
+}
+
+/*
+** Sort the n indexes in aIdx[] by the names of the entries they refer
+** to. aTmp[] is scratch space of the same size.
+*/
+static void zipfileMapSort(ZipfileMap *pMap, int *aIdx, int *aTmp, int n){
+  int nRun;
+  for(nRun=1; nRun<n; nRun*=2){
+    int i;
+    for(i=0; i<n; i+=2*nRun){
+      int iL = i;
+      int iR = MIN(i+nRun, n);
+      int iEnd = MIN(i+2*nRun, n);
+      int iMid = iR;
+      int iOut = i;
+      while( iL<iMid || iR<iEnd ){
+        if( iR>=iEnd || (iL<iMid && zipfileMapCompare(pMap, aIdx[iL],
+            (const u8*)zipfileMapName(pMap, aIdx[iR]),
+            pMap->aEntry[aIdx[iR]].nName)<=0)
+        ){
+          aTmp[iOut++] = aIdx[iL++];
+        }else{
+          aTmp[iOut++] = aIdx[iR++];
+        }
+      }
+    }
+    memcpy(aIdx, aTmp, n*sizeof(int));
+  }
+}
+
+/*
+** Parse the central directory of mapped archive pMap, which is described
+** by EOCD record pEOCD, into pMap->aEntry[], aHash[] and aSort[]. Parsing
+** stops at the first CDS record that cannot be read, leaving its offset
+** in pMap->iCorrupt.
+*/
+static int zipfileMapIndex(ZipfileMap *pMap, ZipfileEOCD *pEOCD){
+  const u8 *aMap = pMap->aMap;
+  i64 iOff = pEOCD->iOffset;
+  i64 iEof = iOff + pEOCD->nSize;
+  i64 nMax;
+  int *aTmp;
+  int i;
+
+  if( pEOCD->nEntry==0 ) return SQLITE_OK;
+
+  /* Every CDS record is at least ZIPFILE_CDS_FIXED_SZ bytes in size */
+  nMax = (MIN(iEof, pMap->nMap) - iOff) / ZIPFILE_CDS_FIXED_SZ + 1;
+  if( nMax<1 ) nMax = 1;
+  pMap->aEntry = sqlite3_malloc64(nMax*sizeof(ZipfileMapEntry));
+  if( pMap->aEntry==0 ) return SQLITE_NOMEM;
+
+  while( iOff<iEof ){
+    const u8 *a = &aMap[iOff];
+    ZipfileMapEntry *pEntry;
+    int nFile;
+    i64 nRecord;
+    if( iOff+ZIPFILE_CDS_FIXED_SZ>pMap->nMap
+     || zipfileGetU32(a)!=ZIPFILE_SIGNATURE_CDS
+    ){
+      pMap->iCorrupt = iOff;
+      pMap->bShort = (iOff+ZIPFILE_CDS_FIXED_SZ>pMap->nMap);
+      break;
+    }
+    nFile = zipfileGetU16(&a[ZIPFILE_CDS_NFILE_OFF]);
+    nRecord = ZIPFILE_CDS_FIXED_SZ + nFile
+            + zipfileGetU16(&a[ZIPFILE_CDS_NFILE_OFF+2])
+            + zipfileGetU16(&a[ZIPFILE_CDS_NFILE_OFF+4]);
+    if( iOff+nRecord>pMap->nMap ){
+      pMap->iCorrupt = iOff;
+      pMap->bShort = 1;
+      break;
+    }
+    assert( pMap->nEntry<nMax );
+    pEntry = &pMap->aEntry[pMap->nEntry++];
+    pEntry->iOff = iOff;
+    pEntry->nName = nFile;
+    a = memchr(&a[ZIPFILE_CDS_FIXED_SZ], 0, nFile);
+    if( a ) pEntry->nName = (int)(a - &aMap[iOff + ZIPFILE_CDS_FIXED_SZ]);
+    iOff += nRecord;
+  }
+
+  pMap->nHash = 16;
+  while( pMap->nHash<2*pMap->nEntry ) pMap->nHash *= 2;
+  pMap->aHash = sqlite3_malloc64(pMap->nHash*sizeof(int));
+  pMap->aSort = sqlite3_malloc64(pMap->nEntry*sizeof(int)+1);
+  aTmp = sqlite3_malloc64(pMap->nEntry*sizeof(int)+1);
+  if( pMap->aHash==0 || pMap->aSort==0 || aTmp==0 ){
+    sqlite3_free(aTmp);
+    return SQLITE_NOMEM;
+  }
+  memset(pMap->aHash, 0xff, pMap->nHash*sizeof(int));
+
+  /* Insert in reverse so that each hash chain is in file order */
+  for(i=pMap->nEntry-1; i>=0; i--){
+    ZipfileMapEntry *pEntry = &pMap->aEntry[i];
+    u32 h = zipfileMapHash((const u8*)zipfileMapName(pMap, i), pEntry->nName);
+    pEntry->iHashNext = pMap->aHash[h & (pMap->nHash-1)];
+    pMap->aHash[h & (pMap->nHash-1)] = i;
+  }
+  for(i=0; i<pMap->nEntry; i++) pMap->aSort[i] = i;
+  zipfileMapSort(pMap, pMap->aSort, aTmp, pMap->nEntry);
+  sqlite3_free(aTmp);
+  return SQLITE_OK;
+}
+
+/*
+** Set *ppMap to a new reference to a ZipfileMap for file zFile, reusing
+** the one cached on pTab if the file has not changed since it was
+** mapped. *ppMap is left NULL, and SQLITE_OK returned, if the file
+** cannot be mapped. The caller then falls back to reading it with
+** fread(). An SQLite error code is returned if the archive is not
+** readable.
+*/
+static int zipfileMapOpen(ZipfileTab *pTab, const char *zFile,
+                          ZipfileMap **ppMap){
+  ZipfileMap *pMap = pTab->pMap;
+  ZipfileEOCD eocd;
+  struct stat st;
+  void *aMap;
+  int fd;
+  int rc;
+
+  *ppMap = 0;
+  if( stat(zFile, &st)!=0 ) return SQLITE_OK;
+  if( pMap
+   && strcmp(pMap->zFile, zFile)==0
+   && pMap->st.st_dev==st.st_dev && pMap->st.st_ino==st.st_ino
+   && pMap->st.st_size==st.st_size
+   && pMap->st.st_mtime==st.st_mtime && pMap->st.st_ctime==st.st_ctime
+  ){
+    pMap->nRef++;
+    *ppMap = pMap;
+    return SQLITE_OK;
+  }
+
+  fd = open(zFile, O_RDONLY);
+  if( fd<0 ) return SQLITE_OK;
+  if( fstat(fd, &st)!=0 || !S_ISREG(st.st_mode)
+   || st.st_size==0 || st.st_size>0x7fffffff
+  ){
+    close(fd);
+    return SQLITE_OK;
+  }
+  aMap = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if( aMap==MAP_FAILED ) return SQLITE_OK;
+
+  pMap = (ZipfileMap*)sqlite3_malloc(sizeof(ZipfileMap));
+  if( pMap==0 ){
+    munmap(aMap, (size_t)st.st_size);
+    return SQLITE_NOMEM;
+  }
+  memset(pMap, 0, sizeof(ZipfileMap));
+  pMap->nRef = 1;
+  pMap->st = st;
+  pMap->aMap = (u8*)aMap;
+  pMap->nMap = st.st_size;
+  pMap->iCorrupt = -1;
+  pMap->zFile = sqlite3_mprintf("%s", zFile);
+  if( pMap->zFile==0 ){
+    rc = SQLITE_NOMEM;
+  }else{
+    rc = zipfileReadEOCD(pTab, pMap->aMap, (int)pMap->nMap, 0, &eocd);
+  }
+  if( rc==SQLITE_OK ) rc = zipfileMapIndex(pMap, &eocd);
+  if( rc!=SQLITE_OK ){
+    zipfileMapRelease(pMap);
+    return rc;
+  }
+
+  zipfileMapRelease(pTab->pMap);
+  pTab->pMap = pMap;
+  pMap->nRef++;
+  *ppMap = pMap;
+  return SQLITE_OK;
+}
+
+static int zipfileMapCmpInt(const void *a, const void *b){
+  return *(const int*)a - *(const int*)b;
+}
+
+/*
+** Restrict the scan of cursor pCsr to entries whose names may satisfy
+** the constraint on column "name" identified by idxNum, where pVal is
+** the right-hand operand. SQLite still evaluates the constraint itself,
+** so the entries selected need only be a superset of the matches. They
+** are visited in file order, as a full scan would.
+*/
+static int zipfileMapFind(ZipfileCsr *pCsr, int idxNum, sqlite3_value *pVal){
+  ZipfileMap *pMap = pCsr->pMap;
+  const u8 *z = sqlite3_value_text(pVal);
+  int n = sqlite3_value_bytes(pVal);
+  int nRow = 0;
+  int i;
+
+  if( z==0 ){
+    /* NULL never compares equal to or matches anything */
+    if( sqlite3_value_type(pVal)!=SQLITE_NULL ) return SQLITE_NOMEM;
+    pCsr->nRow = 0;
+    return SQLITE_OK;
+  }
+  if( pMap->nEntry==0 ) return SQLITE_OK;
+
+  if( idxNum & ZIPFILE_IDX_EQ ){
+    u32 h = zipfileMapHash(z, n) & (pMap->nHash-1);
+    for(i=pMap->aHash[h]; i>=0; i=pMap->aEntry[i].iHashNext){
+      if( pMap->aEntry[i].nName==n
+       && memcmp(zipfileMapName(pMap, i), z, n)==0
+      ){
+        nRow++;
+      }
+    }
+    pCsr->aiRow = (int*)sqlite3_malloc64(nRow*sizeof(int)+1);
+    if( pCsr->aiRow==0 ) return SQLITE_NOMEM;
+    nRow = 0;
+    for(i=pMap->aHash[h]; i>=0; i=pMap->aEntry[i].iHashNext){
+      if( pMap->aEntry[i].nName==n
+       && memcmp(zipfileMapName(pMap, i), z, n)==0
+      ){
+        pCsr->aiRow[nRow++] = i;
+      }
+    }
+  }else{
+    /* Find the literal prefix of the pattern. LIKE folds ASCII case only,
+    ** so stop at the first non-ASCII byte in case an extension such as
+    ** ICU has overridden it. */
+    int nPrefix;
+    int iFirst;
+    int lo = 0;
+    int hi = pMap->nEntry;
+    for(nPrefix=0; nPrefix<n; nPrefix++){
+      u8 c = z[nPrefix];
+      if( idxNum & ZIPFILE_IDX_GLOB ){
+        if( c=='*' || c=='?' || c=='[' ) break;
+      }else{
+        if( c=='%' || c=='_' || c>=0x80 ) break;
+      }
+    }
+    if( nPrefix==0 ) return SQLITE_OK;
+
+    while( lo<hi ){
+      int mid = (lo+hi)/2;
+      if( zipfileMapCompare(pMap, pMap->aSort[mid], z, nPrefix)<0 ){
+        lo = mid+1;
+      }else{
+        hi = mid;
+      }
+    }
+    for(iFirst=lo; lo<pMap->nEntry; lo++){
+      int iEntry = pMap->aSort[lo];
+      if( pMap->aEntry[iEntry].nName<nPrefix
+       || sqlite3_strnicmp(zipfileMapName(pMap, iEntry), (const char*)z,
+                           nPrefix)
+      ){
+        break;
+      }
+    }
+    nRow = lo - iFirst;
+    pCsr->aiRow = (int*)sqlite3_malloc64(nRow*sizeof(int)+1);
+    if( pCsr->aiRow==0 ) return SQLITE_NOMEM;
+    memcpy(pCsr->aiRow, &pMap->aSort[iFirst], nRow*sizeof(int));
+    qsort(pCsr->aiRow, nRow, sizeof(int), zipfileMapCmpInt);
+  }
+  pCsr->nRow = nRow;
+  return SQLITE_OK;
+}
+
+/*
+** Start a scan of file zFile on cursor pCsr using a mapping of it. If
+** the file cannot be mapped, return SQLITE_OK with pCsr->pMap left NULL.
+*/
+static int zipfileMapFilter(
+  ZipfileCsr *pCsr,
+  const char *zFile,
+  int idxNum,
+  sqlite3_value *pName            /* Operand of constraint on "name" */
+){
+  ZipfileTab *pTab = (ZipfileTab*)pCsr->base.pVtab;
+  ZipfileMap *pMap = 0;
+  int rc;
+
+  rc = zipfileMapOpen(pTab, zFile, &pMap);
+  if( rc!=SQLITE_OK || pMap==0 ) return rc;
+
+  /* Keep a reference to each mapping until the cursor is closed, as
+  ** values returned with SQLITE_STATIC may still point into it */
+  if( pCsr->nUsed>0 && pCsr->apUsed[pCsr->nUsed-1]==pMap ){
+    zipfileMapRelease(pMap);
+  }else{
+    ZipfileMap **apNew = (ZipfileMap**)sqlite3_realloc64(
+        pCsr->apUsed, (pCsr->nUsed+1)*sizeof(ZipfileMap*)
+    );
+    if( apNew==0 ){
+      zipfileMapRelease(pMap);
+      return SQLITE_NOMEM;
+    }
+    pCsr->apUsed = apNew;
+    pCsr->apUsed[pCsr->nUsed++] = pMap;
+  }
+
+  pCsr->pMap = pMap;
+  pCsr->nRow = pMap->nEntry;
+  if( pName ) rc = zipfileMapFind(pCsr, idxNum, pName);
+  if( rc==SQLITE_OK ) rc = zipfileNext(&pCsr->base);
+  return rc;
+}
+#endif
+// End Android Add
 /*
 ** xFilter callback.
 */
@@ -10563,10 +12409,18 @@ static int zipfileFilter(
   (void)argc;
 
   zipfileResetCursor(pCsr);
+// Begin Android Add
+#ifdef SHELL_THREADS
+  rc = zipfileTabDrain(pTab, 1);
+  if( rc!=SQLITE_OK ) return rc;
+#endif
+// End Android Add
 
   if( pTab->zFile ){
     zFile = pTab->zFile;
-  }else if( idxNum==0 ){
+// Begin Android Add
+  }else if( (idxNum & ZIPFILE_IDX_FILE)==0 ){
+// End Android Add
     zipfileCursorErr(pCsr, "zipfile() function requires an argument");
     return SQLITE_ERROR;
   }else if( sqlite3_value_type(argv[0])==SQLITE_BLOB ){
@@ -10588,6 +12442,18 @@ static int zipfileFilter(
   }
 
   if( 0==pTab->pWriteFd && 0==bInMemory ){
+// Begin Android Add
+#ifdef SHELL_MMAP
+    if( zFile ){
+      sqlite3_value *pName = 0;
+      if( idxNum & (ZIPFILE_IDX_EQ|ZIPFILE_IDX_GLOB|ZIPFILE_IDX_LIKE) ){
+        pName = argv[(idxNum & ZIPFILE_IDX_FILE) ? 1 : 0];
+      }
+      rc = zipfileMapFilter(pCsr, zFile, idxNum, pName);
+      if( rc!=SQLITE_OK || pCsr->pMap ) return rc;
+    }
+#endif
+// End Android Add
     pCsr->pFile = zFile ? fopen(zFile, "rb") : 0;
     if( pCsr->pFile==0 ){
       zipfileCursorErr(pCsr, "cannot open file: %s", zFile);
@@ -10622,10 +12488,40 @@ static int zipfileBestIndex(
   int i;
   int idx = -1;
   int unusable = 0;
+// Begin Android Add
+#ifdef SHELL_MMAP
+  int iName = -1;                 /* Constraint on "name" to use, or -1 */
+  int eName = 0;                  /* ZIPFILE_IDX_EQ, _GLOB or _LIKE */
+#endif
+// End Android Add
   (void)tab;
 
   for(i=0; i<pIdxInfo->nConstraint; i++){
     const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+// Begin Android Add
+#ifdef SHELL_MMAP
+    /* Constraints on "name" narrow a scan of a mapped archive. Prefer
+    ** equality, which is a hash lookup, to a prefix match. Equality is
+    ** only usable with the BINARY collating sequence. */
+    if( pCons->iColumn==0 && pCons->usable ){
+      int e = 0;
+      if( pCons->op==SQLITE_INDEX_CONSTRAINT_EQ ){
+        const char *zColl = sqlite3_vtab_collation(pIdxInfo, i);
+        if( zColl==0 || sqlite3_stricmp(zColl, "BINARY")==0 ){
+          e = ZIPFILE_IDX_EQ;
+        }
+      }else if( pCons->op==SQLITE_INDEX_CONSTRAINT_GLOB ){
+        e = ZIPFILE_IDX_GLOB;
+      }else if( pCons->op==SQLITE_INDEX_CONSTRAINT_LIKE ){
+        e = ZIPFILE_IDX_LIKE;
+      }
+      if( e && (eName==0 || e<eName) ){
+        iName = i;
+        eName = e;
+      }
+    }
+#endif
+// End Android Add
     if( pCons->iColumn!=ZIPFILE_F_COLUMN_IDX ) continue;
     if( pCons->usable==0 ){
       unusable = 1;
@@ -10641,6 +12537,21 @@ static int zipfileBestIndex(
   }else if( unusable ){
     return SQLITE_CONSTRAINT;
   }
+// Begin Android Add
+#ifdef SHELL_MMAP
+  if( iName>=0 ){
+    pIdxInfo->aConstraintUsage[iName].argvIndex = (idx>=0) ? 2 : 1;
+    pIdxInfo->idxNum |= eName;
+    if( eName==ZIPFILE_IDX_EQ ){
+      pIdxInfo->estimatedCost = 10.0;
+      pIdxInfo->estimatedRows = 1;
+    }else{
+      pIdxInfo->estimatedCost = 100.0;
+      pIdxInfo->estimatedRows = 100;
+    }
+  }
+#endif
+// End Android Add
   return SQLITE_OK;
 }
 
@@ -10854,6 +12765,72 @@ static void zipfileRemoveEntryFromList(ZipfileTab *pTab, ZipfileEntry *pOld){
   }
 }
 
+// Begin Android Add
+#ifdef SHELL_THREADS
+/*
+** Return the worker pool for new entries of pTab, starting it on first
+** use in each transaction, or NULL to compress on this thread.
+*/
+static ZipfilePool *zipfileTabPool(ZipfileTab *pTab){
+  if( pTab->bPoolTried==0 ){
+    pTab->bPoolTried = 1;
+    pTab->pPool = zipfilePoolNew();
+  }
+  return pTab->pPool;
+}
+
+/*
+** Append the local file header and data of each finished job of pTab's
+** pool to the archive, oldest first, stopping at the first unfinished
+** one.  Or, if bAll is true, wait for and append every job.  An entry
+** whose job failed is dropped from the central directory and the error
+** is returned.
+*/
+static int zipfileTabDrain(ZipfileTab *pTab, int bAll){
+  int rc = SQLITE_OK;
+  ZipfileJob *pJob;
+  if( pTab->pPool==0 ) return SQLITE_OK;
+  while( (pJob = zipfilePoolTake(pTab->pPool, bAll))!=0 ){
+    ZipfileEntry *pEntry = pJob->pEntry;
+    if( rc==SQLITE_OK ) rc = pJob->rc;
+    if( pJob->rc==SQLITE_OK ){
+      const u8 *aData;
+      int nData;
+      pEntry->cds.iCompression = (u16)zipfileJobData(pJob, &aData, &nData);
+      pEntry->cds.crc32 = pJob->iCrc32;
+      pEntry->cds.szCompressed = nData;
+      pEntry->cds.iOffset = (u32)pTab->szCurrent;
+      if( rc==SQLITE_OK ) rc = zipfileAppendEntry(pTab, pEntry, aData, nData);
+    }else{
+      ZipfileCsr *pCsr;
+      if( pJob->zErr ){
+        sqlite3_free(pTab->base.zErrMsg);
+        pTab->base.zErrMsg = pJob->zErr;
+        pJob->zErr = 0;
+      }
+      for(pCsr=pTab->pCsrList; pCsr; pCsr=pCsr->pCsrNext){
+        if( pCsr->pCurrent==pEntry ){
+          pCsr->pCurrent = pEntry->pNext;
+          pCsr->bNoop = 1;
+        }
+      }
+      zipfileRemoveEntryFromList(pTab, pEntry);
+    }
+    zipfileJobFree(pJob);
+  }
+  return rc;
+}
+
+/*
+** xSync method.  Finish writing new entries, so that any error is still
+** reported before the transaction commits.
+*/
+static int zipfileSync(sqlite3_vtab *pVtab){
+  return zipfileTabDrain((ZipfileTab*)pVtab, 1);
+}
+#endif /* SHELL_THREADS */
+
+// End Android Add
 /*
 ** xUpdate method.
 */
@@ -10882,6 +12859,12 @@ static int zipfileUpdate(
   int bUpdate = 0;                /* True for an update that modifies "name" */
   int bIsDir = 0;
   u32 iCrc32 = 0;
+// Begin Android Add
+#ifdef SHELL_THREADS
+  ZipfilePool *pPool = 0;         /* Compress on these workers, if not NULL */
+  int eJob = ZIPFILE_JOB_NONE;    /* Job for the workers */
+#endif
+// End Android Add
 
   (void)pRowid;
 
@@ -10894,6 +12877,12 @@ static int zipfileUpdate(
   if( sqlite3_value_type(apVal[0])!=SQLITE_NULL ){
     const char *zDelete = (const char*)sqlite3_value_text(apVal[0]);
     int nDelete = (int)strlen(zDelete);
+// Begin Android Add
+#ifdef SHELL_THREADS
+    rc = zipfileTabDrain(pTab, 1);
+    if( rc!=SQLITE_OK ) return rc;
+#endif
+// End Android Add
     if( nVal>1 ){
       const char *zUpdate = (const char*)sqlite3_value_text(apVal[1]);
       if( zUpdate && zipfileComparePath(zUpdate, zDelete, nDelete)!=0 ){
@@ -10909,6 +12898,12 @@ static int zipfileUpdate(
   }
 
   if( nVal>1 ){
+// Begin Android Add
+#ifdef SHELL_THREADS
+    /* New entries are compressed by the workers and appended in order. */
+    if( pOld==0 ) pPool = zipfileTabPool(pTab);
+#endif
+// End Android Add
     /* Check that "sz" and "rawdata" are both NULL: */
     if( sqlite3_value_type(apVal[5])!=SQLITE_NULL ){
       zipfileTableErr(pTab, "sz must be NULL");
@@ -10937,6 +12932,13 @@ static int zipfileUpdate(
         if( iMethod!=0 && iMethod!=8 ){
           zipfileTableErr(pTab, "unknown compression method: %d", iMethod);
           rc = SQLITE_CONSTRAINT;
+// Begin Android Add
+#ifdef SHELL_THREADS
+        }else if( pPool ){
+          eJob = bAuto ? ZIPFILE_JOB_AUTO :
+                 iMethod ? ZIPFILE_JOB_DEFLATE : ZIPFILE_JOB_STORE;
+#endif
+// End Android Add
         }else{
           if( bAuto || iMethod ){
             int nCmp;
@@ -11025,12 +13027,35 @@ static int zipfileUpdate(
         pNew->cds.iOffset = (u32)pTab->szCurrent;
         pNew->cds.nFile = (u16)nPath;
         pNew->mUnixTime = (u32)mTime;
+// Begin Android Add
+#ifdef SHELL_THREADS
+        if( pPool ){
+          ZipfileJob *pJob = zipfileJobNew(eJob, pNew, pData, nData);
+          if( pJob==0 ){
+            rc = SQLITE_NOMEM;
+          }else{
+            zipfilePoolSubmit(pPool, pJob);
+          }
+        }else
+#endif
+// End Android Add
         rc = zipfileAppendEntry(pTab, pNew, pData, nData);
         zipfileAddEntry(pTab, pOld, pNew);
+// Begin Android Add
+#ifdef SHELL_THREADS
+        if( rc==SQLITE_OK ) rc = zipfileTabDrain(pTab, 0);
+#endif
+// End Android Add
       }
     }
   }
 
+// Begin Android Add
+#ifdef SHELL_THREADS
+  /* pOld2 may still be waiting for a worker. */
+  if( rc==SQLITE_OK && pOld2 ) rc = zipfileTabDrain(pTab, 1);
+#endif
+// End Android Add
   if( rc==SQLITE_OK && (pOld || pOld2) ){
     ZipfileCsr *pCsr;
     for(pCsr=pTab->pCsrList; pCsr; pCsr=pCsr->pCsrNext){
@@ -11128,6 +13153,12 @@ static int zipfileCommit(sqlite3_vtab *pVtab){
     ZipfileEOCD eocd;
     int nEntry = 0;
 
+// Begin Android Add
+#ifdef SHELL_THREADS
+    zipfileTabDrain(pTab, 1);
+    iOffset = pTab->szCurrent;
+#endif
+// End Android Add
     /* Write out all entries */
     for(p=pTab->pFirstEntry; rc==SQLITE_OK && p; p=p->pNext){
       int n = zipfileSerializeCDS(p, pTab->aBuffer);
@@ -11240,6 +13271,12 @@ struct ZipfileCtx {
   int nEntry;
   ZipfileBuffer body;
   ZipfileBuffer cds;
+// Begin Android Add
+#ifdef SHELL_THREADS
+  ZipfilePool *pPool;             /* Workers compressing entries, or NULL */
+  u8 bPoolTried;                  /* True once zipfilePoolNew() was tried */
+#endif
+// End Android Add
 };
 
 static int zipfileBufferGrow(ZipfileBuffer *pBuf, int nByte){
@@ -11257,6 +13294,77 @@ static int zipfileBufferGrow(ZipfileBuffer *pBuf, int nByte){
   return SQLITE_OK;
 }
 
+// Begin Android Add
+/*
+** Append entry pEntry, with the nData bytes of (possibly compressed) data
+** at aData, to the archive being built in p.
+*/
+static int zipfileCtxAppend(
+  ZipfileCtx *p,
+  ZipfileEntry *pEntry,
+  const u8 *aData,
+  int nData
+){
+  int nByte;
+  int rc;
+
+  pEntry->cds.iOffset = p->body.n;
+
+  /* Append the LFH to the body of the new archive */
+  nByte = ZIPFILE_LFH_FIXED_SZ + pEntry->cds.nFile + 9;
+  if( (rc = zipfileBufferGrow(&p->body, nByte)) ) return rc;
+  p->body.n += zipfileSerializeLFH(pEntry, &p->body.a[p->body.n]);
+
+  /* Append the data to the body of the new archive */
+  if( nData>0 ){
+    if( (rc = zipfileBufferGrow(&p->body, nData)) ) return rc;
+    memcpy(&p->body.a[p->body.n], aData, nData);
+    p->body.n += nData;
+  }
+
+  /* Append the CDS record to the directory of the new archive */
+  nByte = ZIPFILE_CDS_FIXED_SZ + pEntry->cds.nFile + 9;
+  if( (rc = zipfileBufferGrow(&p->cds, nByte)) ) return rc;
+  p->cds.n += zipfileSerializeCDS(pEntry, &p->cds.a[p->cds.n]);
+
+  /* Increment the count of entries in the archive */
+  p->nEntry++;
+  return SQLITE_OK;
+}
+
+#ifdef SHELL_THREADS
+/*
+** Append each finished job of p's pool to the archive, oldest first,
+** stopping at the first unfinished one, or if bAll is true waiting for
+** and appending all of them.
+*/
+static int zipfileCtxDrain(ZipfileCtx *p, int bAll, char **pzErr){
+  int rc = SQLITE_OK;
+  ZipfileJob *pJob;
+  if( p->pPool==0 ) return SQLITE_OK;
+  while( (pJob = zipfilePoolTake(p->pPool, bAll))!=0 ){
+    if( rc==SQLITE_OK ){
+      rc = pJob->rc;
+      if( rc==SQLITE_OK ){
+        const u8 *aData;
+        int nData;
+        ZipfileEntry *pEntry = pJob->pEntry;
+        pEntry->cds.iCompression = (u16)zipfileJobData(pJob, &aData, &nData);
+        pEntry->cds.crc32 = pJob->iCrc32;
+        pEntry->cds.szCompressed = nData;
+        rc = zipfileCtxAppend(p, pEntry, aData, nData);
+      }else if( pJob->zErr ){
+        *pzErr = pJob->zErr;
+        pJob->zErr = 0;
+      }
+    }
+    zipfileJobFree(pJob);
+  }
+  return rc;
+}
+#endif /* SHELL_THREADS */
+
+// End Android Add
 /*
 ** xStep() callback for the zipfile() aggregate. This can be called in
 ** any of the following ways:
@@ -11291,11 +13399,25 @@ static void zipfileStep(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal){
   char *zName = 0;                /* Path (name) of new entry */
   int nName = 0;                  /* Size of zName in bytes */
   char *zFree = 0;                /* Free this before returning */
-  int nByte;
+// Begin Android Add
+#ifdef SHELL_THREADS
+  ZipfilePool *pPool = 0;         /* Compress on these workers, if not NULL */
+  int eJob = ZIPFILE_JOB_NONE;    /* Job for the workers */
+#endif
+// End Android Add
 
   memset(&e, 0, sizeof(e));
   p = (ZipfileCtx*)sqlite3_aggregate_context(pCtx, sizeof(ZipfileCtx));
   if( p==0 ) return;
+// Begin Android Add
+#ifdef SHELL_THREADS
+  if( p->bPoolTried==0 ){
+    p->bPoolTried = 1;
+    p->pPool = zipfilePoolNew();
+  }
+  pPool = p->pPool;
+#endif
+// End Android Add
 
   /* Martial the arguments into stack variables */
   if( nVal!=2 && nVal!=4 && nVal!=5 ){
@@ -11344,6 +13466,15 @@ static void zipfileStep(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal){
   }else{
     aData = sqlite3_value_blob(pData);
     szUncompressed = nData = sqlite3_value_bytes(pData);
+// Begin Android Add
+#ifdef SHELL_THREADS
+    if( pPool ){
+      eJob = iMethod<0 ? ZIPFILE_JOB_AUTO :
+             iMethod==8 ? ZIPFILE_JOB_DEFLATE : ZIPFILE_JOB_STORE;
+    }else
+#endif
+    {
+// End Android Add
     iCrc32 = crc32(0, aData, nData);
     if( iMethod<0 || iMethod==8 ){
       int nOut = 0;
@@ -11359,6 +13490,9 @@ static void zipfileStep(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal){
         iMethod = 0;
       }
     }
+// Begin Android Add
+    }
+// End Android Add
   }
 
   /* Decode the "mode" argument. */
@@ -11400,29 +13534,35 @@ static void zipfileStep(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal){
   e.cds.szCompressed = nData;
   e.cds.szUncompressed = szUncompressed;
   e.cds.iExternalAttr = (mode<<16);
-  e.cds.iOffset = p->body.n;
   e.cds.nFile = (u16)nName;
   e.cds.zFile = zName;
 
-  /* Append the LFH to the body of the new archive */
-  nByte = ZIPFILE_LFH_FIXED_SZ + e.cds.nFile + 9;
-  if( (rc = zipfileBufferGrow(&p->body, nByte)) ) goto zipfile_step_out;
-  p->body.n += zipfileSerializeLFH(&e, &p->body.a[p->body.n]);
-
-  /* Append the data to the body of the new archive */
-  if( nData>0 ){
-    if( (rc = zipfileBufferGrow(&p->body, nData)) ) goto zipfile_step_out;
-    memcpy(&p->body.a[p->body.n], aData, nData);
-    p->body.n += nData;
+// Begin Android Add
+#ifdef SHELL_THREADS
+  if( pPool ){
+    /* Hand a copy of the entry and its data to the workers. */
+    ZipfileEntry *pEntry = zipfileNewEntry(zName);
+    ZipfileJob *pJob = 0;
+    if( pEntry ){
+      char *zCopy = pEntry->cds.zFile;
+      pEntry->cds = e.cds;
+      pEntry->cds.zFile = zCopy;
+      pEntry->mUnixTime = e.mUnixTime;
+      pJob = zipfileJobNew(eJob, pEntry, aData, nData);
+      if( pJob==0 ) zipfileEntryFree(pEntry);
+    }
+    if( pJob==0 ){
+      rc = SQLITE_NOMEM;
+    }else{
+      pJob->bFreeEntry = 1;
+      zipfilePoolSubmit(pPool, pJob);
+      rc = zipfileCtxDrain(p, 0, &zErr);
+    }
+    goto zipfile_step_out;
   }
-
-  /* Append the CDS record to the directory of the new archive */
-  nByte = ZIPFILE_CDS_FIXED_SZ + e.cds.nFile + 9;
-  if( (rc = zipfileBufferGrow(&p->cds, nByte)) ) goto zipfile_step_out;
-  p->cds.n += zipfileSerializeCDS(&e, &p->cds.a[p->cds.n]);
-
-  /* Increment the count of entries in the archive */
-  p->nEntry++;
+#endif
+  rc = zipfileCtxAppend(p, &e, aData, nData);
+// End Android Add
 
  zipfile_step_out:
   sqlite3_free(aFree);
@@ -11448,6 +13588,27 @@ static void zipfileFinal(sqlite3_context *pCtx){
 
   p = (ZipfileCtx*)sqlite3_aggregate_context(pCtx, sizeof(ZipfileCtx));
   if( p==0 ) return;
+// Begin Android Add
+#ifdef SHELL_THREADS
+  if( p->pPool ){
+    char *zErr = 0;
+    int rc = zipfileCtxDrain(p, 1, &zErr);
+    zipfilePoolFree(p->pPool);
+    p->pPool = 0;
+    if( rc!=SQLITE_OK ){
+      if( zErr ){
+        sqlite3_result_error(pCtx, zErr, -1);
+      }else{
+        sqlite3_result_error_code(pCtx, rc);
+      }
+      sqlite3_free(zErr);
+      sqlite3_free(p->body.a);
+      sqlite3_free(p->cds.a);
+      return;
+    }
+  }
+#endif
+// End Android Add
   if( p->nEntry>0 ){
     memset(&eocd, 0, sizeof(eocd));
     eocd.nEntry = (u16)p->nEntry;
@@ -11492,7 +13653,13 @@ static int zipfileRegister(sqlite3 *db){
     0,                         /* xRowid - read data */
     zipfileUpdate,             /* xUpdate */
     zipfileBegin,              /* xBegin */
+// Begin Android Add
+#ifdef SHELL_THREADS
+    zipfileSync,               /* xSync */
+#else
     0,                         /* xSync */
+#endif
+// End Android Add
     zipfileCommit,             /* xCommit */
     zipfileRollback,           /* xRollback */
     zipfileFindFunction,       /* xFindMethod */
@@ -18130,6 +20297,62 @@ typedef struct ColModeOpts {
 #define ColModeOpts_default { 60, 0, 0 }
 #define ColModeOpts_default_qbox { 60, 1, 0 }
 
+// Begin Android Add
+#ifdef SHELL_OUT_BUFFER
+/* Query results being formatted by exec_prepared_stmt_buffered() */
+typedef struct ShellOut ShellOut;
+struct ShellOut {
+  char *z;                     /* Formatted output not yet written */
+  i64 n;                       /* Bytes of z[] used */
+  i64 nAlloc;                  /* Bytes allocated for z[] */
+  FILE *pFile;                 /* Write here, not to the output stream */
+};
+#endif
+
+/* Table digests kept by ".sha3sum --jobs N" for reuse by the next one */
+typedef struct Sha3Cache Sha3Cache;
+struct Sha3Cache {
+  sqlite3 *db;                 /* Connection the digests were computed on */
+  unsigned int iDataVersion;   /* SQLITE_FCNTL_DATA_VERSION of "main" then */
+  int nEntry;                  /* Number of entries in aEntry[] */
+  int nAlloc;                  /* Slots allocated for aEntry[] */
+  struct Sha3CacheEntry {
+    char *zName;                 /* Name of the table, lower case */
+    int iSize;                   /* Size of the hash in bits */
+    unsigned char aHash[64];     /* The hash */
+  } *aEntry;
+};
+
+/*
+** Latencies of ".timer histogram", one StmtHistEntry per statement
+** shape.  aCount[] has the log-bucketed counts of stmt_hist_bucket().
+*/
+#define STMT_HIST_SUB      16      /* Buckets per power of two */
+#define STMT_HIST_NBUCKET  (2*STMT_HIST_SUB + 36*STMT_HIST_SUB)
+#define STMT_HIST_NHASH    1024    /* Hash chains in StmtHist.aHash[] */
+typedef struct StmtHistEntry StmtHistEntry;
+struct StmtHistEntry {
+  char *zSql;                  /* Normalized SQL of the statement */
+  unsigned int h;              /* Hash of zSql */
+  StmtHistEntry *pNext;        /* Next entry on the same hash chain */
+  i64 nRun;                    /* Number of times it ran */
+  i64 iSum;                    /* Total latency, in microseconds */
+  i64 iMax;                    /* Largest latency, in microseconds */
+  i64 nStep;                   /* Total SQLITE_STMTSTATUS_VM_STEP */
+  i64 nSort;                   /* Total SQLITE_STMTSTATUS_SORT */
+  i64 nAutoindex;              /* Total SQLITE_STMTSTATUS_AUTOINDEX */
+  i64 nFullscan;               /* Total SQLITE_STMTSTATUS_FULLSCAN_STEP */
+  unsigned int aCount[STMT_HIST_NBUCKET];
+};
+typedef struct StmtHist StmtHist;
+struct StmtHist {
+  int bJson;                   /* Report as JSON rather than as a table */
+  int nEntry;                  /* Number of entries in apEntry[] */
+  int nAlloc;                  /* Slots allocated for apEntry[] */
+  StmtHistEntry **apEntry;     /* Entries, in the order first seen */
+  StmtHistEntry *aHash[STMT_HIST_NHASH];
+};
+// End Android Add
 /*
 ** State information about the database connection is contained in an
 ** instance of the following structure.
@@ -18204,6 +20427,15 @@ struct ShellState {
   char *zNonce;          /* Nonce for temporary safe-mode escapes */
   EQPGraph sGraph;       /* Information for the graphical EXPLAIN QUERY PLAN */
   ExpertInfo expert;     /* Valid if previous command was ".expert OPT..." */
+// Begin Android Add
+  Sha3Cache sha3Cache;   /* Table digests from the last ".sha3sum --jobs" */
+#ifdef SHELL_OUT_BUFFER
+  ShellOut sOut;         /* Output buffer of exec_prepared_stmt_buffered() */
+#endif
+  int nArrowBatch;       /* Rows per record batch of ".mode arrow", or 0 */
+  StmtHist *pStmtHist;   /* Latencies of ".timer histogram", or NULL */
+  int bStmtHistSql;      /* shell_exec() is running SQL from the input */
+// End Android Add
 #ifdef SQLITE_SHELL_FIDDLE
   struct {
     const char * zInput; /* Input string from wasm/JS proxy */
@@ -18293,6 +20525,9 @@ static ShellState shellState;
 #define MODE_Count   17  /* Output only a count of the rows of output */
 #define MODE_Off     18  /* No query output shown */
 #define MODE_ScanExp 19  /* Like MODE_Explain, but for ".scanstats vm" */
+// Begin Android Add
+#define MODE_Arrow   20  /* Apache Arrow IPC stream */
+// End Android Add
 
 static const char *modeDescr[] = {
   "line",
@@ -18313,7 +20548,11 @@ static const char *modeDescr[] = {
   "table",
   "box",
   "count",
-  "off"
+// Begin Android Add
+  "off",
+  "scanexp",
+  "arrow"
+// End Android Add
 };
 
 /*
@@ -18345,6 +20584,11 @@ static void shellLog(void *pArg, int iErrCode, const char *zMsg){
   fflush(p->pLog);
 }
 
+// Begin Android Add
+#ifdef SHELL_OUT_BUFFER
+static void shell_out_flush(ShellOut*);
+#endif
+// End Android Add
 /*
 ** SQL function:  shell_putsnl(X)
 **
@@ -18358,6 +20602,11 @@ static void shellPutsFunc(
 ){
   /* Unused: (ShellState*)sqlite3_user_data(pCtx); */
   (void)nVal;
+// Begin Android Add
+#ifdef SHELL_OUT_BUFFER
+  shell_out_flush(&((ShellState*)sqlite3_user_data(pCtx))->sOut);
+#endif
+// End Android Add
   oputf("%s\n", sqlite3_value_text(apVal[0]));
   sqlite3_result_value(pCtx, apVal[0]);
 }
@@ -19177,6 +21426,11 @@ static void eqp_render(ShellState *p, i64 nCycle){
 */
 static int progress_handler(void *pClientData) {
   ShellState *p = (ShellState*)pClientData;
+// Begin Android Add
+#ifdef SHELL_OUT_BUFFER
+  shell_out_flush(&p->sOut);
+#endif
+// End Android Add
   p->nProgress++;
   if( p->nProgress>=p->mxProgress && p->mxProgress>0 ){
     oputf("Progress limit reached (%u)\n", p->nProgress);
@@ -20150,6 +22404,179 @@ static void display_explain_scanstats(
 
   eqp_render(pArg, nTotal);
 }
+// Begin Android Add
+/*
+** ".scanstats json" writes the plan of each statement, with its
+** sqlite3_stmt_scanstatus_v2() counters, as a line of JSON:
+**
+**   {"sql":"...","version":"3.44.4","cycles":N,"plan":[{"id":2,
+**    "explain":"SCAN t1","name":"t1","loops":1,"rows":100,"est":100.0,
+**    "cycles":1000,"children":[...]},...]}
+**
+** Counters that SQLite does not keep for an entry are left out.
+** ".scanstats folded" writes the plan as folded stacks, for flamegraph.pl
+** and the tools that read its input: a line for each entry with the
+** statement and the entries above it, separated by ";", then the cycles
+** of the entry, or the rows it visited if there are no cycle counts.
+** Cycles of the statement outside of all entries are on a line with the
+** statement alone.
+*/
+#define SCANSTATS_JSON    4    /* ".scanstats json" */
+#define SCANSTATS_FOLDED  5    /* ".scanstats folded" */
+
+/* The counters of an entry of sqlite3_stmt_scanstatus_v2() */
+typedef struct ScanStatsEntry ScanStatsEntry;
+struct ScanStatsEntry {
+  const char *zExplain;        /* SQLITE_SCANSTAT_EXPLAIN */
+  const char *zName;           /* SQLITE_SCANSTAT_NAME, or NULL */
+  int iId;                     /* SQLITE_SCANSTAT_SELECTID */
+  int iPid;                    /* SQLITE_SCANSTAT_PARENTID */
+  i64 nLoop;                   /* SQLITE_SCANSTAT_NLOOP, or -1 */
+  i64 nRow;                    /* SQLITE_SCANSTAT_NVISIT, or -1 */
+  i64 nCycle;                  /* SQLITE_SCANSTAT_NCYCLE, or -1 */
+  double rEst;                 /* SQLITE_SCANSTAT_EST */
+};
+
+/* Read entry ii of the scan status of p, return non-zero if none */
+static int scanstats_entry(sqlite3_stmt *p, int ii, ScanStatsEntry *pEntry){
+  static const int f = SQLITE_SCANSTAT_COMPLEX;
+  memset(pEntry, 0, sizeof(*pEntry));
+  pEntry->nLoop = pEntry->nRow = pEntry->nCycle = -1;
+  if( sqlite3_stmt_scanstatus_v2(p, ii, SQLITE_SCANSTAT_EXPLAIN, f,
+                                 (void*)&pEntry->zExplain) ){
+    return 1;
+  }
+  if( pEntry->zExplain==0 ) pEntry->zExplain = "";
+  sqlite3_stmt_scanstatus_v2(p, ii, SQLITE_SCANSTAT_NAME, f,
+                             (void*)&pEntry->zName);
+  sqlite3_stmt_scanstatus_v2(p, ii, SQLITE_SCANSTAT_SELECTID, f,
+                             (void*)&pEntry->iId);
+  sqlite3_stmt_scanstatus_v2(p, ii, SQLITE_SCANSTAT_PARENTID, f,
+                             (void*)&pEntry->iPid);
+  sqlite3_stmt_scanstatus_v2(p, ii, SQLITE_SCANSTAT_NLOOP, f,
+                             (void*)&pEntry->nLoop);
+  sqlite3_stmt_scanstatus_v2(p, ii, SQLITE_SCANSTAT_NVISIT, f,
+                             (void*)&pEntry->nRow);
+  sqlite3_stmt_scanstatus_v2(p, ii, SQLITE_SCANSTAT_NCYCLE, f,
+                             (void*)&pEntry->nCycle);
+  sqlite3_stmt_scanstatus_v2(p, ii, SQLITE_SCANSTAT_EST, f,
+                             (void*)&pEntry->rEst);
+  return 0;
+}
+
+/* Write the entries of p below iParent as a JSON array */
+static void scanstats_json_level(sqlite3_stmt *p, int iParent, int nDepth){
+  ScanStatsEntry e;
+  int ii;
+  int nOut = 0;
+  oputz("[");
+  for(ii=0; nDepth<100 && scanstats_entry(p, ii, &e)==0; ii++){
+    if( e.iPid!=iParent || e.iId==iParent ) continue;
+    oputf("%s{\"id\":%d,\"explain\":", nOut++ ? "," : "", e.iId);
+    output_json_string(e.zExplain, -1);
+    if( e.zName ){
+      oputz(",\"name\":");
+      output_json_string(e.zName, -1);
+    }
+    if( e.nLoop>=0 ) oputf(",\"loops\":%lld", e.nLoop);
+    if( e.nRow>=0 ) oputf(",\"rows\":%lld", e.nRow);
+    if( e.zName ) oputf(",\"est\":%.1f", e.rEst);
+    if( e.nCycle>=0 ) oputf(",\"cycles\":%lld", e.nCycle);
+    oputz(",\"children\":");
+    scanstats_json_level(p, e.iId, nDepth+1);
+    oputz("}");
+  }
+  oputz("]");
+}
+
+static void display_scanstats_json(ShellState *pArg){
+  sqlite3_stmt *p = pArg->pStmt;
+  const char *zSql = sqlite3_sql(p);
+  i64 nTotal = -1;
+  sqlite3_stmt_scanstatus_v2(p, -1, SQLITE_SCANSTAT_NCYCLE,
+                             SQLITE_SCANSTAT_COMPLEX, (void*)&nTotal);
+  oputz("{\"sql\":");
+  output_json_string(zSql ? zSql : "", -1);
+  oputz(",\"version\":");
+  output_json_string(sqlite3_libversion(), -1);
+  if( nTotal>=0 ) oputf(",\"cycles\":%lld", nTotal);
+  oputz(",\"plan\":");
+  scanstats_json_level(p, 0, 0);
+  oputz("}\n");
+}
+
+/*
+** Return zPrefix, then ";" unless zPrefix is NULL, then the text of z
+** with runs of white space made one space and ";" made ",", so that it
+** is a single frame of a folded stack.
+*/
+static char *scanstats_folded_frame(const char *zPrefix, const char *z){
+  sqlite3_str *pOut = sqlite3_str_new(0);
+  char *zOut;
+  if( zPrefix ){
+    sqlite3_str_appendall(pOut, zPrefix);
+    sqlite3_str_appendchar(pOut, 1, ';');
+  }
+  while( IsSpace(*z) ) z++;
+  while( *z ){
+    if( IsSpace(*z) ){
+      while( IsSpace(*z) ) z++;
+      if( *z ) sqlite3_str_appendchar(pOut, 1, ' ');
+    }else{
+      sqlite3_str_appendchar(pOut, 1, *z==';' ? ',' : *z);
+      z++;
+    }
+  }
+  zOut = sqlite3_str_finish(pOut);
+  shell_check_oom(zOut);
+  return zOut;
+}
+
+/*
+** Write the entries of p below iParent as folded stacks under zStack,
+** and return the total of the values written.
+*/
+static i64 scanstats_folded_level(sqlite3_stmt *p, int iParent,
+                                  const char *zStack, int bCycles,
+                                  int nDepth){
+  ScanStatsEntry e;
+  i64 nSum = 0;
+  int ii;
+  for(ii=0; nDepth<100 && scanstats_entry(p, ii, &e)==0; ii++){
+    char *zFrame;
+    i64 v = bCycles ? e.nCycle : e.nRow;
+    if( e.iPid!=iParent || e.iId==iParent ) continue;
+    zFrame = scanstats_folded_frame(zStack, e.zExplain);
+    if( v>0 ){
+      oputf("%s %lld\n", zFrame, v);
+      nSum += v;
+    }
+    nSum += scanstats_folded_level(p, e.iId, zFrame, bCycles, nDepth+1);
+    sqlite3_free(zFrame);
+  }
+  return nSum;
+}
+
+static void display_scanstats_folded(ShellState *pArg){
+  sqlite3_stmt *p = pArg->pStmt;
+  const char *zSql = sqlite3_sql(p);
+  char *zSqlTrim;
+  char *zRoot;
+  i64 nTotal = -1;
+  i64 nSum;
+  int n = zSql ? (int)strlen(zSql) : 0;
+  while( n>0 && (zSql[n-1]==';' || IsSpace(zSql[n-1])) ) n--;
+  zSqlTrim = sqlite3_mprintf("%.*s", n, zSql ? zSql : "");
+  shell_check_oom(zSqlTrim);
+  zRoot = scanstats_folded_frame(0, zSqlTrim);
+  sqlite3_free(zSqlTrim);
+  sqlite3_stmt_scanstatus_v2(p, -1, SQLITE_SCANSTAT_NCYCLE,
+                             SQLITE_SCANSTAT_COMPLEX, (void*)&nTotal);
+  nSum = scanstats_folded_level(p, 0, zRoot, nTotal>0, 0);
+  if( nTotal>nSum ) oputf("%s %lld\n", zRoot, nTotal-nSum);
+  sqlite3_free(zRoot);
+}
+// End Android Add
 #endif
 
 
@@ -20270,6 +22697,16 @@ static void display_scanstats(
   UNUSED_PARAMETER(db);
   UNUSED_PARAMETER(pArg);
 #else
+// Begin Android Add
+  if( pArg->scanstatsOn==SCANSTATS_JSON ){
+    display_scanstats_json(pArg);
+    return;
+  }
+  if( pArg->scanstatsOn==SCANSTATS_FOLDED ){
+    display_scanstats_folded(pArg);
+    return;
+  }
+// End Android Add
   if( pArg->scanstatsOn==3 ){
     const char *zSql =
       "  SELECT addr, opcode, p1, p2, p3, p4, p5, comment, nexec,"
@@ -20815,704 +23252,1991 @@ columnar_end:
   }
 }
 
+// Begin Android Add
+#ifdef SHELL_OUT_BUFFER
 /*
-** Run a prepared statement
+** exec_prepared_stmt_buffered() formats the rows of ".mode list", "csv",
+** "json", "insert" and "quote" into ShellState.sOut and writes them to
+** the output stream SHELL_OUT_CHUNK bytes at a time, instead of with
+** several small oputz() and oputf() calls, and stdio flushes, per row.
+** Integers are formatted from sqlite3_column_int64(), and in the modes
+** that print floating point values with "%!.20g", so are those, rather
+** than from sqlite3_column_text().  The output is the same as that of
+** shell_callback().
+**
+** Anything else that writes to the output stream while the statement
+** runs (shell_putsnl(), .progress and .trace) flushes sOut first.  The
+** worker threads of ".dump --dir" set ShellOut.pFile to write to a file
+** of their own instead.
 */
-static void exec_prepared_stmt(
-  ShellState *pArg,                                /* Pointer to ShellState */
-  sqlite3_stmt *pStmt                              /* Statement to run */
-){
-  int rc;
-  sqlite3_uint64 nRow = 0;
+#define SHELL_OUT_CHUNK (64*1024)
 
-  if( pArg->cMode==MODE_Column
-   || pArg->cMode==MODE_Table
-   || pArg->cMode==MODE_Box
-   || pArg->cMode==MODE_Markdown
-  ){
-    exec_prepared_stmt_columnar(pArg, pStmt);
-    return;
+/* Make room for n more bytes in pOut->z[] and return a pointer to them */
+static char *shell_out_space(ShellOut *pOut, i64 n){
+  if( pOut->n+n>pOut->nAlloc ){
+    i64 nNew = pOut->nAlloc*2 + n + SHELL_OUT_CHUNK;
+    pOut->z = sqlite3_realloc64(pOut->z, nNew);
+    shell_check_oom(pOut->z);
+    pOut->nAlloc = nNew;
   }
+  return pOut->z + pOut->n;
+}
 
-  /* perform the first step.  this will tell us if we
-  ** have a result set or not and how wide it is.
-  */
-  rc = sqlite3_step(pStmt);
-  /* if we have a result set... */
-  if( SQLITE_ROW == rc ){
-    /* allocate space for col name ptr, value ptr, and type */
-    int nCol = sqlite3_column_count(pStmt);
-    void *pData = sqlite3_malloc64(3*nCol*sizeof(const char*) + 1);
-    if( !pData ){
-      shell_out_of_memory();
+static void shell_out_append(ShellOut *pOut, const char *z, i64 n){
+  memcpy(shell_out_space(pOut, n), z, n);
+  pOut->n += n;
+}
+
+static void shell_out_str(ShellOut *pOut, const char *z){
+  shell_out_append(pOut, z, strlen(z));
+}
+
+static void shell_out_char(ShellOut *pOut, char c){
+  *shell_out_space(pOut, 1) = c;
+  pOut->n++;
+}
+
+/* Write the content of pOut to the output stream */
+static void shell_out_flush(ShellOut *pOut){
+  i64 i;
+  for(i=0; i<pOut->n; i+=0x40000000){
+    i64 n = pOut->n - i;
+    if( pOut->pFile ){
+      fwrite(pOut->z+i, 1, (size_t)(n>0x40000000 ? 0x40000000 : n),
+             pOut->pFile);
     }else{
-      char **azCols = (char **)pData;      /* Names of result columns */
-      char **azVals = &azCols[nCol];       /* Results */
-      int *aiTypes = (int *)&azVals[nCol]; /* Result types */
-      int i, x;
-      assert(sizeof(int) <= sizeof(char *));
-      /* save off ptrs to column names */
-      for(i=0; i<nCol; i++){
-        azCols[i] = (char *)sqlite3_column_name(pStmt, i);
-      }
-      do{
-        nRow++;
-        /* extract the data and data types */
-        for(i=0; i<nCol; i++){
-          aiTypes[i] = x = sqlite3_column_type(pStmt, i);
-          if( x==SQLITE_BLOB
-           && pArg
-           && (pArg->cMode==MODE_Insert || pArg->cMode==MODE_Quote)
-          ){
-            azVals[i] = "";
-          }else{
-            azVals[i] = (char*)sqlite3_column_text(pStmt, i);
-          }
-          if( !azVals[i] && (aiTypes[i]!=SQLITE_NULL) ){
-            rc = SQLITE_NOMEM;
-            break; /* from for */
-          }
-        } /* end for */
+      oputb(pOut->z+i, (int)(n>0x40000000 ? 0x40000000 : n));
+    }
+  }
+  pOut->n = 0;
+}
 
-        /* if data and types extracted successfully... */
-        if( SQLITE_ROW == rc ){
-          /* call the supplied callback with the result row data */
-          if( shell_callback(pArg, nCol, azVals, azCols, aiTypes) ){
-            rc = SQLITE_ABORT;
-          }else{
-            rc = sqlite3_step(pStmt);
-          }
-        }
-      } while( SQLITE_ROW == rc );
-      sqlite3_free(pData);
-      if( pArg->cMode==MODE_Json ){
-        fputs("]\n", pArg->out);
-      }else if( pArg->cMode==MODE_Count ){
-        char zBuf[200];
-        sqlite3_snprintf(sizeof(zBuf), zBuf, "%llu row%s\n",
-                         nRow, nRow!=1 ? "s" : "");
-        printf("%s", zBuf);
+/* Format v into zBuf[] the way "%lld" does and return its length */
+static int shell_format_int64(char *zBuf, sqlite3_int64 v){
+  char zTmp[24];
+  sqlite3_uint64 u = v<0 ? 0-(sqlite3_uint64)v : (sqlite3_uint64)v;
+  int i = sizeof(zTmp), n;
+  do{
+    zTmp[--i] = (char)('0' + u%10);
+    u /= 10;
+  }while( u );
+  if( v<0 ) zTmp[--i] = '-';
+  n = (int)sizeof(zTmp) - i;
+  memcpy(zBuf, zTmp+i, n);
+  zBuf[n] = 0;
+  return n;
+}
+
+/* Like output_csv() */
+static void shell_out_csv(ShellState *p, const char *z, int bSep){
+  ShellOut *pOut = &p->sOut;
+  if( z==0 ){
+    shell_out_str(pOut, p->nullValue);
+  }else{
+    const unsigned char *zU = (const unsigned char*)z;
+    i64 i;
+    for(i=0; zU[i] && !needCsvQuote[zU[i]]; i++){}
+    if( i==0 || zU[i] || strstr(z, p->colSeparator)!=0 ){
+      shell_out_char(pOut, '"');
+      while( 1 ){
+        for(i=0; z[i] && z[i]!='"'; i++){}
+        shell_out_append(pOut, z, i);
+        if( z[i]==0 ) break;
+        shell_out_append(pOut, "\"\"", 2);
+        z += i+1;
       }
+      shell_out_char(pOut, '"');
+    }else{
+      shell_out_append(pOut, z, i);
     }
   }
+  if( bSep ) shell_out_str(pOut, p->colSeparator);
 }
 
-#ifndef SQLITE_OMIT_VIRTUALTABLE
-/*
-** This function is called to process SQL if the previous shell command
-** was ".expert". It passes the SQL in the second argument directly to
-** the sqlite3expert object.
-**
-** If successful, SQLITE_OK is returned. Otherwise, an SQLite error
-** code. In this case, (*pzErr) may be set to point to a buffer containing
-** an English language error message. It is the responsibility of the
-** caller to eventually free this buffer using sqlite3_free().
-*/
-static int expertHandleSQL(
-  ShellState *pState,
-  const char *zSql,
-  char **pzErr
-){
-  assert( pState->expert.pExpert );
-  assert( pzErr==0 || *pzErr==0 );
-  return sqlite3_expert_sql(pState->expert.pExpert, zSql, pzErr);
+/* Like output_json_string() */
+static void shell_out_json_string(ShellOut *pOut, const char *z, i64 n){
+  static const long ctrlMask = ~0L;
+  const char *pcLimit;
+  char c;
+  if( z==0 ) z = "";
+  pcLimit = z + ((n<0)? strlen(z) : (size_t)n);
+  shell_out_char(pOut, '"');
+  while( z < pcLimit ){
+    const char *pcDQBS = anyOfInStr(z, "\"\\", pcLimit-z);
+    const char *pcPast = zSkipValidUtf8(z, (int)(pcLimit-z), ctrlMask);
+    const char *pcEnd = (pcDQBS && pcDQBS < pcPast)? pcDQBS : pcPast;
+    char cbsSay;
+    if( pcEnd > z ){
+      shell_out_append(pOut, z, pcEnd-z);
+      z = pcEnd;
+    }
+    if( z >= pcLimit ) break;
+    c = *(z++);
+    switch( c ){
+      case '"': case '\\': cbsSay = c; break;
+      case '\b': cbsSay = 'b'; break;
+      case '\f': cbsSay = 'f'; break;
+      case '\n': cbsSay = 'n'; break;
+      case '\r': cbsSay = 'r'; break;
+      case '\t': cbsSay = 't'; break;
+      default: cbsSay = 0; break;
+    }
+    if( cbsSay ){
+      shell_out_char(pOut, '\\');
+      shell_out_char(pOut, cbsSay);
+    }else if( c<=0x1f ){
+      char zHex[16];
+      snprintf(zHex, sizeof(zHex), "u%04x", c);
+      shell_out_str(pOut, zHex);
+    }else{
+      shell_out_char(pOut, c);
+    }
+  }
+  shell_out_char(pOut, '"');
 }
 
-/*
-** This function is called either to silently clean up the object
-** created by the ".expert" command (if bCancel==1), or to generate a
-** report from it and then clean it up (if bCancel==0).
-**
-** If successful, SQLITE_OK is returned. Otherwise, an SQLite error
-** code. In this case, (*pzErr) may be set to point to a buffer containing
-** an English language error message. It is the responsibility of the
-** caller to eventually free this buffer using sqlite3_free().
-*/
-static int expertFinish(
-  ShellState *pState,
-  int bCancel,
-  char **pzErr
-){
-  int rc = SQLITE_OK;
-  sqlite3expert *p = pState->expert.pExpert;
-  assert( p );
-  assert( bCancel || pzErr==0 || *pzErr==0 );
-  if( bCancel==0 ){
-    int bVerbose = pState->expert.bVerbose;
+/* Like output_quoted_string() */
+static void shell_out_quoted(ShellOut *pOut, const char *z){
+  shell_out_char(pOut, '\'');
+  while( *z ){
+    i64 i;
+    for(i=0; z[i] && z[i]!='\''; i++){}
+    if( z[i]=='\'' ) i++;
+    shell_out_append(pOut, z, i);
+    if( z[i-1]=='\'' ) shell_out_char(pOut, '\'');
+    z += i;
+  }
+  shell_out_char(pOut, '\'');
+}
 
-    rc = sqlite3_expert_analyze(p, pzErr);
-    if( rc==SQLITE_OK ){
-      int nQuery = sqlite3_expert_count(p);
-      int i;
+/* Like output_quoted_escaped_string() */
+static void shell_out_quoted_escaped(ShellOut *pOut, const char *z){
+  const char *zNL = 0;
+  const char *zCR = 0;
+  char zBuf1[20], zBuf2[20];
+  i64 i;
+  for(i=0; z[i] && z[i]!='\n' && z[i]!='\r'; i++){}
+  if( z[i]==0 ){
+    shell_out_quoted(pOut, z);
+    return;
+  }
+  if( strchr(z, '\n') ){
+    shell_out_str(pOut, "replace(");
+    zNL = unused_string(z, "\\n", "\\012", zBuf1);
+  }
+  if( strchr(z, '\r') ){
+    shell_out_str(pOut, "replace(");
+    zCR = unused_string(z, "\\r", "\\015", zBuf2);
+  }
+  shell_out_char(pOut, '\'');
+  while( *z ){
+    for(i=0; z[i] && z[i]!='\n' && z[i]!='\r' && z[i]!='\''; i++){}
+    shell_out_append(pOut, z, i);
+    z += i;
+    if( *z=='\'' ){
+      shell_out_append(pOut, "''", 2);
+    }else if( *z=='\n' ){
+      shell_out_str(pOut, zNL);
+    }else if( *z=='\r' ){
+      shell_out_str(pOut, zCR);
+    }else{
+      break;
+    }
+    z++;
+  }
+  shell_out_char(pOut, '\'');
+  if( zCR ){
+    shell_out_str(pOut, ",'");
+    shell_out_str(pOut, zCR);
+    shell_out_str(pOut, "',char(13))");
+  }
+  if( zNL ){
+    shell_out_str(pOut, ",'");
+    shell_out_str(pOut, zNL);
+    shell_out_str(pOut, "',char(10))");
+  }
+}
 
-      if( bVerbose ){
-        const char *zCand = sqlite3_expert_report(p,0,EXPERT_REPORT_CANDIDATES);
-        oputz("-- Candidates -----------------------------\n");
-        oputf("%s\n", zCand);
-      }
-      for(i=0; i<nQuery; i++){
-        const char *zSql = sqlite3_expert_report(p, i, EXPERT_REPORT_SQL);
-        const char *zIdx = sqlite3_expert_report(p, i, EXPERT_REPORT_INDEXES);
-        const char *zEQP = sqlite3_expert_report(p, i, EXPERT_REPORT_PLAN);
-        if( zIdx==0 ) zIdx = "(no new indexes)\n";
-        if( bVerbose ){
-          oputf("-- Query %d --------------------------------\n",i+1);
-          oputf("%s\n\n", zSql);
-        }
-        oputf("%s\n", zIdx);
-        oputf("%s\n", zEQP);
-      }
+/* Like output_hex_blob() */
+static void shell_out_hex_blob(ShellOut *pOut, const void *pBlob, int nBlob){
+  static const char aHex[] = "0123456789abcdef";
+  const unsigned char *aBlob = (const unsigned char*)pBlob;
+  char *z = shell_out_space(pOut, 3 + (i64)nBlob*2);
+  int i;
+  *(z++) = 'X';
+  *(z++) = '\'';
+  for(i=0; i<nBlob; i++){
+    *(z++) = aHex[aBlob[i]>>4];
+    *(z++) = aHex[aBlob[i]&0x0f];
+  }
+  *z = '\'';
+  pOut->n += 3 + (i64)nBlob*2;
+}
+
+/* A floating point value the way MODE_Insert, _Json and _Quote show it */
+static void shell_out_double(ShellOut *pOut, double r, int eMode){
+  char z[50];
+  sqlite3_uint64 ur;
+  memcpy(&ur,&r,sizeof(r));
+  if( eMode!=MODE_Quote && ur==0x7ff0000000000000LL ){
+    shell_out_str(pOut, "9.0e+999");
+  }else if( eMode!=MODE_Quote && ur==0xfff0000000000000LL ){
+    shell_out_str(pOut, "-9.0e+999");
+  }else{
+    sqlite3_int64 ir = (sqlite3_int64)r;
+    if( eMode==MODE_Insert && r==(double)ir ){
+      sqlite3_snprintf(50,z,"%lld.0", ir);
+    }else{
+      sqlite3_snprintf(50,z,"%!.20g", r);
     }
+    shell_out_str(pOut, z);
   }
-  sqlite3_expert_destroy(p);
-  pState->expert.pExpert = 0;
-  return rc;
 }
 
 /*
-** Implementation of ".expert" dot command.
+** Run pStmt in one of the modes MODE_List, MODE_Csv, MODE_Json,
+** MODE_Insert or MODE_Quote, with the same output as shell_callback().
 */
-static int expertDotCommand(
-  ShellState *pState,             /* Current shell tool state */
-  char **azArg,                   /* Array of arguments passed to dot command */
-  int nArg                        /* Number of entries in azArg[] */
-){
-  int rc = SQLITE_OK;
-  char *zErr = 0;
-  int i;
-  int iSample = 0;
-
-  assert( pState->expert.pExpert==0 );
-  memset(&pState->expert, 0, sizeof(ExpertInfo));
-
-  for(i=1; rc==SQLITE_OK && i<nArg; i++){
-    char *z = azArg[i];
-    int n;
-    if( z[0]=='-' && z[1]=='-' ) z++;
-    n = strlen30(z);
-    if( n>=2 && 0==cli_strncmp(z, "-verbose", n) ){
-      pState->expert.bVerbose = 1;
+static void exec_prepared_stmt_buffered(ShellState *p, sqlite3_stmt *pStmt){
+  ShellOut *pOut = &p->sOut;
+  int eMode = p->cMode;
+  int nCol, i;
+  int rc = sqlite3_step(pStmt);
+  if( rc!=SQLITE_ROW ) return;
+  nCol = sqlite3_column_count(pStmt);
+  if( eMode==MODE_Csv ) setBinaryMode(p->out, 1);
+  do{
+    /* Headers, and the start of the row */
+    if( eMode==MODE_List || eMode==MODE_Csv ){
+      if( p->cnt++==0 && p->showHeader ){
+        for(i=0; i<nCol; i++){
+          const char *zCol = sqlite3_column_name(pStmt, i);
+          if( eMode==MODE_Csv ){
+            shell_out_csv(p, zCol ? zCol : "", i<nCol-1);
+          }else{
+            shell_out_str(pOut, zCol ? zCol : "");
+            shell_out_str(pOut, i==nCol-1 ? p->rowSeparator : p->colSeparator);
+          }
+        }
+        if( eMode==MODE_Csv ) shell_out_str(pOut, p->rowSeparator);
+      }
+    }else if( eMode==MODE_Insert ){
+      shell_out_str(pOut, "INSERT INTO ");
+      shell_out_str(pOut, p->zDestTable ? p->zDestTable : "(null)");
+      if( p->showHeader ){
+        shell_out_char(pOut, '(');
+        for(i=0; i<nCol; i++){
+          const char *zCol = sqlite3_column_name(pStmt, i);
+          if( i>0 ) shell_out_char(pOut, ',');
+          if( quoteChar(zCol) ){
+            char *z = sqlite3_mprintf("\"%w\"", zCol);
+            shell_check_oom(z);
+            shell_out_str(pOut, z);
+            sqlite3_free(z);
+          }else{
+            shell_out_str(pOut, zCol);
+          }
+        }
+        shell_out_char(pOut, ')');
+      }
+      p->cnt++;
+    }else if( eMode==MODE_Json ){
+      shell_out_str(pOut, p->cnt==0 ? "[{" : ",\n{");
+      p->cnt++;
+    }else{
+      if( p->cnt==0 && p->showHeader ){
+        for(i=0; i<nCol; i++){
+          const char *zCol = sqlite3_column_name(pStmt, i);
+          if( i>0 ) shell_out_str(pOut, p->colSeparator);
+          if( zCol ) shell_out_quoted(pOut, zCol);
+        }
+        shell_out_str(pOut, p->rowSeparator);
+      }
+      p->cnt++;
     }
-    else if( n>=2 && 0==cli_strncmp(z, "-sample", n) ){
-      if( i==(nArg-1) ){
-        eputf("option requires an argument: %s\n", z);
-        rc = SQLITE_ERROR;
-      }else{
-        iSample = (int)integerValue(azArg[++i]);
-        if( iSample<0 || iSample>100 ){
-          eputf("value out of range: %s\n", azArg[i]);
-          rc = SQLITE_ERROR;
+
+    /* The values */
+    for(i=0; i<nCol; i++){
+      int eType = sqlite3_column_type(pStmt, i);
+      const char *z = 0;
+      char zNum[24];
+      if( eType==SQLITE_INTEGER ){
+        shell_format_int64(zNum, sqlite3_column_int64(pStmt, i));
+        z = zNum;
+      }else if( eType==SQLITE_TEXT
+             || (eType!=SQLITE_NULL && (eMode==MODE_List || eMode==MODE_Csv))
+      ){
+        z = (const char*)sqlite3_column_text(pStmt, i);
+        if( z==0 ){
+          rc = SQLITE_NOMEM;
+          break;
+        }
+      }
+      switch( eMode ){
+        case MODE_List: {
+          shell_out_str(pOut, z ? z : p->nullValue);
+          shell_out_str(pOut, i<nCol-1 ? p->colSeparator : p->rowSeparator);
+          break;
+        }
+        case MODE_Csv: {
+          shell_out_csv(p, z, i<nCol-1);
+          break;
+        }
+        case MODE_Json: {
+          shell_out_json_string(pOut, sqlite3_column_name(pStmt, i), -1);
+          shell_out_char(pOut, ':');
+          if( eType==SQLITE_NULL ){
+            shell_out_str(pOut, "null");
+          }else if( eType==SQLITE_FLOAT ){
+            shell_out_double(pOut, sqlite3_column_double(pStmt, i), eMode);
+          }else if( eType==SQLITE_BLOB ){
+            shell_out_json_string(pOut, sqlite3_column_blob(pStmt, i),
+                                  sqlite3_column_bytes(pStmt, i));
+          }else if( eType==SQLITE_TEXT ){
+            shell_out_json_string(pOut, z, -1);
+          }else{
+            shell_out_str(pOut, z);
+          }
+          if( i<nCol-1 ) shell_out_char(pOut, ',');
+          break;
+        }
+        default: {
+          if( eMode==MODE_Insert ){
+            shell_out_str(pOut, i>0 ? "," : " VALUES(");
+          }else if( i>0 ){
+            shell_out_str(pOut, p->colSeparator);
+          }
+          if( eType==SQLITE_NULL ){
+            shell_out_str(pOut, "NULL");
+          }else if( eType==SQLITE_TEXT ){
+            if( eMode==MODE_Insert && !ShellHasFlag(p, SHFLG_Newlines) ){
+              shell_out_quoted_escaped(pOut, z);
+            }else{
+              shell_out_quoted(pOut, z);
+            }
+          }else if( eType==SQLITE_INTEGER ){
+            shell_out_str(pOut, z);
+          }else if( eType==SQLITE_FLOAT ){
+            shell_out_double(pOut, sqlite3_column_double(pStmt, i), eMode);
+          }else{
+            shell_out_hex_blob(pOut, sqlite3_column_blob(pStmt, i),
+                               sqlite3_column_bytes(pStmt, i));
+          }
+          break;
         }
       }
     }
-    else{
-      eputf("unknown option: %s\n", z);
-      rc = SQLITE_ERROR;
+    if( rc==SQLITE_NOMEM ) break;
+
+    /* The end of the row */
+    if( eMode==MODE_Csv ){
+      if( nCol>0 ) shell_out_str(pOut, p->rowSeparator);
+    }else if( eMode==MODE_Insert ){
+      shell_out_str(pOut, ");\n");
+    }else if( eMode==MODE_Json ){
+      shell_out_char(pOut, '}');
+    }else if( eMode==MODE_Quote ){
+      shell_out_str(pOut, p->rowSeparator);
     }
+    if( pOut->n>=SHELL_OUT_CHUNK ) shell_out_flush(pOut);
+    rc = sqlite3_step(pStmt);
+  }while( rc==SQLITE_ROW );
+  if( eMode==MODE_Json ) shell_out_str(pOut, "]\n");
+  shell_out_flush(pOut);
+  if( eMode==MODE_Csv ) setTextMode(p->out, 1);
+}
+#endif /* SHELL_OUT_BUFFER */
+
+/*
+** ".mode arrow" writes the result of each statement as an Apache Arrow
+** IPC stream: a Schema message, a RecordBatch message for each
+** ShellState.nArrowBatch rows (ARROW_BATCH_ROWS if zero), and the
+** end-of-stream marker.  The columns are Int64, Float64, Utf8 or Binary,
+** chosen from the values of the first batch, or from the declared type
+** of a column that only has NULLs in it.  Later values of another type
+** are converted as by CAST.  ".import --arrow" reads such a stream back
+** into a table, see import_arrow().
+**
+** The flatbuffers of the message metadata are written front to back,
+** each table just after its own vtable, with arrow_fb_link() filling in
+** an offset once the object it refers to has been written.
+*/
+#define ARROW_BATCH_ROWS  65536      /* Default rows per record batch */
+#define ARROW_BATCH_BYTES (64<<20)   /* End a batch at this much TEXT/BLOB */
+
+/* Values of the MessageHeader and Type unions of the Arrow format */
+#define ARROW_MSG_Schema           1
+#define ARROW_MSG_DictionaryBatch  2
+#define ARROW_MSG_RecordBatch      3
+#define ARROW_Null                 1
+#define ARROW_Int                  2
+#define ARROW_FloatingPoint        3
+#define ARROW_Binary               4
+#define ARROW_Utf8                 5
+#define ARROW_Bool                 6
+#define ARROW_LargeBinary         19
+#define ARROW_LargeUtf8           20
+
+#define ARROW_V4  3                  /* Oldest MetadataVersion read */
+#define ARROW_V5  4                  /* MetadataVersion written */
+
+/* A growable buffer of bytes */
+typedef struct ArrowBuf ArrowBuf;
+struct ArrowBuf {
+  unsigned char *a;      /* The bytes */
+  i64 n;                 /* Number of bytes used */
+  i64 nAlloc;            /* Space allocated for a[] */
+};
+
+/* Append n zero bytes to b and return the offset of the first */
+static i64 arrow_space(ArrowBuf *b, i64 n){
+  i64 i = b->n;
+  if( b->n+n>b->nAlloc ){
+    i64 nNew = b->nAlloc*2 + n + 4096;
+    b->a = sqlite3_realloc64(b->a, nNew);
+    shell_check_oom(b->a);
+    b->nAlloc = nNew;
   }
+  if( n>0 ) memset(b->a+i, 0, n);
+  b->n += n;
+  return i;
+}
 
-  if( rc==SQLITE_OK ){
-    pState->expert.pExpert = sqlite3_expert_new(pState->db, &zErr);
-    if( pState->expert.pExpert==0 ){
-      eputf("sqlite3_expert_new: %s\n", zErr ? zErr : "out of memory");
-      rc = SQLITE_ERROR;
-    }else{
-      sqlite3_expert_config(
-          pState->expert.pExpert, EXPERT_CONFIG_SAMPLE, iSample
-      );
+/* Append zeros to b up to a multiple of nAlign bytes */
+static void arrow_pad(ArrowBuf *b, int nAlign){
+  if( b->n%nAlign ) arrow_space(b, nAlign - b->n%nAlign);
+}
+
+/* Little-endian integers, as used throughout the Arrow format */
+static void arrow_set16(unsigned char *a, unsigned v){
+  a[0] = (unsigned char)v;
+  a[1] = (unsigned char)(v>>8);
+}
+static void arrow_set32(unsigned char *a, u32 v){
+  arrow_set16(a, v&0xffff);
+  arrow_set16(a+2, v>>16);
+}
+static void arrow_set64(unsigned char *a, sqlite3_uint64 v){
+  arrow_set32(a, (u32)v);
+  arrow_set32(a+4, (u32)(v>>32));
+}
+static unsigned arrow_get16(const unsigned char *a){
+  return a[0] | (a[1]<<8);
+}
+static u32 arrow_get32(const unsigned char *a){
+  return arrow_get16(a) | ((u32)arrow_get16(a+2)<<16);
+}
+static sqlite3_uint64 arrow_get64(const unsigned char *a){
+  return arrow_get32(a) | ((sqlite3_uint64)arrow_get32(a+4)<<32);
+}
+
+/* A field of a flatbuffers table written by arrow_fb_table() */
+typedef struct ArrowFbField ArrowFbField;
+struct ArrowFbField {
+  int nByte;             /* Size of a scalar, ARROW_FB_REF, or 0 if absent */
+  i64 iVal;              /* The value of a scalar */
+  i64 iAt;               /* Set to the offset of the field in the buffer */
+};
+#define ARROW_FB_REF (-4)    /* nByte of a field that refers to an object */
+
+/*
+** Append a flatbuffers table with the nField fields of aField[], and
+** its vtable, to b.  Return the offset of the table.
+*/
+static i64 arrow_fb_table(ArrowBuf *b, ArrowFbField *aField, int nField){
+  int aPos[8];
+  int nVt = 4 + 2*nField;
+  int nTab = 4;
+  int sz, i;
+  i64 iVt, iTab;
+  assert( nField<=ArraySize(aPos) );
+  memset(aPos, 0, sizeof(aPos));
+  for(sz=8; sz>0; sz/=2){
+    for(i=0; i<nField; i++){
+      int n = aField[i].nByte==ARROW_FB_REF ? 4 : aField[i].nByte;
+      if( n==sz ){
+        aPos[i] = nTab;
+        nTab += sz;
+      }
     }
   }
-  sqlite3_free(zErr);
+  /* The table starts 4 bytes short of a multiple of 8, so that the
+  ** 8-byte fields after its vtable offset are aligned */
+  while( (b->n+nVt)%8!=4 ) arrow_space(b, 1);
+  iVt = arrow_space(b, nVt);
+  iTab = arrow_space(b, nTab);
+  arrow_set16(b->a+iVt, nVt);
+  arrow_set16(b->a+iVt+2, nTab);
+  arrow_set32(b->a+iTab, (u32)(iTab-iVt));
+  for(i=0; i<nField; i++){
+    unsigned char *a = b->a+iTab+aPos[i];
+    arrow_set16(b->a+iVt+4+2*i, aPos[i]);
+    aField[i].iAt = iTab+aPos[i];
+    switch( aField[i].nByte ){
+      case 1:  a[0] = (unsigned char)aField[i].iVal;                break;
+      case 2:  arrow_set16(a, (unsigned)aField[i].iVal);            break;
+      case 4:  arrow_set32(a, (u32)aField[i].iVal);                 break;
+      case 8:  arrow_set64(a, (sqlite3_uint64)aField[i].iVal);      break;
+    }
+  }
+  return iTab;
+}
 
-  return rc;
+/* Make the offset at iAt of b refer to the object at iTarget */
+static void arrow_fb_link(ArrowBuf *b, i64 iAt, i64 iTarget){
+  arrow_set32(b->a+iAt, (u32)(iTarget-iAt));
 }
-#endif /* ifndef SQLITE_OMIT_VIRTUALTABLE */
 
 /*
-** Execute a statement or set of statements.  Print
-** any result rows/columns depending on the current mode
-** set via the supplied callback.
-**
-** This is very similar to SQLite's built-in sqlite3_exec()
-** function except it takes a slightly different callback
-** and callback data argument.
+** Append a vector of nElem elements of szElem bytes each, aligned to
+** nAlign bytes and zeroed, to b.  Return the offset of the vector, which
+** is that of its length, 4 bytes before the first element.
 */
-static int shell_exec(
-  ShellState *pArg,                         /* Pointer to ShellState */
-  const char *zSql,                         /* SQL to be evaluated */
-  char **pzErrMsg                           /* Error msg written here */
-){
-  sqlite3_stmt *pStmt = NULL;     /* Statement to execute. */
-  int rc = SQLITE_OK;             /* Return Code */
-  int rc2;
-  const char *zLeftover;          /* Tail of unprocessed SQL */
-  sqlite3 *db = pArg->db;
+static i64 arrow_fb_vector(ArrowBuf *b, int nElem, int szElem, int nAlign){
+  i64 i;
+  while( b->n%4 || (b->n+4)%nAlign ) arrow_space(b, 1);
+  i = arrow_space(b, 4 + (i64)nElem*szElem);
+  arrow_set32(b->a+i, nElem);
+  return i;
+}
 
-  if( pzErrMsg ){
-    *pzErrMsg = NULL;
-  }
+/* Append the string z to b and return its offset */
+static i64 arrow_fb_string(ArrowBuf *b, const char *z){
+  int n = strlen30(z);
+  i64 i;
+  arrow_pad(b, 4);
+  i = arrow_space(b, 4+n+1);
+  arrow_set32(b->a+i, n);
+  memcpy(b->a+i+4, z, n);
+  return i;
+}
 
-#ifndef SQLITE_OMIT_VIRTUALTABLE
-  if( pArg->expert.pExpert ){
-    rc = expertHandleSQL(pArg, zSql, pzErrMsg);
-    return expertFinish(pArg, (rc!=SQLITE_OK), pzErrMsg);
-  }
-#endif
+/*
+** Start b over with the flatbuffer of a Message that has a header of
+** type eHdr and a body of nBody bytes.  Return the offset of the offset
+** to link to the header table.
+*/
+static i64 arrow_fb_message(ArrowBuf *b, int eHdr, i64 nBody){
+  ArrowFbField aField[4] = {
+    {2, ARROW_V5, 0}, {1, 0, 0}, {ARROW_FB_REF, 0, 0}, {8, 0, 0}
+  };
+  aField[1].iVal = eHdr;
+  aField[3].iVal = nBody;
+  b->n = 0;
+  arrow_space(b, 4);            /* Offset of the root table */
+  arrow_fb_link(b, 0, arrow_fb_table(b, aField, 4));
+  return aField[2].iAt;
+}
+
+/* Write the message with metadata pMeta and body pBody, if any, to out */
+static void arrow_write_message(FILE *out, ArrowBuf *pMeta, ArrowBuf *pBody){
+  unsigned char aPrefix[8];
+  arrow_pad(pMeta, 8);
+  arrow_set32(aPrefix, 0xffffffff);
+  arrow_set32(aPrefix+4, (u32)pMeta->n);
+  fwrite(aPrefix, 1, 8, out);
+  fwrite(pMeta->a, 1, pMeta->n, out);
+  if( pBody && pBody->n>0 ) fwrite(pBody->a, 1, pBody->n, out);
+}
+
+/* A column of ".mode arrow" output, with its values in the current batch */
+typedef struct ArrowCol ArrowCol;
+struct ArrowCol {
+  char *zName;           /* Column name */
+  int eDecl;             /* ARROW_* type from the declared type */
+  int eType;             /* ARROW_Int, _FloatingPoint, _Utf8 or _Binary */
+  unsigned char *aType;  /* SQLITE_* type of each value */
+  i64 *aVal;             /* INTEGER, REAL bits, or offset into data.a[] */
+  int *aLen;             /* Size of each TEXT or BLOB */
+};
 
-  while( zSql[0] && (SQLITE_OK == rc) ){
-    static const char *zStmtSql;
-    rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, &zLeftover);
-    if( SQLITE_OK != rc ){
-      if( pzErrMsg ){
-        *pzErrMsg = save_err_msg(db, "in prepare", rc, zSql);
+/* The state of exec_prepared_stmt_arrow() */
+typedef struct ArrowWriter ArrowWriter;
+struct ArrowWriter {
+  FILE *out;             /* Write the stream here */
+  sqlite3 *db;           /* Database connection, for pCast */
+  int nCol;              /* Number of columns */
+  ArrowCol *aCol;        /* The columns */
+  int nRow;              /* Rows in the current batch */
+  int nAlloc;            /* Rows allocated in each ArrowCol */
+  int mxRow;             /* Rows per batch */
+  ArrowBuf data;         /* TEXT and BLOB values of the batch */
+  ArrowBuf meta;         /* Message metadata */
+  ArrowBuf body;         /* Message body */
+  i64 *aBuf;             /* Offset and size of each buffer of the body */
+  i64 *aNull;            /* NULLs in each column of the batch */
+  sqlite3_stmt *pCast;   /* Converts a value to INTEGER, REAL and TEXT */
+  i64 nConvert;          /* Number of values converted */
+  int bSchema;           /* True once the Schema message is written */
+};
+
+/* The Arrow type of a column of declared type zType with only NULLs */
+static int arrow_decl_type(const char *zType){
+  if( zType==0 ) return ARROW_Utf8;
+  if( sqlite3_strlike("%INT%", zType, 0)==0 ) return ARROW_Int;
+  if( sqlite3_strlike("%BLOB%", zType, 0)==0 ) return ARROW_Binary;
+  if( sqlite3_strlike("%REAL%", zType, 0)==0
+   || sqlite3_strlike("%FLOA%", zType, 0)==0
+   || sqlite3_strlike("%DOUB%", zType, 0)==0
+  ){
+    return ARROW_FloatingPoint;
+  }
+  return ARROW_Utf8;
+}
+
+/* Add the current row of pStmt to the batch */
+static void arrow_add_row(ArrowWriter *w, sqlite3_stmt *pStmt){
+  int i, iRow = w->nRow;
+  if( iRow==w->nAlloc ){
+    int nNew = w->nAlloc ? w->nAlloc*2 : 1024;
+    if( nNew>w->mxRow ) nNew = w->mxRow;
+    for(i=0; i<w->nCol; i++){
+      ArrowCol *pCol = &w->aCol[i];
+      pCol->aType = sqlite3_realloc64(pCol->aType, nNew);
+      pCol->aVal = sqlite3_realloc64(pCol->aVal, nNew*sizeof(i64));
+      pCol->aLen = sqlite3_realloc64(pCol->aLen, nNew*sizeof(int));
+      shell_check_oom(pCol->aType);
+      shell_check_oom(pCol->aVal);
+      shell_check_oom(pCol->aLen);
+    }
+    w->nAlloc = nNew;
+  }
+  for(i=0; i<w->nCol; i++){
+    ArrowCol *pCol = &w->aCol[i];
+    int eType = sqlite3_column_type(pStmt, i);
+    pCol->aType[iRow] = (unsigned char)eType;
+    switch( eType ){
+      case SQLITE_INTEGER: {
+        pCol->aVal[iRow] = sqlite3_column_int64(pStmt, i);
+        break;
       }
-    }else{
-      if( !pStmt ){
-        /* this happens for a comment or white-space */
-        zSql = zLeftover;
-        while( IsSpace(zSql[0]) ) zSql++;
-        continue;
+      case SQLITE_FLOAT: {
+        double r = sqlite3_column_double(pStmt, i);
+        memcpy(&pCol->aVal[iRow], &r, sizeof(r));
+        break;
       }
-      zStmtSql = sqlite3_sql(pStmt);
-      if( zStmtSql==0 ) zStmtSql = "";
-      while( IsSpace(zStmtSql[0]) ) zStmtSql++;
-
-      /* save off the prepared statement handle and reset row count */
-      if( pArg ){
-        pArg->pStmt = pStmt;
-        pArg->cnt = 0;
+      case SQLITE_TEXT:
+      case SQLITE_BLOB: {
+        const void *z = eType==SQLITE_TEXT
+                          ? (const void*)sqlite3_column_text(pStmt, i)
+                          : sqlite3_column_blob(pStmt, i);
+        int n = sqlite3_column_bytes(pStmt, i);
+        i64 iOff = arrow_space(&w->data, n);
+        if( n>0 ) memcpy(w->data.a+iOff, z, n);
+        pCol->aVal[iRow] = iOff;
+        pCol->aLen[iRow] = n;
+        break;
       }
+    }
+  }
+  w->nRow++;
+}
 
-      /* Show the EXPLAIN QUERY PLAN if .eqp is on */
-      if( pArg && pArg->autoEQP && sqlite3_stmt_isexplain(pStmt)==0 ){
-        sqlite3_stmt *pExplain;
-        int triggerEQP = 0;
-        disable_debug_trace_modes();
-        sqlite3_db_config(db, SQLITE_DBCONFIG_TRIGGER_EQP, -1, &triggerEQP);
-        if( pArg->autoEQP>=AUTOEQP_trigger ){
-          sqlite3_db_config(db, SQLITE_DBCONFIG_TRIGGER_EQP, 1, 0);
-        }
-        pExplain = pStmt;
-        sqlite3_reset(pExplain);
-        rc = sqlite3_stmt_explain(pExplain, 2);
-        if( rc==SQLITE_OK ){
-          while( sqlite3_step(pExplain)==SQLITE_ROW ){
-            const char *zEQPLine = (const char*)sqlite3_column_text(pExplain,3);
-            int iEqpId = sqlite3_column_int(pExplain, 0);
-            int iParentId = sqlite3_column_int(pExplain, 1);
-            if( zEQPLine==0 ) zEQPLine = "";
-            if( zEQPLine[0]=='-' ) eqp_render(pArg, 0);
-            eqp_append(pArg, iEqpId, iParentId, zEQPLine);
+/*
+** Convert value iRow of pCol for a column of another type.  Return a
+** statement with the value CAST to INTEGER, REAL and TEXT in its three
+** columns, or NULL if that fails.
+*/
+static sqlite3_stmt *arrow_convert(ArrowWriter *w, ArrowCol *pCol, int iRow){
+  sqlite3_stmt *pCast = w->pCast;
+  if( pCast==0 ){
+    sqlite3_prepare_v2(w->db,
+        "SELECT CAST(?1 AS INTEGER), CAST(?1 AS REAL), CAST(?1 AS TEXT)",
+        -1, &w->pCast, 0);
+    if( (pCast = w->pCast)==0 ) return 0;
+  }
+  sqlite3_reset(pCast);
+  switch( pCol->aType[iRow] ){
+    case SQLITE_INTEGER: {
+      sqlite3_bind_int64(pCast, 1, pCol->aVal[iRow]);
+      break;
+    }
+    case SQLITE_FLOAT: {
+      double r;
+      memcpy(&r, &pCol->aVal[iRow], sizeof(r));
+      sqlite3_bind_double(pCast, 1, r);
+      break;
+    }
+    case SQLITE_TEXT: {
+      sqlite3_bind_text(pCast, 1, (const char*)w->data.a+pCol->aVal[iRow],
+                        pCol->aLen[iRow], SQLITE_STATIC);
+      break;
+    }
+    default: {
+      sqlite3_bind_blob(pCast, 1, w->data.a+pCol->aVal[iRow],
+                        pCol->aLen[iRow], SQLITE_STATIC);
+      break;
+    }
+  }
+  if( sqlite3_step(pCast)!=SQLITE_ROW ) return 0;
+  w->nConvert++;
+  return pCast;
+}
+
+/*
+** Append a buffer of n zero bytes to the body, 8-byte aligned, and note
+** it as buffer *piBuf of the batch.  Return its offset in the body.
+*/
+static i64 arrow_body_buffer(ArrowWriter *w, int *piBuf, i64 n){
+  i64 i;
+  arrow_pad(&w->body, 8);
+  i = arrow_space(&w->body, n);
+  w->aBuf[*piBuf*2] = i;
+  w->aBuf[*piBuf*2+1] = n;
+  (*piBuf)++;
+  return i;
+}
+
+/* Append the validity bitmap and values of pCol to the body */
+static void arrow_encode_column(ArrowWriter *w, ArrowCol *pCol, int *piBuf,
+                                i64 *pnNull){
+  int nRow = w->nRow;
+  int i;
+  i64 nNull = 0;
+  i64 iAt;
+  sqlite3_stmt *pCast;
+  for(i=0; i<nRow; i++){
+    if( pCol->aType[i]==SQLITE_NULL ) nNull++;
+  }
+  *pnNull = nNull;
+  /* The validity bitmap is left out if there are no NULLs */
+  iAt = arrow_body_buffer(w, piBuf, nNull ? (nRow+7)/8 : 0);
+  if( nNull ){
+    for(i=0; i<nRow; i++){
+      if( pCol->aType[i]!=SQLITE_NULL ) w->body.a[iAt+i/8] |= 1<<(i%8);
+    }
+  }
+  switch( pCol->eType ){
+    case ARROW_Int: {
+      iAt = arrow_body_buffer(w, piBuf, (i64)nRow*8);
+      for(i=0; i<nRow; i++){
+        i64 v = 0;
+        switch( pCol->aType[i] ){
+          case SQLITE_INTEGER:  v = pCol->aVal[i];  break;
+          case SQLITE_NULL:     break;
+          default: {
+            if( (pCast = arrow_convert(w, pCol, i))!=0 ){
+              v = sqlite3_column_int64(pCast, 0);
+            }
+            break;
           }
-          eqp_render(pArg, 0);
         }
-        if( pArg->autoEQP>=AUTOEQP_full ){
-          /* Also do an EXPLAIN for ".eqp full" mode */
-          sqlite3_reset(pExplain);
-          rc = sqlite3_stmt_explain(pExplain, 1);
-          if( rc==SQLITE_OK ){
-            pArg->cMode = MODE_Explain;
-            assert( sqlite3_stmt_isexplain(pExplain)==1 );
-            explain_data_prepare(pArg, pExplain);
-            exec_prepared_stmt(pArg, pExplain);
-            explain_data_delete(pArg);
+        arrow_set64(w->body.a+iAt+i*8, (sqlite3_uint64)v);
+      }
+      break;
+    }
+    case ARROW_FloatingPoint: {
+      iAt = arrow_body_buffer(w, piBuf, (i64)nRow*8);
+      for(i=0; i<nRow; i++){
+        double r = 0.0;
+        sqlite3_uint64 u;
+        switch( pCol->aType[i] ){
+          case SQLITE_FLOAT:    memcpy(&r, &pCol->aVal[i], sizeof(r));  break;
+          case SQLITE_INTEGER:  r = (double)pCol->aVal[i];              break;
+          case SQLITE_NULL:     break;
+          default: {
+            if( (pCast = arrow_convert(w, pCol, i))!=0 ){
+              r = sqlite3_column_double(pCast, 1);
+            }
+            break;
           }
         }
-        if( pArg->autoEQP>=AUTOEQP_trigger && triggerEQP==0 ){
-          sqlite3_db_config(db, SQLITE_DBCONFIG_TRIGGER_EQP, 0, 0);
-        }
-        sqlite3_reset(pStmt);
-        sqlite3_stmt_explain(pStmt, 0);
-        restore_debug_trace_modes();
+        memcpy(&u, &r, sizeof(u));
+        arrow_set64(w->body.a+iAt+i*8, u);
       }
-
-      if( pArg ){
-        int bIsExplain = (sqlite3_stmt_isexplain(pStmt)==1);
-        pArg->cMode = pArg->mode;
-        if( pArg->autoExplain ){
-          if( bIsExplain ){
-            pArg->cMode = MODE_Explain;
+      break;
+    }
+    default: {
+      /* Utf8 and Binary: int32 offsets into the data that follows */
+      i64 iOffsets = arrow_body_buffer(w, piBuf, (i64)(nRow+1)*4);
+      i64 iData = arrow_body_buffer(w, piBuf, 0);
+      for(i=0; i<nRow; i++){
+        const unsigned char *z = 0;
+        int n = 0;
+        switch( pCol->aType[i] ){
+          case SQLITE_TEXT:
+          case SQLITE_BLOB: {
+            z = w->data.a+pCol->aVal[i];
+            n = pCol->aLen[i];
+            break;
           }
-          if( sqlite3_stmt_isexplain(pStmt)==2 ){
-            pArg->cMode = MODE_EQP;
+          case SQLITE_NULL:  break;
+          default: {
+            if( (pCast = arrow_convert(w, pCol, i))!=0 ){
+              z = sqlite3_column_text(pCast, 2);
+              n = sqlite3_column_bytes(pCast, 2);
+            }
+            break;
           }
         }
-
-        /* If the shell is currently in ".explain" mode, gather the extra
-        ** data required to add indents to the output.*/
-        if( pArg->cMode==MODE_Explain && bIsExplain ){
-          explain_data_prepare(pArg, pStmt);
+        if( n>0 ){
+          i64 iByte = arrow_space(&w->body, n);
+          memcpy(w->body.a+iByte, z, n);
         }
+        arrow_set32(w->body.a+iOffsets+(i+1)*4, (u32)(w->body.n-iData));
       }
-
-      bind_prepared_stmt(pArg, pStmt);
-      exec_prepared_stmt(pArg, pStmt);
-      explain_data_delete(pArg);
-      eqp_render(pArg, 0);
-
-      /* print usage stats if stats on */
-      if( pArg && pArg->statsOn ){
-        display_stats(db, pArg, 0);
-      }
-
-      /* print loop-counters if required */
-      if( pArg && pArg->scanstatsOn ){
-        display_scanstats(db, pArg);
-      }
-
-      /* Finalize the statement just executed. If this fails, save a
-      ** copy of the error message. Otherwise, set zSql to point to the
-      ** next statement to execute. */
-      rc2 = sqlite3_finalize(pStmt);
-      if( rc!=SQLITE_NOMEM ) rc = rc2;
-      if( rc==SQLITE_OK ){
-        zSql = zLeftover;
-        while( IsSpace(zSql[0]) ) zSql++;
-      }else if( pzErrMsg ){
-        *pzErrMsg = save_err_msg(db, "stepping", rc, 0);
-      }
-
-      /* clear saved stmt handle */
-      if( pArg ){
-        pArg->pStmt = NULL;
-      }
+      w->aBuf[*piBuf*2-1] = w->body.n - iData;
+      break;
     }
-  } /* end while */
+  }
+}
 
-  return rc;
+/* Choose the type of each column from the values of the first batch */
+static void arrow_choose_types(ArrowWriter *w){
+  int i, j;
+  for(i=0; i<w->nCol; i++){
+    ArrowCol *pCol = &w->aCol[i];
+    unsigned mSeen = 0;
+    for(j=0; j<w->nRow; j++) mSeen |= 1<<pCol->aType[j];
+    if( mSeen & (1<<SQLITE_TEXT) ){
+      pCol->eType = ARROW_Utf8;
+    }else if( mSeen & (1<<SQLITE_BLOB) ){
+      pCol->eType = ARROW_Binary;
+    }else if( mSeen & (1<<SQLITE_FLOAT) ){
+      pCol->eType = ARROW_FloatingPoint;
+    }else if( mSeen & (1<<SQLITE_INTEGER) ){
+      pCol->eType = ARROW_Int;
+    }else{
+      pCol->eType = pCol->eDecl;
+    }
+  }
 }
 
-/*
-** Release memory previously allocated by tableColumnList().
-*/
-static void freeColumnList(char **azCol){
+/* Write the Schema message, a nullable field for each column */
+static void arrow_write_schema(ArrowWriter *w){
+  ArrowBuf *b = &w->meta;
+  ArrowFbField aSchema[2] = { {0, 0, 0}, {ARROW_FB_REF, 0, 0} };
+  i64 iHdr = arrow_fb_message(b, ARROW_MSG_Schema, 0);
+  i64 iFields;
   int i;
-  for(i=1; azCol[i]; i++){
-    sqlite3_free(azCol[i]);
+  arrow_fb_link(b, iHdr, arrow_fb_table(b, aSchema, 2));
+  iFields = arrow_fb_vector(b, w->nCol, 4, 4);
+  arrow_fb_link(b, aSchema[1].iAt, iFields);
+  for(i=0; i<w->nCol; i++){
+    ArrowCol *pCol = &w->aCol[i];
+    ArrowFbField aField[6] = {
+      {ARROW_FB_REF, 0, 0},     /* name */
+      {1, 1, 0},                /* nullable */
+      {1, 0, 0},                /* type_type */
+      {ARROW_FB_REF, 0, 0},     /* type */
+      {0, 0, 0},                /* dictionary */
+      {ARROW_FB_REF, 0, 0}      /* children */
+    };
+    ArrowFbField aType[2] = { {0, 0, 0}, {0, 0, 0} };
+    int nType = 0;
+    aField[2].iVal = pCol->eType;
+    arrow_fb_link(b, iFields+4+i*4, arrow_fb_table(b, aField, 6));
+    arrow_fb_link(b, aField[0].iAt, arrow_fb_string(b, pCol->zName));
+    if( pCol->eType==ARROW_Int ){
+      aType[0].nByte = 4;       /* bitWidth */
+      aType[0].iVal = 64;
+      aType[1].nByte = 1;       /* is_signed */
+      aType[1].iVal = 1;
+      nType = 2;
+    }else if( pCol->eType==ARROW_FloatingPoint ){
+      aType[0].nByte = 2;       /* precision: DOUBLE */
+      aType[0].iVal = 2;
+      nType = 1;
+    }
+    arrow_fb_link(b, aField[3].iAt, arrow_fb_table(b, aType, nType));
+    arrow_fb_link(b, aField[5].iAt, arrow_fb_vector(b, 0, 4, 4));
+  }
+  arrow_write_message(w->out, b, 0);
+  w->bSchema = 1;
+}
+
+/* Write the rows of the batch, after the Schema message if it is first */
+static void arrow_write_batch(ArrowWriter *w){
+  ArrowBuf *b = &w->meta;
+  ArrowFbField aBatch[3] = {
+    {8, 0, 0}, {ARROW_FB_REF, 0, 0}, {ARROW_FB_REF, 0, 0}
+  };
+  i64 iHdr, iVec;
+  int i, nBuf = 0;
+  if( !w->bSchema ){
+    arrow_choose_types(w);
+    arrow_write_schema(w);
+  }
+  if( w->nRow==0 ) return;
+  w->body.n = 0;
+  for(i=0; i<w->nCol; i++){
+    arrow_encode_column(w, &w->aCol[i], &nBuf, &w->aNull[i]);
+  }
+  arrow_pad(&w->body, 8);
+  iHdr = arrow_fb_message(b, ARROW_MSG_RecordBatch, w->body.n);
+  aBatch[0].iVal = w->nRow;
+  arrow_fb_link(b, iHdr, arrow_fb_table(b, aBatch, 3));
+  iVec = arrow_fb_vector(b, w->nCol, 16, 8);
+  arrow_fb_link(b, aBatch[1].iAt, iVec);
+  for(i=0; i<w->nCol; i++){
+    arrow_set64(b->a+iVec+4+i*16, w->nRow);
+    arrow_set64(b->a+iVec+4+i*16+8, w->aNull[i]);
+  }
+  iVec = arrow_fb_vector(b, nBuf, 16, 8);
+  arrow_fb_link(b, aBatch[2].iAt, iVec);
+  for(i=0; i<nBuf; i++){
+    arrow_set64(b->a+iVec+4+i*16, w->aBuf[i*2]);
+    arrow_set64(b->a+iVec+4+i*16+8, w->aBuf[i*2+1]);
+  }
+  arrow_write_message(w->out, b, &w->body);
+  w->nRow = 0;
+  w->data.n = 0;
+}
+
+/*
+** Run pStmt in MODE_Arrow.  Statements that return no columns write
+** nothing, and those that return no rows write a Schema message only.
+*/
+static void exec_prepared_stmt_arrow(ShellState *p, sqlite3_stmt *pStmt){
+  ArrowWriter w;
+  unsigned char aEos[8];
+  int i;
+  int rc = sqlite3_step(pStmt);
+  memset(&w, 0, sizeof(w));
+  w.nCol = sqlite3_column_count(pStmt);
+  if( w.nCol==0 || (rc!=SQLITE_ROW && rc!=SQLITE_DONE) ) return;
+  w.out = p->out;
+  w.db = p->db;
+  w.mxRow = p->nArrowBatch>0 ? p->nArrowBatch : ARROW_BATCH_ROWS;
+  w.aCol = sqlite3_malloc64(w.nCol*sizeof(ArrowCol));
+  w.aBuf = sqlite3_malloc64(w.nCol*7*sizeof(i64));
+  shell_check_oom(w.aCol);
+  shell_check_oom(w.aBuf);
+  memset(w.aCol, 0, w.nCol*sizeof(ArrowCol));
+  w.aNull = &w.aBuf[w.nCol*6];
+  for(i=0; i<w.nCol; i++){
+    const char *zName = sqlite3_column_name(pStmt, i);
+    w.aCol[i].zName = sqlite3_mprintf("%s", zName ? zName : "");
+    shell_check_oom(w.aCol[i].zName);
+    w.aCol[i].eDecl = arrow_decl_type(sqlite3_column_decltype(pStmt, i));
+  }
+  setBinaryMode(p->out, 1);
+  while( rc==SQLITE_ROW ){
+    arrow_add_row(&w, pStmt);
+    if( w.nRow>=w.mxRow || w.data.n>=ARROW_BATCH_BYTES ){
+      arrow_write_batch(&w);
+    }
+    rc = sqlite3_step(pStmt);
   }
-  /* azCol[0] is a static string */
-  sqlite3_free(azCol);
+  arrow_write_batch(&w);
+  arrow_set32(aEos, 0xffffffff);
+  arrow_set32(aEos+4, 0);
+  fwrite(aEos, 1, 8, p->out);
+  setTextMode(p->out, 1);
+  if( w.nConvert>0 ){
+    eputf("warning: %lld values converted to the Arrow type of their column\n",
+          w.nConvert);
+  }
+  for(i=0; i<w.nCol; i++){
+    sqlite3_free(w.aCol[i].zName);
+    sqlite3_free(w.aCol[i].aType);
+    sqlite3_free(w.aCol[i].aVal);
+    sqlite3_free(w.aCol[i].aLen);
+  }
+  sqlite3_free(w.aCol);
+  sqlite3_free(w.aBuf);
+  sqlite3_free(w.data.a);
+  sqlite3_free(w.meta.a);
+  sqlite3_free(w.body.a);
+  sqlite3_finalize(w.pCast);
 }
-
+// End Android Add
 /*
-** Return a list of pointers to strings which are the names of all
-** columns in table zTab.   The memory to hold the names is dynamically
-** allocated and must be released by the caller using a subsequent call
-** to freeColumnList().
-**
-** The azCol[0] entry is usually NULL.  However, if zTab contains a rowid
-** value that needs to be preserved, then azCol[0] is filled in with the
-** name of the rowid column.
-**
-** The first regular column in the table is azCol[1].  The list is terminated
-** by an entry with azCol[i]==0.
+** Run a prepared statement
 */
-static char **tableColumnList(ShellState *p, const char *zTab){
-  char **azCol = 0;
-  sqlite3_stmt *pStmt;
-  char *zSql;
-  int nCol = 0;
-  int nAlloc = 0;
-  int nPK = 0;       /* Number of PRIMARY KEY columns seen */
-  int isIPK = 0;     /* True if one PRIMARY KEY column of type INTEGER */
-  int preserveRowid = ShellHasFlag(p, SHFLG_PreserveRowid);
+static void exec_prepared_stmt(
+  ShellState *pArg,                                /* Pointer to ShellState */
+  sqlite3_stmt *pStmt                              /* Statement to run */
+){
   int rc;
+  sqlite3_uint64 nRow = 0;
 
-  zSql = sqlite3_mprintf("PRAGMA table_info=%Q", zTab);
-  shell_check_oom(zSql);
-  rc = sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc ) return 0;
-  while( sqlite3_step(pStmt)==SQLITE_ROW ){
-    if( nCol>=nAlloc-2 ){
-      nAlloc = nAlloc*2 + nCol + 10;
-      azCol = sqlite3_realloc(azCol, nAlloc*sizeof(azCol[0]));
-      shell_check_oom(azCol);
-    }
-    azCol[++nCol] = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 1));
-    shell_check_oom(azCol[nCol]);
-    if( sqlite3_column_int(pStmt, 5) ){
-      nPK++;
-      if( nPK==1
-       && sqlite3_stricmp((const char*)sqlite3_column_text(pStmt,2),
-                          "INTEGER")==0
-      ){
-        isIPK = 1;
-      }else{
-        isIPK = 0;
-      }
-    }
+  if( pArg->cMode==MODE_Column
+   || pArg->cMode==MODE_Table
+   || pArg->cMode==MODE_Box
+   || pArg->cMode==MODE_Markdown
+  ){
+    exec_prepared_stmt_columnar(pArg, pStmt);
+    return;
   }
-  sqlite3_finalize(pStmt);
-  if( azCol==0 ) return 0;
-  azCol[0] = 0;
-  azCol[nCol+1] = 0;
+// Begin Android Add
+  if( pArg->cMode==MODE_Arrow ){
+    exec_prepared_stmt_arrow(pArg, pStmt);
+    return;
+  }
+#ifdef SHELL_OUT_BUFFER
+  if( (pArg->cMode==MODE_List
+    || pArg->cMode==MODE_Csv
+    || pArg->cMode==MODE_Json
+    || pArg->cMode==MODE_Insert
+    || pArg->cMode==MODE_Quote)
+   && pArg->out==setOutputStream(invalidFileStream)
+  ){
+    exec_prepared_stmt_buffered(pArg, pStmt);
+    return;
+  }
+#endif
+// End Android Add
 
-  /* The decision of whether or not a rowid really needs to be preserved
-  ** is tricky.  We never need to preserve a rowid for a WITHOUT ROWID table
-  ** or a table with an INTEGER PRIMARY KEY.  We are unable to preserve
-  ** rowids on tables where the rowid is inaccessible because there are other
-  ** columns in the table named "rowid", "_rowid_", and "oid".
+  /* perform the first step.  this will tell us if we
+  ** have a result set or not and how wide it is.
   */
-  if( preserveRowid && isIPK ){
-    /* If a single PRIMARY KEY column with type INTEGER was seen, then it
-    ** might be an alias for the ROWID.  But it might also be a WITHOUT ROWID
-    ** table or a INTEGER PRIMARY KEY DESC column, neither of which are
-    ** ROWID aliases.  To distinguish these cases, check to see if
-    ** there is a "pk" entry in "PRAGMA index_list".  There will be
-    ** no "pk" index if the PRIMARY KEY really is an alias for the ROWID.
-    */
-    zSql = sqlite3_mprintf("SELECT 1 FROM pragma_index_list(%Q)"
-                           " WHERE origin='pk'", zTab);
-    shell_check_oom(zSql);
-    rc = sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
-    if( rc ){
-      freeColumnList(azCol);
-      return 0;
-    }
-    rc = sqlite3_step(pStmt);
-    sqlite3_finalize(pStmt);
-    preserveRowid = rc==SQLITE_ROW;
-  }
-  if( preserveRowid ){
-    /* Only preserve the rowid if we can find a name to use for the
-    ** rowid */
-    static char *azRowid[] = { "rowid", "_rowid_", "oid" };
-    int i, j;
-    for(j=0; j<3; j++){
-      for(i=1; i<=nCol; i++){
-        if( sqlite3_stricmp(azRowid[j],azCol[i])==0 ) break;
+  rc = sqlite3_step(pStmt);
+  /* if we have a result set... */
+  if( SQLITE_ROW == rc ){
+    /* allocate space for col name ptr, value ptr, and type */
+    int nCol = sqlite3_column_count(pStmt);
+    void *pData = sqlite3_malloc64(3*nCol*sizeof(const char*) + 1);
+    if( !pData ){
+      shell_out_of_memory();
+    }else{
+      char **azCols = (char **)pData;      /* Names of result columns */
+      char **azVals = &azCols[nCol];       /* Results */
+      int *aiTypes = (int *)&azVals[nCol]; /* Result types */
+      int i, x;
+      assert(sizeof(int) <= sizeof(char *));
+      /* save off ptrs to column names */
+      for(i=0; i<nCol; i++){
+        azCols[i] = (char *)sqlite3_column_name(pStmt, i);
       }
-      if( i>nCol ){
-        /* At this point, we know that azRowid[j] is not the name of any
-        ** ordinary column in the table.  Verify that azRowid[j] is a valid
-        ** name for the rowid before adding it to azCol[0].  WITHOUT ROWID
-        ** tables will fail this last check */
-        rc = sqlite3_table_column_metadata(p->db,0,zTab,azRowid[j],0,0,0,0,0);
-        if( rc==SQLITE_OK ) azCol[0] = azRowid[j];
-        break;
+      do{
+        nRow++;
+        /* extract the data and data types */
+        for(i=0; i<nCol; i++){
+          aiTypes[i] = x = sqlite3_column_type(pStmt, i);
+          if( x==SQLITE_BLOB
+           && pArg
+           && (pArg->cMode==MODE_Insert || pArg->cMode==MODE_Quote)
+          ){
+            azVals[i] = "";
+          }else{
+            azVals[i] = (char*)sqlite3_column_text(pStmt, i);
+          }
+          if( !azVals[i] && (aiTypes[i]!=SQLITE_NULL) ){
+            rc = SQLITE_NOMEM;
+            break; /* from for */
+          }
+        } /* end for */
+
+        /* if data and types extracted successfully... */
+        if( SQLITE_ROW == rc ){
+          /* call the supplied callback with the result row data */
+          if( shell_callback(pArg, nCol, azVals, azCols, aiTypes) ){
+            rc = SQLITE_ABORT;
+          }else{
+            rc = sqlite3_step(pStmt);
+          }
+        }
+      } while( SQLITE_ROW == rc );
+      sqlite3_free(pData);
+      if( pArg->cMode==MODE_Json ){
+        fputs("]\n", pArg->out);
+      }else if( pArg->cMode==MODE_Count ){
+        char zBuf[200];
+        sqlite3_snprintf(sizeof(zBuf), zBuf, "%llu row%s\n",
+                         nRow, nRow!=1 ? "s" : "");
+        printf("%s", zBuf);
       }
     }
   }
-  return azCol;
 }
 
+#ifndef SQLITE_OMIT_VIRTUALTABLE
 /*
-** Toggle the reverse_unordered_selects setting.
+** This function is called to process SQL if the previous shell command
+** was ".expert". It passes the SQL in the second argument directly to
+** the sqlite3expert object.
+**
+** If successful, SQLITE_OK is returned. Otherwise, an SQLite error
+** code. In this case, (*pzErr) may be set to point to a buffer containing
+** an English language error message. It is the responsibility of the
+** caller to eventually free this buffer using sqlite3_free().
 */
-static void toggleSelectOrder(sqlite3 *db){
-  sqlite3_stmt *pStmt = 0;
-  int iSetting = 0;
-  char zStmt[100];
-  sqlite3_prepare_v2(db, "PRAGMA reverse_unordered_selects", -1, &pStmt, 0);
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    iSetting = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-  sqlite3_snprintf(sizeof(zStmt), zStmt,
-       "PRAGMA reverse_unordered_selects(%d)", !iSetting);
-  sqlite3_exec(db, zStmt, 0, 0, 0);
+static int expertHandleSQL(
+  ShellState *pState,
+  const char *zSql,
+  char **pzErr
+){
+  assert( pState->expert.pExpert );
+  assert( pzErr==0 || *pzErr==0 );
+  return sqlite3_expert_sql(pState->expert.pExpert, zSql, pzErr);
 }
 
 /*
-** This is a different callback routine used for dumping the database.
-** Each row received by this callback consists of a table name,
-** the table type ("index" or "table") and SQL to create the table.
-** This routine should print text sufficient to recreate the table.
+** This function is called either to silently clean up the object
+** created by the ".expert" command (if bCancel==1), or to generate a
+** report from it and then clean it up (if bCancel==0).
+**
+** If successful, SQLITE_OK is returned. Otherwise, an SQLite error
+** code. In this case, (*pzErr) may be set to point to a buffer containing
+** an English language error message. It is the responsibility of the
+** caller to eventually free this buffer using sqlite3_free().
 */
-static int dump_callback(void *pArg, int nArg, char **azArg, char **azNotUsed){
-  int rc;
-  const char *zTable;
-  const char *zType;
-  const char *zSql;
-  ShellState *p = (ShellState *)pArg;
-  int dataOnly;
-  int noSys;
+static int expertFinish(
+  ShellState *pState,
+  int bCancel,
+  char **pzErr
+){
+  int rc = SQLITE_OK;
+  sqlite3expert *p = pState->expert.pExpert;
+  assert( p );
+  assert( bCancel || pzErr==0 || *pzErr==0 );
+  if( bCancel==0 ){
+    int bVerbose = pState->expert.bVerbose;
 
-  UNUSED_PARAMETER(azNotUsed);
-  if( nArg!=3 || azArg==0 ) return 0;
-  zTable = azArg[0];
-  zType = azArg[1];
-  zSql = azArg[2];
-  if( zTable==0 ) return 0;
-  if( zType==0 ) return 0;
-  dataOnly = (p->shellFlgs & SHFLG_DumpDataOnly)!=0;
-  noSys    = (p->shellFlgs & SHFLG_DumpNoSys)!=0;
+    rc = sqlite3_expert_analyze(p, pzErr);
+    if( rc==SQLITE_OK ){
+      int nQuery = sqlite3_expert_count(p);
+      int i;
 
-  if( cli_strcmp(zTable, "sqlite_sequence")==0 && !noSys ){
-    if( !dataOnly ) oputz("DELETE FROM sqlite_sequence;\n");
-  }else if( sqlite3_strglob("sqlite_stat?", zTable)==0 && !noSys ){
-    if( !dataOnly ) oputz("ANALYZE sqlite_schema;\n");
-  }else if( cli_strncmp(zTable, "sqlite_", 7)==0 ){
-    return 0;
-  }else if( dataOnly ){
-    /* no-op */
-  }else if( cli_strncmp(zSql, "CREATE VIRTUAL TABLE", 20)==0 ){
-    char *zIns;
-    if( !p->writableSchema ){
-      oputz("PRAGMA writable_schema=ON;\n");
-      p->writableSchema = 1;
+      if( bVerbose ){
+        const char *zCand = sqlite3_expert_report(p,0,EXPERT_REPORT_CANDIDATES);
+        oputz("-- Candidates -----------------------------\n");
+        oputf("%s\n", zCand);
+      }
+      for(i=0; i<nQuery; i++){
+        const char *zSql = sqlite3_expert_report(p, i, EXPERT_REPORT_SQL);
+        const char *zIdx = sqlite3_expert_report(p, i, EXPERT_REPORT_INDEXES);
+        const char *zEQP = sqlite3_expert_report(p, i, EXPERT_REPORT_PLAN);
+        if( zIdx==0 ) zIdx = "(no new indexes)\n";
+        if( bVerbose ){
+          oputf("-- Query %d --------------------------------\n",i+1);
+          oputf("%s\n\n", zSql);
+        }
+        oputf("%s\n", zIdx);
+        oputf("%s\n", zEQP);
+      }
     }
-    zIns = sqlite3_mprintf(
-       "INSERT INTO sqlite_schema(type,name,tbl_name,rootpage,sql)"
-       "VALUES('table','%q','%q',0,'%q');",
-       zTable, zTable, zSql);
-    shell_check_oom(zIns);
-    oputf("%s\n", zIns);
-    sqlite3_free(zIns);
-    return 0;
-  }else{
-    printSchemaLine(zSql, ";\n");
   }
+  sqlite3_expert_destroy(p);
+  pState->expert.pExpert = 0;
+  return rc;
+}
 
-  if( cli_strcmp(zType, "table")==0 ){
-    ShellText sSelect;
-    ShellText sTable;
-    char **azCol;
-    int i;
-    char *savedDestTable;
-    int savedMode;
-
-    azCol = tableColumnList(p, zTable);
-    if( azCol==0 ){
-      p->nErr++;
-      return 0;
-    }
-
-    /* Always quote the table name, even if it appears to be pure ascii,
-    ** in case it is a keyword. Ex:  INSERT INTO "table" ... */
-    initText(&sTable);
-    appendText(&sTable, zTable, quoteChar(zTable));
-    /* If preserving the rowid, add a column list after the table name.
-    ** In other words:  "INSERT INTO tab(rowid,a,b,c,...) VALUES(...)"
-    ** instead of the usual "INSERT INTO tab VALUES(...)".
-    */
-    if( azCol[0] ){
-      appendText(&sTable, "(", 0);
-      appendText(&sTable, azCol[0], 0);
-      for(i=1; azCol[i]; i++){
-        appendText(&sTable, ",", 0);
-        appendText(&sTable, azCol[i], quoteChar(azCol[i]));
-      }
-      appendText(&sTable, ")", 0);
-    }
+/*
+** Implementation of ".expert" dot command.
+*/
+static int expertDotCommand(
+  ShellState *pState,             /* Current shell tool state */
+  char **azArg,                   /* Array of arguments passed to dot command */
+  int nArg                        /* Number of entries in azArg[] */
+){
+  int rc = SQLITE_OK;
+  char *zErr = 0;
+  int i;
+  int iSample = 0;
 
-    /* Build an appropriate SELECT statement */
-    initText(&sSelect);
-    appendText(&sSelect, "SELECT ", 0);
-    if( azCol[0] ){
-      appendText(&sSelect, azCol[0], 0);
-      appendText(&sSelect, ",", 0);
+  assert( pState->expert.pExpert==0 );
+  memset(&pState->expert, 0, sizeof(ExpertInfo));
+
+  for(i=1; rc==SQLITE_OK && i<nArg; i++){
+    char *z = azArg[i];
+    int n;
+    if( z[0]=='-' && z[1]=='-' ) z++;
+    n = strlen30(z);
+    if( n>=2 && 0==cli_strncmp(z, "-verbose", n) ){
+      pState->expert.bVerbose = 1;
     }
-    for(i=1; azCol[i]; i++){
-      appendText(&sSelect, azCol[i], quoteChar(azCol[i]));
-      if( azCol[i+1] ){
-        appendText(&sSelect, ",", 0);
+    else if( n>=2 && 0==cli_strncmp(z, "-sample", n) ){
+      if( i==(nArg-1) ){
+        eputf("option requires an argument: %s\n", z);
+        rc = SQLITE_ERROR;
+      }else{
+        iSample = (int)integerValue(azArg[++i]);
+        if( iSample<0 || iSample>100 ){
+          eputf("value out of range: %s\n", azArg[i]);
+          rc = SQLITE_ERROR;
+        }
       }
     }
-    freeColumnList(azCol);
-    appendText(&sSelect, " FROM ", 0);
-    appendText(&sSelect, zTable, quoteChar(zTable));
+    else{
+      eputf("unknown option: %s\n", z);
+      rc = SQLITE_ERROR;
+    }
+  }
 
-    savedDestTable = p->zDestTable;
-    savedMode = p->mode;
-    p->zDestTable = sTable.z;
-    p->mode = p->cMode = MODE_Insert;
-    rc = shell_exec(p, sSelect.z, 0);
-    if( (rc&0xff)==SQLITE_CORRUPT ){
-      oputz("/****** CORRUPTION ERROR *******/\n");
-      toggleSelectOrder(p->db);
-      shell_exec(p, sSelect.z, 0);
-      toggleSelectOrder(p->db);
+  if( rc==SQLITE_OK ){
+    pState->expert.pExpert = sqlite3_expert_new(pState->db, &zErr);
+    if( pState->expert.pExpert==0 ){
+      eputf("sqlite3_expert_new: %s\n", zErr ? zErr : "out of memory");
+      rc = SQLITE_ERROR;
+    }else{
+      sqlite3_expert_config(
+          pState->expert.pExpert, EXPERT_CONFIG_SAMPLE, iSample
+      );
     }
-    p->zDestTable = savedDestTable;
-    p->mode = savedMode;
-    freeText(&sTable);
-    freeText(&sSelect);
-    if( rc ) p->nErr++;
   }
-  return 0;
+  sqlite3_free(zErr);
+
+  return rc;
 }
+#endif /* ifndef SQLITE_OMIT_VIRTUALTABLE */
 
+// Begin Android Add
 /*
-** Run zQuery.  Use dump_callback() as the callback routine so that
-** the contents of the query are output as SQL statements.
-**
-** If we get a SQLITE_CORRUPT error, rerun the query after appending
-** "ORDER BY rowid DESC" to the end.
+** ".timer histogram" keeps, for each shape of statement run from the
+** input, a histogram of its latency and the totals of some of its
+** sqlite3_stmt_status() counters.  Two statements have the same shape if
+** stmt_hist_normalize() makes the same text of them.  Latencies below
+** 2*STMT_HIST_SUB microseconds are counted exactly, and larger ones in
+** STMT_HIST_SUB buckets per power of two, as HdrHistogram does, so the
+** percentiles reported are within 1/STMT_HIST_SUB of the true values.
 */
-static int run_schema_dump_query(
-  ShellState *p,
-  const char *zQuery
-){
-  int rc;
-  char *zErr = 0;
-  rc = sqlite3_exec(p->db, zQuery, dump_callback, p, &zErr);
-  if( rc==SQLITE_CORRUPT ){
-    char *zQ2;
-    int len = strlen30(zQuery);
-    oputz("/****** CORRUPTION ERROR *******/\n");
-    if( zErr ){
-      oputf("/****** %s ******/\n", zErr);
-      sqlite3_free(zErr);
-      zErr = 0;
+
+/* Return the bucket of aCount[] for a latency of v microseconds */
+static int stmt_hist_bucket(i64 v){
+  u64 u;
+  int e = 0;
+  if( v<2*STMT_HIST_SUB ) return v<0 ? 0 : (int)v;
+  for(u=(u64)v; u>=2*STMT_HIST_SUB; u>>=1) e++;
+  if( e>36 ) return STMT_HIST_NBUCKET-1;
+  return (e+1)*STMT_HIST_SUB + (int)(u - STMT_HIST_SUB);
+}
+
+/* Return the largest latency counted in bucket i of aCount[] */
+static i64 stmt_hist_value(int i){
+  int e;
+  if( i<2*STMT_HIST_SUB ) return i;
+  e = i/STMT_HIST_SUB - 1;
+  return ((i64)(i%STMT_HIST_SUB + STMT_HIST_SUB + 1)<<e) - 1;
+}
+
+/* Return the latency below which rPct percent of the runs of pEntry are */
+static i64 stmt_hist_percentile(StmtHistEntry *pEntry, double rPct){
+  i64 nWant = (i64)(pEntry->nRun*rPct/100.0);
+  i64 nSeen = 0;
+  int i;
+  if( nWant<pEntry->nRun*rPct/100.0 ) nWant++;
+  if( nWant<1 ) nWant = 1;
+  for(i=0; i<STMT_HIST_NBUCKET; i++){
+    nSeen += pEntry->aCount[i];
+    if( nSeen>=nWant ) break;
+  }
+  if( i>=STMT_HIST_NBUCKET || stmt_hist_value(i)>pEntry->iMax ){
+    return pEntry->iMax;
+  }
+  return stmt_hist_value(i);
+}
+
+static int stmt_hist_is_ident(char c){
+  return isalnum((unsigned char)c) || c=='_' || c=='$' || (c&0x80)!=0;
+}
+
+/*
+** Append a literal to the normalized SQL in z[0..n-1] and return the new
+** n.  A literal after "(?," makes it "(?,...", and others after that are
+** dropped.
+*/
+static int stmt_hist_literal(char *z, int n){
+  if( n>=7 && memcmp(&z[n-7], "(?,...,", 7)==0 ){
+    n--;
+  }else if( n>=3 && memcmp(&z[n-3], "(?,", 3)==0 ){
+    memcpy(&z[n], "...", 3);
+    n += 3;
+  }else{
+    z[n++] = '?';
+  }
+  return n;
+}
+
+/*
+** Return the shape of statement zSql, in memory from sqlite3_malloc():
+** zSql without its comments, with runs of white space made one space or
+** none, and with each literal replaced by "?" and each parenthesized
+** list of literals by "(?,...)".
+*/
+static char *stmt_hist_normalize(const char *zSql){
+  i64 nSql = strlen(zSql);
+  char *z = sqlite3_malloc64(nSql*3 + 1);
+  int n = 0;
+  i64 i = 0;
+  shell_check_oom(z);
+  while( zSql[i] ){
+    char c = zSql[i];
+    char cPrev = n>0 ? z[n-1] : 0;
+    if( IsSpace(c) || (c=='-' && zSql[i+1]=='-')
+     || (c=='/' && zSql[i+1]=='*')
+    ){
+      while( 1 ){
+        if( IsSpace(zSql[i]) ){
+          i++;
+        }else if( zSql[i]=='-' && zSql[i+1]=='-' ){
+          while( zSql[i] && zSql[i]!='\n' ) i++;
+        }else if( zSql[i]=='/' && zSql[i+1]=='*' ){
+          for(i+=2; zSql[i] && (zSql[i]!='*' || zSql[i+1]!='/'); i++){}
+          if( zSql[i] ) i += 2;
+        }else{
+          break;
+        }
+      }
+      if( cPrev!=0 && cPrev!='(' && cPrev!=',' && zSql[i]!=0
+       && zSql[i]!=')' && zSql[i]!=',' && zSql[i]!=';'
+      ){
+        z[n++] = ' ';
+      }
+    }else if( c=='\''
+           || ((c=='x' || c=='X') && zSql[i+1]=='\''
+               && !stmt_hist_is_ident(cPrev))
+    ){
+      if( c!='\'' ) i++;
+      for(i++; zSql[i]; i++){
+        if( zSql[i]=='\'' ){
+          if( zSql[i+1]!='\'' ){ i++; break; }
+          i++;
+        }
+      }
+      n = stmt_hist_literal(z, n);
+    }else if( c=='"' || c=='`' || c=='[' ){
+      char cEnd = c=='[' ? ']' : c;
+      z[n++] = zSql[i++];
+      while( zSql[i] ){
+        z[n++] = zSql[i];
+        if( zSql[i++]==cEnd ){
+          if( cEnd==']' || zSql[i]!=cEnd ) break;
+          z[n++] = zSql[i++];
+        }
+      }
+    }else if( (IsDigit(c) || (c=='.' && IsDigit(zSql[i+1])))
+           && !stmt_hist_is_ident(cPrev) && cPrev!='?'
+    ){
+      for(i++; zSql[i]; i++){
+        if( (zSql[i]=='+' || zSql[i]=='-')
+         && (zSql[i-1]=='e' || zSql[i-1]=='E')
+        ){
+          continue;
+        }
+        if( !stmt_hist_is_ident(zSql[i]) && zSql[i]!='.' ) break;
+      }
+      n = stmt_hist_literal(z, n);
+    }else if( stmt_hist_is_ident(c) ){
+      while( stmt_hist_is_ident(zSql[i]) ) z[n++] = zSql[i++];
+    }else{
+      z[n++] = zSql[i++];
     }
-    zQ2 = malloc( len+100 );
-    if( zQ2==0 ) return rc;
-    sqlite3_snprintf(len+100, zQ2, "%s ORDER BY rowid DESC", zQuery);
-    rc = sqlite3_exec(p->db, zQ2, dump_callback, p, &zErr);
-    if( rc ){
-      oputf("/****** ERROR: %s ******/\n", zErr);
+  }
+  while( n>0 && (z[n-1]==';' || z[n-1]==' ') ) n--;
+  z[n] = 0;
+  return z;
+}
+
+/* Start timing a run of pStmt, and return the time it started */
+static i64 stmt_hist_begin(sqlite3_stmt *pStmt){
+  sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+  sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_SORT, 1);
+  sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+  sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+  return timerMicros();
+}
+
+/* Add a run of pStmt that started at iStart to pHist */
+static void stmt_hist_record(StmtHist *pHist, sqlite3_stmt *pStmt,
+                             i64 iStart){
+  i64 iTime = timerMicros() - iStart;
+  const char *zSql = sqlite3_sql(pStmt);
+  char *zNorm = stmt_hist_normalize(zSql ? zSql : "");
+  StmtHistEntry *pEntry;
+  unsigned int h = 0;
+  int i;
+  for(i=0; zNorm[i]; i++) h = h*31 + (unsigned char)zNorm[i];
+  for(pEntry=pHist->aHash[h%STMT_HIST_NHASH]; pEntry; pEntry=pEntry->pNext){
+    if( pEntry->h==h && strcmp(pEntry->zSql, zNorm)==0 ) break;
+  }
+  if( pEntry==0 ){
+    if( pHist->nEntry>=pHist->nAlloc ){
+      pHist->nAlloc = pHist->nAlloc*2 + 16;
+      pHist->apEntry = sqlite3_realloc64(pHist->apEntry,
+                                         pHist->nAlloc*sizeof(pEntry));
+      shell_check_oom(pHist->apEntry);
+    }
+    pEntry = sqlite3_malloc64(sizeof(*pEntry));
+    shell_check_oom(pEntry);
+    memset(pEntry, 0, sizeof(*pEntry));
+    pEntry->zSql = zNorm;
+    zNorm = 0;
+    pEntry->h = h;
+    pEntry->pNext = pHist->aHash[h%STMT_HIST_NHASH];
+    pHist->aHash[h%STMT_HIST_NHASH] = pEntry;
+    pHist->apEntry[pHist->nEntry++] = pEntry;
+  }
+  sqlite3_free(zNorm);
+  pEntry->nRun++;
+  pEntry->iSum += iTime;
+  if( iTime>pEntry->iMax ) pEntry->iMax = iTime;
+  pEntry->aCount[stmt_hist_bucket(iTime)]++;
+  pEntry->nStep += sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_VM_STEP, 0);
+  pEntry->nSort += sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_SORT, 0);
+  pEntry->nAutoindex +=
+      sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_AUTOINDEX, 0);
+  pEntry->nFullscan +=
+      sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+}
+
+/* Remove all entries from pHist */
+static void stmt_hist_reset(StmtHist *pHist){
+  int i;
+  for(i=0; i<pHist->nEntry; i++){
+    sqlite3_free(pHist->apEntry[i]->zSql);
+    sqlite3_free(pHist->apEntry[i]);
+  }
+  sqlite3_free(pHist->apEntry);
+  pHist->apEntry = 0;
+  pHist->nEntry = pHist->nAlloc = 0;
+  memset(pHist->aHash, 0, sizeof(pHist->aHash));
+}
+
+/* Order entries by total latency, largest first */
+static int stmt_hist_compare(const void *pA, const void *pB){
+  const StmtHistEntry *a = *(StmtHistEntry*const*)pA;
+  const StmtHistEntry *b = *(StmtHistEntry*const*)pB;
+  if( a->iSum!=b->iSum ) return a->iSum>b->iSum ? -1 : 1;
+  return strcmp(a->zSql, b->zSql);
+}
+
+/* Write the report of ".timer histogram", in milliseconds */
+static void stmt_hist_report(StmtHist *pHist, int bJson){
+  int i;
+  qsort(pHist->apEntry, pHist->nEntry, sizeof(pHist->apEntry[0]),
+        stmt_hist_compare);
+  if( bJson ){
+    oputz("[");
+  }else{
+    oputf("%8s %10s %9s %9s %9s %9s %12s %6s %9s  %s\n",
+          "count", "total_ms", "p50_ms", "p95_ms", "p99_ms", "max_ms",
+          "vm_steps", "sorts", "autoindex", "sql");
+  }
+  for(i=0; i<pHist->nEntry; i++){
+    StmtHistEntry *pEntry = pHist->apEntry[i];
+    double r50 = stmt_hist_percentile(pEntry, 50.0)*0.001;
+    double r95 = stmt_hist_percentile(pEntry, 95.0)*0.001;
+    double r99 = stmt_hist_percentile(pEntry, 99.0)*0.001;
+    if( bJson ){
+      oputz(i>0 ? ",\n{\"sql\":" : "\n{\"sql\":");
+      output_json_string(pEntry->zSql, -1);
+      oputf(",\"count\":%lld,\"total_ms\":%.3f,\"p50_ms\":%.3f"
+            ",\"p95_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f"
+            ",\"vm_steps\":%lld,\"sorts\":%lld,\"autoindex\":%lld"
+            ",\"fullscan_steps\":%lld}",
+            pEntry->nRun, pEntry->iSum*0.001, r50, r95, r99,
+            pEntry->iMax*0.001, pEntry->nStep, pEntry->nSort,
+            pEntry->nAutoindex, pEntry->nFullscan);
     }else{
-      rc = SQLITE_CORRUPT;
+      oputf("%8lld %10.3f %9.3f %9.3f %9.3f %9.3f %12lld %6lld %9lld  %s\n",
+            pEntry->nRun, pEntry->iSum*0.001, r50, r95, r99,
+            pEntry->iMax*0.001, pEntry->nStep, pEntry->nSort,
+            pEntry->nAutoindex, pEntry->zSql);
     }
-    sqlite3_free(zErr);
-    free(zQ2);
   }
-  return rc;
+  if( bJson ) oputz("\n]\n");
 }
 
+/* Stop ".timer histogram" on p */
+static void stmt_hist_free(ShellState *p){
+  if( p->pStmtHist ){
+    stmt_hist_reset(p->pStmtHist);
+    sqlite3_free(p->pStmtHist);
+    p->pStmtHist = 0;
+  }
+}
+// End Android Add
 /*
-** Text of help messages.
-**
-** The help text for each individual command begins with a line that starts
-** with ".".  Subsequent lines are supplemental information.
+** Execute a statement or set of statements.  Print
+** any result rows/columns depending on the current mode
+** set via the supplied callback.
 **
-** There must be two or more spaces between the end of the command and the
-** start of the description of what that command does.
+** This is very similar to SQLite's built-in sqlite3_exec()
+** function except it takes a slightly different callback
+** and callback data argument.
 */
-static const char *(azHelp[]) = {
-#if defined(SQLITE_HAVE_ZLIB) && !defined(SQLITE_OMIT_VIRTUALTABLE) \
-  && !defined(SQLITE_SHELL_FIDDLE)
-  ".archive ...             Manage SQL archives",
-  "   Each command must have exactly one of the following options:",
-  "     -c, --create               Create a new archive",
-  "     -u, --update               Add or update files with changed mtime",
-  "     -i, --insert               Like -u but always add even if unchanged",
-  "     -r, --remove               Remove files from archive",
-  "     -t, --list                 List contents of archive",
-  "     -x, --extract              Extract files from archive",
-  "   Optional arguments:",
-  "     -v, --verbose              Print each filename as it is processed",
-  "     -f FILE, --file FILE       Use archive FILE (default is current db)",
-  "     -a FILE, --append FILE     Open FILE using the apndvfs VFS",
-  "     -C DIR, --directory DIR    Read/extract files from directory DIR",
-  "     -g, --glob                 Use glob matching for names in archive",
-  "     -n, --dryrun               Show the SQL that would have occurred",
-  "   Examples:",
-  "     .ar -cf ARCHIVE foo bar  # Create ARCHIVE from files foo and bar",
-  "     .ar -tf ARCHIVE          # List members of ARCHIVE",
-  "     .ar -xvf ARCHIVE         # Verbosely extract files from ARCHIVE",
-  "   See also:",
-  "      http://sqlite.org/cli.html#sqlite_archive_support",
-#endif
-#ifndef SQLITE_OMIT_AUTHORIZATION
-  ".auth ON|OFF             Show authorizer callbacks",
+static int shell_exec(
+  ShellState *pArg,                         /* Pointer to ShellState */
+  const char *zSql,                         /* SQL to be evaluated */
+  char **pzErrMsg                           /* Error msg written here */
+){
+  sqlite3_stmt *pStmt = NULL;     /* Statement to execute. */
+  int rc = SQLITE_OK;             /* Return Code */
+  int rc2;
+  const char *zLeftover;          /* Tail of unprocessed SQL */
+  sqlite3 *db = pArg->db;
+// Begin Android Add
+  i64 iHistStart = 0;             /* stmt_hist_begin() of this statement */
+// End Android Add
+
+  if( pzErrMsg ){
+    *pzErrMsg = NULL;
+  }
+
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+  if( pArg->expert.pExpert ){
+    rc = expertHandleSQL(pArg, zSql, pzErrMsg);
+    return expertFinish(pArg, (rc!=SQLITE_OK), pzErrMsg);
+  }
 #endif
-#ifndef SQLITE_SHELL_FIDDLE
-  ".backup ?DB? FILE        Backup DB (default \"main\") to FILE",
-  "   Options:",
+
+  while( zSql[0] && (SQLITE_OK == rc) ){
+    static const char *zStmtSql;
+    rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, &zLeftover);
+    if( SQLITE_OK != rc ){
+      if( pzErrMsg ){
+        *pzErrMsg = save_err_msg(db, "in prepare", rc, zSql);
+      }
+    }else{
+      if( !pStmt ){
+        /* this happens for a comment or white-space */
+        zSql = zLeftover;
+        while( IsSpace(zSql[0]) ) zSql++;
+        continue;
+      }
+      zStmtSql = sqlite3_sql(pStmt);
+      if( zStmtSql==0 ) zStmtSql = "";
+      while( IsSpace(zStmtSql[0]) ) zStmtSql++;
+
+      /* save off the prepared statement handle and reset row count */
+      if( pArg ){
+        pArg->pStmt = pStmt;
+        pArg->cnt = 0;
+      }
+
+      /* Show the EXPLAIN QUERY PLAN if .eqp is on */
+      if( pArg && pArg->autoEQP && sqlite3_stmt_isexplain(pStmt)==0 ){
+        sqlite3_stmt *pExplain;
+        int triggerEQP = 0;
+        disable_debug_trace_modes();
+        sqlite3_db_config(db, SQLITE_DBCONFIG_TRIGGER_EQP, -1, &triggerEQP);
+        if( pArg->autoEQP>=AUTOEQP_trigger ){
+          sqlite3_db_config(db, SQLITE_DBCONFIG_TRIGGER_EQP, 1, 0);
+        }
+        pExplain = pStmt;
+        sqlite3_reset(pExplain);
+        rc = sqlite3_stmt_explain(pExplain, 2);
+        if( rc==SQLITE_OK ){
+          while( sqlite3_step(pExplain)==SQLITE_ROW ){
+            const char *zEQPLine = (const char*)sqlite3_column_text(pExplain,3);
+            int iEqpId = sqlite3_column_int(pExplain, 0);
+            int iParentId = sqlite3_column_int(pExplain, 1);
+            if( zEQPLine==0 ) zEQPLine = "";
+            if( zEQPLine[0]=='-' ) eqp_render(pArg, 0);
+            eqp_append(pArg, iEqpId, iParentId, zEQPLine);
+          }
+          eqp_render(pArg, 0);
+        }
+        if( pArg->autoEQP>=AUTOEQP_full ){
+          /* Also do an EXPLAIN for ".eqp full" mode */
+          sqlite3_reset(pExplain);
+          rc = sqlite3_stmt_explain(pExplain, 1);
+          if( rc==SQLITE_OK ){
+            pArg->cMode = MODE_Explain;
+            assert( sqlite3_stmt_isexplain(pExplain)==1 );
+            explain_data_prepare(pArg, pExplain);
+            exec_prepared_stmt(pArg, pExplain);
+            explain_data_delete(pArg);
+          }
+        }
+        if( pArg->autoEQP>=AUTOEQP_trigger && triggerEQP==0 ){
+          sqlite3_db_config(db, SQLITE_DBCONFIG_TRIGGER_EQP, 0, 0);
+        }
+        sqlite3_reset(pStmt);
+        sqlite3_stmt_explain(pStmt, 0);
+        restore_debug_trace_modes();
+      }
+
+      if( pArg ){
+        int bIsExplain = (sqlite3_stmt_isexplain(pStmt)==1);
+        pArg->cMode = pArg->mode;
+        if( pArg->autoExplain ){
+          if( bIsExplain ){
+            pArg->cMode = MODE_Explain;
+          }
+          if( sqlite3_stmt_isexplain(pStmt)==2 ){
+            pArg->cMode = MODE_EQP;
+          }
+        }
+
+        /* If the shell is currently in ".explain" mode, gather the extra
+        ** data required to add indents to the output.*/
+        if( pArg->cMode==MODE_Explain && bIsExplain ){
+          explain_data_prepare(pArg, pStmt);
+        }
+      }
+
+// Begin Android Add
+      if( pArg && pArg->bStmtHistSql ) iHistStart = stmt_hist_begin(pStmt);
+// End Android Add
+      bind_prepared_stmt(pArg, pStmt);
+      exec_prepared_stmt(pArg, pStmt);
+// Begin Android Add
+      if( pArg && pArg->bStmtHistSql ){
+        stmt_hist_record(pArg->pStmtHist, pStmt, iHistStart);
+      }
+// End Android Add
+      explain_data_delete(pArg);
+      eqp_render(pArg, 0);
+
+      /* print usage stats if stats on */
+      if( pArg && pArg->statsOn ){
+        display_stats(db, pArg, 0);
+      }
+
+      /* print loop-counters if required */
+      if( pArg && pArg->scanstatsOn ){
+        display_scanstats(db, pArg);
+      }
+
+      /* Finalize the statement just executed. If this fails, save a
+      ** copy of the error message. Otherwise, set zSql to point to the
+      ** next statement to execute. */
+      rc2 = sqlite3_finalize(pStmt);
+      if( rc!=SQLITE_NOMEM ) rc = rc2;
+      if( rc==SQLITE_OK ){
+        zSql = zLeftover;
+        while( IsSpace(zSql[0]) ) zSql++;
+      }else if( pzErrMsg ){
+        *pzErrMsg = save_err_msg(db, "stepping", rc, 0);
+      }
+
+      /* clear saved stmt handle */
+      if( pArg ){
+        pArg->pStmt = NULL;
+      }
+    }
+  } /* end while */
+
+  return rc;
+}
+
+/*
+** Release memory previously allocated by tableColumnList().
+*/
+static void freeColumnList(char **azCol){
+  int i;
+  for(i=1; azCol[i]; i++){
+    sqlite3_free(azCol[i]);
+  }
+  /* azCol[0] is a static string */
+  sqlite3_free(azCol);
+}
+
+/*
+** Return a list of pointers to strings which are the names of all
+** columns in table zTab.   The memory to hold the names is dynamically
+** allocated and must be released by the caller using a subsequent call
+** to freeColumnList().
+**
+** The azCol[0] entry is usually NULL.  However, if zTab contains a rowid
+** value that needs to be preserved, then azCol[0] is filled in with the
+** name of the rowid column.
+**
+** The first regular column in the table is azCol[1].  The list is terminated
+** by an entry with azCol[i]==0.
+*/
+static char **tableColumnList(ShellState *p, const char *zTab){
+  char **azCol = 0;
+  sqlite3_stmt *pStmt;
+  char *zSql;
+  int nCol = 0;
+  int nAlloc = 0;
+  int nPK = 0;       /* Number of PRIMARY KEY columns seen */
+  int isIPK = 0;     /* True if one PRIMARY KEY column of type INTEGER */
+  int preserveRowid = ShellHasFlag(p, SHFLG_PreserveRowid);
+  int rc;
+
+  zSql = sqlite3_mprintf("PRAGMA table_info=%Q", zTab);
+  shell_check_oom(zSql);
+  rc = sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc ) return 0;
+  while( sqlite3_step(pStmt)==SQLITE_ROW ){
+    if( nCol>=nAlloc-2 ){
+      nAlloc = nAlloc*2 + nCol + 10;
+      azCol = sqlite3_realloc(azCol, nAlloc*sizeof(azCol[0]));
+      shell_check_oom(azCol);
+    }
+    azCol[++nCol] = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 1));
+    shell_check_oom(azCol[nCol]);
+    if( sqlite3_column_int(pStmt, 5) ){
+      nPK++;
+      if( nPK==1
+       && sqlite3_stricmp((const char*)sqlite3_column_text(pStmt,2),
+                          "INTEGER")==0
+      ){
+        isIPK = 1;
+      }else{
+        isIPK = 0;
+      }
+    }
+  }
+  sqlite3_finalize(pStmt);
+  if( azCol==0 ) return 0;
+  azCol[0] = 0;
+  azCol[nCol+1] = 0;
+
+  /* The decision of whether or not a rowid really needs to be preserved
+  ** is tricky.  We never need to preserve a rowid for a WITHOUT ROWID table
+  ** or a table with an INTEGER PRIMARY KEY.  We are unable to preserve
+  ** rowids on tables where the rowid is inaccessible because there are other
+  ** columns in the table named "rowid", "_rowid_", and "oid".
+  */
+  if( preserveRowid && isIPK ){
+    /* If a single PRIMARY KEY column with type INTEGER was seen, then it
+    ** might be an alias for the ROWID.  But it might also be a WITHOUT ROWID
+    ** table or a INTEGER PRIMARY KEY DESC column, neither of which are
+    ** ROWID aliases.  To distinguish these cases, check to see if
+    ** there is a "pk" entry in "PRAGMA index_list".  There will be
+    ** no "pk" index if the PRIMARY KEY really is an alias for the ROWID.
+    */
+    zSql = sqlite3_mprintf("SELECT 1 FROM pragma_index_list(%Q)"
+                           " WHERE origin='pk'", zTab);
+    shell_check_oom(zSql);
+    rc = sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, 0);
+    sqlite3_free(zSql);
+    if( rc ){
+      freeColumnList(azCol);
+      return 0;
+    }
+    rc = sqlite3_step(pStmt);
+    sqlite3_finalize(pStmt);
+    preserveRowid = rc==SQLITE_ROW;
+  }
+  if( preserveRowid ){
+    /* Only preserve the rowid if we can find a name to use for the
+    ** rowid */
+    static char *azRowid[] = { "rowid", "_rowid_", "oid" };
+    int i, j;
+    for(j=0; j<3; j++){
+      for(i=1; i<=nCol; i++){
+        if( sqlite3_stricmp(azRowid[j],azCol[i])==0 ) break;
+      }
+      if( i>nCol ){
+        /* At this point, we know that azRowid[j] is not the name of any
+        ** ordinary column in the table.  Verify that azRowid[j] is a valid
+        ** name for the rowid before adding it to azCol[0].  WITHOUT ROWID
+        ** tables will fail this last check */
+        rc = sqlite3_table_column_metadata(p->db,0,zTab,azRowid[j],0,0,0,0,0);
+        if( rc==SQLITE_OK ) azCol[0] = azRowid[j];
+        break;
+      }
+    }
+  }
+  return azCol;
+}
+
+/*
+** Toggle the reverse_unordered_selects setting.
+*/
+static void toggleSelectOrder(sqlite3 *db){
+  sqlite3_stmt *pStmt = 0;
+  int iSetting = 0;
+  char zStmt[100];
+  sqlite3_prepare_v2(db, "PRAGMA reverse_unordered_selects", -1, &pStmt, 0);
+  if( sqlite3_step(pStmt)==SQLITE_ROW ){
+    iSetting = sqlite3_column_int(pStmt, 0);
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_snprintf(sizeof(zStmt), zStmt,
+       "PRAGMA reverse_unordered_selects(%d)", !iSetting);
+  sqlite3_exec(db, zStmt, 0, 0, 0);
+}
+
+/*
+** This is a different callback routine used for dumping the database.
+** Each row received by this callback consists of a table name,
+** the table type ("index" or "table") and SQL to create the table.
+** This routine should print text sufficient to recreate the table.
+*/
+static int dump_callback(void *pArg, int nArg, char **azArg, char **azNotUsed){
+  int rc;
+  const char *zTable;
+  const char *zType;
+  const char *zSql;
+  ShellState *p = (ShellState *)pArg;
+  int dataOnly;
+  int noSys;
+
+  UNUSED_PARAMETER(azNotUsed);
+  if( nArg!=3 || azArg==0 ) return 0;
+  zTable = azArg[0];
+  zType = azArg[1];
+  zSql = azArg[2];
+  if( zTable==0 ) return 0;
+  if( zType==0 ) return 0;
+  dataOnly = (p->shellFlgs & SHFLG_DumpDataOnly)!=0;
+  noSys    = (p->shellFlgs & SHFLG_DumpNoSys)!=0;
+
+  if( cli_strcmp(zTable, "sqlite_sequence")==0 && !noSys ){
+    if( !dataOnly ) oputz("DELETE FROM sqlite_sequence;\n");
+  }else if( sqlite3_strglob("sqlite_stat?", zTable)==0 && !noSys ){
+    if( !dataOnly ) oputz("ANALYZE sqlite_schema;\n");
+  }else if( cli_strncmp(zTable, "sqlite_", 7)==0 ){
+    return 0;
+  }else if( dataOnly ){
+    /* no-op */
+  }else if( cli_strncmp(zSql, "CREATE VIRTUAL TABLE", 20)==0 ){
+    char *zIns;
+    if( !p->writableSchema ){
+      oputz("PRAGMA writable_schema=ON;\n");
+      p->writableSchema = 1;
+    }
+    zIns = sqlite3_mprintf(
+       "INSERT INTO sqlite_schema(type,name,tbl_name,rootpage,sql)"
+       "VALUES('table','%q','%q',0,'%q');",
+       zTable, zTable, zSql);
+    shell_check_oom(zIns);
+    oputf("%s\n", zIns);
+    sqlite3_free(zIns);
+    return 0;
+  }else{
+    printSchemaLine(zSql, ";\n");
+  }
+
+  if( cli_strcmp(zType, "table")==0 ){
+    ShellText sSelect;
+    ShellText sTable;
+    char **azCol;
+    int i;
+    char *savedDestTable;
+    int savedMode;
+
+    azCol = tableColumnList(p, zTable);
+    if( azCol==0 ){
+      p->nErr++;
+      return 0;
+    }
+
+    /* Always quote the table name, even if it appears to be pure ascii,
+    ** in case it is a keyword. Ex:  INSERT INTO "table" ... */
+    initText(&sTable);
+    appendText(&sTable, zTable, quoteChar(zTable));
+    /* If preserving the rowid, add a column list after the table name.
+    ** In other words:  "INSERT INTO tab(rowid,a,b,c,...) VALUES(...)"
+    ** instead of the usual "INSERT INTO tab VALUES(...)".
+    */
+    if( azCol[0] ){
+      appendText(&sTable, "(", 0);
+      appendText(&sTable, azCol[0], 0);
+      for(i=1; azCol[i]; i++){
+        appendText(&sTable, ",", 0);
+        appendText(&sTable, azCol[i], quoteChar(azCol[i]));
+      }
+      appendText(&sTable, ")", 0);
+    }
+
+    /* Build an appropriate SELECT statement */
+    initText(&sSelect);
+    appendText(&sSelect, "SELECT ", 0);
+    if( azCol[0] ){
+      appendText(&sSelect, azCol[0], 0);
+      appendText(&sSelect, ",", 0);
+    }
+    for(i=1; azCol[i]; i++){
+      appendText(&sSelect, azCol[i], quoteChar(azCol[i]));
+      if( azCol[i+1] ){
+        appendText(&sSelect, ",", 0);
+      }
+    }
+    freeColumnList(azCol);
+    appendText(&sSelect, " FROM ", 0);
+    appendText(&sSelect, zTable, quoteChar(zTable));
+
+    savedDestTable = p->zDestTable;
+    savedMode = p->mode;
+    p->zDestTable = sTable.z;
+    p->mode = p->cMode = MODE_Insert;
+    rc = shell_exec(p, sSelect.z, 0);
+    if( (rc&0xff)==SQLITE_CORRUPT ){
+      oputz("/****** CORRUPTION ERROR *******/\n");
+      toggleSelectOrder(p->db);
+      shell_exec(p, sSelect.z, 0);
+      toggleSelectOrder(p->db);
+    }
+    p->zDestTable = savedDestTable;
+    p->mode = savedMode;
+    freeText(&sTable);
+    freeText(&sSelect);
+    if( rc ) p->nErr++;
+  }
+  return 0;
+}
+
+/*
+** Run zQuery.  Use dump_callback() as the callback routine so that
+** the contents of the query are output as SQL statements.
+**
+** If we get a SQLITE_CORRUPT error, rerun the query after appending
+** "ORDER BY rowid DESC" to the end.
+*/
+static int run_schema_dump_query(
+  ShellState *p,
+  const char *zQuery
+){
+  int rc;
+  char *zErr = 0;
+  rc = sqlite3_exec(p->db, zQuery, dump_callback, p, &zErr);
+  if( rc==SQLITE_CORRUPT ){
+    char *zQ2;
+    int len = strlen30(zQuery);
+    oputz("/****** CORRUPTION ERROR *******/\n");
+    if( zErr ){
+      oputf("/****** %s ******/\n", zErr);
+      sqlite3_free(zErr);
+      zErr = 0;
+    }
+    zQ2 = malloc( len+100 );
+    if( zQ2==0 ) return rc;
+    sqlite3_snprintf(len+100, zQ2, "%s ORDER BY rowid DESC", zQuery);
+    rc = sqlite3_exec(p->db, zQ2, dump_callback, p, &zErr);
+    if( rc ){
+      oputf("/****** ERROR: %s ******/\n", zErr);
+    }else{
+      rc = SQLITE_CORRUPT;
+    }
+    sqlite3_free(zErr);
+    free(zQ2);
+  }
+  return rc;
+}
+
+/*
+** Text of help messages.
+**
+** The help text for each individual command begins with a line that starts
+** with ".".  Subsequent lines are supplemental information.
+**
+** There must be two or more spaces between the end of the command and the
+** start of the description of what that command does.
+*/
+static const char *(azHelp[]) = {
+#if defined(SQLITE_HAVE_ZLIB) && !defined(SQLITE_OMIT_VIRTUALTABLE) \
+  && !defined(SQLITE_SHELL_FIDDLE)
+  ".archive ...             Manage SQL archives",
+  "   Each command must have exactly one of the following options:",
+  "     -c, --create               Create a new archive",
+  "     -u, --update               Add or update files with changed mtime",
+  "     -i, --insert               Like -u but always add even if unchanged",
+  "     -r, --remove               Remove files from archive",
+  "     -t, --list                 List contents of archive",
+  "     -x, --extract              Extract files from archive",
+  "   Optional arguments:",
+  "     -v, --verbose              Print each filename as it is processed",
+  "     -f FILE, --file FILE       Use archive FILE (default is current db)",
+  "     -a FILE, --append FILE     Open FILE using the apndvfs VFS",
+  "     -C DIR, --directory DIR    Read/extract files from directory DIR",
+  "     -g, --glob                 Use glob matching for names in archive",
+  "     -n, --dryrun               Show the SQL that would have occurred",
+// Begin Android Add
+  "     -j N, --jobs N             Deflate or inflate ZIP members on N threads",
+// End Android Add
+  "   Examples:",
+  "     .ar -cf ARCHIVE foo bar  # Create ARCHIVE from files foo and bar",
+  "     .ar -tf ARCHIVE          # List members of ARCHIVE",
+  "     .ar -xvf ARCHIVE         # Verbosely extract files from ARCHIVE",
+  "   See also:",
+  "      http://sqlite.org/cli.html#sqlite_archive_support",
+#endif
+#ifndef SQLITE_OMIT_AUTHORIZATION
+  ".auth ON|OFF             Show authorizer callbacks",
+#endif
+#ifndef SQLITE_SHELL_FIDDLE
+  ".backup ?DB? FILE        Backup DB (default \"main\") to FILE",
+  "   Options:",
   "       --append            Use the appendvfs",
   "       --async             Write to FILE without journal and fsync()",
 #endif
@@ -21524,6 +25248,10 @@ static const char *(azHelp[]) = {
 #ifndef SQLITE_SHELL_FIDDLE
   ".check GLOB              Fail if output since .testcase does not match",
   ".clone NEWDB             Clone data into NEWDB from the existing database",
+// Begin Android Add
+  "   Options:",
+  "     --jobs N              Copy the data of the tables on N threads",
+// End Android Add
 #endif
   ".connection [close] [#]  Open or close an auxiliary database connection",
 #if defined(_WIN32) || defined(WIN32)
@@ -21537,6 +25265,14 @@ static const char *(azHelp[]) = {
   ".dump ?OBJECTS?          Render database content as SQL",
   "   Options:",
   "     --data-only            Output only INSERT statements",
+// Begin Android Add
+#if defined(SHELL_THREADS) && defined(SHELL_OUT_BUFFER)
+  "     --dir D                Write a file per table into directory D.  Run",
+  "                            in name order they rebuild the database as",
+  "                            .dump output does, but the text differs",
+  "     --jobs N               With --dir, write the files on N threads",
+#endif
+// End Android Add
   "     --newlines             Allow unescaped newline characters in output",
   "     --nosys                Omit system tables (ex: \"sqlite_stat1\")",
   "     --preserve-rowids      Include ROWID values in the output",
@@ -21571,6 +25307,14 @@ static const char *(azHelp[]) = {
   "     --ascii               Use \\037 and \\036 as column and row separators",
   "     --csv                 Use , and \\n as column and row separators",
   "     --skip N              Skip the first N rows of input",
+// Begin Android Add
+  "     --threads N           Parse the input on N threads, where supported",
+  "     --typed               Bind numbers as numbers for numeric columns",
+  "     --infer N             Declare a new TABLE's column types from the",
+  "                           first N rows of input.  Implies --typed",
+  "     --commit N            Commit after every N rows",
+  "     --arrow               Read an Apache Arrow IPC stream or file",
+// End Android Add
   "     --schema S            Target table to be S.TABLE",
   "     -v                    \"Verbose\" - increase auxiliary output",
   "   Notes:",
@@ -21578,6 +25322,10 @@ static const char *(azHelp[]) = {
   "        determines the column names.",
   "     *  If neither --csv or --ascii are used, the input mode is derived",
   "        from the \".mode\" output mode",
+// Begin Android Add
+  "     *  --arrow creates TABLE with the column names and types of the",
+  "        stream's schema.",
+// End Android Add
   "     *  If FILE begins with \"|\" then it is a command that generates the",
   "        input text.",
 #endif
@@ -21597,1381 +25345,4102 @@ static const char *(azHelp[]) = {
 #if !defined(SQLITE_OMIT_LOAD_EXTENSION) && !defined(SQLITE_SHELL_FIDDLE)
   ".load FILE ?ENTRY?       Load an extension library",
 #endif
-#if !defined(SQLITE_SHELL_FIDDLE)
-  ".log FILE|on|off         Turn logging on or off.  FILE can be stderr/stdout",
+#if !defined(SQLITE_SHELL_FIDDLE)
+  ".log FILE|on|off         Turn logging on or off.  FILE can be stderr/stdout",
+#else
+  ".log on|off              Turn logging on or off.",
+#endif
+  ".mode MODE ?OPTIONS?     Set output mode",
+  "   MODE is one of:",
+// Begin Android Add
+  "     arrow       Apache Arrow IPC stream, in record batches of N rows",
+// End Android Add
+  "     ascii       Columns/rows delimited by 0x1F and 0x1E",
+  "     box         Tables using unicode box-drawing characters",
+  "     csv         Comma-separated values",
+  "     column      Output in columns.  (See .width)",
+  "     html        HTML <table> code",
+  "     insert      SQL insert statements for TABLE",
+  "     json        Results in a JSON array",
+  "     line        One value per line",
+  "     list        Values delimited by \"|\"",
+  "     markdown    Markdown table format",
+  "     qbox        Shorthand for \"box --wrap 60 --quote\"",
+  "     quote       Escape answers as for SQL",
+  "     table       ASCII-art table",
+  "     tabs        Tab-separated values",
+  "     tcl         TCL list elements",
+  "   OPTIONS: (for columnar modes or insert mode):",
+  "     --wrap N       Wrap output lines to no longer than N characters",
+  "     --wordwrap B   Wrap or not at word boundaries per B (on/off)",
+  "     --ww           Shorthand for \"--wordwrap 1\"",
+  "     --quote        Quote output text as SQL literals",
+  "     --noquote      Do not quote output text",
+  "     TABLE          The name of SQL table used for \"insert\" mode",
+// Begin Android Add
+  "     --batch N      Rows per record batch for \"arrow\" mode (65536)",
+// End Android Add
+#ifndef SQLITE_SHELL_FIDDLE
+  ".nonce STRING            Suspend safe mode for one command if nonce matches",
+#endif
+  ".nullvalue STRING        Use STRING in place of NULL values",
+#ifndef SQLITE_SHELL_FIDDLE
+  ".once ?OPTIONS? ?FILE?   Output for the next SQL command only to FILE",
+  "     If FILE begins with '|' then open as a pipe",
+  "       --bom  Put a UTF8 byte-order mark at the beginning",
+  "       -e     Send output to the system text editor",
+  "       -x     Send output as CSV to a spreadsheet (same as \".excel\")",
+  /* Note that .open is (partially) available in WASM builds but is
+  ** currently only intended to be used by the fiddle tool, not
+  ** end users, so is "undocumented." */
+  ".open ?OPTIONS? ?FILE?   Close existing database and reopen FILE",
+  "     Options:",
+  "        --append        Use appendvfs to append database to the end of FILE",
+#endif
+#ifndef SQLITE_OMIT_DESERIALIZE
+  "        --deserialize   Load into memory using sqlite3_deserialize()",
+  "        --hexdb         Load the output of \"dbtotxt\" as an in-memory db",
+  "        --maxsize N     Maximum size for --hexdb or --deserialized database",
+#endif
+  "        --new           Initialize FILE to an empty database",
+  "        --nofollow      Do not follow symbolic links",
+  "        --readonly      Open FILE readonly",
+  "        --zip           FILE is a ZIP archive",
+#ifndef SQLITE_SHELL_FIDDLE
+  ".output ?FILE?           Send output to FILE or stdout if FILE is omitted",
+  "   If FILE begins with '|' then open it as a pipe.",
+  "   Options:",
+  "     --bom                 Prefix output with a UTF8 byte-order mark",
+  "     -e                    Send output to the system text editor",
+  "     -x                    Send output as CSV to a spreadsheet",
+#endif
+  ".parameter CMD ...       Manage SQL parameter bindings",
+  "   clear                   Erase all bindings",
+  "   init                    Initialize the TEMP table that holds bindings",
+  "   list                    List the current parameter bindings",
+  "   set PARAMETER VALUE     Given SQL parameter PARAMETER a value of VALUE",
+  "                           PARAMETER should start with one of: $ : @ ?",
+  "   unset PARAMETER         Remove PARAMETER from the binding table",
+  ".print STRING...         Print literal STRING",
+#ifndef SQLITE_OMIT_PROGRESS_CALLBACK
+  ".progress N              Invoke progress handler after every N opcodes",
+  "   --limit N                 Interrupt after N progress callbacks",
+  "   --once                    Do no more than one progress interrupt",
+  "   --quiet|-q                No output except at interrupts",
+  "   --reset                   Reset the count for each input and interrupt",
+#endif
+  ".prompt MAIN CONTINUE    Replace the standard prompts",
+#ifndef SQLITE_SHELL_FIDDLE
+  ".quit                    Stop interpreting input stream, exit if primary.",
+  ".read FILE               Read input from FILE or command output",
+  "    If FILE begins with \"|\", it is a command that generates the input.",
+#endif
+#if SQLITE_SHELL_HAVE_RECOVER
+  ".recover                 Recover as much data as possible from corrupt db.",
+  "   --ignore-freelist        Ignore pages that appear to be on db freelist",
+  "   --lost-and-found TABLE   Alternative name for the lost-and-found table",
+  "   --no-rowids              Do not attempt to recover rowid values",
+  "                            that are not also INTEGER PRIMARY KEYs",
+#endif
+#ifndef SQLITE_SHELL_FIDDLE
+  ".restore ?DB? FILE       Restore content of DB (default \"main\") from FILE",
+// Begin Android Add
+#if defined(SHELL_THREADS) && defined(SHELL_OUT_BUFFER)
+  "   Or: .restore --dir D ?--jobs N?  Read a \".dump --dir D\" into \"main\",",
+  "       staging N tables at a time in separate databases",
+#endif
+// End Android Add
+  ".save ?OPTIONS? FILE     Write database to FILE (an alias for .backup ...)",
+#endif
+  ".scanstats on|off|est    Turn sqlite3_stmt_scanstatus() metrics on or off",
+// Begin Android Add
+  "   Or: .scanstats json|folded  Write them as a line of JSON per statement,",
+  "       or as folded stacks of cycles for flame graphs",
+// End Android Add
+  ".schema ?PATTERN?        Show the CREATE statements matching PATTERN",
+  "   Options:",
+  "      --indent             Try to pretty-print the schema",
+  "      --nosys              Omit objects whose names start with \"sqlite_\"",
+  ",selftest ?OPTIONS?      Run tests defined in the SELFTEST table",
+  "    Options:",
+  "       --init               Create a new SELFTEST table",
+  "       -v                   Verbose output",
+  ".separator COL ?ROW?     Change the column and row separators",
+#if defined(SQLITE_ENABLE_SESSION)
+  ".session ?NAME? CMD ...  Create or control sessions",
+  "   Subcommands:",
+  "     attach TABLE             Attach TABLE",
+  "     changeset FILE           Write a changeset into FILE",
+  "     close                    Close one session",
+  "     enable ?BOOLEAN?         Set or query the enable bit",
+  "     filter GLOB...           Reject tables matching GLOBs",
+  "     indirect ?BOOLEAN?       Mark or query the indirect status",
+  "     isempty                  Query whether the session is empty",
+  "     list                     List currently open session names",
+  "     open DB NAME             Open a new session on DB",
+  "     patchset FILE            Write a patchset into FILE",
+  "   If ?NAME? is omitted, the first defined session is used.",
+#endif
+  ".sha3sum ...             Compute a SHA3 hash of database content",
+  "    Options:",
+  "      --schema              Also hash the sqlite_schema table",
+  "      --sha3-224            Use the sha3-224 algorithm",
+  "      --sha3-256            Use the sha3-256 algorithm (default)",
+  "      --sha3-384            Use the sha3-384 algorithm",
+  "      --sha3-512            Use the sha3-512 algorithm",
+// Begin Android Add
+  "      --jobs N              Hash on N threads.  Without a pattern the",
+  "                            result is a hash of the table hashes, labelled",
+  "                            so, and differs from the hash without --jobs",
+// End Android Add
+  "    Any other argument is a LIKE pattern for tables to hash",
+#if !defined(SQLITE_NOHAVE_SYSTEM) && !defined(SQLITE_SHELL_FIDDLE)
+  ".shell CMD ARGS...       Run CMD ARGS... in a system shell",
+#endif
+  ".show                    Show the current values for various settings",
+  ".stats ?ARG?             Show stats or turn stats on or off",
+  "   off                      Turn off automatic stat display",
+  "   on                       Turn on automatic stat display",
+  "   stmt                     Show statement stats",
+  "   vmstep                   Show the virtual machine step count only",
+#if !defined(SQLITE_NOHAVE_SYSTEM) && !defined(SQLITE_SHELL_FIDDLE)
+  ".system CMD ARGS...      Run CMD ARGS... in a system shell",
+#endif
+  ".tables ?TABLE?          List names of tables matching LIKE pattern TABLE",
+#ifndef SQLITE_SHELL_FIDDLE
+  ",testcase NAME           Begin redirecting output to 'testcase-out.txt'",
+#endif
+  ",testctrl CMD ...        Run various sqlite3_test_control() operations",
+  "                           Run \".testctrl\" with no arguments for details",
+  ".timeout MS              Try opening locked tables for MS milliseconds",
+  ".timer on|off            Turn SQL timer on or off",
+// Begin Android Add
+  "   Or: .timer histogram ?on|off|reset|show? ?--json?",
+  "       Keep latency percentiles and VM counters per statement shape,",
+  "       and show them with \"show\" and when the shell exits",
+// End Android Add
+#ifndef SQLITE_OMIT_TRACE
+  ".trace ?OPTIONS?         Output each SQL statement as it is run",
+  "    FILE                    Send output to FILE",
+  "    stdout                  Send output to stdout",
+  "    stderr                  Send output to stderr",
+  "    off                     Disable tracing",
+  "    --expanded              Expand query parameters",
+#ifdef SQLITE_ENABLE_NORMALIZE
+  "    --normalized            Normal the SQL statements",
+#endif
+  "    --plain                 Show SQL as it is input",
+  "    --stmt                  Trace statement execution (SQLITE_TRACE_STMT)",
+  "    --profile               Profile statements (SQLITE_TRACE_PROFILE)",
+  "    --row                   Trace each row (SQLITE_TRACE_ROW)",
+  "    --close                 Trace connection close (SQLITE_TRACE_CLOSE)",
+#endif /* SQLITE_OMIT_TRACE */
+#ifdef SQLITE_DEBUG
+  ".unmodule NAME ...       Unregister virtual table modules",
+  "    --allexcept             Unregister everything except those named",
+#endif
+  ".version                 Show source, library and compiler versions",
+  ".vfsinfo ?AUX?           Information about the top-level VFS",
+  ".vfslist                 List all available VFSes",
+  ".vfsname ?AUX?           Print the name of the VFS stack",
+  ".width NUM1 NUM2 ...     Set minimum column widths for columnar output",
+  "     Negative values right-justify",
+};
+
+/*
+** Output help text.
+**
+** zPattern describes the set of commands for which help text is provided.
+** If zPattern is NULL, then show all commands, but only give a one-line
+** description of each.
+**
+** Return the number of matches.
+*/
+static int showHelp(FILE *out, const char *zPattern){
+  int i = 0;
+  int j = 0;
+  int n = 0;
+  char *zPat;
+  if( zPattern==0
+   || zPattern[0]=='0'
+   || cli_strcmp(zPattern,"-a")==0
+   || cli_strcmp(zPattern,"-all")==0
+   || cli_strcmp(zPattern,"--all")==0
+  ){
+    enum HelpWanted { HW_NoCull = 0, HW_SummaryOnly = 1, HW_Undoc = 2 };
+    enum HelpHave { HH_Undoc = 2, HH_Summary = 1, HH_More = 0 };
+    /* Show all or most commands
+    ** *zPattern==0   => summary of documented commands only
+    ** *zPattern=='0' => whole help for undocumented commands
+    ** Otherwise      => whole help for documented commands
+    */
+    enum HelpWanted hw = HW_SummaryOnly;
+    enum HelpHave hh = HH_More;
+    if( zPattern!=0 ){
+      hw = (*zPattern=='0')? HW_NoCull|HW_Undoc : HW_NoCull;
+    }
+    for(i=0; i<ArraySize(azHelp); i++){
+      switch( azHelp[i][0] ){
+      case ',':
+        hh = HH_Summary|HH_Undoc;
+        break;
+      case '.':
+        hh = HH_Summary;
+        break;
+      default:
+        hh &= ~HH_Summary;
+        break;
+      }
+      if( ((hw^hh)&HH_Undoc)==0 ){
+        if( (hh&HH_Summary)!=0 ){
+          sputf(out, ".%s\n", azHelp[i]+1);
+          ++n;
+        }else if( (hw&HW_SummaryOnly)==0 ){
+          sputf(out, "%s\n", azHelp[i]);
+        }
+      }
+    }
+  }else{
+    /* Seek documented commands for which zPattern is an exact prefix */
+    zPat = sqlite3_mprintf(".%s*", zPattern);
+    shell_check_oom(zPat);
+    for(i=0; i<ArraySize(azHelp); i++){
+      if( sqlite3_strglob(zPat, azHelp[i])==0 ){
+        sputf(out, "%s\n", azHelp[i]);
+        j = i+1;
+        n++;
+      }
+    }
+    sqlite3_free(zPat);
+    if( n ){
+      if( n==1 ){
+        /* when zPattern is a prefix of exactly one command, then include
+        ** the details of that command, which should begin at offset j */
+        while( j<ArraySize(azHelp)-1 && azHelp[j][0]==' ' ){
+          sputf(out, "%s\n", azHelp[j]);
+          j++;
+        }
+      }
+      return n;
+    }
+    /* Look for documented commands that contain zPattern anywhere.
+    ** Show complete text of all documented commands that match. */
+    zPat = sqlite3_mprintf("%%%s%%", zPattern);
+    shell_check_oom(zPat);
+    for(i=0; i<ArraySize(azHelp); i++){
+      if( azHelp[i][0]==',' ){
+        while( i<ArraySize(azHelp)-1 && azHelp[i+1][0]==' ' ) ++i;
+        continue;
+      }
+      if( azHelp[i][0]=='.' ) j = i;
+      if( sqlite3_strlike(zPat, azHelp[i], 0)==0 ){
+        sputf(out, "%s\n", azHelp[j]);
+        while( j<ArraySize(azHelp)-1 && azHelp[j+1][0]==' ' ){
+          j++;
+          sputf(out, "%s\n", azHelp[j]);
+        }
+        i = j;
+        n++;
+      }
+    }
+    sqlite3_free(zPat);
+  }
+  return n;
+}
+
+/* Forward reference */
+static int process_input(ShellState *p);
+
+/*
+** Read the content of file zName into memory obtained from sqlite3_malloc64()
+** and return a pointer to the buffer. The caller is responsible for freeing
+** the memory.
+**
+** If parameter pnByte is not NULL, (*pnByte) is set to the number of bytes
+** read.
+**
+** For convenience, a nul-terminator byte is always appended to the data read
+** from the file before the buffer is returned. This byte is not included in
+** the final value of (*pnByte), if applicable.
+**
+** NULL is returned if any error is encountered. The final value of *pnByte
+** is undefined in this case.
+*/
+static char *readFile(const char *zName, int *pnByte){
+  FILE *in = fopen(zName, "rb");
+  long nIn;
+  size_t nRead;
+  char *pBuf;
+  int rc;
+  if( in==0 ) return 0;
+  rc = fseek(in, 0, SEEK_END);
+  if( rc!=0 ){
+    eputf("Error: '%s' not seekable\n", zName);
+    fclose(in);
+    return 0;
+  }
+  nIn = ftell(in);
+  rewind(in);
+  pBuf = sqlite3_malloc64( nIn+1 );
+  if( pBuf==0 ){
+    eputz("Error: out of memory\n");
+    fclose(in);
+    return 0;
+  }
+  nRead = fread(pBuf, nIn, 1, in);
+  fclose(in);
+  if( nRead!=1 ){
+    sqlite3_free(pBuf);
+    eputf("Error: cannot read '%s'\n", zName);
+    return 0;
+  }
+  pBuf[nIn] = 0;
+  if( pnByte ) *pnByte = nIn;
+  return pBuf;
+}
+
+#if defined(SQLITE_ENABLE_SESSION)
+/*
+** Close a single OpenSession object and release all of its associated
+** resources.
+*/
+static void session_close(OpenSession *pSession){
+  int i;
+  sqlite3session_delete(pSession->p);
+  sqlite3_free(pSession->zName);
+  for(i=0; i<pSession->nFilter; i++){
+    sqlite3_free(pSession->azFilter[i]);
+  }
+  sqlite3_free(pSession->azFilter);
+  memset(pSession, 0, sizeof(OpenSession));
+}
+#endif
+
+/*
+** Close all OpenSession objects and release all associated resources.
+*/
+#if defined(SQLITE_ENABLE_SESSION)
+static void session_close_all(ShellState *p, int i){
+  int j;
+  struct AuxDb *pAuxDb = i<0 ? p->pAuxDb : &p->aAuxDb[i];
+  for(j=0; j<pAuxDb->nSession; j++){
+    session_close(&pAuxDb->aSession[j]);
+  }
+  pAuxDb->nSession = 0;
+}
 #else
-  ".log on|off              Turn logging on or off.",
-#endif
-  ".mode MODE ?OPTIONS?     Set output mode",
-  "   MODE is one of:",
-  "     ascii       Columns/rows delimited by 0x1F and 0x1E",
-  "     box         Tables using unicode box-drawing characters",
-  "     csv         Comma-separated values",
-  "     column      Output in columns.  (See .width)",
-  "     html        HTML <table> code",
-  "     insert      SQL insert statements for TABLE",
-  "     json        Results in a JSON array",
-  "     line        One value per line",
-  "     list        Values delimited by \"|\"",
-  "     markdown    Markdown table format",
-  "     qbox        Shorthand for \"box --wrap 60 --quote\"",
-  "     quote       Escape answers as for SQL",
-  "     table       ASCII-art table",
-  "     tabs        Tab-separated values",
-  "     tcl         TCL list elements",
-  "   OPTIONS: (for columnar modes or insert mode):",
-  "     --wrap N       Wrap output lines to no longer than N characters",
-  "     --wordwrap B   Wrap or not at word boundaries per B (on/off)",
-  "     --ww           Shorthand for \"--wordwrap 1\"",
-  "     --quote        Quote output text as SQL literals",
-  "     --noquote      Do not quote output text",
-  "     TABLE          The name of SQL table used for \"insert\" mode",
-#ifndef SQLITE_SHELL_FIDDLE
-  ".nonce STRING            Suspend safe mode for one command if nonce matches",
-#endif
-  ".nullvalue STRING        Use STRING in place of NULL values",
-#ifndef SQLITE_SHELL_FIDDLE
-  ".once ?OPTIONS? ?FILE?   Output for the next SQL command only to FILE",
-  "     If FILE begins with '|' then open as a pipe",
-  "       --bom  Put a UTF8 byte-order mark at the beginning",
-  "       -e     Send output to the system text editor",
-  "       -x     Send output as CSV to a spreadsheet (same as \".excel\")",
-  /* Note that .open is (partially) available in WASM builds but is
-  ** currently only intended to be used by the fiddle tool, not
-  ** end users, so is "undocumented." */
-  ".open ?OPTIONS? ?FILE?   Close existing database and reopen FILE",
-  "     Options:",
-  "        --append        Use appendvfs to append database to the end of FILE",
-#endif
-#ifndef SQLITE_OMIT_DESERIALIZE
-  "        --deserialize   Load into memory using sqlite3_deserialize()",
-  "        --hexdb         Load the output of \"dbtotxt\" as an in-memory db",
-  "        --maxsize N     Maximum size for --hexdb or --deserialized database",
-#endif
-  "        --new           Initialize FILE to an empty database",
-  "        --nofollow      Do not follow symbolic links",
-  "        --readonly      Open FILE readonly",
-  "        --zip           FILE is a ZIP archive",
-#ifndef SQLITE_SHELL_FIDDLE
-  ".output ?FILE?           Send output to FILE or stdout if FILE is omitted",
-  "   If FILE begins with '|' then open it as a pipe.",
-  "   Options:",
-  "     --bom                 Prefix output with a UTF8 byte-order mark",
-  "     -e                    Send output to the system text editor",
-  "     -x                    Send output as CSV to a spreadsheet",
-#endif
-  ".parameter CMD ...       Manage SQL parameter bindings",
-  "   clear                   Erase all bindings",
-  "   init                    Initialize the TEMP table that holds bindings",
-  "   list                    List the current parameter bindings",
-  "   set PARAMETER VALUE     Given SQL parameter PARAMETER a value of VALUE",
-  "                           PARAMETER should start with one of: $ : @ ?",
-  "   unset PARAMETER         Remove PARAMETER from the binding table",
-  ".print STRING...         Print literal STRING",
-#ifndef SQLITE_OMIT_PROGRESS_CALLBACK
-  ".progress N              Invoke progress handler after every N opcodes",
-  "   --limit N                 Interrupt after N progress callbacks",
-  "   --once                    Do no more than one progress interrupt",
-  "   --quiet|-q                No output except at interrupts",
-  "   --reset                   Reset the count for each input and interrupt",
+# define session_close_all(X,Y)
 #endif
-  ".prompt MAIN CONTINUE    Replace the standard prompts",
-#ifndef SQLITE_SHELL_FIDDLE
-  ".quit                    Stop interpreting input stream, exit if primary.",
-  ".read FILE               Read input from FILE or command output",
-  "    If FILE begins with \"|\", it is a command that generates the input.",
+
+/*
+** Implementation of the xFilter function for an open session.  Omit
+** any tables named by ".session filter" but let all other table through.
+*/
+#if defined(SQLITE_ENABLE_SESSION)
+static int session_filter(void *pCtx, const char *zTab){
+  OpenSession *pSession = (OpenSession*)pCtx;
+  int i;
+  for(i=0; i<pSession->nFilter; i++){
+    if( sqlite3_strglob(pSession->azFilter[i], zTab)==0 ) return 0;
+  }
+  return 1;
+}
 #endif
-#if SQLITE_SHELL_HAVE_RECOVER
-  ".recover                 Recover as much data as possible from corrupt db.",
-  "   --ignore-freelist        Ignore pages that appear to be on db freelist",
-  "   --lost-and-found TABLE   Alternative name for the lost-and-found table",
-  "   --no-rowids              Do not attempt to recover rowid values",
-  "                            that are not also INTEGER PRIMARY KEYs",
+
+/*
+** Try to deduce the type of file for zName based on its content.  Return
+** one of the SHELL_OPEN_* constants.
+**
+** If the file does not exist or is empty but its name looks like a ZIP
+** archive and the dfltZip flag is true, then assume it is a ZIP archive.
+** Otherwise, assume an ordinary database regardless of the filename if
+** the type cannot be determined from content.
+*/
+int deduceDatabaseType(const char *zName, int dfltZip){
+  FILE *f = fopen(zName, "rb");
+  size_t n;
+  int rc = SHELL_OPEN_UNSPEC;
+  char zBuf[100];
+  if( f==0 ){
+    if( dfltZip && sqlite3_strlike("%.zip",zName,0)==0 ){
+       return SHELL_OPEN_ZIPFILE;
+    }else{
+       return SHELL_OPEN_NORMAL;
+    }
+  }
+  n = fread(zBuf, 16, 1, f);
+  if( n==1 && memcmp(zBuf, "SQLite format 3", 16)==0 ){
+    fclose(f);
+    return SHELL_OPEN_NORMAL;
+  }
+  fseek(f, -25, SEEK_END);
+  n = fread(zBuf, 25, 1, f);
+  if( n==1 && memcmp(zBuf, "Start-Of-SQLite3-", 17)==0 ){
+    rc = SHELL_OPEN_APPENDVFS;
+  }else{
+    fseek(f, -22, SEEK_END);
+    n = fread(zBuf, 22, 1, f);
+    if( n==1 && zBuf[0]==0x50 && zBuf[1]==0x4b && zBuf[2]==0x05
+       && zBuf[3]==0x06 ){
+      rc = SHELL_OPEN_ZIPFILE;
+    }else if( n==0 && dfltZip && sqlite3_strlike("%.zip",zName,0)==0 ){
+      rc = SHELL_OPEN_ZIPFILE;
+    }
+  }
+  fclose(f);
+  return rc;
+}
+
+#ifndef SQLITE_OMIT_DESERIALIZE
+/*
+** Reconstruct an in-memory database using the output from the "dbtotxt"
+** program.  Read content from the file in p->aAuxDb[].zDbFilename.
+** If p->aAuxDb[].zDbFilename is 0, then read from standard input.
+*/
+static unsigned char *readHexDb(ShellState *p, int *pnData){
+  unsigned char *a = 0;
+  int nLine;
+  int n = 0;
+  int pgsz = 0;
+  int iOffset = 0;
+  int j, k;
+  int rc;
+  FILE *in;
+  const char *zDbFilename = p->pAuxDb->zDbFilename;
+  unsigned int x[16];
+  char zLine[1000];
+  if( zDbFilename ){
+    in = fopen(zDbFilename, "r");
+    if( in==0 ){
+      eputf("cannot open \"%s\" for reading\n", zDbFilename);
+      return 0;
+    }
+    nLine = 0;
+  }else{
+    in = p->in;
+    nLine = p->lineno;
+    if( in==0 ) in = stdin;
+  }
+  *pnData = 0;
+  nLine++;
+  if( fgets(zLine, sizeof(zLine), in)==0 ) goto readHexDb_error;
+  rc = sscanf(zLine, "| size %d pagesize %d", &n, &pgsz);
+  if( rc!=2 ) goto readHexDb_error;
+  if( n<0 ) goto readHexDb_error;
+  if( pgsz<512 || pgsz>65536 || (pgsz&(pgsz-1))!=0 ) goto readHexDb_error;
+  n = (n+pgsz-1)&~(pgsz-1);  /* Round n up to the next multiple of pgsz */
+  a = sqlite3_malloc( n ? n : 1 );
+  shell_check_oom(a);
+  memset(a, 0, n);
+  if( pgsz<512 || pgsz>65536 || (pgsz & (pgsz-1))!=0 ){
+    eputz("invalid pagesize\n");
+    goto readHexDb_error;
+  }
+  for(nLine++; fgets(zLine, sizeof(zLine), in)!=0; nLine++){
+    rc = sscanf(zLine, "| page %d offset %d", &j, &k);
+    if( rc==2 ){
+      iOffset = k;
+      continue;
+    }
+    if( cli_strncmp(zLine, "| end ", 6)==0 ){
+      break;
+    }
+    rc = sscanf(zLine,"| %d: %x %x %x %x %x %x %x %x %x %x %x %x %x %x %x %x",
+                &j, &x[0], &x[1], &x[2], &x[3], &x[4], &x[5], &x[6], &x[7],
+                &x[8], &x[9], &x[10], &x[11], &x[12], &x[13], &x[14], &x[15]);
+    if( rc==17 ){
+      k = iOffset+j;
+      if( k+16<=n && k>=0 ){
+        int ii;
+        for(ii=0; ii<16; ii++) a[k+ii] = x[ii]&0xff;
+      }
+    }
+  }
+  *pnData = n;
+  if( in!=p->in ){
+    fclose(in);
+  }else{
+    p->lineno = nLine;
+  }
+  return a;
+
+readHexDb_error:
+  if( in!=p->in ){
+    fclose(in);
+  }else{
+    while( fgets(zLine, sizeof(zLine), p->in)!=0 ){
+      nLine++;
+      if(cli_strncmp(zLine, "| end ", 6)==0 ) break;
+    }
+    p->lineno = nLine;
+  }
+  sqlite3_free(a);
+  eputf("Error on line %d of --hexdb input\n", nLine);
+  return 0;
+}
+#endif /* SQLITE_OMIT_DESERIALIZE */
+
+/*
+** Scalar function "usleep(X)" invokes sqlite3_sleep(X) and returns X.
+*/
+static void shellUSleepFunc(
+  sqlite3_context *context,
+  int argcUnused,
+  sqlite3_value **argv
+){
+  int sleep = sqlite3_value_int(argv[0]);
+  (void)argcUnused;
+  sqlite3_sleep(sleep/1000);
+  sqlite3_result_int(context, sleep);
+}
+
+/* Flags for open_db().
+**
+** The default behavior of open_db() is to exit(1) if the database fails to
+** open.  The OPEN_DB_KEEPALIVE flag changes that so that it prints an error
+** but still returns without calling exit.
+**
+** The OPEN_DB_ZIPFILE flag causes open_db() to prefer to open files as a
+** ZIP archive if the file does not exist or is empty and its name matches
+** the *.zip pattern.
+*/
+#define OPEN_DB_KEEPALIVE   0x001   /* Return after error if true */
+#define OPEN_DB_ZIPFILE     0x002   /* Open as ZIP if name matches *.zip */
+
+/*
+** Make sure the database is open.  If it is not, then open it.  If
+** the database fails to open, print an error message and exit.
+*/
+// Begin Android Add
+/* Forget the table digests kept by ".sha3sum --jobs" */
+static void sha3_cache_clear(Sha3Cache *pCache){
+  int i;
+  for(i=0; i<pCache->nEntry; i++) sqlite3_free(pCache->aEntry[i].zName);
+  sqlite3_free(pCache->aEntry);
+  memset(pCache, 0, sizeof(*pCache));
+}
+// End Android Add
+static void open_db(ShellState *p, int openFlags){
+  if( p->db==0 ){
+// Begin Android Add
+    sha3_cache_clear(&p->sha3Cache);
+// End Android Add
+    const char *zDbFilename = p->pAuxDb->zDbFilename;
+    if( p->openMode==SHELL_OPEN_UNSPEC ){
+      if( zDbFilename==0 || zDbFilename[0]==0 ){
+        p->openMode = SHELL_OPEN_NORMAL;
+      }else{
+        p->openMode = (u8)deduceDatabaseType(zDbFilename,
+                             (openFlags & OPEN_DB_ZIPFILE)!=0);
+      }
+    }
+    switch( p->openMode ){
+      case SHELL_OPEN_APPENDVFS: {
+        sqlite3_open_v2(zDbFilename, &p->db,
+           SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|p->openFlags, "apndvfs");
+        break;
+      }
+      case SHELL_OPEN_HEXDB:
+      case SHELL_OPEN_DESERIALIZE: {
+        sqlite3_open(0, &p->db);
+        break;
+      }
+      case SHELL_OPEN_ZIPFILE: {
+        sqlite3_open(":memory:", &p->db);
+        break;
+      }
+      case SHELL_OPEN_READONLY: {
+        sqlite3_open_v2(zDbFilename, &p->db,
+            SQLITE_OPEN_READONLY|p->openFlags, 0);
+        break;
+      }
+      case SHELL_OPEN_UNSPEC:
+      case SHELL_OPEN_NORMAL: {
+        sqlite3_open_v2(zDbFilename, &p->db,
+           SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|p->openFlags, 0);
+        break;
+      }
+    }
+    globalDb = p->db;
+    if( p->db==0 || SQLITE_OK!=sqlite3_errcode(p->db) ){
+      eputf("Error: unable to open database \"%s\": %s\n",
+            zDbFilename, sqlite3_errmsg(p->db));
+      if( (openFlags & OPEN_DB_KEEPALIVE)==0 ){
+        exit(1);
+      }
+      sqlite3_close(p->db);
+      sqlite3_open(":memory:", &p->db);
+      if( p->db==0 || SQLITE_OK!=sqlite3_errcode(p->db) ){
+        eputz("Also: unable to open substitute in-memory database.\n");
+        exit(1);
+      }else{
+        eputf("Notice: using substitute in-memory database instead of \"%s\"\n",
+              zDbFilename);
+      }
+    }
+    sqlite3_db_config(p->db, SQLITE_DBCONFIG_STMT_SCANSTATUS, (int)0, (int*)0);
+
+    /* Reflect the use or absence of --unsafe-testing invocation. */
+    {
+      int testmode_on = ShellHasFlag(p,SHFLG_TestingMode);
+      sqlite3_db_config(p->db, SQLITE_DBCONFIG_TRUSTED_SCHEMA, testmode_on,0);
+      sqlite3_db_config(p->db, SQLITE_DBCONFIG_DEFENSIVE, !testmode_on,0);
+    }
+
+#ifndef SQLITE_OMIT_LOAD_EXTENSION
+    sqlite3_enable_load_extension(p->db, 1);
 #endif
+    sqlite3_shathree_init(p->db, 0, 0);
+    sqlite3_uint_init(p->db, 0, 0);
+    sqlite3_decimal_init(p->db, 0, 0);
+    sqlite3_base64_init(p->db, 0, 0);
+    sqlite3_base85_init(p->db, 0, 0);
+    sqlite3_regexp_init(p->db, 0, 0);
+    sqlite3_ieee_init(p->db, 0, 0);
+    sqlite3_series_init(p->db, 0, 0);
 #ifndef SQLITE_SHELL_FIDDLE
-  ".restore ?DB? FILE       Restore content of DB (default \"main\") from FILE",
-  ".save ?OPTIONS? FILE     Write database to FILE (an alias for .backup ...)",
+    sqlite3_fileio_init(p->db, 0, 0);
+    sqlite3_completion_init(p->db, 0, 0);
 #endif
-  ".scanstats on|off|est    Turn sqlite3_stmt_scanstatus() metrics on or off",
-  ".schema ?PATTERN?        Show the CREATE statements matching PATTERN",
-  "   Options:",
-  "      --indent             Try to pretty-print the schema",
-  "      --nosys              Omit objects whose names start with \"sqlite_\"",
-  ",selftest ?OPTIONS?      Run tests defined in the SELFTEST table",
-  "    Options:",
-  "       --init               Create a new SELFTEST table",
-  "       -v                   Verbose output",
-  ".separator COL ?ROW?     Change the column and row separators",
-#if defined(SQLITE_ENABLE_SESSION)
-  ".session ?NAME? CMD ...  Create or control sessions",
-  "   Subcommands:",
-  "     attach TABLE             Attach TABLE",
-  "     changeset FILE           Write a changeset into FILE",
-  "     close                    Close one session",
-  "     enable ?BOOLEAN?         Set or query the enable bit",
-  "     filter GLOB...           Reject tables matching GLOBs",
-  "     indirect ?BOOLEAN?       Mark or query the indirect status",
-  "     isempty                  Query whether the session is empty",
-  "     list                     List currently open session names",
-  "     open DB NAME             Open a new session on DB",
-  "     patchset FILE            Write a patchset into FILE",
-  "   If ?NAME? is omitted, the first defined session is used.",
+#ifdef SQLITE_HAVE_ZLIB
+    if( !p->bSafeModePersist ){
+      sqlite3_zipfile_init(p->db, 0, 0);
+      sqlite3_sqlar_init(p->db, 0, 0);
+    }
 #endif
-  ".sha3sum ...             Compute a SHA3 hash of database content",
-  "    Options:",
-  "      --schema              Also hash the sqlite_schema table",
-  "      --sha3-224            Use the sha3-224 algorithm",
-  "      --sha3-256            Use the sha3-256 algorithm (default)",
-  "      --sha3-384            Use the sha3-384 algorithm",
-  "      --sha3-512            Use the sha3-512 algorithm",
-  "    Any other argument is a LIKE pattern for tables to hash",
-#if !defined(SQLITE_NOHAVE_SYSTEM) && !defined(SQLITE_SHELL_FIDDLE)
-  ".shell CMD ARGS...       Run CMD ARGS... in a system shell",
+#ifdef SQLITE_SHELL_EXTFUNCS
+    /* Create a preprocessing mechanism for extensions to make
+     * their own provisions for being built into the shell.
+     * This is a short-span macro. See further below for usage.
+     */
+#define SHELL_SUB_MACRO(base, variant) base ## _ ## variant
+#define SHELL_SUBMACRO(base, variant) SHELL_SUB_MACRO(base, variant)
+    /* Let custom-included extensions get their ..._init() called.
+     * The WHATEVER_INIT( db, pzErrorMsg, pApi ) macro should cause
+     * the extension's sqlite3_*_init( db, pzErrorMsg, pApi )
+     * initialization routine to be called.
+     */
+    {
+      int irc = SHELL_SUBMACRO(SQLITE_SHELL_EXTFUNCS, INIT)(p->db);
+    /* Let custom-included extensions expose their functionality.
+     * The WHATEVER_EXPOSE( db, pzErrorMsg ) macro should cause
+     * the SQL functions, virtual tables, collating sequences or
+     * VFS's implemented by the extension to be registered.
+     */
+      if( irc==SQLITE_OK
+          || irc==SQLITE_OK_LOAD_PERMANENTLY ){
+        SHELL_SUBMACRO(SQLITE_SHELL_EXTFUNCS, EXPOSE)(p->db, 0);
+      }
+#undef SHELL_SUB_MACRO
+#undef SHELL_SUBMACRO
+    }
 #endif
-  ".show                    Show the current values for various settings",
-  ".stats ?ARG?             Show stats or turn stats on or off",
-  "   off                      Turn off automatic stat display",
-  "   on                       Turn on automatic stat display",
-  "   stmt                     Show statement stats",
-  "   vmstep                   Show the virtual machine step count only",
-#if !defined(SQLITE_NOHAVE_SYSTEM) && !defined(SQLITE_SHELL_FIDDLE)
-  ".system CMD ARGS...      Run CMD ARGS... in a system shell",
+
+    sqlite3_create_function(p->db, "strtod", 1, SQLITE_UTF8, 0,
+                            shellStrtod, 0, 0);
+    sqlite3_create_function(p->db, "dtostr", 1, SQLITE_UTF8, 0,
+                            shellDtostr, 0, 0);
+    sqlite3_create_function(p->db, "dtostr", 2, SQLITE_UTF8, 0,
+                            shellDtostr, 0, 0);
+    sqlite3_create_function(p->db, "shell_add_schema", 3, SQLITE_UTF8, 0,
+                            shellAddSchemaName, 0, 0);
+    sqlite3_create_function(p->db, "shell_module_schema", 1, SQLITE_UTF8, 0,
+                            shellModuleSchema, 0, 0);
+    sqlite3_create_function(p->db, "shell_putsnl", 1, SQLITE_UTF8, p,
+                            shellPutsFunc, 0, 0);
+    sqlite3_create_function(p->db, "usleep",1,SQLITE_UTF8,0,
+                            shellUSleepFunc, 0, 0);
+#ifndef SQLITE_NOHAVE_SYSTEM
+    sqlite3_create_function(p->db, "edit", 1, SQLITE_UTF8, 0,
+                            editFunc, 0, 0);
+    sqlite3_create_function(p->db, "edit", 2, SQLITE_UTF8, 0,
+                            editFunc, 0, 0);
 #endif
-  ".tables ?TABLE?          List names of tables matching LIKE pattern TABLE",
-#ifndef SQLITE_SHELL_FIDDLE
-  ",testcase NAME           Begin redirecting output to 'testcase-out.txt'",
+
+// Begin Android Add
+#ifndef NO_ANDROID_FUNCS
+    int err = register_localized_collators(p->db, "en_US", 0);
+    if (err != SQLITE_OK) {
+      fprintf(stderr, "register_localized_collators() failed\n");
+      exit(1);
+    }
+    err = register_android_functions(p->db, 0);
+    if (err != SQLITE_OK) {
+      fprintf(stderr, "register_android_functions() failed\n");
+      exit(1);
+    }
 #endif
-  ",testctrl CMD ...        Run various sqlite3_test_control() operations",
-  "                           Run \".testctrl\" with no arguments for details",
-  ".timeout MS              Try opening locked tables for MS milliseconds",
-  ".timer on|off            Turn SQL timer on or off",
-#ifndef SQLITE_OMIT_TRACE
-  ".trace ?OPTIONS?         Output each SQL statement as it is run",
-  "    FILE                    Send output to FILE",
-  "    stdout                  Send output to stdout",
-  "    stderr                  Send output to stderr",
-  "    off                     Disable tracing",
-  "    --expanded              Expand query parameters",
-#ifdef SQLITE_ENABLE_NORMALIZE
-  "    --normalized            Normal the SQL statements",
+// End Android Add
+    if( p->openMode==SHELL_OPEN_ZIPFILE ){
+      char *zSql = sqlite3_mprintf(
+         "CREATE VIRTUAL TABLE zip USING zipfile(%Q);", zDbFilename);
+      shell_check_oom(zSql);
+      sqlite3_exec(p->db, zSql, 0, 0, 0);
+      sqlite3_free(zSql);
+    }
+#ifndef SQLITE_OMIT_DESERIALIZE
+    else
+    if( p->openMode==SHELL_OPEN_DESERIALIZE || p->openMode==SHELL_OPEN_HEXDB ){
+      int rc;
+      int nData = 0;
+      unsigned char *aData;
+      if( p->openMode==SHELL_OPEN_DESERIALIZE ){
+        aData = (unsigned char*)readFile(zDbFilename, &nData);
+      }else{
+        aData = readHexDb(p, &nData);
+      }
+      if( aData==0 ){
+        return;
+      }
+      rc = sqlite3_deserialize(p->db, "main", aData, nData, nData,
+                   SQLITE_DESERIALIZE_RESIZEABLE |
+                   SQLITE_DESERIALIZE_FREEONCLOSE);
+      if( rc ){
+        eputf("Error: sqlite3_deserialize() returns %d\n", rc);
+      }
+      if( p->szMax>0 ){
+        sqlite3_file_control(p->db, "main", SQLITE_FCNTL_SIZE_LIMIT, &p->szMax);
+      }
+    }
 #endif
-  "    --plain                 Show SQL as it is input",
-  "    --stmt                  Trace statement execution (SQLITE_TRACE_STMT)",
-  "    --profile               Profile statements (SQLITE_TRACE_PROFILE)",
-  "    --row                   Trace each row (SQLITE_TRACE_ROW)",
-  "    --close                 Trace connection close (SQLITE_TRACE_CLOSE)",
-#endif /* SQLITE_OMIT_TRACE */
-#ifdef SQLITE_DEBUG
-  ".unmodule NAME ...       Unregister virtual table modules",
-  "    --allexcept             Unregister everything except those named",
+  }
+  if( p->db!=0 ){
+    if( p->bSafeModePersist ){
+      sqlite3_set_authorizer(p->db, safeModeAuth, p);
+    }
+    sqlite3_db_config(
+        p->db, SQLITE_DBCONFIG_STMT_SCANSTATUS, p->scanstatsOn, (int*)0
+    );
+  }
+}
+
+/*
+** Attempt to close the database connection.  Report errors.
+*/
+void close_db(sqlite3 *db){
+  int rc = sqlite3_close(db);
+  if( rc ){
+    eputf("Error: sqlite3_close() returns %d: %s\n", rc, sqlite3_errmsg(db));
+  }
+}
+
+#if HAVE_READLINE || HAVE_EDITLINE
+/*
+** Readline completion callbacks
+*/
+static char *readline_completion_generator(const char *text, int state){
+  static sqlite3_stmt *pStmt = 0;
+  char *zRet;
+  if( state==0 ){
+    char *zSql;
+    sqlite3_finalize(pStmt);
+    zSql = sqlite3_mprintf("SELECT DISTINCT candidate COLLATE nocase"
+                           "  FROM completion(%Q) ORDER BY 1", text);
+    shell_check_oom(zSql);
+    sqlite3_prepare_v2(globalDb, zSql, -1, &pStmt, 0);
+    sqlite3_free(zSql);
+  }
+  if( sqlite3_step(pStmt)==SQLITE_ROW ){
+    const char *z = (const char*)sqlite3_column_text(pStmt,0);
+    zRet = z ? strdup(z) : 0;
+  }else{
+    sqlite3_finalize(pStmt);
+    pStmt = 0;
+    zRet = 0;
+  }
+  return zRet;
+}
+static char **readline_completion(const char *zText, int iStart, int iEnd){
+  (void)iStart;
+  (void)iEnd;
+  rl_attempted_completion_over = 1;
+  return rl_completion_matches(zText, readline_completion_generator);
+}
+
+#elif HAVE_LINENOISE
+/*
+** Linenoise completion callback
+*/
+static void linenoise_completion(const char *zLine, linenoiseCompletions *lc){
+  i64 nLine = strlen(zLine);
+  i64 i, iStart;
+  sqlite3_stmt *pStmt = 0;
+  char *zSql;
+  char zBuf[1000];
+
+  if( nLine>(i64)sizeof(zBuf)-30 ) return;
+  if( zLine[0]=='.' || zLine[0]=='#') return;
+  for(i=nLine-1; i>=0 && (isalnum(zLine[i]) || zLine[i]=='_'); i--){}
+  if( i==nLine-1 ) return;
+  iStart = i+1;
+  memcpy(zBuf, zLine, iStart);
+  zSql = sqlite3_mprintf("SELECT DISTINCT candidate COLLATE nocase"
+                         "  FROM completion(%Q,%Q) ORDER BY 1",
+                         &zLine[iStart], zLine);
+  shell_check_oom(zSql);
+  sqlite3_prepare_v2(globalDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  sqlite3_exec(globalDb, "PRAGMA page_count", 0, 0, 0); /* Load the schema */
+  while( sqlite3_step(pStmt)==SQLITE_ROW ){
+    const char *zCompletion = (const char*)sqlite3_column_text(pStmt, 0);
+    int nCompletion = sqlite3_column_bytes(pStmt, 0);
+    if( iStart+nCompletion < (i64)sizeof(zBuf)-1 && zCompletion ){
+      memcpy(zBuf+iStart, zCompletion, nCompletion+1);
+      linenoiseAddCompletion(lc, zBuf);
+    }
+  }
+  sqlite3_finalize(pStmt);
+}
 #endif
-  ".version                 Show source, library and compiler versions",
-  ".vfsinfo ?AUX?           Information about the top-level VFS",
-  ".vfslist                 List all available VFSes",
-  ".vfsname ?AUX?           Print the name of the VFS stack",
-  ".width NUM1 NUM2 ...     Set minimum column widths for columnar output",
-  "     Negative values right-justify",
-};
 
 /*
-** Output help text.
-**
-** zPattern describes the set of commands for which help text is provided.
-** If zPattern is NULL, then show all commands, but only give a one-line
-** description of each.
-**
-** Return the number of matches.
+** Do C-language style dequoting.
+**
+**    \a    -> alarm
+**    \b    -> backspace
+**    \t    -> tab
+**    \n    -> newline
+**    \v    -> vertical tab
+**    \f    -> form feed
+**    \r    -> carriage return
+**    \s    -> space
+**    \"    -> "
+**    \'    -> '
+**    \\    -> backslash
+**    \NNN  -> ascii character NNN in octal
+**    \xHH  -> ascii character HH in hexadecimal
+*/
+static void resolve_backslashes(char *z){
+  int i, j;
+  char c;
+  while( *z && *z!='\\' ) z++;
+  for(i=j=0; (c = z[i])!=0; i++, j++){
+    if( c=='\\' && z[i+1]!=0 ){
+      c = z[++i];
+      if( c=='a' ){
+        c = '\a';
+      }else if( c=='b' ){
+        c = '\b';
+      }else if( c=='t' ){
+        c = '\t';
+      }else if( c=='n' ){
+        c = '\n';
+      }else if( c=='v' ){
+        c = '\v';
+      }else if( c=='f' ){
+        c = '\f';
+      }else if( c=='r' ){
+        c = '\r';
+      }else if( c=='"' ){
+        c = '"';
+      }else if( c=='\'' ){
+        c = '\'';
+      }else if( c=='\\' ){
+        c = '\\';
+      }else if( c=='x' ){
+        int nhd = 0, hdv;
+        u8 hv = 0;
+        while( nhd<2 && (c=z[i+1+nhd])!=0 && (hdv=hexDigitValue(c))>=0 ){
+          hv = (u8)((hv<<4)|hdv);
+          ++nhd;
+        }
+        i += nhd;
+        c = (u8)hv;
+      }else if( c>='0' && c<='7' ){
+        c -= '0';
+        if( z[i+1]>='0' && z[i+1]<='7' ){
+          i++;
+          c = (c<<3) + z[i] - '0';
+          if( z[i+1]>='0' && z[i+1]<='7' ){
+            i++;
+            c = (c<<3) + z[i] - '0';
+          }
+        }
+      }
+    }
+    z[j] = c;
+  }
+  if( j<i ) z[j] = 0;
+}
+
+/*
+** Interpret zArg as either an integer or a boolean value.  Return 1 or 0
+** for TRUE and FALSE.  Return the integer value if appropriate.
 */
-static int showHelp(FILE *out, const char *zPattern){
-  int i = 0;
-  int j = 0;
-  int n = 0;
-  char *zPat;
-  if( zPattern==0
-   || zPattern[0]=='0'
-   || cli_strcmp(zPattern,"-a")==0
-   || cli_strcmp(zPattern,"-all")==0
-   || cli_strcmp(zPattern,"--all")==0
-  ){
-    enum HelpWanted { HW_NoCull = 0, HW_SummaryOnly = 1, HW_Undoc = 2 };
-    enum HelpHave { HH_Undoc = 2, HH_Summary = 1, HH_More = 0 };
-    /* Show all or most commands
-    ** *zPattern==0   => summary of documented commands only
-    ** *zPattern=='0' => whole help for undocumented commands
-    ** Otherwise      => whole help for documented commands
-    */
-    enum HelpWanted hw = HW_SummaryOnly;
-    enum HelpHave hh = HH_More;
-    if( zPattern!=0 ){
-      hw = (*zPattern=='0')? HW_NoCull|HW_Undoc : HW_NoCull;
+static int booleanValue(const char *zArg){
+  int i;
+  if( zArg[0]=='0' && zArg[1]=='x' ){
+    for(i=2; hexDigitValue(zArg[i])>=0; i++){}
+  }else{
+    for(i=0; zArg[i]>='0' && zArg[i]<='9'; i++){}
+  }
+  if( i>0 && zArg[i]==0 ) return (int)(integerValue(zArg) & 0xffffffff);
+  if( sqlite3_stricmp(zArg, "on")==0 || sqlite3_stricmp(zArg,"yes")==0 ){
+    return 1;
+  }
+  if( sqlite3_stricmp(zArg, "off")==0 || sqlite3_stricmp(zArg,"no")==0 ){
+    return 0;
+  }
+  eputf("ERROR: Not a boolean value: \"%s\". Assuming \"no\".\n", zArg);
+  return 0;
+}
+
+/*
+** Set or clear a shell flag according to a boolean value.
+*/
+static void setOrClearFlag(ShellState *p, unsigned mFlag, const char *zArg){
+  if( booleanValue(zArg) ){
+    ShellSetFlag(p, mFlag);
+  }else{
+    ShellClearFlag(p, mFlag);
+  }
+}
+
+/*
+** Close an output file, assuming it is not stderr or stdout
+*/
+static void output_file_close(FILE *f){
+  if( f && f!=stdout && f!=stderr ) fclose(f);
+}
+
+/*
+** Try to open an output file.   The names "stdout" and "stderr" are
+** recognized and do the right thing.  NULL is returned if the output
+** filename is "off".
+*/
+static FILE *output_file_open(const char *zFile, int bTextMode){
+  FILE *f;
+  if( cli_strcmp(zFile,"stdout")==0 ){
+    f = stdout;
+  }else if( cli_strcmp(zFile, "stderr")==0 ){
+    f = stderr;
+  }else if( cli_strcmp(zFile, "off")==0 ){
+    f = 0;
+  }else{
+    f = fopen(zFile, bTextMode ? "w" : "wb");
+    if( f==0 ){
+      eputf("Error: cannot open \"%s\"\n", zFile);
     }
-    for(i=0; i<ArraySize(azHelp); i++){
-      switch( azHelp[i][0] ){
-      case ',':
-        hh = HH_Summary|HH_Undoc;
-        break;
-      case '.':
-        hh = HH_Summary;
-        break;
-      default:
-        hh &= ~HH_Summary;
+  }
+  return f;
+}
+
+#ifndef SQLITE_OMIT_TRACE
+/*
+** A routine for handling output from sqlite3_trace().
+*/
+static int sql_trace_callback(
+  unsigned mType,         /* The trace type */
+  void *pArg,             /* The ShellState pointer */
+  void *pP,               /* Usually a pointer to sqlite_stmt */
+  void *pX                /* Auxiliary output */
+){
+  ShellState *p = (ShellState*)pArg;
+  sqlite3_stmt *pStmt;
+  const char *zSql;
+  i64 nSql;
+  if( p->traceOut==0 ) return 0;
+  if( mType==SQLITE_TRACE_CLOSE ){
+    sputz(p->traceOut, "-- closing database connection\n");
+    return 0;
+  }
+  if( mType!=SQLITE_TRACE_ROW && pX!=0 && ((const char*)pX)[0]=='-' ){
+    zSql = (const char*)pX;
+  }else{
+    pStmt = (sqlite3_stmt*)pP;
+    switch( p->eTraceType ){
+      case SHELL_TRACE_EXPANDED: {
+        zSql = sqlite3_expanded_sql(pStmt);
         break;
       }
-      if( ((hw^hh)&HH_Undoc)==0 ){
-        if( (hh&HH_Summary)!=0 ){
-          sputf(out, ".%s\n", azHelp[i]+1);
-          ++n;
-        }else if( (hw&HW_SummaryOnly)==0 ){
-          sputf(out, "%s\n", azHelp[i]);
-        }
+#ifdef SQLITE_ENABLE_NORMALIZE
+      case SHELL_TRACE_NORMALIZED: {
+        zSql = sqlite3_normalized_sql(pStmt);
+        break;
       }
-    }
-  }else{
-    /* Seek documented commands for which zPattern is an exact prefix */
-    zPat = sqlite3_mprintf(".%s*", zPattern);
-    shell_check_oom(zPat);
-    for(i=0; i<ArraySize(azHelp); i++){
-      if( sqlite3_strglob(zPat, azHelp[i])==0 ){
-        sputf(out, "%s\n", azHelp[i]);
-        j = i+1;
-        n++;
+#endif
+      default: {
+        zSql = sqlite3_sql(pStmt);
+        break;
       }
     }
-    sqlite3_free(zPat);
-    if( n ){
-      if( n==1 ){
-        /* when zPattern is a prefix of exactly one command, then include
-        ** the details of that command, which should begin at offset j */
-        while( j<ArraySize(azHelp)-1 && azHelp[j][0]==' ' ){
-          sputf(out, "%s\n", azHelp[j]);
-          j++;
-        }
-      }
-      return n;
+  }
+  if( zSql==0 ) return 0;
+// Begin Android Add
+#ifdef SHELL_OUT_BUFFER
+  shell_out_flush(&p->sOut);
+#endif
+// End Android Add
+  nSql = strlen(zSql);
+  if( nSql>1000000000 ) nSql = 1000000000;
+  while( nSql>0 && zSql[nSql-1]==';' ){ nSql--; }
+  switch( mType ){
+    case SQLITE_TRACE_ROW:
+    case SQLITE_TRACE_STMT: {
+      sputf(p->traceOut, "%.*s;\n", (int)nSql, zSql);
+      break;
     }
-    /* Look for documented commands that contain zPattern anywhere.
-    ** Show complete text of all documented commands that match. */
-    zPat = sqlite3_mprintf("%%%s%%", zPattern);
-    shell_check_oom(zPat);
-    for(i=0; i<ArraySize(azHelp); i++){
-      if( azHelp[i][0]==',' ){
-        while( i<ArraySize(azHelp)-1 && azHelp[i+1][0]==' ' ) ++i;
-        continue;
-      }
-      if( azHelp[i][0]=='.' ) j = i;
-      if( sqlite3_strlike(zPat, azHelp[i], 0)==0 ){
-        sputf(out, "%s\n", azHelp[j]);
-        while( j<ArraySize(azHelp)-1 && azHelp[j+1][0]==' ' ){
-          j++;
-          sputf(out, "%s\n", azHelp[j]);
-        }
-        i = j;
-        n++;
-      }
+    case SQLITE_TRACE_PROFILE: {
+      sqlite3_int64 nNanosec = pX ? *(sqlite3_int64*)pX : 0;
+      sputf(p->traceOut, "%.*s; -- %lld ns\n", (int)nSql, zSql, nNanosec);
+      break;
     }
-    sqlite3_free(zPat);
   }
-  return n;
+  return 0;
+}
+#endif
+
+/*
+** A no-op routine that runs with the ".breakpoint" doc-command.  This is
+** a useful spot to set a debugger breakpoint.
+**
+** This routine does not do anything practical.  The code are there simply
+** to prevent the compiler from optimizing this routine out.
+*/
+static void test_breakpoint(void){
+  static unsigned int nCall = 0;
+  if( (nCall++)==0xffffffff ) printf("Many .breakpoints have run\n");
 }
 
-/* Forward reference */
-static int process_input(ShellState *p);
-
 /*
-** Read the content of file zName into memory obtained from sqlite3_malloc64()
-** and return a pointer to the buffer. The caller is responsible for freeing
-** the memory.
-**
-** If parameter pnByte is not NULL, (*pnByte) is set to the number of bytes
-** read.
-**
-** For convenience, a nul-terminator byte is always appended to the data read
-** from the file before the buffer is returned. This byte is not included in
-** the final value of (*pnByte), if applicable.
-**
-** NULL is returned if any error is encountered. The final value of *pnByte
-** is undefined in this case.
+** An object used to read a CSV and other files for import.
 */
-static char *readFile(const char *zName, int *pnByte){
-  FILE *in = fopen(zName, "rb");
-  long nIn;
-  size_t nRead;
-  char *pBuf;
-  int rc;
-  if( in==0 ) return 0;
-  rc = fseek(in, 0, SEEK_END);
-  if( rc!=0 ){
-    eputf("Error: '%s' not seekable\n", zName);
-    fclose(in);
-    return 0;
-  }
-  nIn = ftell(in);
-  rewind(in);
-  pBuf = sqlite3_malloc64( nIn+1 );
-  if( pBuf==0 ){
-    eputz("Error: out of memory\n");
-    fclose(in);
-    return 0;
+typedef struct ImportCtx ImportCtx;
+struct ImportCtx {
+  const char *zFile;  /* Name of the input file */
+  FILE *in;           /* Read the CSV text from this input stream */
+  int (SQLITE_CDECL *xCloser)(FILE*);      /* Func to close in */
+  char *z;            /* Accumulated text for a field */
+  int n;              /* Number of bytes in z */
+  int nAlloc;         /* Space allocated for z[] */
+  int nLine;          /* Current line number */
+  int nRow;           /* Number of rows imported */
+  int nErr;           /* Number of errors encountered */
+  int bNotFirst;      /* True if one or more bytes already read */
+  int cTerm;          /* Character that terminated the most recent field */
+  int cColSep;        /* The column separator character.  (Usually ",") */
+  int cRowSep;        /* The row separator character.  (Usually "\n") */
+// Begin Android Add
+  char *zBuf;         /* Block of input text read from in */
+  i64 nBuf;           /* Number of bytes of input in zBuf[] */
+  i64 nBufAlloc;      /* Space allocated for zBuf[], less one byte */
+  i64 iBuf;           /* Offset of the next unread byte in zBuf[] */
+  i64 iMark;          /* Input from zBuf[iMark] on is kept on refill */
+  int bEof;           /* True once in has been read to the end */
+  sqlite3_str *pMsg;  /* Collect diagnostics here instead, if not NULL */
+  char *aAff;         /* Column affinities for --typed, or NULL */
+  int nCommit;        /* COMMIT and BEGIN again after this many rows */
+  int nUncommitted;   /* Rows inserted since the last BEGIN */
+// End Android Add
+};
+
+/* Clean up resourced used by an ImportCtx */
+static void import_cleanup(ImportCtx *p){
+  if( p->in!=0 && p->xCloser!=0 ){
+    p->xCloser(p->in);
+    p->in = 0;
   }
-  nRead = fread(pBuf, nIn, 1, in);
-  fclose(in);
-  if( nRead!=1 ){
-    sqlite3_free(pBuf);
-    eputf("Error: cannot read '%s'\n", zName);
-    return 0;
+  sqlite3_free(p->z);
+  p->z = 0;
+// Begin Android Add
+  sqlite3_free(p->zBuf);
+  p->zBuf = 0;
+  sqlite3_free(p->aAff);
+  p->aAff = 0;
+  p->nBuf = p->nBufAlloc = p->iBuf = p->iMark = 0;
+// End Android Add
+}
+
+/* Append a single byte to z[] */
+static void import_append_char(ImportCtx *p, int c){
+  if( p->n+1>=p->nAlloc ){
+    p->nAlloc += p->nAlloc + 100;
+    p->z = sqlite3_realloc64(p->z, p->nAlloc);
+    shell_check_oom(p->z);
   }
-  pBuf[nIn] = 0;
-  if( pnByte ) *pnByte = nIn;
-  return pBuf;
+  p->z[p->n++] = (char)c;
 }
 
-#if defined(SQLITE_ENABLE_SESSION)
+// Begin Android Add
 /*
-** Close a single OpenSession object and release all of its associated
-** resources.
+** The readers below take their input from p->in a block at a time
+** rather than with one fgetc() per byte.  Unquoted fields are returned
+** in place, as a pointer into the block, and the scans for separators
+** and quotes look at 16 bytes per step where the compiler offers SSE2
+** or NEON.
 */
-static void session_close(OpenSession *pSession){
-  int i;
-  sqlite3session_delete(pSession->p);
-  sqlite3_free(pSession->zName);
-  for(i=0; i<pSession->nFilter; i++){
-    sqlite3_free(pSession->azFilter[i]);
+#define IMPORT_BLOCK_SIZE (256*1024)
+
+#if defined(__GNUC__) && defined(__SSE2__)
+# include <emmintrin.h>
+# define IMPORT_FIND_SSE2 1
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+# include <arm_neon.h>
+# define IMPORT_FIND_NEON 1
+#endif
+
+/* Append n bytes of text to z[] */
+static void import_append_text(ImportCtx *p, const char *z, i64 n){
+  if( p->n+n+1>=p->nAlloc ){
+    i64 nNew = 2*(i64)p->nAlloc + n + 100;
+    if( nNew>0x7fffffff ) shell_out_of_memory();
+    p->nAlloc = (int)nNew;
+    p->z = sqlite3_realloc64(p->z, p->nAlloc);
+    shell_check_oom(p->z);
   }
-  sqlite3_free(pSession->azFilter);
-  memset(pSession, 0, sizeof(OpenSession));
+  memcpy(p->z+p->n, z, n);
+  p->n += (int)n;
+}
+
+/* Report a problem with the input, on stderr or into p->pMsg */
+static void import_warn(ImportCtx *p, const char *zFormat, ...){
+  va_list ap;
+  va_start(ap, zFormat);
+  if( p->pMsg ){
+    sqlite3_str_vappendf(p->pMsg, zFormat, ap);
+  }else{
+    char *zMsg = sqlite3_vmprintf(zFormat, ap);
+    shell_check_oom(zMsg);
+    eputz(zMsg);
+    sqlite3_free(zMsg);
+  }
+  va_end(ap);
 }
-#endif
 
 /*
-** Close all OpenSession objects and release all associated resources.
-*/
-#if defined(SQLITE_ENABLE_SESSION)
-static void session_close_all(ShellState *p, int i){
-  int j;
-  struct AuxDb *pAuxDb = i<0 ? p->pAuxDb : &p->aAuxDb[i];
-  for(j=0; j<pAuxDb->nSession; j++){
-    session_close(&pAuxDb->aSession[j]);
+** Move the input from zBuf[iMark] onwards to the start of zBuf[],
+** growing zBuf[] if that would leave less than half of it free, then
+** read more input after it.  iBuf and iMark move down with the text.
+** Return the number of bytes read, which is zero at end-of-file.  Once
+** at end-of-file, nothing in zBuf[] moves any more.
+*/
+static i64 import_fill(ImportCtx *p){
+  i64 nKeep = p->nBuf - p->iMark;
+  size_t got;
+  if( p->bEof ) return 0;
+  if( nKeep>0 && p->iMark>0 ) memmove(p->zBuf, p->zBuf+p->iMark, nKeep);
+  p->nBuf = nKeep;
+  p->iBuf -= p->iMark;
+  p->iMark = 0;
+  if( p->zBuf==0 || nKeep*2>p->nBufAlloc ){
+    i64 nNew = p->nBufAlloc ? 2*p->nBufAlloc : IMPORT_BLOCK_SIZE;
+    /* One byte more than nBufAlloc, for the terminator of a field
+    ** that ends at end-of-file */
+    p->zBuf = sqlite3_realloc64(p->zBuf, nNew+1);
+    shell_check_oom(p->zBuf);
+    p->nBufAlloc = nNew;
+  }
+  got = fread(p->zBuf+nKeep, 1, (size_t)(p->nBufAlloc-nKeep), p->in);
+  if( got==0 ) p->bEof = 1;
+  p->nBuf += got;
+  return (i64)got;
+}
+
+/* Read the next byte of input, or return EOF */
+static int import_getc(ImportCtx *p){
+  if( p->iBuf>=p->nBuf && import_fill(p)==0 ) return EOF;
+  return (u8)p->zBuf[p->iBuf++];
+}
+
+/*
+** Return the offset of the first byte in z[i..n-1] that is either a or
+** b, or n if there is no such byte.
+*/
+static i64 import_find2(const char *z, i64 i, i64 n, char a, char b){
+#if defined(IMPORT_FIND_SSE2)
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  while( i+16<=n ){
+    __m128i x = _mm_loadu_si128((const __m128i*)(z+i));
+    int m = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)));
+    if( m ) return i + __builtin_ctz((unsigned)m);
+    i += 16;
+  }
+#elif defined(IMPORT_FIND_NEON)
+  const uint8x16_t va = vdupq_n_u8((u8)a);
+  const uint8x16_t vb = vdupq_n_u8((u8)b);
+  while( i+16<=n ){
+    uint8x16_t x = vld1q_u8((const u8*)(z+i));
+    uint8x16_t m = vorrq_u8(vceqq_u8(x, va), vceqq_u8(x, vb));
+    /* Narrow to 4 bits per byte to get a scalar bitmask */
+    uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(
+        vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+    if( bits ) return i + (__builtin_ctzll(bits)>>2);
+    i += 16;
+  }
+#endif
+  while( i<n && z[i]!=a && z[i]!=b ) i++;
+  return i;
+}
+
+/*
+** Scan an unquoted field that starts at zBuf[p->iBuf] and ends at the
+** next cSep or rSep.  Return its first byte, NUL-terminated in place,
+** with p->n set to its length and p->cTerm to the terminator.  Strip a
+** '\r' before rSep if bStripCr.
+*/
+static char *import_scan_field(ImportCtx *p, int cSep, int rSep, int bStripCr){
+  i64 i = p->iBuf;
+  int c;
+  char *z;
+  p->iMark = p->iBuf;
+  while( (i = import_find2(p->zBuf, i, p->nBuf, (char)cSep, (char)rSep))
+           >=p->nBuf ){
+    i64 nScan = i - p->iMark;
+    i64 nGot = import_fill(p);
+    i = p->iMark + nScan;
+    if( nGot==0 ) break;
+  }
+  if( i<p->nBuf ){
+    c = (u8)p->zBuf[i];
+    p->iBuf = i+1;
+  }else{
+    c = EOF;
+    p->iBuf = i;
   }
-  pAuxDb->nSession = 0;
+  z = p->zBuf + p->iMark;
+  p->n = (int)(i - p->iMark);
+  if( c==rSep ){
+    p->nLine++;
+    if( bStripCr && p->n>0 && z[p->n-1]=='\r' ) p->n--;
+  }
+  z[p->n] = 0;
+  p->cTerm = c;
+  return z;
 }
-#else
-# define session_close_all(X,Y)
-#endif
+
+/* Forward reference */
+static char *SQLITE_CDECL csv_read_one_field(ImportCtx*);
 
 /*
-** Implementation of the xFilter function for an open session.  Omit
-** any tables named by ".session filter" but let all other table through.
+** Read one row of nCol values for .import from p with xRead and pass
+** each to xValue(pArg, iCol, z), with z==0 for NULL.  Set *piLine to the
+** line the row starts on.  Return true if the row should be inserted.
 */
-#if defined(SQLITE_ENABLE_SESSION)
-static int session_filter(void *pCtx, const char *zTab){
-  OpenSession *pSession = (OpenSession*)pCtx;
+static int import_read_row(
+  ImportCtx *p,                            /* Input */
+  char *(SQLITE_CDECL *xRead)(ImportCtx*), /* Func to read one value */
+  int nCol,                                /* Number of columns */
+  int bAscii,                              /* True for .mode ascii */
+  void (*xValue)(void*,int,char*),         /* Receives each value */
+  void *pArg,                              /* First argument to xValue */
+  int *piLine                              /* OUT: Line the row starts on */
+){
   int i;
-  for(i=0; i<pSession->nFilter; i++){
-    if( sqlite3_strglob(pSession->azFilter[i], zTab)==0 ) return 0;
+  int startLine = *piLine = p->nLine;
+  for(i=0; i<nCol; i++){
+    char *z = xRead(p);
+    /*
+    ** Did we reach end-of-file before finding any columns?
+    ** If so, stop instead of NULL filling the remaining columns.
+    */
+    if( z==0 && i==0 ) break;
+    /*
+    ** Did we reach end-of-file OR end-of-line before finding any
+    ** columns in ASCII mode?  If so, stop instead of NULL filling
+    ** the remaining columns.
+    */
+    if( bAscii && (z==0 || z[0]==0) && i==0 ) break;
+    /*
+    ** For CSV mode, per RFC 4180, accept EOF in lieu of final
+    ** record terminator but only for last field of multi-field row.
+    ** (If there are too few fields, it's not valid CSV anyway.)
+    */
+    if( z==0 && (xRead==csv_read_one_field) && i==nCol-1 && i>0 ){
+      z = "";
+    }
+    xValue(pArg, i, z);
+    if( i<nCol-1 && p->cTerm!=p->cColSep ){
+      import_warn(p, "%s:%d: expected %d columns but found %d"
+                  " - filling the rest with NULL\n",
+                  p->zFile, startLine, nCol, i+1);
+      i += 2;
+      while( i<=nCol ){ xValue(pArg, i-1, 0); i++; }
+    }
   }
-  return 1;
+  if( p->cTerm==p->cColSep ){
+    do{
+      xRead(p);
+      i++;
+    }while( p->cTerm==p->cColSep );
+    import_warn(p, "%s:%d: expected %d columns but found %d - extras ignored\n",
+                p->zFile, startLine, nCol, i);
+  }
+  return i>=nCol;
 }
-#endif
 
 /*
-** Try to deduce the type of file for zName based on its content.  Return
-** one of the SHELL_OPEN_* constants.
-**
-** If the file does not exist or is empty but its name looks like a ZIP
-** archive and the dfltZip flag is true, then assume it is a ZIP archive.
-** Otherwise, assume an ordinary database regardless of the filename if
-** the type cannot be determined from content.
+** If z is an integer with at most 18 significant digits, store it in
+** *piVal and return SQLITE_INTEGER.  If it is a decimal with at most 15
+** significant digits, store its correctly rounded value in *prVal and
+** return SQLITE_FLOAT.  Otherwise return SQLITE_TEXT.  Only an optional
+** sign, digits and an optional '.' are recognized, so anything else that
+** SQLite would read as a number, such as " 1" or "1e3", is left as text
+** for SQLite to convert.
 */
-int deduceDatabaseType(const char *zName, int dfltZip){
-  FILE *f = fopen(zName, "rb");
-  size_t n;
-  int rc = SHELL_OPEN_UNSPEC;
-  char zBuf[100];
-  if( f==0 ){
-    if( dfltZip && sqlite3_strlike("%.zip",zName,0)==0 ){
-       return SHELL_OPEN_ZIPFILE;
+static int import_number(const char *z, sqlite3_int64 *piVal, double *prVal){
+  static const double aPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  sqlite3_uint64 s = 0;
+  int bNeg = 0;
+  int bDigit = 0;
+  int nDigit = 0;               /* Significant digits */
+  int nFrac = -1;               /* Digits after the '.', or -1 if none */
+  if( *z=='-' ){
+    bNeg = 1;
+    z++;
+  }else if( *z=='+' ){
+    z++;
+  }
+  for(;; z++){
+    if( *z>='0' && *z<='9' ){
+      bDigit = 1;
+      if( s>0 || *z>'0' ){
+        if( ++nDigit>18 ) return SQLITE_TEXT;
+        s = s*10 + (*z - '0');
+      }
+      if( nFrac>=0 ) nFrac++;
+    }else if( *z=='.' && nFrac<0 ){
+      nFrac = 0;
     }else{
-       return SHELL_OPEN_NORMAL;
+      break;
     }
   }
-  n = fread(zBuf, 16, 1, f);
-  if( n==1 && memcmp(zBuf, "SQLite format 3", 16)==0 ){
-    fclose(f);
-    return SHELL_OPEN_NORMAL;
-  }
-  fseek(f, -25, SEEK_END);
-  n = fread(zBuf, 25, 1, f);
-  if( n==1 && memcmp(zBuf, "Start-Of-SQLite3-", 17)==0 ){
-    rc = SHELL_OPEN_APPENDVFS;
-  }else{
-    fseek(f, -22, SEEK_END);
-    n = fread(zBuf, 22, 1, f);
-    if( n==1 && zBuf[0]==0x50 && zBuf[1]==0x4b && zBuf[2]==0x05
-       && zBuf[3]==0x06 ){
-      rc = SHELL_OPEN_ZIPFILE;
-    }else if( n==0 && dfltZip && sqlite3_strlike("%.zip",zName,0)==0 ){
-      rc = SHELL_OPEN_ZIPFILE;
-    }
+  if( *z || !bDigit ) return SQLITE_TEXT;
+  if( nFrac<0 ){
+    *piVal = bNeg ? -(sqlite3_int64)s : (sqlite3_int64)s;
+    return SQLITE_INTEGER;
   }
-  fclose(f);
-  return rc;
+  if( nDigit>15 || nFrac>22 ) return SQLITE_TEXT;
+  /* Both operands are exact, so the quotient is correctly rounded */
+  *prVal = (double)s / aPow10[nFrac];
+  if( bNeg ) *prVal = -*prVal;
+  return SQLITE_FLOAT;
 }
 
-#ifndef SQLITE_OMIT_DESERIALIZE
 /*
-** Reconstruct an in-memory database using the output from the "dbtotxt"
-** program.  Read content from the file in p->aAuxDb[].zDbFilename.
-** If p->aAuxDb[].zDbFilename is 0, then read from standard input.
+** The affinity of a column with declared type zType, as used by
+** --typed: 'i' for INTEGER or NUMERIC, 'r' for REAL, or 't' for TEXT or
+** BLOB, whose values are always bound as text.
 */
-static unsigned char *readHexDb(ShellState *p, int *pnData){
-  unsigned char *a = 0;
-  int nLine;
-  int n = 0;
-  int pgsz = 0;
-  int iOffset = 0;
-  int j, k;
-  int rc;
-  FILE *in;
-  const char *zDbFilename = p->pAuxDb->zDbFilename;
-  unsigned int x[16];
-  char zLine[1000];
-  if( zDbFilename ){
-    in = fopen(zDbFilename, "r");
-    if( in==0 ){
-      eputf("cannot open \"%s\" for reading\n", zDbFilename);
-      return 0;
-    }
-    nLine = 0;
-  }else{
-    in = p->in;
-    nLine = p->lineno;
-    if( in==0 ) in = stdin;
+static char import_affinity(const char *zType){
+  if( zType==0 ) return 't';
+  if( sqlite3_strlike("%INT%", zType, 0)==0 ) return 'i';
+  if( sqlite3_strlike("%CHAR%", zType, 0)==0
+   || sqlite3_strlike("%CLOB%", zType, 0)==0
+   || sqlite3_strlike("%TEXT%", zType, 0)==0
+   || sqlite3_strlike("%BLOB%", zType, 0)==0
+   || zType[0]==0
+  ){
+    return 't';
   }
-  *pnData = 0;
-  nLine++;
-  if( fgets(zLine, sizeof(zLine), in)==0 ) goto readHexDb_error;
-  rc = sscanf(zLine, "| size %d pagesize %d", &n, &pgsz);
-  if( rc!=2 ) goto readHexDb_error;
-  if( n<0 ) goto readHexDb_error;
-  if( pgsz<512 || pgsz>65536 || (pgsz&(pgsz-1))!=0 ) goto readHexDb_error;
-  n = (n+pgsz-1)&~(pgsz-1);  /* Round n up to the next multiple of pgsz */
-  a = sqlite3_malloc( n ? n : 1 );
-  shell_check_oom(a);
-  memset(a, 0, n);
-  if( pgsz<512 || pgsz>65536 || (pgsz & (pgsz-1))!=0 ){
-    eputz("invalid pagesize\n");
-    goto readHexDb_error;
+  if( sqlite3_strlike("%REAL%", zType, 0)==0
+   || sqlite3_strlike("%FLOA%", zType, 0)==0
+   || sqlite3_strlike("%DOUB%", zType, 0)==0
+  ){
+    return 'r';
   }
-  for(nLine++; fgets(zLine, sizeof(zLine), in)!=0; nLine++){
-    rc = sscanf(zLine, "| page %d offset %d", &j, &k);
-    if( rc==2 ){
-      iOffset = k;
-      continue;
-    }
-    if( cli_strncmp(zLine, "| end ", 6)==0 ){
-      break;
-    }
-    rc = sscanf(zLine,"| %d: %x %x %x %x %x %x %x %x %x %x %x %x %x %x %x %x",
-                &j, &x[0], &x[1], &x[2], &x[3], &x[4], &x[5], &x[6], &x[7],
-                &x[8], &x[9], &x[10], &x[11], &x[12], &x[13], &x[14], &x[15]);
-    if( rc==17 ){
-      k = iOffset+j;
-      if( k+16<=n && k>=0 ){
-        int ii;
-        for(ii=0; ii<16; ii++) a[k+ii] = x[ii]&0xff;
-      }
-    }
+  return 'i';
+}
+
+/* A number converted from the text of an imported value */
+typedef union ImportNum ImportNum;
+union ImportNum {
+  sqlite3_int64 i;
+  double r;
+};
+
+/*
+** Decide how to bind the value z for a column of affinity cAff: return
+** SQLITE_NULL if z is NULL, SQLITE_INTEGER or SQLITE_FLOAT after setting
+** *pNum if the number stored is the same either way, or SQLITE_TEXT.
+*/
+static int import_convert(const char *z, char cAff, ImportNum *pNum){
+  if( z==0 ) return SQLITE_NULL;
+  if( cAff=='t' ) return SQLITE_TEXT;
+  switch( import_number(z, &pNum->i, &pNum->r) ){
+    case SQLITE_INTEGER:
+      if( cAff=='i' ) return SQLITE_INTEGER;
+      /* A REAL column converts integers to floating point, which is
+      ** exact up to 2**53 */
+      if( pNum->i>=-((sqlite3_int64)1<<53) && pNum->i<=((sqlite3_int64)1<<53) ){
+        pNum->r = (double)pNum->i;
+        return SQLITE_FLOAT;
+      }
+      return SQLITE_TEXT;
+    case SQLITE_FLOAT:
+      /* INTEGER and NUMERIC columns turn integral values back into
+      ** integers, as they do for text */
+      return SQLITE_FLOAT;
   }
-  *pnData = n;
-  if( in!=p->in ){
-    fclose(in);
-  }else{
-    p->lineno = nLine;
+  return SQLITE_TEXT;
+}
+
+/* Bind a value converted by import_convert() to parameter i of pStmt */
+static void import_bind(
+  sqlite3_stmt *pStmt,
+  int i,
+  const char *z,
+  int eType,
+  const ImportNum *pNum,
+  void (*xDel)(void*)
+){
+  switch( eType ){
+    case SQLITE_INTEGER: sqlite3_bind_int64(pStmt, i, pNum->i);    break;
+    case SQLITE_FLOAT:   sqlite3_bind_double(pStmt, i, pNum->r);   break;
+    default:             sqlite3_bind_text(pStmt, i, z, -1, xDel); break;
   }
-  return a;
+}
 
-readHexDb_error:
-  if( in!=p->in ){
-    fclose(in);
+/* The statement and column affinities used by import_bind_value() */
+typedef struct ImportBind ImportBind;
+struct ImportBind {
+  sqlite3_stmt *pStmt;          /* The INSERT statement */
+  const char *aAff;             /* Column affinities, or NULL for text */
+};
+
+/* An xValue callback for import_read_row() that binds to a statement */
+static void import_bind_value(void *pArg, int iCol, char *z){
+  ImportBind *pBind = (ImportBind*)pArg;
+  ImportNum num;
+  int eType = pBind->aAff ? import_convert(z, pBind->aAff[iCol], &num)
+                          : SQLITE_TEXT;
+  import_bind(pBind->pStmt, iCol+1, z, eType, &num, SQLITE_TRANSIENT);
+}
+
+/*
+** Insert the row bound to pStmt, counting it in p->nRow or p->nErr.
+** Return the result of sqlite3_reset().
+*/
+static int import_insert_row(
+  ImportCtx *p,
+  sqlite3 *db,
+  sqlite3_stmt *pStmt,
+  int startLine
+){
+  int rc;
+  sqlite3_step(pStmt);
+  rc = sqlite3_reset(pStmt);
+  if( rc!=SQLITE_OK ){
+    eputf("%s:%d: INSERT failed: %s\n",
+          p->zFile, startLine, sqlite3_errmsg(db));
+    p->nErr++;
   }else{
-    while( fgets(zLine, sizeof(zLine), p->in)!=0 ){
-      nLine++;
-      if(cli_strncmp(zLine, "| end ", 6)==0 ) break;
-    }
-    p->lineno = nLine;
+    p->nRow++;
   }
-  sqlite3_free(a);
-  eputf("Error on line %d of --hexdb input\n", nLine);
-  return 0;
+  if( p->nCommit>0 && ++p->nUncommitted>=p->nCommit ){
+    sqlite3_exec(db, "COMMIT", 0, 0, 0);
+    sqlite3_exec(db, "BEGIN", 0, 0, 0);
+    p->nUncommitted = 0;
+  }
+  return rc;
 }
-#endif /* SQLITE_OMIT_DESERIALIZE */
 
 /*
-** Scalar function "usleep(X)" invokes sqlite3_sleep(X) and returns X.
+** ".import --arrow" reads an Apache Arrow IPC stream, or an Arrow file,
+** which is a stream between "ARROW1" magic and a footer.  Only the types
+** that map directly onto SQLite values are read: Null, Bool, signed and
+** unsigned Int, single and double precision FloatingPoint, and Utf8 and
+** Binary with 32 or 64 bit offsets.  Dictionaries and compressed record
+** batches are not supported.  Every offset and size taken from the input
+** is checked before use, so damaged input ends the import with an error.
 */
-static void shellUSleepFunc(
-  sqlite3_context *context,
-  int argcUnused,
-  sqlite3_value **argv
-){
-  int sleep = sqlite3_value_int(argv[0]);
-  (void)argcUnused;
-  sqlite3_sleep(sleep/1000);
-  sqlite3_result_int(context, sleep);
+typedef struct ArrowField ArrowField;
+struct ArrowField {
+  char *zName;           /* Column name */
+  int eType;             /* ARROW_Null, ARROW_Int, ... */
+  int nBit;              /* Width of an Int or FloatingPoint */
+  int bSigned;           /* True for a signed Int */
+};
+
+/* The buffers of a column of the record batch being imported */
+typedef struct ArrowArray ArrowArray;
+struct ArrowArray {
+  const unsigned char *aValid;   /* Validity bitmap, or NULL if no NULLs */
+  const unsigned char *aVal;     /* Values, or offsets into aData[] */
+  const unsigned char *aData;    /* Bytes of Utf8 and Binary values */
+  i64 nData;                     /* Size of aData[] */
+};
+
+/* The state of import_arrow() */
+typedef struct ArrowReader ArrowReader;
+struct ArrowReader {
+  ImportCtx *pCtx;       /* The input */
+  ArrowBuf meta;         /* Metadata of the current message */
+  ArrowBuf body;         /* Body of the current message */
+  int eHdr;              /* ARROW_MSG_* type of the current message */
+  i64 iHdr;              /* Offset of its header table in meta.a[] */
+  int nField;            /* Number of columns */
+  ArrowField *aField;    /* The columns */
+  int nBatch;            /* Record batches read */
+  int iRow;              /* Rows read */
+  char *zErr;            /* Error message, or NULL */
+};
+
+/* Set the error message of r, unless there is one already */
+static void arrow_error(ArrowReader *r, const char *zFormat, ...){
+  if( r->zErr==0 ){
+    va_list ap;
+    va_start(ap, zFormat);
+    r->zErr = sqlite3_vmprintf(zFormat, ap);
+    va_end(ap);
+    shell_check_oom(r->zErr);
+  }
 }
 
-/* Flags for open_db().
-**
-** The default behavior of open_db() is to exit(1) if the database fails to
-** open.  The OPEN_DB_KEEPALIVE flag changes that so that it prints an error
-** but still returns without calling exit.
-**
-** The OPEN_DB_ZIPFILE flag causes open_db() to prefer to open files as a
-** ZIP archive if the file does not exist or is empty and its name matches
-** the *.zip pattern.
+/*
+** Return the offset of field iSlot, of nByte bytes, of the table at iTab
+** in the flatbuffer b, or 0 if the field is absent or out of bounds.
 */
-#define OPEN_DB_KEEPALIVE   0x001   /* Return after error if true */
-#define OPEN_DB_ZIPFILE     0x002   /* Open as ZIP if name matches *.zip */
+static i64 arrow_fb_field(const ArrowBuf *b, i64 iTab, int iSlot, int nByte){
+  i64 iVt;
+  int iOff;
+  if( iTab<0 || iTab+4>b->n ) return 0;
+  iVt = iTab - (int)arrow_get32(b->a+iTab);
+  if( iVt<0 || iVt+4>b->n ) return 0;
+  if( 4+2*iSlot+2>(int)arrow_get16(b->a+iVt) || iVt+4+2*iSlot+2>b->n ){
+    return 0;
+  }
+  iOff = arrow_get16(b->a+iVt+4+2*iSlot);
+  if( iOff==0 || iTab+iOff+nByte>b->n ) return 0;
+  return iTab+iOff;
+}
+
+/* The integer field iSlot of nByte bytes of a table, or iDefault */
+static i64 arrow_fb_int(const ArrowBuf *b, i64 iTab, int iSlot, int nByte,
+                        i64 iDefault){
+  i64 i = arrow_fb_field(b, iTab, iSlot, nByte);
+  if( i==0 ) return iDefault;
+  switch( nByte ){
+    case 1:  return b->a[i];
+    case 2:  return (short)arrow_get16(b->a+i);
+    case 4:  return (int)arrow_get32(b->a+i);
+    default: return (i64)arrow_get64(b->a+i);
+  }
+}
+
+/* The offset of the object that field iSlot of a table refers to, or -1 */
+static i64 arrow_fb_ref(const ArrowBuf *b, i64 iTab, int iSlot){
+  i64 i = arrow_fb_field(b, iTab, iSlot, 4);
+  if( i==0 ) return -1;
+  i += arrow_get32(b->a+i);
+  return i+4<=b->n ? i : -1;
+}
 
 /*
-** Make sure the database is open.  If it is not, then open it.  If
-** the database fails to open, print an error message and exit.
+** The offset of the first element of the vector at iVec, of elements of
+** szElem bytes, after setting *pnElem, or -1 if it is out of bounds.
 */
-static void open_db(ShellState *p, int openFlags){
-  if( p->db==0 ){
-    const char *zDbFilename = p->pAuxDb->zDbFilename;
-    if( p->openMode==SHELL_OPEN_UNSPEC ){
-      if( zDbFilename==0 || zDbFilename[0]==0 ){
-        p->openMode = SHELL_OPEN_NORMAL;
-      }else{
-        p->openMode = (u8)deduceDatabaseType(zDbFilename,
-                             (openFlags & OPEN_DB_ZIPFILE)!=0);
-      }
+static i64 arrow_fb_elements(const ArrowBuf *b, i64 iVec, int szElem,
+                             int *pnElem){
+  u32 nElem;
+  *pnElem = 0;
+  if( iVec<0 || iVec+4>b->n ) return -1;
+  nElem = arrow_get32(b->a+iVec);
+  if( nElem>0x7fffffff || (i64)nElem*szElem>b->n-iVec-4 ) return -1;
+  *pnElem = (int)nElem;
+  return iVec+4;
+}
+
+/* Read n bytes into b, growing it as they arrive.  Return 0 if short */
+static int arrow_read(ArrowReader *r, ArrowBuf *b, i64 n){
+  b->n = 0;
+  while( b->n<n ){
+    i64 nChunk = n - b->n;
+    i64 i;
+    /* A damaged size is found out before all of it is allocated */
+    if( nChunk>(1<<20) && nChunk>b->n ) nChunk = b->n>(1<<20) ? b->n : 1<<20;
+    i = arrow_space(b, nChunk);
+    if( (i64)fread(b->a+i, 1, (size_t)nChunk, r->pCtx->in)<nChunk ) return 0;
+  }
+  return 1;
+}
+
+/*
+** Read the next message into r.  Return 1 on success, or 0 at the end of
+** the stream or on an error, with r->zErr set.
+*/
+static int arrow_next_message(ArrowReader *r){
+  unsigned char a[8];
+  u32 nMeta;
+  i64 iMsg, nBody;
+  r->eHdr = 0;
+  r->iHdr = -1;
+  if( fread(a, 1, 4, r->pCtx->in)!=4 ) return 0;
+  if( r->nBatch==0 && r->nField==0 && memcmp(a, "ARRO", 4)==0 ){
+    /* The magic and padding at the start of an Arrow file */
+    if( fread(a, 1, 8, r->pCtx->in)!=8 || memcmp(a, "W1\0\0", 4)!=0 ){
+      arrow_error(r, "not an Arrow IPC stream or file");
+      return 0;
     }
-    switch( p->openMode ){
-      case SHELL_OPEN_APPENDVFS: {
-        sqlite3_open_v2(zDbFilename, &p->db,
-           SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|p->openFlags, "apndvfs");
-        break;
-      }
-      case SHELL_OPEN_HEXDB:
-      case SHELL_OPEN_DESERIALIZE: {
-        sqlite3_open(0, &p->db);
-        break;
-      }
-      case SHELL_OPEN_ZIPFILE: {
-        sqlite3_open(":memory:", &p->db);
+    memmove(a, a+4, 4);
+  }
+  nMeta = arrow_get32(a);
+  if( nMeta==0xffffffff ){
+    if( fread(a, 1, 4, r->pCtx->in)!=4 ) return 0;
+    nMeta = arrow_get32(a);
+  }
+  if( nMeta==0 ) return 0;
+  if( nMeta>(1<<30) || !arrow_read(r, &r->meta, nMeta) || nMeta<4 ){
+    arrow_error(r, "not an Arrow IPC stream, or truncated");
+    return 0;
+  }
+  iMsg = arrow_get32(r->meta.a);
+  if( arrow_fb_int(&r->meta, iMsg, 0, 2, 0)<ARROW_V4 ){
+    arrow_error(r, "unsupported Arrow metadata version");
+    return 0;
+  }
+  r->eHdr = (int)arrow_fb_int(&r->meta, iMsg, 1, 1, 0);
+  r->iHdr = arrow_fb_ref(&r->meta, iMsg, 2);
+  nBody = arrow_fb_int(&r->meta, iMsg, 3, 8, 0);
+  if( nBody<0 || !arrow_read(r, &r->body, nBody) ){
+    arrow_error(r, "truncated Arrow message");
+    return 0;
+  }
+  return 1;
+}
+
+/* Read the Schema message that starts the stream.  Return 0 on success */
+static int arrow_read_schema(ArrowReader *r){
+  const ArrowBuf *b = &r->meta;
+  i64 iFields;
+  int i, nField, nName;
+  if( !arrow_next_message(r) || r->eHdr!=ARROW_MSG_Schema || r->iHdr<0 ){
+    arrow_error(r, "not an Arrow IPC stream or file");
+    return 1;
+  }
+  if( arrow_fb_int(b, r->iHdr, 0, 2, 0)!=0 ){
+    arrow_error(r, "big-endian Arrow data is not supported");
+    return 1;
+  }
+  iFields = arrow_fb_elements(b, arrow_fb_ref(b, r->iHdr, 1), 4, &nField);
+  if( iFields<0 || nField==0 ){
+    arrow_error(r, "the Arrow schema has no columns");
+    return 1;
+  }
+  r->aField = sqlite3_malloc64(nField*sizeof(ArrowField));
+  shell_check_oom(r->aField);
+  memset(r->aField, 0, nField*sizeof(ArrowField));
+  r->nField = nField;
+  for(i=0; i<nField; i++){
+    ArrowField *pField = &r->aField[i];
+    i64 iField = iFields+i*4 + arrow_get32(b->a+iFields+i*4);
+    i64 iName = arrow_fb_elements(b, arrow_fb_ref(b, iField, 0), 1, &nName);
+    i64 iType = arrow_fb_ref(b, iField, 3);
+    if( iName>=0 && nName>0 ){
+      pField->zName = sqlite3_mprintf("%.*s", nName, b->a+iName);
+    }else{
+      pField->zName = sqlite3_mprintf("c%d", i+1);
+    }
+    shell_check_oom(pField->zName);
+    pField->eType = (int)arrow_fb_int(b, iField, 2, 1, 0);
+    if( arrow_fb_field(b, iField, 4, 4) ){
+      arrow_error(r, "column \"%s\": dictionaries are not supported",
+                  pField->zName);
+      return 1;
+    }
+    switch( pField->eType ){
+      case ARROW_Int: {
+        pField->nBit = (int)arrow_fb_int(b, iType, 0, 4, 0);
+        pField->bSigned = arrow_fb_int(b, iType, 1, 1, 0)!=0;
+        if( pField->nBit!=8 && pField->nBit!=16
+         && pField->nBit!=32 && pField->nBit!=64
+        ){
+          pField->eType = 0;
+        }
         break;
       }
-      case SHELL_OPEN_READONLY: {
-        sqlite3_open_v2(zDbFilename, &p->db,
-            SQLITE_OPEN_READONLY|p->openFlags, 0);
+      case ARROW_FloatingPoint: {
+        switch( arrow_fb_int(b, iType, 0, 2, 0) ){
+          case 1:  pField->nBit = 32;         break;
+          case 2:  pField->nBit = 64;         break;
+          default: pField->eType = 0;         break;
+        }
         break;
       }
-      case SHELL_OPEN_UNSPEC:
-      case SHELL_OPEN_NORMAL: {
-        sqlite3_open_v2(zDbFilename, &p->db,
-           SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|p->openFlags, 0);
+      case ARROW_Null:
+      case ARROW_Bool:
+      case ARROW_Binary:
+      case ARROW_Utf8:
+      case ARROW_LargeBinary:
+      case ARROW_LargeUtf8:
+        break;
+      default:
+        pField->eType = 0;
         break;
-      }
-    }
-    globalDb = p->db;
-    if( p->db==0 || SQLITE_OK!=sqlite3_errcode(p->db) ){
-      eputf("Error: unable to open database \"%s\": %s\n",
-            zDbFilename, sqlite3_errmsg(p->db));
-      if( (openFlags & OPEN_DB_KEEPALIVE)==0 ){
-        exit(1);
-      }
-      sqlite3_close(p->db);
-      sqlite3_open(":memory:", &p->db);
-      if( p->db==0 || SQLITE_OK!=sqlite3_errcode(p->db) ){
-        eputz("Also: unable to open substitute in-memory database.\n");
-        exit(1);
-      }else{
-        eputf("Notice: using substitute in-memory database instead of \"%s\"\n",
-              zDbFilename);
-      }
-    }
-    sqlite3_db_config(p->db, SQLITE_DBCONFIG_STMT_SCANSTATUS, (int)0, (int*)0);
-
-    /* Reflect the use or absence of --unsafe-testing invocation. */
-    {
-      int testmode_on = ShellHasFlag(p,SHFLG_TestingMode);
-      sqlite3_db_config(p->db, SQLITE_DBCONFIG_TRUSTED_SCHEMA, testmode_on,0);
-      sqlite3_db_config(p->db, SQLITE_DBCONFIG_DEFENSIVE, !testmode_on,0);
-    }
-
-#ifndef SQLITE_OMIT_LOAD_EXTENSION
-    sqlite3_enable_load_extension(p->db, 1);
-#endif
-    sqlite3_shathree_init(p->db, 0, 0);
-    sqlite3_uint_init(p->db, 0, 0);
-    sqlite3_decimal_init(p->db, 0, 0);
-    sqlite3_base64_init(p->db, 0, 0);
-    sqlite3_base85_init(p->db, 0, 0);
-    sqlite3_regexp_init(p->db, 0, 0);
-    sqlite3_ieee_init(p->db, 0, 0);
-    sqlite3_series_init(p->db, 0, 0);
-#ifndef SQLITE_SHELL_FIDDLE
-    sqlite3_fileio_init(p->db, 0, 0);
-    sqlite3_completion_init(p->db, 0, 0);
-#endif
-#ifdef SQLITE_HAVE_ZLIB
-    if( !p->bSafeModePersist ){
-      sqlite3_zipfile_init(p->db, 0, 0);
-      sqlite3_sqlar_init(p->db, 0, 0);
-    }
-#endif
-#ifdef SQLITE_SHELL_EXTFUNCS
-    /* Create a preprocessing mechanism for extensions to make
-     * their own provisions for being built into the shell.
-     * This is a short-span macro. See further below for usage.
-     */
-#define SHELL_SUB_MACRO(base, variant) base ## _ ## variant
-#define SHELL_SUBMACRO(base, variant) SHELL_SUB_MACRO(base, variant)
-    /* Let custom-included extensions get their ..._init() called.
-     * The WHATEVER_INIT( db, pzErrorMsg, pApi ) macro should cause
-     * the extension's sqlite3_*_init( db, pzErrorMsg, pApi )
-     * initialization routine to be called.
-     */
-    {
-      int irc = SHELL_SUBMACRO(SQLITE_SHELL_EXTFUNCS, INIT)(p->db);
-    /* Let custom-included extensions expose their functionality.
-     * The WHATEVER_EXPOSE( db, pzErrorMsg ) macro should cause
-     * the SQL functions, virtual tables, collating sequences or
-     * VFS's implemented by the extension to be registered.
-     */
-      if( irc==SQLITE_OK
-          || irc==SQLITE_OK_LOAD_PERMANENTLY ){
-        SHELL_SUBMACRO(SQLITE_SHELL_EXTFUNCS, EXPOSE)(p->db, 0);
-      }
-#undef SHELL_SUB_MACRO
-#undef SHELL_SUBMACRO
-    }
-#endif
-
-    sqlite3_create_function(p->db, "strtod", 1, SQLITE_UTF8, 0,
-                            shellStrtod, 0, 0);
-    sqlite3_create_function(p->db, "dtostr", 1, SQLITE_UTF8, 0,
-                            shellDtostr, 0, 0);
-    sqlite3_create_function(p->db, "dtostr", 2, SQLITE_UTF8, 0,
-                            shellDtostr, 0, 0);
-    sqlite3_create_function(p->db, "shell_add_schema", 3, SQLITE_UTF8, 0,
-                            shellAddSchemaName, 0, 0);
-    sqlite3_create_function(p->db, "shell_module_schema", 1, SQLITE_UTF8, 0,
-                            shellModuleSchema, 0, 0);
-    sqlite3_create_function(p->db, "shell_putsnl", 1, SQLITE_UTF8, p,
-                            shellPutsFunc, 0, 0);
-    sqlite3_create_function(p->db, "usleep",1,SQLITE_UTF8,0,
-                            shellUSleepFunc, 0, 0);
-#ifndef SQLITE_NOHAVE_SYSTEM
-    sqlite3_create_function(p->db, "edit", 1, SQLITE_UTF8, 0,
-                            editFunc, 0, 0);
-    sqlite3_create_function(p->db, "edit", 2, SQLITE_UTF8, 0,
-                            editFunc, 0, 0);
-#endif
-
-// Begin Android Add
-#ifndef NO_ANDROID_FUNCS
-    int err = register_localized_collators(p->db, "en_US", 0);
-    if (err != SQLITE_OK) {
-      fprintf(stderr, "register_localized_collators() failed\n");
-      exit(1);
-    }
-    err = register_android_functions(p->db, 0);
-    if (err != SQLITE_OK) {
-      fprintf(stderr, "register_android_functions() failed\n");
-      exit(1);
     }
-#endif
-// End Android Add
+    if( pField->eType==0 ){
+      arrow_error(r, "column \"%s\": unsupported Arrow type",
+                  pField->zName);
+      return 1;
+    }
+  }
+  return 0;
+}
 
-    if( p->openMode==SHELL_OPEN_ZIPFILE ){
-      char *zSql = sqlite3_mprintf(
-         "CREATE VIRTUAL TABLE zip USING zipfile(%Q);", zDbFilename);
-      shell_check_oom(zSql);
-      sqlite3_exec(p->db, zSql, 0, 0, 0);
-      sqlite3_free(zSql);
+/* Bind value iRow of column iCol.  Return non-zero if it is damaged */
+static int arrow_bind(
+  sqlite3_stmt *pStmt,
+  int iCol,
+  const ArrowField *pField,
+  const ArrowArray *pArray,
+  i64 iRow
+){
+  const unsigned char *a = pArray->aVal;
+  if( pField->eType==ARROW_Null
+   || (pArray->aValid && (pArray->aValid[iRow/8]&(1<<(iRow%8)))==0)
+  ){
+    sqlite3_bind_null(pStmt, iCol+1);
+    return 0;
+  }
+  switch( pField->eType ){
+    case ARROW_Int: {
+      int nByte = pField->nBit/8;
+      sqlite3_uint64 u = 0;
+      int k;
+      for(k=nByte-1; k>=0; k--) u = (u<<8) | a[iRow*nByte+k];
+      if( pField->bSigned && nByte<8 && (u>>(pField->nBit-1)) ){
+        u |= ~(sqlite3_uint64)0 << pField->nBit;
+      }
+      if( !pField->bSigned && (u>>63) ){
+        sqlite3_bind_double(pStmt, iCol+1, (double)u);
+      }else{
+        sqlite3_bind_int64(pStmt, iCol+1, (i64)u);
+      }
+      break;
     }
-#ifndef SQLITE_OMIT_DESERIALIZE
-    else
-    if( p->openMode==SHELL_OPEN_DESERIALIZE || p->openMode==SHELL_OPEN_HEXDB ){
-      int rc;
-      int nData = 0;
-      unsigned char *aData;
-      if( p->openMode==SHELL_OPEN_DESERIALIZE ){
-        aData = (unsigned char*)readFile(zDbFilename, &nData);
+    case ARROW_FloatingPoint: {
+      if( pField->nBit==32 ){
+        u32 u = arrow_get32(a+iRow*4);
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        sqlite3_bind_double(pStmt, iCol+1, f);
       }else{
-        aData = readHexDb(p, &nData);
+        sqlite3_uint64 u = arrow_get64(a+iRow*8);
+        double r;
+        memcpy(&r, &u, sizeof(r));
+        sqlite3_bind_double(pStmt, iCol+1, r);
       }
-      if( aData==0 ){
-        return;
+      break;
+    }
+    case ARROW_Bool: {
+      sqlite3_bind_int(pStmt, iCol+1, (a[iRow/8]>>(iRow%8))&1);
+      break;
+    }
+    default: {
+      i64 iStart, iEnd;
+      if( pField->eType==ARROW_LargeUtf8 || pField->eType==ARROW_LargeBinary ){
+        iStart = (i64)arrow_get64(a+iRow*8);
+        iEnd = (i64)arrow_get64(a+iRow*8+8);
+      }else{
+        iStart = (int)arrow_get32(a+iRow*4);
+        iEnd = (int)arrow_get32(a+iRow*4+4);
       }
-      rc = sqlite3_deserialize(p->db, "main", aData, nData, nData,
-                   SQLITE_DESERIALIZE_RESIZEABLE |
-                   SQLITE_DESERIALIZE_FREEONCLOSE);
-      if( rc ){
-        eputf("Error: sqlite3_deserialize() returns %d\n", rc);
+      if( iStart<0 || iEnd<iStart || iEnd>pArray->nData
+       || iEnd-iStart>0x7fffffff
+      ){
+        return 1;
       }
-      if( p->szMax>0 ){
-        sqlite3_file_control(p->db, "main", SQLITE_FCNTL_SIZE_LIMIT, &p->szMax);
+      if( pField->eType==ARROW_Utf8 || pField->eType==ARROW_LargeUtf8 ){
+        sqlite3_bind_text(pStmt, iCol+1, (const char*)pArray->aData+iStart,
+                          (int)(iEnd-iStart), SQLITE_STATIC);
+      }else{
+        sqlite3_bind_blob(pStmt, iCol+1, pArray->aData+iStart,
+                          (int)(iEnd-iStart), SQLITE_STATIC);
       }
+      break;
     }
-#endif
   }
-  if( p->db!=0 ){
-    if( p->bSafeModePersist ){
-      sqlite3_set_authorizer(p->db, safeModeAuth, p);
+  return 0;
+}
+
+/* Insert the rows of the RecordBatch message in r */
+static void arrow_insert_batch(ArrowReader *r, sqlite3 *db,
+                               sqlite3_stmt *pStmt){
+  const ArrowBuf *b = &r->meta;
+  ArrowArray *aArray;
+  i64 nRow, iNode, iBuf, iRow;
+  int nNode, nBuf, i, k = 0;
+  nRow = arrow_fb_int(b, r->iHdr, 0, 8, 0);
+  iNode = arrow_fb_elements(b, arrow_fb_ref(b, r->iHdr, 1), 16, &nNode);
+  iBuf = arrow_fb_elements(b, arrow_fb_ref(b, r->iHdr, 2), 16, &nBuf);
+  r->nBatch++;
+  if( arrow_fb_field(b, r->iHdr, 3, 4) ){
+    arrow_error(r, "compressed record batches are not supported");
+    return;
+  }
+  if( r->iHdr<0 || nRow<0 || nRow>0x7fffffff
+   || iNode<0 || iBuf<0 || nNode<r->nField
+  ){
+    arrow_error(r, "record batch %d is damaged", r->nBatch);
+    return;
+  }
+  aArray = sqlite3_malloc64(r->nField*sizeof(ArrowArray));
+  shell_check_oom(aArray);
+  memset(aArray, 0, r->nField*sizeof(ArrowArray));
+  for(i=0; i<r->nField; i++){
+    const ArrowField *pField = &r->aField[i];
+    i64 nLength = (i64)arrow_get64(b->a+iNode+i*16);
+    i64 nNull = (i64)arrow_get64(b->a+iNode+i*16+8);
+    const unsigned char *aPtr[3];
+    i64 aSize[3], nNeed;
+    int nArrayBuf, m;
+    switch( pField->eType ){
+      case ARROW_Null:                              nArrayBuf = 0;  break;
+      case ARROW_Int: case ARROW_FloatingPoint:
+      case ARROW_Bool:                              nArrayBuf = 2;  break;
+      default:                                      nArrayBuf = 3;  break;
+    }
+    if( nLength<nRow || k+nArrayBuf>nBuf ) break;
+    for(m=0; m<nArrayBuf; m++, k++){
+      i64 iOff = (i64)arrow_get64(b->a+iBuf+k*16);
+      aSize[m] = (i64)arrow_get64(b->a+iBuf+k*16+8);
+      if( iOff<0 || aSize[m]<0 || iOff>r->body.n || aSize[m]>r->body.n-iOff ){
+        break;
+      }
+      aPtr[m] = r->body.a+iOff;
     }
-    sqlite3_db_config(
-        p->db, SQLITE_DBCONFIG_STMT_SCANSTATUS, p->scanstatsOn, (int*)0
-    );
+    if( m<nArrayBuf ) break;
+    if( nArrayBuf==0 ) continue;
+    if( nNull>0 ){
+      if( aSize[0]<(nRow+7)/8 ) break;
+      aArray[i].aValid = aPtr[0];
+    }
+    switch( pField->eType ){
+      case ARROW_Int:
+      case ARROW_FloatingPoint:   nNeed = nRow*(pField->nBit/8);       break;
+      case ARROW_Bool:            nNeed = (nRow+7)/8;                  break;
+      case ARROW_LargeUtf8:
+      case ARROW_LargeBinary:     nNeed = nRow ? (nRow+1)*8 : 0;       break;
+      default:                    nNeed = nRow ? (nRow+1)*4 : 0;       break;
+    }
+    if( aSize[1]<nNeed ) break;
+    aArray[i].aVal = aPtr[1];
+    if( nArrayBuf==3 ){
+      aArray[i].aData = aPtr[2];
+      aArray[i].nData = aSize[2];
+    }
+  }
+  if( i<r->nField ){
+    arrow_error(r, "record batch %d is damaged", r->nBatch);
+  }
+  for(iRow=0; r->zErr==0 && iRow<nRow; iRow++){
+    for(i=0; i<r->nField; i++){
+      if( arrow_bind(pStmt, i, &r->aField[i], &aArray[i], iRow) ){
+        arrow_error(r, "record batch %d is damaged", r->nBatch);
+        break;
+      }
+    }
+    if( i==r->nField ) import_insert_row(r->pCtx, db, pStmt, ++r->iRow);
+  }
+  sqlite3_clear_bindings(pStmt);
+  sqlite3_free(aArray);
+}
+
+/* The column type of a new table for an Arrow column of type eType */
+static const char *arrow_sql_type(int eType){
+  switch( eType ){
+    case ARROW_Null:            return "";
+    case ARROW_Int:
+    case ARROW_Bool:            return " INTEGER";
+    case ARROW_FloatingPoint:   return " REAL";
+    case ARROW_Utf8:
+    case ARROW_LargeUtf8:       return " TEXT";
+    default:                    return " BLOB";
   }
 }
 
 /*
-** Attempt to close the database connection.  Report errors.
+** Import the Arrow stream in pCtx->in into table zFullTabName, which is
+** created with columns named and typed after the schema of the stream if
+** it does not exist.  Return non-zero on an error.
+**
+** The table is created in the same transaction, or savepoint if one is
+** open already, as the rows are inserted, and if the stream turns out
+** to be damaged or unsupported it is all rolled back.  Only the rows of
+** transactions already committed because of nCommit are kept then.
 */
-void close_db(sqlite3 *db){
-  int rc = sqlite3_close(db);
+static int import_arrow(
+  ShellState *p,
+  ImportCtx *pCtx,
+  const char *zFullTabName,
+  int nCommit,
+  int eVerbose
+){
+  ArrowReader r;
+  sqlite3_stmt *pStmt = 0;
+  sqlite3_str *pSql;
+  char *zSql;
+  int rc = 1;
+  int i, nCol;
+  int needCommit = sqlite3_get_autocommit(p->db);
+  int bTxn = 0;
+  memset(&r, 0, sizeof(r));
+  r.pCtx = pCtx;
+  if( arrow_read_schema(&r) ) goto import_arrow_end;
+  bTxn = sqlite3_exec(p->db, needCommit ? "BEGIN" : "SAVEPOINT import_arrow",
+                      0, 0, 0)==SQLITE_OK;
+  zSql = sqlite3_mprintf("SELECT * FROM %s", zFullTabName);
+  shell_check_oom(zSql);
+  rc = sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, 0);
+  if( rc && sqlite3_strglob("no such table: *", sqlite3_errmsg(p->db))==0 ){
+    char *zCreate;
+    pSql = sqlite3_str_new(0);
+    sqlite3_str_appendf(pSql, "CREATE TABLE %s(", zFullTabName);
+    for(i=0; i<r.nField; i++){
+      sqlite3_str_appendf(pSql, "%s\"%w\"%s", i ? ", " : "",
+                          r.aField[i].zName, arrow_sql_type(r.aField[i].eType));
+    }
+    sqlite3_str_appendall(pSql, ")");
+    zCreate = sqlite3_str_finish(pSql);
+    shell_check_oom(zCreate);
+    if( eVerbose>=1 ){
+      oputf("%s\n", zCreate);
+    }
+    rc = sqlite3_exec(p->db, zCreate, 0, 0, 0);
+    if( rc ){
+      eputf("%s failed:\n%s\n", zCreate, sqlite3_errmsg(p->db));
+      sqlite3_free(zCreate);
+      sqlite3_free(zSql);
+      goto import_arrow_end;
+    }
+    sqlite3_free(zCreate);
+    rc = sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, 0);
+  }
+  sqlite3_free(zSql);
   if( rc ){
-    eputf("Error: sqlite3_close() returns %d: %s\n", rc, sqlite3_errmsg(db));
+    eputf("Error: %s\n", sqlite3_errmsg(p->db));
+    goto import_arrow_end;
+  }
+  nCol = sqlite3_column_count(pStmt);
+  sqlite3_finalize(pStmt);
+  pStmt = 0;
+  if( nCol!=r.nField ){
+    eputf("Error: %s has %d columns but %s has %d\n",
+          zFullTabName, nCol, pCtx->zFile, r.nField);
+    rc = 1;
+    goto import_arrow_end;
+  }
+  pSql = sqlite3_str_new(0);
+  sqlite3_str_appendf(pSql, "INSERT INTO %s VALUES(?", zFullTabName);
+  for(i=1; i<nCol; i++) sqlite3_str_appendall(pSql, ",?");
+  sqlite3_str_appendall(pSql, ")");
+  zSql = sqlite3_str_finish(pSql);
+  shell_check_oom(zSql);
+  if( eVerbose>=2 ){
+    oputf("Insert using: %s\n", zSql);
+  }
+  rc = sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc ){
+    eputf("Error: %s\n", sqlite3_errmsg(p->db));
+    goto import_arrow_end;
+  }
+  if( needCommit ) pCtx->nCommit = nCommit;
+  while( r.zErr==0 && arrow_next_message(&r) ){
+    if( r.eHdr==ARROW_MSG_RecordBatch ){
+      arrow_insert_batch(&r, p->db, pStmt);
+    }else if( r.eHdr==ARROW_MSG_DictionaryBatch ){
+      arrow_error(&r, "dictionaries are not supported");
+    }
+  }
+  if( eVerbose>0 && r.zErr==0 ){
+    oputf("Added %d rows with %d errors from %d record batches\n",
+          pCtx->nRow, pCtx->nErr, r.nBatch);
+  }
+import_arrow_end:
+  if( r.zErr ){
+    eputf("%s: %s\n", pCtx->zFile, r.zErr);
+    rc = 1;
   }
+  sqlite3_finalize(pStmt);
+  if( bTxn && rc==0 ){
+    sqlite3_exec(p->db, needCommit ? "COMMIT" : "RELEASE import_arrow",
+                 0, 0, 0);
+  }else if( bTxn ){
+    sqlite3_exec(p->db, needCommit ? "ROLLBACK"
+                     : "ROLLBACK TO import_arrow; RELEASE import_arrow",
+                 0, 0, 0);
+  }
+  for(i=0; i<r.nField; i++) sqlite3_free(r.aField[i].zName);
+  sqlite3_free(r.aField);
+  sqlite3_free(r.meta.a);
+  sqlite3_free(r.body.a);
+  sqlite3_free(r.zErr);
+  return rc;
 }
 
-#if HAVE_READLINE || HAVE_EDITLINE
 /*
-** Readline completion callbacks
+** Set up pNew to read the n bytes of text in z[], which has one byte to
+** spare at the end, with the separators and file name of pFrom.
+** Diagnostics are collected in pNew->pMsg.
 */
-static char *readline_completion_generator(const char *text, int state){
-  static sqlite3_stmt *pStmt = 0;
-  char *zRet;
-  if( state==0 ){
-    char *zSql;
-    sqlite3_finalize(pStmt);
-    zSql = sqlite3_mprintf("SELECT DISTINCT candidate COLLATE nocase"
-                           "  FROM completion(%Q) ORDER BY 1", text);
-    shell_check_oom(zSql);
-    sqlite3_prepare_v2(globalDb, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
+static void import_open_text(
+  ImportCtx *pNew,
+  const ImportCtx *pFrom,
+  char *z,
+  i64 n,
+  int iLine,
+  int bNotFirst
+){
+  memset(pNew, 0, sizeof(*pNew));
+  pNew->zFile = pFrom->zFile;
+  pNew->cColSep = pFrom->cColSep;
+  pNew->cRowSep = pFrom->cRowSep;
+  pNew->nLine = iLine;
+  pNew->bNotFirst = bNotFirst;
+  pNew->zBuf = z;
+  pNew->nBuf = pNew->nBufAlloc = n;
+  pNew->bEof = 1;
+  pNew->pMsg = sqlite3_str_new(0);
+  import_append_char(pNew, 0);    /* To ensure pNew->z is allocated */
+}
+
+/* The types seen in the values of each column by import_infer_types() */
+typedef struct ImportSample ImportSample;
+struct ImportSample {
+  int *aRow;                    /* Type of each value in the current row */
+  int *aCol;                    /* Types seen so far in each column */
+};
+
+/* An xValue callback for import_read_row() that notes the value's type */
+static void import_sample_value(void *pArg, int iCol, char *z){
+  ImportSample *pSample = (ImportSample*)pArg;
+  ImportNum num;
+  pSample->aRow[iCol] = (z==0 || z[0]==0) ? 0 : import_number(z, &num.i, &num.r);
+}
+
+/*
+** Choose INTEGER, REAL or TEXT as the type of each of nCol columns
+** from the values in up to nSample rows at the start of the rest of the
+** input of p, without consuming them, and write it to azType[].  Only
+** rows within the first block of input are looked at.  NULL and empty
+** values do not count, and a column with no others is TEXT.
+*/
+static void import_infer_types(
+  ImportCtx *p,                            /* Input */
+  char *(SQLITE_CDECL *xRead)(ImportCtx*), /* Func to read one value */
+  int nCol,                                /* Number of columns */
+  int bAscii,                              /* True for .mode ascii */
+  int nSample,                             /* Number of rows to look at */
+  const char **azType                      /* OUT: Type of each column */
+){
+  ImportCtx sIn;
+  ImportSample sSample;
+  char *z;
+  i64 n;
+  int i, iRow, iLine;
+  p->iMark = p->iBuf;
+  while( p->nBuf-p->iBuf<IMPORT_BLOCK_SIZE && import_fill(p)>0 ){}
+  n = p->nBuf - p->iBuf;
+  z = sqlite3_malloc64(n+1);
+  sSample.aRow = sqlite3_malloc64(2*nCol*sizeof(int));
+  shell_check_oom(z);
+  shell_check_oom(sSample.aRow);
+  memcpy(z, p->zBuf+p->iBuf, n);
+  sSample.aCol = &sSample.aRow[nCol];
+  memset(sSample.aCol, 0, nCol*sizeof(int));
+  import_open_text(&sIn, p, z, n, p->nLine, p->bNotFirst);
+  for(iRow=0; iRow<nSample && sIn.cTerm!=EOF; iRow++){
+    memset(sSample.aRow, 0, nCol*sizeof(int));
+    import_read_row(&sIn, xRead, nCol, bAscii, import_sample_value, &sSample,
+                    &iLine);
+    /* The last row may have been cut short by the end of the block */
+    if( sIn.cTerm==EOF && !p->bEof ) break;
+    for(i=0; i<nCol; i++){
+      int a = sSample.aCol[i], b = sSample.aRow[i];
+      if( a==SQLITE_TEXT || b==SQLITE_TEXT ){
+        sSample.aCol[i] = SQLITE_TEXT;
+      }else if( a==SQLITE_FLOAT || b==SQLITE_FLOAT ){
+        sSample.aCol[i] = SQLITE_FLOAT;
+      }else if( b ){
+        sSample.aCol[i] = b;
+      }
+    }
   }
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    const char *z = (const char*)sqlite3_column_text(pStmt,0);
-    zRet = z ? strdup(z) : 0;
-  }else{
-    sqlite3_finalize(pStmt);
-    pStmt = 0;
-    zRet = 0;
+  for(i=0; i<nCol; i++){
+    switch( sSample.aCol[i] ){
+      case SQLITE_INTEGER: azType[i] = "INTEGER"; break;
+      case SQLITE_FLOAT:   azType[i] = "REAL";    break;
+      default:             azType[i] = "TEXT";    break;
+    }
   }
-  return zRet;
-}
-static char **readline_completion(const char *zText, int iStart, int iEnd){
-  (void)iStart;
-  (void)iEnd;
-  rl_attempted_completion_over = 1;
-  return rl_completion_matches(zText, readline_completion_generator);
+  sqlite3_free(sqlite3_str_finish(sIn.pMsg));
+  sqlite3_free(sIn.z);
+  sqlite3_free(sSample.aRow);
+  sqlite3_free(z);
 }
 
-#elif HAVE_LINENOISE
 /*
-** Linenoise completion callback
+** Return a copy of zColDefs, a column list from zAutoColumn() in which
+** every column is declared TEXT, with the i-th column declared as
+** azType[i] instead.  zColDefs is freed.
 */
-static void linenoise_completion(const char *zLine, linenoiseCompletions *lc){
-  i64 nLine = strlen(zLine);
-  i64 i, iStart;
-  sqlite3_stmt *pStmt = 0;
-  char *zSql;
-  char zBuf[1000];
-
-  if( nLine>(i64)sizeof(zBuf)-30 ) return;
-  if( zLine[0]=='.' || zLine[0]=='#') return;
-  for(i=nLine-1; i>=0 && (isalnum(zLine[i]) || zLine[i]=='_'); i--){}
-  if( i==nLine-1 ) return;
-  iStart = i+1;
-  memcpy(zBuf, zLine, iStart);
-  zSql = sqlite3_mprintf("SELECT DISTINCT candidate COLLATE nocase"
-                         "  FROM completion(%Q,%Q) ORDER BY 1",
-                         &zLine[iStart], zLine);
-  shell_check_oom(zSql);
-  sqlite3_prepare_v2(globalDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  sqlite3_exec(globalDb, "PRAGMA page_count", 0, 0, 0); /* Load the schema */
-  while( sqlite3_step(pStmt)==SQLITE_ROW ){
-    const char *zCompletion = (const char*)sqlite3_column_text(pStmt, 0);
-    int nCompletion = sqlite3_column_bytes(pStmt, 0);
-    if( iStart+nCompletion < (i64)sizeof(zBuf)-1 && zCompletion ){
-      memcpy(zBuf+iStart, zCompletion, nCompletion+1);
-      linenoiseAddCompletion(lc, zBuf);
+static char *import_retype_columns(char *zColDefs, const char **azType,
+                                   int nCol){
+  sqlite3_str *pOut = sqlite3_str_new(0);
+  const char *z = zColDefs;
+  char *zOut;
+  int i = 0;
+  while( *z ){
+    if( *z=='"' ){
+      const char *zName = z++;
+      while( *z ){
+        if( *z++=='"' ){
+          if( *z!='"' ) break;
+          z++;
+        }
+      }
+      sqlite3_str_append(pOut, zName, (int)(z-zName));
+      if( i<nCol && strncmp(z, " TEXT", 5)==0 ){
+        sqlite3_str_appendf(pOut, " %s", azType[i++]);
+        z += 5;
+      }
+    }else{
+      sqlite3_str_appendchar(pOut, 1, *z++);
     }
   }
-  sqlite3_finalize(pStmt);
+  sqlite3_free(zColDefs);
+  zOut = sqlite3_str_finish(pOut);
+  shell_check_oom(zOut);
+  return zOut;
 }
-#endif
 
+#ifdef SHELL_THREADS
 /*
-** Do C-language style dequoting.
-**
-**    \a    -> alarm
-**    \b    -> backspace
-**    \t    -> tab
-**    \n    -> newline
-**    \v    -> vertical tab
-**    \f    -> form feed
-**    \r    -> carriage return
-**    \s    -> space
-**    \"    -> "
-**    \'    -> '
-**    \\    -> backslash
-**    \NNN  -> ascii character NNN in octal
-**    \xHH  -> ascii character HH in hexadecimal
+** ".import --threads N" cuts the input into chunks of whole records on
+** whichever of N worker threads is free, parses each chunk into an
+** ImportBatch on that thread, and inserts the batches in input order on
+** the calling thread.  Diagnostics are collected with each batch and
+** printed as its rows are inserted, so the output matches a serial
+** import.
 */
-static void resolve_backslashes(char *z){
-  int i, j;
-  char c;
-  while( *z && *z!='\\' ) z++;
-  for(i=j=0; (c = z[i])!=0; i++, j++){
-    if( c=='\\' && z[i+1]!=0 ){
-      c = z[++i];
-      if( c=='a' ){
-        c = '\a';
-      }else if( c=='b' ){
-        c = '\b';
-      }else if( c=='t' ){
-        c = '\t';
-      }else if( c=='n' ){
-        c = '\n';
-      }else if( c=='v' ){
-        c = '\v';
-      }else if( c=='f' ){
-        c = '\f';
-      }else if( c=='r' ){
-        c = '\r';
-      }else if( c=='"' ){
-        c = '"';
-      }else if( c=='\'' ){
-        c = '\'';
-      }else if( c=='\\' ){
-        c = '\\';
-      }else if( c=='x' ){
-        int nhd = 0, hdv;
-        u8 hv = 0;
-        while( nhd<2 && (c=z[i+1+nhd])!=0 && (hdv=hexDigitValue(c))>=0 ){
-          hv = (u8)((hv<<4)|hdv);
-          ++nhd;
-        }
-        i += nhd;
-        c = (u8)hv;
-      }else if( c>='0' && c<='7' ){
-        c -= '0';
-        if( z[i+1]>='0' && z[i+1]<='7' ){
-          i++;
-          c = (c<<3) + z[i] - '0';
-          if( z[i+1]>='0' && z[i+1]<='7' ){
-            i++;
-            c = (c<<3) + z[i] - '0';
-          }
+#define IMPORT_CHUNK_SIZE (1024*1024)
+
+/* Skip one field of input, counting row separators in p->nLine.  Return
+** the character that terminates it, as csv_read_one_field() or
+** ascii_read_one_field() would. */
+static int import_skip_field(ImportCtx *p, int bCsv){
+  int cSep = (u8)p->cColSep;
+  int rSep = (u8)p->cRowSep;
+  int c = import_getc(p);
+  if( c==EOF ) return EOF;
+  if( bCsv && c=='"' ){
+    int pc = 0, ppc = 0;
+    while( 1 ){
+      if( pc!='"' ){
+        i64 i = p->iBuf;
+        i64 j = import_find2(p->zBuf, i, p->nBuf, '"', (char)rSep);
+        if( j>i ){
+          ppc = j-i>=2 ? (u8)p->zBuf[j-2] : pc;
+          pc = (u8)p->zBuf[j-1];
+          p->iBuf = j;
+          continue;
         }
       }
+      c = import_getc(p);
+      if( c==rSep ) p->nLine++;
+      if( c=='"' && pc=='"' ){
+        pc = 0;
+        continue;
+      }
+      if( (c==cSep && pc=='"')
+       || (c==rSep && pc=='"')
+       || (c==rSep && pc=='\r' && ppc=='"')
+       || c==EOF
+      ){
+        return c;
+      }
+      ppc = pc;
+      pc = c;
     }
-    z[j] = c;
   }
-  if( j<i ) z[j] = 0;
+  while( c!=cSep && c!=rSep ){
+    i64 j = import_find2(p->zBuf, p->iBuf, p->nBuf, (char)cSep, (char)rSep);
+    if( j<p->nBuf ){
+      c = (u8)p->zBuf[j];
+      p->iBuf = j+1;
+      break;
+    }
+    p->iBuf = j;
+    if( import_fill(p)==0 ) return EOF;
+  }
+  if( c==rSep ) p->nLine++;
+  return c;
 }
 
 /*
-** Interpret zArg as either an integer or a boolean value.  Return 1 or 0
-** for TRUE and FALSE.  Return the integer value if appropriate.
+** Cut whole records from the input of p, at least nMin bytes of them
+** unless the input ends first.  Return them in a buffer from
+** sqlite3_malloc64() with one byte to spare at the end, and set *pn to
+** their size, or return NULL at end-of-input.  p->nLine is advanced past
+** them.
 */
-static int booleanValue(const char *zArg){
-  int i;
-  if( zArg[0]=='0' && zArg[1]=='x' ){
-    for(i=2; hexDigitValue(zArg[i])>=0; i++){}
-  }else{
-    for(i=0; zArg[i]>='0' && zArg[i]<='9'; i++){}
+static char *import_cut_records(ImportCtx *p, int bCsv, i64 nMin, i64 *pn){
+  int rSep = (u8)p->cRowSep;
+  char *z;
+  i64 n;
+  p->iMark = p->iBuf;
+  if( p->iBuf>=p->nBuf ) import_fill(p);
+  if( p->iBuf>=p->nBuf || seenInterrupt ) return 0;
+  if( bCsv && p->bNotFirst==0 ){
+    /* Step over a UTF-8 BOM, which csv_read_one_field() will skip */
+    while( p->nBuf-p->iBuf<3 && import_fill(p)>0 ){}
+    if( p->nBuf-p->iBuf>=3 && memcmp(p->zBuf+p->iBuf, "\xef\xbb\xbf", 3)==0 ){
+      p->iBuf += 3;
+    }
   }
-  if( i>0 && zArg[i]==0 ) return (int)(integerValue(zArg) & 0xffffffff);
-  if( sqlite3_stricmp(zArg, "on")==0 || sqlite3_stricmp(zArg,"yes")==0 ){
-    return 1;
+  p->bNotFirst = 1;
+  while( 1 ){
+    int c = import_skip_field(p, bCsv);
+    if( c==EOF ) break;
+    if( c==rSep && p->iBuf-p->iMark>=nMin ) break;
   }
-  if( sqlite3_stricmp(zArg, "off")==0 || sqlite3_stricmp(zArg,"no")==0 ){
-    return 0;
+  n = p->iBuf - p->iMark;
+  z = sqlite3_malloc64(n+1);
+  shell_check_oom(z);
+  memcpy(z, p->zBuf+p->iMark, n);
+  *pn = n;
+  return z;
+}
+
+/* The rows parsed from one chunk of input */
+typedef struct ImportBatch ImportBatch;
+struct ImportBatch {
+  ImportCtx *pIn;     /* Context reading zChunk[], while parsing */
+  const char *aAff;   /* Column affinities if typed, or NULL */
+  char *zChunk;       /* The input text, which values point into */
+  int nCol;           /* Number of values per row */
+  int nRow;           /* Number of rows */
+  int nRowAlloc;      /* Space allocated for rows */
+  char **azVal;       /* nCol values per row, NULL for SQL NULL */
+  u8 *aeType;         /* How to bind each value, if typed */
+  ImportNum *aNum;    /* The number to bind for each value, if typed */
+  int *aiLine;        /* Line each row starts on */
+  int *aiMsg;         /* End of the diagnostics for each row in zMsg[] */
+  u8 *abInsert;       /* True for each row that should be inserted */
+  char *zMsg;         /* Diagnostics for all rows, or NULL */
+};
+
+/* An xValue callback for import_read_row() that stores to an ImportBatch */
+static void import_batch_value(void *pArg, int iCol, char *z){
+  ImportBatch *pBatch = (ImportBatch*)pArg;
+  ImportCtx *pIn = pBatch->pIn;
+  if( z!=0 && z==pIn->z ){
+    /* A quoted field, decoded into pIn->z.  It fits in the input it was
+    ** decoded from, which ends just before zBuf[iBuf]. */
+    char *zDest = pIn->zBuf + pIn->iBuf - (pIn->n+1);
+    memcpy(zDest, z, pIn->n+1);
+    z = zDest;
+  }
+  pBatch->azVal[pBatch->nRow*pBatch->nCol + iCol] = z;
+  if( pBatch->aAff ){
+    int iVal = pBatch->nRow*pBatch->nCol + iCol;
+    pBatch->aeType[iVal] = (u8)import_convert(z, pBatch->aAff[iCol],
+                                              &pBatch->aNum[iVal]);
+  }
+}
+
+static void import_batch_free(ImportBatch *pBatch){
+  if( pBatch ){
+    sqlite3_free(pBatch->zChunk);
+    sqlite3_free(pBatch->azVal);
+    sqlite3_free(pBatch->aeType);
+    sqlite3_free(pBatch->aNum);
+    sqlite3_free(pBatch->aiLine);
+    sqlite3_free(pBatch->aiMsg);
+    sqlite3_free(pBatch->abInsert);
+    sqlite3_free(pBatch->zMsg);
+    sqlite3_free(pBatch);
+  }
+}
+
+/* State shared by the threads of an ".import --threads N" */
+typedef struct ImportPool ImportPool;
+struct ImportPool {
+  ImportCtx *pIn;           /* Input being cut into chunks */
+  char *(SQLITE_CDECL *xRead)(ImportCtx*); /* Func to read one value */
+  int nCol;                 /* Number of columns in the table */
+  int bAscii;               /* True for .mode ascii */
+  pthread_mutex_t mutex;    /* Protects pIn and the fields below */
+  pthread_cond_t cond;      /* Broadcast when any of them change */
+  i64 iCut;                 /* Sequence number of the next chunk to cut */
+  i64 iWrite;               /* Sequence number of the next batch to write */
+  int bDone;                /* True once all input has been cut */
+  int nSlot;                /* Number of entries in apBatch[] */
+  ImportBatch **apBatch;    /* Parsed batches, by sequence number % nSlot */
+};
+
+/* Parse a chunk of whole records that starts on line iLine */
+static ImportBatch *import_parse_chunk(
+  ImportPool *pPool,
+  char *zChunk,
+  i64 nChunk,
+  int iLine,
+  int bNotFirst
+){
+  ImportCtx sIn;
+  ImportBatch *pBatch = sqlite3_malloc64(sizeof(*pBatch));
+  shell_check_oom(pBatch);
+  memset(pBatch, 0, sizeof(*pBatch));
+  import_open_text(&sIn, pPool->pIn, zChunk, nChunk, iLine, bNotFirst);
+  pBatch->pIn = &sIn;
+  pBatch->aAff = pPool->pIn->aAff;
+  pBatch->zChunk = zChunk;
+  pBatch->nCol = pPool->nCol;
+  do{
+    if( pBatch->nRow>=pBatch->nRowAlloc ){
+      i64 nNew = 2*(i64)pBatch->nRowAlloc + 64;
+      pBatch->azVal = sqlite3_realloc64(pBatch->azVal,
+                                   nNew*pBatch->nCol*sizeof(char*));
+      pBatch->aiLine = sqlite3_realloc64(pBatch->aiLine, nNew*sizeof(int));
+      pBatch->aiMsg = sqlite3_realloc64(pBatch->aiMsg, nNew*sizeof(int));
+      pBatch->abInsert = sqlite3_realloc64(pBatch->abInsert, nNew);
+      shell_check_oom(pBatch->azVal);
+      shell_check_oom(pBatch->aiLine);
+      shell_check_oom(pBatch->aiMsg);
+      shell_check_oom(pBatch->abInsert);
+      if( pBatch->aAff ){
+        pBatch->aeType = sqlite3_realloc64(pBatch->aeType, nNew*pBatch->nCol);
+        pBatch->aNum = sqlite3_realloc64(pBatch->aNum,
+                                         nNew*pBatch->nCol*sizeof(ImportNum));
+        shell_check_oom(pBatch->aeType);
+        shell_check_oom(pBatch->aNum);
+      }
+      pBatch->nRowAlloc = (int)nNew;
+    }
+    memset(&pBatch->azVal[pBatch->nRow*pBatch->nCol], 0,
+           pBatch->nCol*sizeof(char*));
+    pBatch->abInsert[pBatch->nRow] = (u8)import_read_row(&sIn, pPool->xRead,
+        pBatch->nCol, pPool->bAscii, import_batch_value, pBatch,
+        &pBatch->aiLine[pBatch->nRow]);
+    pBatch->aiMsg[pBatch->nRow] = sqlite3_str_length(sIn.pMsg);
+    pBatch->nRow++;
+  }while( sIn.cTerm!=EOF );
+  pBatch->zMsg = sqlite3_str_finish(sIn.pMsg);
+  pBatch->pIn = 0;
+  sqlite3_free(sIn.z);
+  return pBatch;
+}
+
+/* The body of each worker thread */
+static void *import_worker(void *pArg){
+  ImportPool *pPool = (ImportPool*)pArg;
+  ImportCtx *pIn = pPool->pIn;
+  pthread_mutex_lock(&pPool->mutex);
+  while( 1 ){
+    i64 iSeq, nChunk;
+    int iLine, bNotFirst;
+    char *zChunk;
+    ImportBatch *pBatch;
+    while( !pPool->bDone && pPool->iCut>=pPool->iWrite+pPool->nSlot ){
+      pthread_cond_wait(&pPool->cond, &pPool->mutex);
+    }
+    if( pPool->bDone ) break;
+    iLine = pIn->nLine;
+    bNotFirst = pIn->bNotFirst;
+    zChunk = import_cut_records(pIn, pPool->xRead==csv_read_one_field,
+                                IMPORT_CHUNK_SIZE, &nChunk);
+    if( zChunk==0 ){
+      pPool->bDone = 1;
+      pthread_cond_broadcast(&pPool->cond);
+      break;
+    }
+    iSeq = pPool->iCut++;
+    pthread_mutex_unlock(&pPool->mutex);
+    pBatch = import_parse_chunk(pPool, zChunk, nChunk, iLine, bNotFirst);
+    pthread_mutex_lock(&pPool->mutex);
+    pPool->apBatch[iSeq % pPool->nSlot] = pBatch;
+    pthread_cond_broadcast(&pPool->cond);
   }
-  eputf("ERROR: Not a boolean value: \"%s\". Assuming \"no\".\n", zArg);
+  pthread_mutex_unlock(&pPool->mutex);
   return 0;
 }
 
 /*
-** Set or clear a shell flag according to a boolean value.
+** Import the rest of the input of p into pStmt using nThread worker
+** threads.  Return 0 if no thread could be started, in which case
+** nothing has been read, or 1 after setting *pRc to the result of the
+** last insert.
 */
-static void setOrClearFlag(ShellState *p, unsigned mFlag, const char *zArg){
-  if( booleanValue(zArg) ){
-    ShellSetFlag(p, mFlag);
+static int import_with_threads(
+  ImportCtx *p,                            /* Input */
+  char *(SQLITE_CDECL *xRead)(ImportCtx*), /* Func to read one value */
+  int nCol,                                /* Number of columns */
+  int bAscii,                              /* True for .mode ascii */
+  int nThread,                             /* Number of worker threads */
+  sqlite3 *db,                             /* Database being imported to */
+  sqlite3_stmt *pStmt,                     /* The INSERT statement */
+  int *pRc                                 /* OUT: Result of last insert */
+){
+  ImportPool sPool;
+  pthread_t *aThread;
+  int nStarted = 0;
+  int i;
+  i64 iSeq;
+  memset(&sPool, 0, sizeof(sPool));
+  sPool.pIn = p;
+  sPool.xRead = xRead;
+  sPool.nCol = nCol;
+  sPool.bAscii = bAscii;
+  sPool.nSlot = 2*nThread;
+  sPool.apBatch = sqlite3_malloc64(sPool.nSlot*sizeof(ImportBatch*));
+  aThread = sqlite3_malloc64(nThread*sizeof(pthread_t));
+  shell_check_oom(sPool.apBatch);
+  shell_check_oom(aThread);
+  memset(sPool.apBatch, 0, sPool.nSlot*sizeof(ImportBatch*));
+  pthread_mutex_init(&sPool.mutex, 0);
+  pthread_cond_init(&sPool.cond, 0);
+  for(i=0; i<nThread; i++){
+    if( pthread_create(&aThread[nStarted], 0, import_worker, &sPool)==0 ){
+      nStarted++;
+    }
+  }
+  for(iSeq=0; nStarted>0; iSeq++){
+    ImportBatch *pBatch;
+    const char *zMsg;
+    int iMsg = 0;
+    int r;
+    pthread_mutex_lock(&sPool.mutex);
+    while( (pBatch = sPool.apBatch[iSeq % sPool.nSlot])==0
+        && !(sPool.bDone && iSeq>=sPool.iCut)
+    ){
+      pthread_cond_wait(&sPool.cond, &sPool.mutex);
+    }
+    sPool.apBatch[iSeq % sPool.nSlot] = 0;
+    sPool.iWrite = iSeq+1;
+    pthread_cond_broadcast(&sPool.cond);
+    pthread_mutex_unlock(&sPool.mutex);
+    if( pBatch==0 ) break;
+    zMsg = pBatch->zMsg ? pBatch->zMsg : "";
+    for(r=0; r<pBatch->nRow && !seenInterrupt; r++){
+      char **azVal = &pBatch->azVal[r*nCol];
+      if( pBatch->aiMsg[r]>iMsg ){
+        eputf("%.*s", pBatch->aiMsg[r]-iMsg, zMsg+iMsg);
+        iMsg = pBatch->aiMsg[r];
+      }
+      if( pBatch->abInsert[r] ){
+        for(i=0; i<nCol; i++){
+          int iVal = r*nCol + i;
+          import_bind(pStmt, i+1, azVal[i],
+                      pBatch->aeType ? pBatch->aeType[iVal] : SQLITE_TEXT,
+                      pBatch->aNum ? &pBatch->aNum[iVal] : 0, SQLITE_STATIC);
+        }
+        *pRc = import_insert_row(p, db, pStmt, pBatch->aiLine[r]);
+      }
+    }
+    import_batch_free(pBatch);
+  }
+  for(i=0; i<nStarted; i++){
+    pthread_join(aThread[i], 0);
+  }
+  for(i=0; i<sPool.nSlot; i++){
+    import_batch_free(sPool.apBatch[i]);
+  }
+  pthread_cond_destroy(&sPool.cond);
+  pthread_mutex_destroy(&sPool.mutex);
+  sqlite3_free(sPool.apBatch);
+  sqlite3_free(aThread);
+  return nStarted>0;
+}
+#endif /* SHELL_THREADS */
+// End Android Add
+/* Read a single field of CSV text.  Compatible with rfc4180 and extended
+** with the option of having a separator other than ",".
+**
+**   +  Input comes from p->in.
+**   +  Store results in p->z of length p->n.  Space to hold p->z comes
+**      from sqlite3_malloc64().
+**   +  Use p->cSep as the column separator.  The default is ",".
+**   +  Use p->rSep as the row separator.  The default is "\n".
+**   +  Keep track of the line number in p->nLine.
+**   +  Store the character that terminates the field in p->cTerm.  Store
+**      EOF on end-of-file.
+**   +  Report syntax errors on stderr
+*/
+// Begin Android Add
+/* Unquoted fields are instead returned in place within p->zBuf.  Either
+** way, the text is only valid until the next call.
+*/
+// End Android Add
+static char *SQLITE_CDECL csv_read_one_field(ImportCtx *p){
+  int c;
+  int cSep = (u8)p->cColSep;
+  int rSep = (u8)p->cRowSep;
+  p->n = 0;
+// Begin Android Add
+  p->iMark = p->iBuf;
+  if( p->iBuf>=p->nBuf ) import_fill(p);
+  c = p->iBuf<p->nBuf ? (u8)p->zBuf[p->iBuf] : EOF;
+// End Android Add
+  if( c==EOF || seenInterrupt ){
+    p->cTerm = EOF;
+    return 0;
+  }
+  if( c=='"' ){
+    int pc, ppc;
+    int startLine = p->nLine;
+    int cQuote = c;
+    pc = ppc = 0;
+// Begin Android Add
+    p->iBuf++;
+// End Android Add
+    while( 1 ){
+// Begin Android Add
+      /* Copy a run of bytes that cannot end the field in one go */
+      if( pc!=cQuote ){
+        i64 i = p->iBuf;
+        i64 j = import_find2(p->zBuf, i, p->nBuf, (char)cQuote, (char)rSep);
+        if( j>i ){
+          import_append_text(p, p->zBuf+i, j-i);
+          ppc = j-i>=2 ? (u8)p->zBuf[j-2] : pc;
+          pc = (u8)p->zBuf[j-1];
+          p->iBuf = j;
+          continue;
+        }
+      }
+      p->iMark = p->iBuf;
+      c = import_getc(p);
+// End Android Add
+      if( c==rSep ) p->nLine++;
+      if( c==cQuote ){
+        if( pc==cQuote ){
+          pc = 0;
+          continue;
+        }
+      }
+      if( (c==cSep && pc==cQuote)
+       || (c==rSep && pc==cQuote)
+       || (c==rSep && pc=='\r' && ppc==cQuote)
+       || (c==EOF && pc==cQuote)
+      ){
+        do{ p->n--; }while( p->z[p->n]!=cQuote );
+        p->cTerm = c;
+        break;
+      }
+      if( pc==cQuote && c!='\r' ){
+// Begin Android Add
+        import_warn(p, "%s:%d: unescaped %c character\n",
+                    p->zFile, p->nLine, cQuote);
+// End Android Add
+      }
+      if( c==EOF ){
+// Begin Android Add
+        import_warn(p, "%s:%d: unterminated %c-quoted field\n",
+                    p->zFile, startLine, cQuote);
+// End Android Add
+        p->cTerm = c;
+        break;
+      }
+      import_append_char(p, c);
+      ppc = pc;
+      pc = c;
+    }
   }else{
-    ShellClearFlag(p, mFlag);
+    /* If this is the first field being parsed and it begins with the
+    ** UTF-8 BOM  (0xEF BB BF) then skip the BOM */
+    if( (c&0xff)==0xef && p->bNotFirst==0 ){
+// Begin Android Add
+      while( p->nBuf-p->iBuf<3 && import_fill(p)>0 ){}
+      if( p->nBuf-p->iBuf>=3 && memcmp(p->zBuf+p->iBuf, "\xef\xbb\xbf", 3)==0 ){
+        p->iBuf += 3;
+        p->bNotFirst = 1;
+        return csv_read_one_field(p);
+      }
+    }
+    p->bNotFirst = 1;
+    return import_scan_field(p, cSep, rSep, 1);
+// End Android Add
+  }
+  if( p->z ) p->z[p->n] = 0;
+  p->bNotFirst = 1;
+  return p->z;
+}
+
+/* Read a single field of ASCII delimited text.
+**
+**   +  Input comes from p->in.
+**   +  Store results in p->z of length p->n.  Space to hold p->z comes
+**      from sqlite3_malloc64().
+**   +  Use p->cSep as the column separator.  The default is "\x1F".
+**   +  Use p->rSep as the row separator.  The default is "\x1E".
+**   +  Keep track of the row number in p->nLine.
+**   +  Store the character that terminates the field in p->cTerm.  Store
+**      EOF on end-of-file.
+**   +  Report syntax errors on stderr
+*/
+// Begin Android Add
+/* The field is in fact returned in place within p->zBuf, with p->n set
+** to its length.  The text is only valid until the next call.
+*/
+// End Android Add
+static char *SQLITE_CDECL ascii_read_one_field(ImportCtx *p){
+  int cSep = (u8)p->cColSep;
+  int rSep = (u8)p->cRowSep;
+  p->n = 0;
+// Begin Android Add
+  p->iMark = p->iBuf;
+  if( p->iBuf>=p->nBuf ) import_fill(p);
+  if( p->iBuf>=p->nBuf || seenInterrupt ){
+    p->cTerm = EOF;
+    return 0;
   }
+  return import_scan_field(p, cSep, rSep, 0);
+// End Android Add
 }
 
-/*
-** Close an output file, assuming it is not stderr or stdout
-*/
-static void output_file_close(FILE *f){
-  if( f && f!=stdout && f!=stderr ) fclose(f);
+/*
+** Try to transfer data for table zTable.  If an error is seen while
+** moving forward, try to go backwards.  The backwards movement won't
+** work for WITHOUT ROWID tables.
+*/
+static void tryToCloneData(
+  ShellState *p,
+  sqlite3 *newDb,
+  const char *zTable
+){
+  sqlite3_stmt *pQuery = 0;
+  sqlite3_stmt *pInsert = 0;
+  char *zQuery = 0;
+  char *zInsert = 0;
+  int rc;
+  int i, j, n;
+  int nTable = strlen30(zTable);
+  int k = 0;
+  int cnt = 0;
+  const int spinRate = 10000;
+
+  zQuery = sqlite3_mprintf("SELECT * FROM \"%w\"", zTable);
+  shell_check_oom(zQuery);
+  rc = sqlite3_prepare_v2(p->db, zQuery, -1, &pQuery, 0);
+  if( rc ){
+    eputf("Error %d: %s on [%s]\n",
+          sqlite3_extended_errcode(p->db), sqlite3_errmsg(p->db), zQuery);
+    goto end_data_xfer;
+  }
+  n = sqlite3_column_count(pQuery);
+  zInsert = sqlite3_malloc64(200 + nTable + n*3);
+  shell_check_oom(zInsert);
+  sqlite3_snprintf(200+nTable,zInsert,
+                   "INSERT OR IGNORE INTO \"%s\" VALUES(?", zTable);
+  i = strlen30(zInsert);
+  for(j=1; j<n; j++){
+    memcpy(zInsert+i, ",?", 2);
+    i += 2;
+  }
+  memcpy(zInsert+i, ");", 3);
+  rc = sqlite3_prepare_v2(newDb, zInsert, -1, &pInsert, 0);
+  if( rc ){
+    eputf("Error %d: %s on [%s]\n",
+          sqlite3_extended_errcode(newDb), sqlite3_errmsg(newDb), zInsert);
+    goto end_data_xfer;
+  }
+  for(k=0; k<2; k++){
+    while( (rc = sqlite3_step(pQuery))==SQLITE_ROW ){
+      for(i=0; i<n; i++){
+        switch( sqlite3_column_type(pQuery, i) ){
+          case SQLITE_NULL: {
+            sqlite3_bind_null(pInsert, i+1);
+            break;
+          }
+          case SQLITE_INTEGER: {
+            sqlite3_bind_int64(pInsert, i+1, sqlite3_column_int64(pQuery,i));
+            break;
+          }
+          case SQLITE_FLOAT: {
+            sqlite3_bind_double(pInsert, i+1, sqlite3_column_double(pQuery,i));
+            break;
+          }
+          case SQLITE_TEXT: {
+            sqlite3_bind_text(pInsert, i+1,
+                             (const char*)sqlite3_column_text(pQuery,i),
+                             -1, SQLITE_STATIC);
+            break;
+          }
+          case SQLITE_BLOB: {
+            sqlite3_bind_blob(pInsert, i+1, sqlite3_column_blob(pQuery,i),
+                                            sqlite3_column_bytes(pQuery,i),
+                                            SQLITE_STATIC);
+            break;
+          }
+        }
+      } /* End for */
+      rc = sqlite3_step(pInsert);
+      if( rc!=SQLITE_OK && rc!=SQLITE_ROW && rc!=SQLITE_DONE ){
+        eputf("Error %d: %s\n",
+              sqlite3_extended_errcode(newDb), sqlite3_errmsg(newDb));
+      }
+      sqlite3_reset(pInsert);
+      cnt++;
+      if( (cnt%spinRate)==0 ){
+        printf("%c\b", "|/-\\"[(cnt/spinRate)%4]);
+        fflush(stdout);
+      }
+    } /* End while */
+    if( rc==SQLITE_DONE ) break;
+    sqlite3_finalize(pQuery);
+    sqlite3_free(zQuery);
+    zQuery = sqlite3_mprintf("SELECT * FROM \"%w\" ORDER BY rowid DESC;",
+                             zTable);
+    shell_check_oom(zQuery);
+    rc = sqlite3_prepare_v2(p->db, zQuery, -1, &pQuery, 0);
+    if( rc ){
+      eputf("Warning: cannot step \"%s\" backwards", zTable);
+      break;
+    }
+  } /* End for(k=0...) */
+
+end_data_xfer:
+  sqlite3_finalize(pQuery);
+  sqlite3_finalize(pInsert);
+  sqlite3_free(zQuery);
+  sqlite3_free(zInsert);
 }
 
-/*
-** Try to open an output file.   The names "stdout" and "stderr" are
-** recognized and do the right thing.  NULL is returned if the output
-** filename is "off".
-*/
-static FILE *output_file_open(const char *zFile, int bTextMode){
-  FILE *f;
-  if( cli_strcmp(zFile,"stdout")==0 ){
-    f = stdout;
-  }else if( cli_strcmp(zFile, "stderr")==0 ){
-    f = stderr;
-  }else if( cli_strcmp(zFile, "off")==0 ){
-    f = 0;
-  }else{
-    f = fopen(zFile, bTextMode ? "w" : "wb");
-    if( f==0 ){
-      eputf("Error: cannot open \"%s\"\n", zFile);
-    }
-  }
-  return f;
-}
 
-#ifndef SQLITE_OMIT_TRACE
 /*
-** A routine for handling output from sqlite3_trace().
+** Try to transfer all rows of the schema that match zWhere.  For
+** each row, invoke xForEach() on the object defined by that row.
+** If an error is encountered while moving forward through the
+** sqlite_schema table, try again moving backwards.
 */
-static int sql_trace_callback(
-  unsigned mType,         /* The trace type */
-  void *pArg,             /* The ShellState pointer */
-  void *pP,               /* Usually a pointer to sqlite_stmt */
-  void *pX                /* Auxiliary output */
+static void tryToCloneSchema(
+  ShellState *p,
+  sqlite3 *newDb,
+  const char *zWhere,
+  void (*xForEach)(ShellState*,sqlite3*,const char*)
 ){
-  ShellState *p = (ShellState*)pArg;
-  sqlite3_stmt *pStmt;
-  const char *zSql;
-  i64 nSql;
-  if( p->traceOut==0 ) return 0;
-  if( mType==SQLITE_TRACE_CLOSE ){
-    sputz(p->traceOut, "-- closing database connection\n");
-    return 0;
+  sqlite3_stmt *pQuery = 0;
+  char *zQuery = 0;
+  int rc;
+  const unsigned char *zName;
+  const unsigned char *zSql;
+  char *zErrMsg = 0;
+
+  zQuery = sqlite3_mprintf("SELECT name, sql FROM sqlite_schema"
+                           " WHERE %s ORDER BY rowid ASC", zWhere);
+  shell_check_oom(zQuery);
+  rc = sqlite3_prepare_v2(p->db, zQuery, -1, &pQuery, 0);
+  if( rc ){
+    eputf("Error: (%d) %s on [%s]\n", sqlite3_extended_errcode(p->db),
+          sqlite3_errmsg(p->db), zQuery);
+    goto end_schema_xfer;
   }
-  if( mType!=SQLITE_TRACE_ROW && pX!=0 && ((const char*)pX)[0]=='-' ){
-    zSql = (const char*)pX;
-  }else{
-    pStmt = (sqlite3_stmt*)pP;
-    switch( p->eTraceType ){
-      case SHELL_TRACE_EXPANDED: {
-        zSql = sqlite3_expanded_sql(pStmt);
-        break;
-      }
-#ifdef SQLITE_ENABLE_NORMALIZE
-      case SHELL_TRACE_NORMALIZED: {
-        zSql = sqlite3_normalized_sql(pStmt);
-        break;
-      }
-#endif
-      default: {
-        zSql = sqlite3_sql(pStmt);
-        break;
+  while( (rc = sqlite3_step(pQuery))==SQLITE_ROW ){
+    zName = sqlite3_column_text(pQuery, 0);
+    zSql = sqlite3_column_text(pQuery, 1);
+    if( zName==0 || zSql==0 ) continue;
+    if( sqlite3_stricmp((char*)zName, "sqlite_sequence")!=0 ){
+      sputf(stdout, "%s... ", zName); fflush(stdout);
+      sqlite3_exec(newDb, (const char*)zSql, 0, 0, &zErrMsg);
+      if( zErrMsg ){
+        eputf("Error: %s\nSQL: [%s]\n", zErrMsg, zSql);
+        sqlite3_free(zErrMsg);
+        zErrMsg = 0;
       }
     }
+    if( xForEach ){
+      xForEach(p, newDb, (const char*)zName);
+    }
+    sputz(stdout, "done\n");
   }
-  if( zSql==0 ) return 0;
-  nSql = strlen(zSql);
-  if( nSql>1000000000 ) nSql = 1000000000;
-  while( nSql>0 && zSql[nSql-1]==';' ){ nSql--; }
-  switch( mType ){
-    case SQLITE_TRACE_ROW:
-    case SQLITE_TRACE_STMT: {
-      sputf(p->traceOut, "%.*s;\n", (int)nSql, zSql);
-      break;
+  if( rc!=SQLITE_DONE ){
+    sqlite3_finalize(pQuery);
+    sqlite3_free(zQuery);
+    zQuery = sqlite3_mprintf("SELECT name, sql FROM sqlite_schema"
+                             " WHERE %s ORDER BY rowid DESC", zWhere);
+    shell_check_oom(zQuery);
+    rc = sqlite3_prepare_v2(p->db, zQuery, -1, &pQuery, 0);
+    if( rc ){
+      eputf("Error: (%d) %s on [%s]\n",
+            sqlite3_extended_errcode(p->db), sqlite3_errmsg(p->db), zQuery);
+      goto end_schema_xfer;
     }
-    case SQLITE_TRACE_PROFILE: {
-      sqlite3_int64 nNanosec = pX ? *(sqlite3_int64*)pX : 0;
-      sputf(p->traceOut, "%.*s; -- %lld ns\n", (int)nSql, zSql, nNanosec);
-      break;
+    while( sqlite3_step(pQuery)==SQLITE_ROW ){
+      zName = sqlite3_column_text(pQuery, 0);
+      zSql = sqlite3_column_text(pQuery, 1);
+      if( zName==0 || zSql==0 ) continue;
+      if( sqlite3_stricmp((char*)zName, "sqlite_sequence")==0 ) continue;
+      sputf(stdout, "%s... ", zName); fflush(stdout);
+      sqlite3_exec(newDb, (const char*)zSql, 0, 0, &zErrMsg);
+      if( zErrMsg ){
+        eputf("Error: %s\nSQL: [%s]\n", zErrMsg, zSql);
+        sqlite3_free(zErrMsg);
+        zErrMsg = 0;
+      }
+      if( xForEach ){
+        xForEach(p, newDb, (const char*)zName);
+      }
+      sputz(stdout, "done\n");
     }
   }
-  return 0;
+end_schema_xfer:
+  sqlite3_finalize(pQuery);
+  sqlite3_free(zQuery);
 }
-#endif
+
+// Begin Android Add
+#ifdef SHELL_THREADS
+/*
+** ".clone --jobs N" copies the data of the tables on N worker threads,
+** each with its own read-only connection to the database file.  The
+** workers pack rows into CloneBatch objects and queue them for the
+** calling thread, which inserts them into the new database.  The main
+** connection holds the write lock meanwhile (or, failing that, a read
+** lock), so all workers see the same committed state of the database,
+** WAL or not.
+*/
+#define CLONE_BATCH_SIZE (256*1024)    /* Bytes of values per batch */
+#define CLONE_QUEUE_SIZE 8             /* Batches queued per worker */
+
+/* Rows of one table, packed for the writer */
+typedef struct CloneBatch CloneBatch;
+struct CloneBatch {
+  CloneBatch *pNext;        /* Next batch in the queue */
+  int iTable;               /* Index of the table in CloneJob.aTable[] */
+  int nCol;                 /* Values per row */
+  int nRow;                 /* Number of rows */
+  int bLast;                /* True for the last batch of the table */
+  i64 nData;                /* Bytes of aData[] used */
+  i64 nAlloc;               /* Bytes allocated for aData[] */
+  unsigned char *aData;     /* Values, as a type byte then the value */
+};
+
+/* One table to copy */
+typedef struct CloneTable CloneTable;
+struct CloneTable {
+  char *zName;              /* Name of the table */
+  char *zErr;               /* Error reading it, or NULL */
+  sqlite3_stmt *pInsert;    /* INSERT into the new database */
+  int bFailed;              /* True if pInsert could not be prepared */
+  i64 nRow;                 /* Rows inserted */
+  i64 nByte;                /* Bytes of values inserted */
+  sqlite3_int64 iStart;     /* timeOfDay() when reading started */
+};
 
 /*
-** A no-op routine that runs with the ".breakpoint" doc-command.  This is
-** a useful spot to set a debugger breakpoint.
+** Begin a transaction on db that keeps the content of the database file
+** from changing until it ends, so that other connections opened by
+** worker threads read the same state.  Take the write lock if possible,
+** or else a read lock.  Return SQLITE_OK on success.
 **
-** This routine does not do anything practical.  The code are there simply
-** to prevent the compiler from optimizing this routine out.
+** A read lock only keeps writers from committing in rollback journal
+** modes.  In WAL mode connections that start reading later still see new
+** commits, so if the write lock cannot be taken there *pbShared is set
+** to 0, and the caller must do all of its reading on db.  Otherwise it
+** is set to 1.
 */
-static void test_breakpoint(void){
-  static unsigned int nCall = 0;
-  if( (nCall++)==0xffffffff ) printf("Many .breakpoints have run\n");
+static int shell_hold_snapshot(sqlite3 *db, int *pbShared){
+  sqlite3_stmt *pStmt = 0;
+  *pbShared = 1;
+  if( sqlite3_exec(db, "BEGIN IMMEDIATE;", 0, 0, 0)==SQLITE_OK ){
+    return SQLITE_OK;
+  }
+  if( sqlite3_exec(db, "BEGIN; SELECT count(*) FROM sqlite_schema;",
+                   0, 0, 0)!=SQLITE_OK
+  ){
+    sqlite3_exec(db, "ROLLBACK;", 0, 0, 0);
+    return SQLITE_ERROR;
+  }
+  if( sqlite3_prepare_v2(db, "PRAGMA main.journal_mode", -1, &pStmt, 0)
+        ==SQLITE_OK
+   && sqlite3_step(pStmt)==SQLITE_ROW
+   && sqlite3_stricmp((const char*)sqlite3_column_text(pStmt, 0), "wal")==0
+  ){
+    *pbShared = 0;
+  }
+  sqlite3_finalize(pStmt);
+  return SQLITE_OK;
 }
 
-/*
-** An object used to read a CSV and other files for import.
-*/
-typedef struct ImportCtx ImportCtx;
-struct ImportCtx {
-  const char *zFile;  /* Name of the input file */
-  FILE *in;           /* Read the CSV text from this input stream */
-  int (SQLITE_CDECL *xCloser)(FILE*);      /* Func to close in */
-  char *z;            /* Accumulated text for a field */
-  int n;              /* Number of bytes in z */
-  int nAlloc;         /* Space allocated for z[] */
-  int nLine;          /* Current line number */
-  int nRow;           /* Number of rows imported */
-  int nErr;           /* Number of errors encountered */
-  int bNotFirst;      /* True if one or more bytes already read */
-  int cTerm;          /* Character that terminated the most recent field */
-  int cColSep;        /* The column separator character.  (Usually ",") */
-  int cRowSep;        /* The row separator character.  (Usually "\n") */
+/* State shared by the threads of a ".clone --jobs N" */
+typedef struct CloneJob CloneJob;
+struct CloneJob {
+  const char *zFile;        /* Database file to read */
+  CloneTable *aTable;       /* Tables to copy */
+  int nTable;               /* Number of entries in aTable[] */
+  pthread_mutex_t mutex;    /* Protects the fields below */
+  pthread_cond_t cond;      /* Broadcast when any of them change */
+  int iNext;                /* Next table for a worker to start on */
+  int nQueued;              /* Number of batches in the queue */
+  int nMaxQueued;           /* Workers wait while nQueued is this many */
+  CloneBatch *pFirst;       /* Queue of batches for the writer */
+  CloneBatch *pLast;        /* Last batch in the queue */
 };
 
-/* Clean up resourced used by an ImportCtx */
-static void import_cleanup(ImportCtx *p){
-  if( p->in!=0 && p->xCloser!=0 ){
-    p->xCloser(p->in);
-    p->in = 0;
-  }
-  sqlite3_free(p->z);
-  p->z = 0;
+static CloneBatch *clone_batch_new(int iTable, int nCol){
+  CloneBatch *pBatch = sqlite3_malloc64(sizeof(*pBatch));
+  shell_check_oom(pBatch);
+  memset(pBatch, 0, sizeof(*pBatch));
+  pBatch->iTable = iTable;
+  pBatch->nCol = nCol;
+  return pBatch;
 }
 
-/* Append a single byte to z[] */
-static void import_append_char(ImportCtx *p, int c){
-  if( p->n+1>=p->nAlloc ){
-    p->nAlloc += p->nAlloc + 100;
-    p->z = sqlite3_realloc64(p->z, p->nAlloc);
-    shell_check_oom(p->z);
-  }
-  p->z[p->n++] = (char)c;
+static void clone_batch_free(CloneBatch *pBatch){
+  sqlite3_free(pBatch->aData);
+  sqlite3_free(pBatch);
 }
 
-/* Read a single field of CSV text.  Compatible with rfc4180 and extended
-** with the option of having a separator other than ",".
-**
-**   +  Input comes from p->in.
-**   +  Store results in p->z of length p->n.  Space to hold p->z comes
-**      from sqlite3_malloc64().
-**   +  Use p->cSep as the column separator.  The default is ",".
-**   +  Use p->rSep as the row separator.  The default is "\n".
-**   +  Keep track of the line number in p->nLine.
-**   +  Store the character that terminates the field in p->cTerm.  Store
-**      EOF on end-of-file.
-**   +  Report syntax errors on stderr
-*/
-static char *SQLITE_CDECL csv_read_one_field(ImportCtx *p){
-  int c;
-  int cSep = (u8)p->cColSep;
-  int rSep = (u8)p->cRowSep;
-  p->n = 0;
-  c = fgetc(p->in);
-  if( c==EOF || seenInterrupt ){
-    p->cTerm = EOF;
-    return 0;
+/* Make room for n more bytes in pBatch->aData[] */
+static unsigned char *clone_batch_space(CloneBatch *pBatch, i64 n){
+  if( pBatch->nData+n>pBatch->nAlloc ){
+    i64 nNew = 2*pBatch->nAlloc + n + CLONE_BATCH_SIZE/4;
+    pBatch->aData = sqlite3_realloc64(pBatch->aData, nNew);
+    shell_check_oom(pBatch->aData);
+    pBatch->nAlloc = nNew;
   }
-  if( c=='"' ){
-    int pc, ppc;
-    int startLine = p->nLine;
-    int cQuote = c;
-    pc = ppc = 0;
-    while( 1 ){
-      c = fgetc(p->in);
-      if( c==rSep ) p->nLine++;
-      if( c==cQuote ){
-        if( pc==cQuote ){
-          pc = 0;
-          continue;
-        }
+  return &pBatch->aData[pBatch->nData];
+}
+
+/* Append the current row of pQuery to pBatch */
+static void clone_pack_row(CloneBatch *pBatch, sqlite3_stmt *pQuery){
+  int i;
+  for(i=0; i<pBatch->nCol; i++){
+    int eType = sqlite3_column_type(pQuery, i);
+    unsigned char *a;
+    switch( eType ){
+      case SQLITE_INTEGER: {
+        sqlite3_int64 v = sqlite3_column_int64(pQuery, i);
+        a = clone_batch_space(pBatch, 1+sizeof(v));
+        memcpy(a+1, &v, sizeof(v));
+        pBatch->nData += 1+sizeof(v);
+        break;
       }
-      if( (c==cSep && pc==cQuote)
-       || (c==rSep && pc==cQuote)
-       || (c==rSep && pc=='\r' && ppc==cQuote)
-       || (c==EOF && pc==cQuote)
-      ){
-        do{ p->n--; }while( p->z[p->n]!=cQuote );
-        p->cTerm = c;
+      case SQLITE_FLOAT: {
+        double r = sqlite3_column_double(pQuery, i);
+        a = clone_batch_space(pBatch, 1+sizeof(r));
+        memcpy(a+1, &r, sizeof(r));
+        pBatch->nData += 1+sizeof(r);
         break;
       }
-      if( pc==cQuote && c!='\r' ){
-        eputf("%s:%d: unescaped %c character\n", p->zFile, p->nLine, cQuote);
+      case SQLITE_TEXT:
+      case SQLITE_BLOB: {
+        const void *z = eType==SQLITE_TEXT
+                          ? (const void*)sqlite3_column_text(pQuery, i)
+                          : sqlite3_column_blob(pQuery, i);
+        int n = sqlite3_column_bytes(pQuery, i);
+        a = clone_batch_space(pBatch, 1+sizeof(n)+n);
+        memcpy(a+1, &n, sizeof(n));
+        if( n>0 ) memcpy(a+1+sizeof(n), z, n);
+        pBatch->nData += 1+sizeof(n)+n;
+        break;
       }
-      if( c==EOF ){
-        eputf("%s:%d: unterminated %c-quoted field\n",
-              p->zFile, startLine, cQuote);
-        p->cTerm = c;
+      default: {
+        a = clone_batch_space(pBatch, 1);
+        pBatch->nData++;
         break;
       }
-      import_append_char(p, c);
-      ppc = pc;
-      pc = c;
     }
+    a[0] = (unsigned char)eType;
+  }
+  pBatch->nRow++;
+}
+
+/* Hand pBatch to the writer, waiting if too many are queued already */
+static void clone_queue(CloneJob *pJob, CloneBatch *pBatch){
+  pthread_mutex_lock(&pJob->mutex);
+  while( pJob->nQueued>=pJob->nMaxQueued && !pBatch->bLast ){
+    pthread_cond_wait(&pJob->cond, &pJob->mutex);
+  }
+  if( pJob->pLast ){
+    pJob->pLast->pNext = pBatch;
   }else{
-    /* If this is the first field being parsed and it begins with the
-    ** UTF-8 BOM  (0xEF BB BF) then skip the BOM */
-    if( (c&0xff)==0xef && p->bNotFirst==0 ){
-      import_append_char(p, c);
-      c = fgetc(p->in);
-      if( (c&0xff)==0xbb ){
-        import_append_char(p, c);
-        c = fgetc(p->in);
-        if( (c&0xff)==0xbf ){
-          p->bNotFirst = 1;
-          p->n = 0;
-          return csv_read_one_field(p);
-        }
+    pJob->pFirst = pBatch;
+  }
+  pJob->pLast = pBatch;
+  pJob->nQueued++;
+  pthread_cond_broadcast(&pJob->cond);
+  pthread_mutex_unlock(&pJob->mutex);
+}
+
+/*
+** Read all rows of table iTable on db and queue them, followed by a
+** batch with bLast set.  As in tryToCloneData(), if an error is seen
+** while moving forward, try to go backwards.
+*/
+static void clone_read_table(CloneJob *pJob, sqlite3 *db, int iTable){
+  CloneTable *pTab = &pJob->aTable[iTable];
+  CloneBatch *pBatch = 0;
+  sqlite3_stmt *pQuery = 0;
+  char *zQuery;
+  int nCol = 0;
+  int rc, k;
+  pTab->iStart = timeOfDay();
+  zQuery = sqlite3_mprintf("SELECT * FROM \"%w\"", pTab->zName);
+  shell_check_oom(zQuery);
+  rc = sqlite3_prepare_v2(db, zQuery, -1, &pQuery, 0);
+  if( rc ){
+    pTab->zErr = sqlite3_mprintf("Error %d: %s on [%s]\n",
+        sqlite3_extended_errcode(db), sqlite3_errmsg(db), zQuery);
+    goto end_read_table;
+  }
+  nCol = sqlite3_column_count(pQuery);
+  for(k=0; k<2; k++){
+    while( !seenInterrupt && (rc = sqlite3_step(pQuery))==SQLITE_ROW ){
+      if( pBatch==0 ) pBatch = clone_batch_new(iTable, nCol);
+      clone_pack_row(pBatch, pQuery);
+      if( pBatch->nData>=CLONE_BATCH_SIZE ){
+        clone_queue(pJob, pBatch);
+        pBatch = 0;
       }
     }
-    while( c!=EOF && c!=cSep && c!=rSep ){
-      import_append_char(p, c);
-      c = fgetc(p->in);
+    if( rc==SQLITE_DONE || seenInterrupt ) break;
+    sqlite3_finalize(pQuery);
+    sqlite3_free(zQuery);
+    zQuery = sqlite3_mprintf("SELECT * FROM \"%w\" ORDER BY rowid DESC;",
+                             pTab->zName);
+    shell_check_oom(zQuery);
+    rc = sqlite3_prepare_v2(db, zQuery, -1, &pQuery, 0);
+    if( rc ){
+      pTab->zErr = sqlite3_mprintf("Warning: cannot step \"%s\" backwards",
+                                   pTab->zName);
+      break;
+    }
+  }
+end_read_table:
+  sqlite3_finalize(pQuery);
+  sqlite3_free(zQuery);
+  if( pBatch==0 ) pBatch = clone_batch_new(iTable, nCol);
+  pBatch->bLast = 1;
+  clone_queue(pJob, pBatch);
+}
+
+/* The body of each worker thread */
+static void *clone_worker(void *pArg){
+  CloneJob *pJob = (CloneJob*)pArg;
+  sqlite3 *db = 0;
+  if( sqlite3_open_v2(pJob->zFile, &db, SQLITE_OPEN_READONLY, 0)==SQLITE_OK ){
+    sqlite3_exec(db, "PRAGMA writable_schema=ON;", 0, 0, 0);
+  }
+  while( 1 ){
+    int iTable;
+    pthread_mutex_lock(&pJob->mutex);
+    iTable = pJob->iNext++;
+    pthread_mutex_unlock(&pJob->mutex);
+    if( iTable>=pJob->nTable ) break;
+    clone_read_table(pJob, db, iTable);
+  }
+  sqlite3_close(db);
+  return 0;
+}
+
+/* Insert the rows of pBatch into newDb */
+static void clone_write_batch(CloneJob *pJob, sqlite3 *newDb,
+                              CloneBatch *pBatch){
+  CloneTable *pTab = &pJob->aTable[pBatch->iTable];
+  const unsigned char *a = pBatch->aData;
+  int iRow, i;
+  if( pBatch->nRow==0 ) return;
+  if( pTab->pInsert==0 && !pTab->bFailed ){
+    sqlite3_str *pSql = sqlite3_str_new(0);
+    char *zInsert;
+    sqlite3_str_appendf(pSql, "INSERT OR IGNORE INTO \"%w\" VALUES(?",
+                        pTab->zName);
+    for(i=1; i<pBatch->nCol; i++) sqlite3_str_append(pSql, ",?", 2);
+    sqlite3_str_append(pSql, ");", 2);
+    zInsert = sqlite3_str_finish(pSql);
+    shell_check_oom(zInsert);
+    if( sqlite3_prepare_v2(newDb, zInsert, -1, &pTab->pInsert, 0) ){
+      eputf("Error %d: %s on [%s]\n",
+            sqlite3_extended_errcode(newDb), sqlite3_errmsg(newDb), zInsert);
+      pTab->bFailed = 1;
+    }
+    sqlite3_free(zInsert);
+  }
+  if( pTab->bFailed ) return;
+  for(iRow=0; iRow<pBatch->nRow; iRow++){
+    int rc;
+    for(i=0; i<pBatch->nCol; i++){
+      switch( *a++ ){
+        case SQLITE_INTEGER: {
+          sqlite3_int64 v;
+          memcpy(&v, a, sizeof(v));
+          a += sizeof(v);
+          sqlite3_bind_int64(pTab->pInsert, i+1, v);
+          break;
+        }
+        case SQLITE_FLOAT: {
+          double r;
+          memcpy(&r, a, sizeof(r));
+          a += sizeof(r);
+          sqlite3_bind_double(pTab->pInsert, i+1, r);
+          break;
+        }
+        case SQLITE_TEXT: {
+          int n;
+          memcpy(&n, a, sizeof(n));
+          a += sizeof(n);
+          sqlite3_bind_text(pTab->pInsert, i+1, (const char*)a, n,
+                            SQLITE_STATIC);
+          a += n;
+          break;
+        }
+        case SQLITE_BLOB: {
+          int n;
+          memcpy(&n, a, sizeof(n));
+          a += sizeof(n);
+          sqlite3_bind_blob(pTab->pInsert, i+1, a, n, SQLITE_STATIC);
+          a += n;
+          break;
+        }
+        default: {
+          sqlite3_bind_null(pTab->pInsert, i+1);
+          break;
+        }
+      }
     }
-    if( c==rSep ){
-      p->nLine++;
-      if( p->n>0 && p->z[p->n-1]=='\r' ) p->n--;
+    rc = sqlite3_step(pTab->pInsert);
+    if( rc!=SQLITE_OK && rc!=SQLITE_ROW && rc!=SQLITE_DONE ){
+      eputf("Error %d: %s\n",
+            sqlite3_extended_errcode(newDb), sqlite3_errmsg(newDb));
     }
-    p->cTerm = c;
+    sqlite3_reset(pTab->pInsert);
   }
-  if( p->z ) p->z[p->n] = 0;
-  p->bNotFirst = 1;
-  return p->z;
+  pTab->nRow += pBatch->nRow;
+  pTab->nByte += pBatch->nData;
 }
 
-/* Read a single field of ASCII delimited text.
-**
-**   +  Input comes from p->in.
-**   +  Store results in p->z of length p->n.  Space to hold p->z comes
-**      from sqlite3_malloc64().
-**   +  Use p->cSep as the column separator.  The default is "\x1F".
-**   +  Use p->rSep as the row separator.  The default is "\x1E".
-**   +  Keep track of the row number in p->nLine.
-**   +  Store the character that terminates the field in p->cTerm.  Store
-**      EOF on end-of-file.
-**   +  Report syntax errors on stderr
+/*
+** Copy the tables of p->db, with their data, into newDb using nJob
+** worker threads, and report the rows and bytes copied per table.
+** Return 0 without doing anything if the database is not a file that
+** the workers can open.
 */
-static char *SQLITE_CDECL ascii_read_one_field(ImportCtx *p){
-  int c;
-  int cSep = (u8)p->cColSep;
-  int rSep = (u8)p->cRowSep;
-  p->n = 0;
-  c = fgetc(p->in);
-  if( c==EOF || seenInterrupt ){
-    p->cTerm = EOF;
+static int clone_with_jobs(ShellState *p, sqlite3 *newDb, int nJob){
+  CloneJob sJob;
+  pthread_t *aThread;
+  sqlite3_stmt *pQuery = 0;
+  int nAlloc = 0;
+  int nStarted = 0;
+  int nDone = 0;
+  int bShared = 0;
+  int i;
+  const char *zFile = sqlite3_db_filename(p->db, "main");
+  if( zFile==0 || zFile[0]==0 || !sqlite3_threadsafe()
+   || !sqlite3_get_autocommit(p->db)
+  ){
+    return 0;
+  }
+  memset(&sJob, 0, sizeof(sJob));
+  sJob.zFile = zFile;
+  if( shell_hold_snapshot(p->db, &bShared)!=SQLITE_OK ) return 0;
+  if( !bShared ){
+    eputz("Warning: WAL database is locked, copying without --jobs\n");
+    sqlite3_exec(p->db, "COMMIT;", 0, 0, 0);
     return 0;
   }
-  while( c!=EOF && c!=cSep && c!=rSep ){
-    import_append_char(p, c);
-    c = fgetc(p->in);
+  /* sqlite_sequence is copied first, below, so that inserting into
+  ** AUTOINCREMENT tables updates its rows rather than adding more */
+  if( sqlite3_prepare_v2(p->db, "SELECT name FROM sqlite_schema"
+                         " WHERE type='table' AND sql IS NOT NULL"
+                         " AND name<>'sqlite_sequence' COLLATE NOCASE"
+                         " ORDER BY rowid ASC", -1, &pQuery, 0)==SQLITE_OK ){
+    while( sqlite3_step(pQuery)==SQLITE_ROW ){
+      const char *zName = (const char*)sqlite3_column_text(pQuery, 0);
+      if( zName==0 ) continue;
+      if( sJob.nTable>=nAlloc ){
+        nAlloc = nAlloc*2 + 16;
+        sJob.aTable = sqlite3_realloc64(sJob.aTable,
+                                        nAlloc*sizeof(CloneTable));
+        shell_check_oom(sJob.aTable);
+      }
+      memset(&sJob.aTable[sJob.nTable], 0, sizeof(CloneTable));
+      sJob.aTable[sJob.nTable].zName = sqlite3_mprintf("%s", zName);
+      shell_check_oom(sJob.aTable[sJob.nTable].zName);
+      sJob.nTable++;
+    }
   }
-  if( c==rSep ){
-    p->nLine++;
+  sqlite3_finalize(pQuery);
+  tryToCloneSchema(p, newDb, "type='table'", 0);
+  if( sqlite3_table_column_metadata(p->db, "main", "sqlite_sequence", 0,
+                                    0, 0, 0, 0, 0)==SQLITE_OK ){
+    tryToCloneData(p, newDb, "sqlite_sequence");
+  }
+  sJob.nMaxQueued = CLONE_QUEUE_SIZE*nJob;
+  pthread_mutex_init(&sJob.mutex, 0);
+  pthread_cond_init(&sJob.cond, 0);
+  aThread = sqlite3_malloc64(nJob*sizeof(pthread_t));
+  shell_check_oom(aThread);
+  for(i=0; i<nJob && i<sJob.nTable; i++){
+    if( pthread_create(&aThread[nStarted], 0, clone_worker, &sJob)==0 ){
+      nStarted++;
+    }
+  }
+  for(i=nStarted==0 ? 0 : sJob.nTable; i<sJob.nTable; i++){
+    /* No thread could be started, so copy the data here */
+    tryToCloneData(p, newDb, sJob.aTable[i].zName);
+  }
+  while( nStarted>0 && nDone<sJob.nTable ){
+    CloneBatch *pBatch;
+    pthread_mutex_lock(&sJob.mutex);
+    while( sJob.pFirst==0 ){
+      pthread_cond_wait(&sJob.cond, &sJob.mutex);
+    }
+    pBatch = sJob.pFirst;
+    sJob.pFirst = pBatch->pNext;
+    if( sJob.pFirst==0 ) sJob.pLast = 0;
+    sJob.nQueued--;
+    pthread_cond_broadcast(&sJob.cond);
+    pthread_mutex_unlock(&sJob.mutex);
+    if( !seenInterrupt ) clone_write_batch(&sJob, newDb, pBatch);
+    if( pBatch->bLast ){
+      CloneTable *pTab = &sJob.aTable[pBatch->iTable];
+      double rSec = (timeOfDay() - pTab->iStart)*0.001;
+      if( pTab->zErr ) eputz(pTab->zErr);
+      sputf(stdout, "%s: %lld rows, %.1f MB in %.3fs (%.0f rows/s)\n",
+            pTab->zName, pTab->nRow, pTab->nByte/1048576.0, rSec,
+            rSec>0 ? pTab->nRow/rSec : 0.0);
+      nDone++;
+    }
+    clone_batch_free(pBatch);
+  }
+  for(i=0; i<nStarted; i++){
+    pthread_join(aThread[i], 0);
+  }
+  for(i=0; i<sJob.nTable; i++){
+    sqlite3_finalize(sJob.aTable[i].pInsert);
+    sqlite3_free(sJob.aTable[i].zName);
+    sqlite3_free(sJob.aTable[i].zErr);
+  }
+  pthread_cond_destroy(&sJob.cond);
+  pthread_mutex_destroy(&sJob.mutex);
+  sqlite3_free(sJob.aTable);
+  sqlite3_free(aThread);
+  sqlite3_exec(p->db, "COMMIT;", 0, 0, 0);
+  return 1;
+}
+#endif /* SHELL_THREADS */
+
+#if defined(SHELL_THREADS) && defined(SHELL_OUT_BUFFER)
+/*
+** ".dump --dir D" writes the dump as a directory of files that, run in
+** the order of their names, build the same database as the output of a
+** plain ".dump" does.  The text is not the same, as the files hold all of
+** the CREATE TABLEs first and a transaction per table:
+**
+**    0-schema.sql    PRAGMA foreign_keys=OFF and the CREATE TABLEs
+**    1-NNNNNN.sql    The rows of the Nth table, in a transaction of their own
+**    2-post.sql      The indexes, triggers and views
+**
+** Each 1-NNNNNN.sql starts with a "-- Table: 'NAME'" line.  With --jobs N
+** they are written by N worker threads, each with its own read-only
+** connection, while the main connection keeps the database from changing
+** with shell_hold_snapshot().
+**
+** ".restore --dir D" reads such a directory into the main database.  With
+** --jobs N, N worker threads each replay a table into a staging database
+** of its own, D/stage-NNNNNN.db, and the main thread copies the staged
+** rows over with "INSERT INTO ... SELECT *", which SQLite does without
+** decoding them when the two tables match.  The sqlite_* tables, and
+** tables that already have rows in them, are replayed into the main
+** database directly, after the others.
+*/
+
+/* One table of a ".dump --dir" or ".restore --dir" */
+typedef struct DumpDirTable DumpDirTable;
+struct DumpDirTable {
+  char *zName;              /* Name of the table, or NULL if unknown */
+  char *zFile;              /* Its 1-NNNNNN.sql file */
+  char *zSelect;            /* .dump: SELECT of the rows */
+  char *zTarget;            /* .dump: Table, and columns, to INSERT INTO */
+  const char *zPre;         /* .dump: SQL to write before the rows */
+  char *zCreate;            /* .restore: CREATE TABLE for the staging db */
+  char *zStage;             /* .restore: Staging database file */
+  int bMain;                /* .restore: Replay into the main database */
+  int bStaged;              /* .restore: The staging table was created */
+  char *zErr;               /* First error, or NULL */
+  int nErr;                 /* Number of errors */
+  i64 nRow;                 /* Rows written or restored */
+  i64 nByte;                /* Size of zFile */
+  sqlite3_int64 iStart;     /* timeOfDay() when work on the table began */
+  sqlite3_int64 iEnd;       /* timeOfDay() when it was done */
+};
+
+/* State shared by the threads of a ".dump --dir" or ".restore --dir" */
+typedef struct DumpDirJob DumpDirJob;
+struct DumpDirJob {
+  ShellState *p;            /* The shell */
+  const char *zFile;        /* .dump: Database file to read */
+  DumpDirTable *aTable;     /* The tables */
+  int nTable;               /* Number of entries in aTable[] */
+  int *aDone;               /* Tables done, in the order they were done */
+  pthread_mutex_t mutex;    /* Protects the fields below */
+  pthread_cond_t cond;      /* Broadcast when a table is done */
+  int iNext;                /* Next table for a worker to start on */
+  int nDone;                /* Number of entries in aDone[] */
+};
+
+/* Add a table to pJob and return it, zeroed */
+static DumpDirTable *dump_dir_add(DumpDirJob *pJob, int *pnAlloc){
+  DumpDirTable *pTab;
+  if( pJob->nTable>=*pnAlloc ){
+    *pnAlloc = *pnAlloc*2 + 16;
+    pJob->aTable = sqlite3_realloc64(pJob->aTable,
+                                     *pnAlloc*sizeof(DumpDirTable));
+    shell_check_oom(pJob->aTable);
   }
-  p->cTerm = c;
-  if( p->z ) p->z[p->n] = 0;
-  return p->z;
+  pTab = &pJob->aTable[pJob->nTable++];
+  memset(pTab, 0, sizeof(*pTab));
+  return pTab;
+}
+
+/* Count an error on pTab, keeping the message of the first one */
+static void dump_dir_error(DumpDirTable *pTab, const char *zFormat, ...){
+  if( pTab->zErr==0 ){
+    va_list ap;
+    va_start(ap, zFormat);
+    pTab->zErr = sqlite3_vmprintf(zFormat, ap);
+    va_end(ap);
+  }
+  pTab->nErr++;
+}
+
+/* Return the next table for a worker thread, or -1 if there are none */
+static int dump_dir_next(DumpDirJob *pJob){
+  int iTable = -1;
+  pthread_mutex_lock(&pJob->mutex);
+  while( pJob->iNext<pJob->nTable && pJob->aTable[pJob->iNext].bMain ){
+    pJob->iNext++;
+  }
+  if( pJob->iNext<pJob->nTable ) iTable = pJob->iNext++;
+  pthread_mutex_unlock(&pJob->mutex);
+  return iTable;
+}
+
+/* Record that a worker is done with table iTable */
+static void dump_dir_done(DumpDirJob *pJob, int iTable){
+  pJob->aTable[iTable].iEnd = timeOfDay();
+  pthread_mutex_lock(&pJob->mutex);
+  pJob->aDone[pJob->nDone++] = iTable;
+  pthread_cond_broadcast(&pJob->cond);
+  pthread_mutex_unlock(&pJob->mutex);
+}
+
+/* Wait until the workers are done with iSeen+1 tables, return the last */
+static int dump_dir_wait(DumpDirJob *pJob, int iSeen){
+  int iTable;
+  pthread_mutex_lock(&pJob->mutex);
+  while( pJob->nDone<=iSeen ){
+    pthread_cond_wait(&pJob->cond, &pJob->mutex);
+  }
+  iTable = pJob->aDone[iSeen];
+  pthread_mutex_unlock(&pJob->mutex);
+  return iTable;
+}
+
+/* Report on a table once it is done */
+static void dump_dir_report(DumpDirTable *pTab){
+  const char *zName = pTab->zName ? pTab->zName : pTab->zFile;
+  double rSec = (pTab->iEnd - pTab->iStart)*0.001;
+  if( pTab->zErr && pTab->nErr>1 ){
+    eputf("Error: %s: %s (and %d more)\n", zName, pTab->zErr, pTab->nErr-1);
+  }else if( pTab->zErr ){
+    eputf("Error: %s: %s\n", zName, pTab->zErr);
+  }
+  sputf(stdout, "%s: %lld rows, %.1f MB in %.3fs (%.0f rows/s)\n",
+        zName, pTab->nRow, pTab->nByte/1048576.0, rSec,
+        rSec>0 ? pTab->nRow/rSec : 0.0);
+}
+
+static void dump_dir_free(DumpDirJob *pJob){
+  int i;
+  for(i=0; i<pJob->nTable; i++){
+    DumpDirTable *pTab = &pJob->aTable[i];
+    sqlite3_free(pTab->zName);
+    sqlite3_free(pTab->zFile);
+    sqlite3_free(pTab->zSelect);
+    sqlite3_free(pTab->zTarget);
+    sqlite3_free(pTab->zCreate);
+    sqlite3_free(pTab->zStage);
+    sqlite3_free(pTab->zErr);
+  }
+  sqlite3_free(pJob->aTable);
+  sqlite3_free(pJob->aDone);
+}
+
+/*
+** Set pTab->zTarget and pTab->zSelect for table zTable the way that
+** dump_callback() builds them.  Return non-zero if the columns of the
+** table cannot be found.
+*/
+static int dump_dir_table_sql(ShellState *p, const char *zTable,
+                              DumpDirTable *pTab){
+  char **azCol = tableColumnList(p, zTable);
+  ShellText sTable;
+  ShellText sSelect;
+  int i;
+  if( azCol==0 ) return 1;
+  initText(&sTable);
+  appendText(&sTable, zTable, quoteChar(zTable));
+  if( azCol[0] ){
+    appendText(&sTable, "(", 0);
+    appendText(&sTable, azCol[0], 0);
+    for(i=1; azCol[i]; i++){
+      appendText(&sTable, ",", 0);
+      appendText(&sTable, azCol[i], quoteChar(azCol[i]));
+    }
+    appendText(&sTable, ")", 0);
+  }
+  initText(&sSelect);
+  appendText(&sSelect, "SELECT ", 0);
+  if( azCol[0] ){
+    appendText(&sSelect, azCol[0], 0);
+    appendText(&sSelect, ",", 0);
+  }
+  for(i=1; azCol[i]; i++){
+    appendText(&sSelect, azCol[i], quoteChar(azCol[i]));
+    if( azCol[i+1] ){
+      appendText(&sSelect, ",", 0);
+    }
+  }
+  freeColumnList(azCol);
+  appendText(&sSelect, " FROM ", 0);
+  appendText(&sSelect, zTable, quoteChar(zTable));
+  pTab->zTarget = sqlite3_mprintf("%s", sTable.z);
+  pTab->zSelect = sqlite3_mprintf("%s", sSelect.z);
+  shell_check_oom(pTab->zTarget);
+  shell_check_oom(pTab->zSelect);
+  freeText(&sTable);
+  freeText(&sSelect);
+  return 0;
+}
+
+/* Write the rows of zSelect, run on db, as INSERTs through pState */
+static int dump_dir_select(ShellState *pState, sqlite3 *db,
+                           const char *zSelect){
+  sqlite3_stmt *pStmt = 0;
+  int rc = sqlite3_prepare_v2(db, zSelect, -1, &pStmt, 0);
+  if( rc==SQLITE_OK ){
+    exec_prepared_stmt_buffered(pState, pStmt);
+    rc = sqlite3_finalize(pStmt);
+  }
+  return rc;
+}
+
+/* Write the 1-NNNNNN.sql file of table iTable, reading it through db */
+static void dump_dir_write_table(DumpDirJob *pJob, sqlite3 *db, int iTable){
+  DumpDirTable *pTab = &pJob->aTable[iTable];
+  int dataOnly = (pJob->p->shellFlgs & SHFLG_DumpDataOnly)!=0;
+  ShellState s;
+  FILE *out;
+  int rc;
+  pTab->iStart = timeOfDay();
+  if( seenInterrupt ){
+    dump_dir_error(pTab, "interrupted");
+    return;
+  }
+  out = fopen(pTab->zFile, "wb");
+  if( out==0 ){
+    dump_dir_error(pTab, "cannot open \"%s\"", pTab->zFile);
+    return;
+  }
+  /* A name with a line break in it would end the comment early, so such
+  ** tables are left unnamed, and replayed as they are by .restore */
+  if( strchr(pTab->zName, '\n')==0 && strchr(pTab->zName, '\r')==0 ){
+    char *zLine = sqlite3_mprintf("-- Table: %Q\n", pTab->zName);
+    shell_check_oom(zLine);
+    fputs(zLine, out);
+    sqlite3_free(zLine);
+  }else{
+    fputs("-- Table:\n", out);
+  }
+  if( !dataOnly ) fputs("BEGIN TRANSACTION;\n", out);
+  if( pTab->zPre ) fputs(pTab->zPre, out);
+  memcpy(&s, pJob->p, sizeof(s));
+  memset(&s.sOut, 0, sizeof(s.sOut));
+  s.sOut.pFile = out;
+  s.db = db;
+  s.mode = s.cMode = MODE_Insert;
+  s.zDestTable = pTab->zTarget;
+  s.showHeader = 0;
+  s.cnt = 0;
+  rc = dump_dir_select(&s, db, pTab->zSelect);
+  if( (rc&0xff)==SQLITE_CORRUPT ){
+    fputs("/****** CORRUPTION ERROR *******/\n", out);
+    toggleSelectOrder(db);
+    dump_dir_select(&s, db, pTab->zSelect);
+    toggleSelectOrder(db);
+  }
+  if( rc ) dump_dir_error(pTab, "%s", sqlite3_errmsg(db));
+  if( !dataOnly ){
+    fputs(pTab->nErr ? "ROLLBACK; -- due to errors\n" : "COMMIT;\n", out);
+  }
+  sqlite3_free(s.sOut.z);
+  pTab->nRow = s.cnt;
+  pTab->nByte = ftell(out);
+  if( ferror(out) ) dump_dir_error(pTab, "cannot write \"%s\"", pTab->zFile);
+  fclose(out);
+}
+
+/* The body of each worker thread of a ".dump --dir" */
+static void *dump_dir_worker(void *pArg){
+  DumpDirJob *pJob = (DumpDirJob*)pArg;
+  sqlite3 *db = 0;
+  int iTable;
+  if( sqlite3_open_v2(pJob->zFile, &db, SQLITE_OPEN_READONLY, 0)==SQLITE_OK ){
+    sqlite3_exec(db, "PRAGMA writable_schema=ON;", 0, 0, 0);
+  }
+  while( (iTable = dump_dir_next(pJob))>=0 ){
+    dump_dir_write_table(pJob, db, iTable);
+    dump_dir_done(pJob, iTable);
+  }
+  sqlite3_close(db);
+  return 0;
+}
+
+/* Open zFile for writing and make it the output stream */
+static FILE *dump_dir_output(ShellState *p, const char *zDir,
+                             const char *zName){
+  char *zFile = sqlite3_mprintf("%s/%s", zDir, zName);
+  FILE *out;
+  shell_check_oom(zFile);
+  out = fopen(zFile, "wb");
+  if( out==0 ){
+    eputf("Error: cannot open \"%s\"\n", zFile);
+  }else{
+    p->out = out;
+    setOutputStream(out);
+  }
+  sqlite3_free(zFile);
+  return out;
 }
 
 /*
-** Try to transfer data for table zTable.  If an error is seen while
-** moving forward, try to go backwards.  The backwards movement won't
-** work for WITHOUT ROWID tables.
+** Implementation of ".dump --dir zDir ?--jobs nJob?" for the tables that
+** match zLike.  Return the number of errors.
 */
-static void tryToCloneData(
-  ShellState *p,
-  sqlite3 *newDb,
-  const char *zTable
-){
+static int dump_dir(ShellState *p, const char *zDir, const char *zLike,
+                    int nJob){
+  DumpDirJob sJob;
+  FILE *pSaved = p->out;
+  FILE *out;
+  pthread_t *aThread = 0;
   sqlite3_stmt *pQuery = 0;
-  sqlite3_stmt *pInsert = 0;
-  char *zQuery = 0;
-  char *zInsert = 0;
-  int rc;
-  int i, j, n;
-  int nTable = strlen30(zTable);
-  int k = 0;
-  int cnt = 0;
-  const int spinRate = 10000;
+  char *zSql;
+  int dataOnly = (p->shellFlgs & SHFLG_DumpDataOnly)!=0;
+  int noSys = (p->shellFlgs & SHFLG_DumpNoSys)!=0;
+  int bOwnTxn = sqlite3_get_autocommit(p->db);
+  int bShared = 0;
+  int nAlloc = 0;
+  int nStarted = 0;
+  int nErr = 0;
+  int i;
 
-  zQuery = sqlite3_mprintf("SELECT * FROM \"%w\"", zTable);
-  shell_check_oom(zQuery);
-  rc = sqlite3_prepare_v2(p->db, zQuery, -1, &pQuery, 0);
-  if( rc ){
-    eputf("Error %d: %s on [%s]\n",
-          sqlite3_extended_errcode(p->db), sqlite3_errmsg(p->db), zQuery);
-    goto end_data_xfer;
+  if( mkdir(zDir, 0777) && errno!=EEXIST ){
+    eputf("Error: cannot create directory \"%s\"\n", zDir);
+    return 1;
   }
-  n = sqlite3_column_count(pQuery);
-  zInsert = sqlite3_malloc64(200 + nTable + n*3);
-  shell_check_oom(zInsert);
-  sqlite3_snprintf(200+nTable,zInsert,
-                   "INSERT OR IGNORE INTO \"%s\" VALUES(?", zTable);
-  i = strlen30(zInsert);
-  for(j=1; j<n; j++){
-    memcpy(zInsert+i, ",?", 2);
-    i += 2;
+  zSql = sqlite3_mprintf("%s/0-schema.sql", zDir);
+  shell_check_oom(zSql);
+  i = access(zSql, 0);
+  sqlite3_free(zSql);
+  if( i==0 ){
+    eputf("Error: \"%s\" already holds a dump\n", zDir);
+    return 1;
   }
-  memcpy(zInsert+i, ");", 3);
-  rc = sqlite3_prepare_v2(newDb, zInsert, -1, &pInsert, 0);
-  if( rc ){
-    eputf("Error %d: %s on [%s]\n",
-          sqlite3_extended_errcode(newDb), sqlite3_errmsg(newDb), zInsert);
-    goto end_data_xfer;
+  if( bOwnTxn && shell_hold_snapshot(p->db, &bShared)!=SQLITE_OK ){
+    eputf("Error: %s\n", sqlite3_errmsg(p->db));
+    return 1;
   }
-  for(k=0; k<2; k++){
-    while( (rc = sqlite3_step(pQuery))==SQLITE_ROW ){
-      for(i=0; i<n; i++){
-        switch( sqlite3_column_type(pQuery, i) ){
-          case SQLITE_NULL: {
-            sqlite3_bind_null(pInsert, i+1);
-            break;
-          }
-          case SQLITE_INTEGER: {
-            sqlite3_bind_int64(pInsert, i+1, sqlite3_column_int64(pQuery,i));
-            break;
-          }
-          case SQLITE_FLOAT: {
-            sqlite3_bind_double(pInsert, i+1, sqlite3_column_double(pQuery,i));
-            break;
-          }
-          case SQLITE_TEXT: {
-            sqlite3_bind_text(pInsert, i+1,
-                             (const char*)sqlite3_column_text(pQuery,i),
-                             -1, SQLITE_STATIC);
-            break;
-          }
-          case SQLITE_BLOB: {
-            sqlite3_bind_blob(pInsert, i+1, sqlite3_column_blob(pQuery,i),
-                                            sqlite3_column_bytes(pQuery,i),
-                                            SQLITE_STATIC);
-            break;
-          }
-        }
-      } /* End for */
-      rc = sqlite3_step(pInsert);
-      if( rc!=SQLITE_OK && rc!=SQLITE_ROW && rc!=SQLITE_DONE ){
-        eputf("Error %d: %s\n",
-              sqlite3_extended_errcode(newDb), sqlite3_errmsg(newDb));
+  sqlite3_exec(p->db, "PRAGMA writable_schema=ON;", 0, 0, 0);
+  memset(&sJob, 0, sizeof(sJob));
+  sJob.p = p;
+  sJob.zFile = sqlite3_db_filename(p->db, "main");
+
+  /* 0-schema.sql, and the list of tables */
+  out = dump_dir_output(p, zDir, "0-schema.sql");
+  if( out==0 ){
+    nErr++;
+    goto end_dump_dir;
+  }
+  if( !dataOnly ){
+    oputz("PRAGMA foreign_keys=OFF;\n");
+    oputz("BEGIN TRANSACTION;\n");
+  }
+  p->writableSchema = 0;
+  p->nErr = 0;
+  zSql = sqlite3_mprintf(
+    "SELECT name, type, sql FROM sqlite_schema AS o "
+    "WHERE (%s) AND type=='table'"
+    "  AND sql NOT NULL"
+    " ORDER BY tbl_name='sqlite_sequence', rowid",
+    zLike
+  );
+  shell_check_oom(zSql);
+  if( sqlite3_prepare_v2(p->db, zSql, -1, &pQuery, 0)!=SQLITE_OK ){
+    eputf("Error: %s\n", sqlite3_errmsg(p->db));
+    p->nErr++;
+  }
+  sqlite3_free(zSql);
+  while( pQuery && sqlite3_step(pQuery)==SQLITE_ROW ){
+    const char *zTable = (const char*)sqlite3_column_text(pQuery, 0);
+    const char *zSchema = (const char*)sqlite3_column_text(pQuery, 2);
+    const char *zPre = 0;
+    DumpDirTable *pTab;
+    if( zTable==0 || zSchema==0 ) continue;
+    /* As in dump_callback() */
+    if( cli_strcmp(zTable, "sqlite_sequence")==0 && !noSys ){
+      if( !dataOnly ) zPre = "DELETE FROM sqlite_sequence;\n";
+    }else if( sqlite3_strglob("sqlite_stat?", zTable)==0 && !noSys ){
+      if( !dataOnly ) zPre = "ANALYZE sqlite_schema;\n";
+    }else if( cli_strncmp(zTable, "sqlite_", 7)==0 ){
+      continue;
+    }else if( dataOnly ){
+      /* no-op */
+    }else if( cli_strncmp(zSchema, "CREATE VIRTUAL TABLE", 20)==0 ){
+      char *zIns;
+      if( !p->writableSchema ){
+        oputz("PRAGMA writable_schema=ON;\n");
+        p->writableSchema = 1;
+      }
+      zIns = sqlite3_mprintf(
+         "INSERT INTO sqlite_schema(type,name,tbl_name,rootpage,sql)"
+         "VALUES('table','%q','%q',0,'%q');",
+         zTable, zTable, zSchema);
+      shell_check_oom(zIns);
+      oputf("%s\n", zIns);
+      sqlite3_free(zIns);
+      continue;
+    }else{
+      printSchemaLine(zSchema, ";\n");
+    }
+    pTab = dump_dir_add(&sJob, &nAlloc);
+    if( dump_dir_table_sql(p, zTable, pTab) ){
+      sJob.nTable--;
+      p->nErr++;
+      continue;
+    }
+    pTab->zName = sqlite3_mprintf("%s", zTable);
+    pTab->zFile = sqlite3_mprintf("%s/1-%06d.sql", zDir, sJob.nTable);
+    shell_check_oom(pTab->zName);
+    shell_check_oom(pTab->zFile);
+    pTab->zPre = zPre;
+  }
+  sqlite3_finalize(pQuery);
+  if( p->writableSchema ){
+    oputz("PRAGMA writable_schema=OFF;\n");
+    p->writableSchema = 0;
+  }
+  if( !dataOnly ){
+    oputz(p->nErr ? "ROLLBACK; -- due to errors\n" : "COMMIT;\n");
+  }
+  nErr += p->nErr;
+  fclose(out);
+  p->out = pSaved;
+  setOutputStream(pSaved);
+
+  /* 2-post.sql */
+  if( !dataOnly && (out = dump_dir_output(p, zDir, "2-post.sql"))!=0 ){
+    p->nErr = 0;
+    oputz("BEGIN TRANSACTION;\n");
+    zSql = sqlite3_mprintf(
+      "SELECT sql FROM sqlite_schema AS o "
+      "WHERE (%s) AND sql NOT NULL"
+      "  AND type IN ('index','trigger','view')",
+      zLike
+    );
+    shell_check_oom(zSql);
+    run_table_dump_query(p, zSql);
+    sqlite3_free(zSql);
+    oputz(p->nErr ? "ROLLBACK; -- due to errors\n" : "COMMIT;\n");
+    nErr += p->nErr;
+    fclose(out);
+    p->out = pSaved;
+    setOutputStream(pSaved);
+  }else if( !dataOnly ){
+    nErr++;
+  }
+
+  /* 1-NNNNNN.sql, on worker threads if they can open the database */
+  sJob.aDone = sqlite3_malloc64((sJob.nTable+1)*sizeof(int));
+  shell_check_oom(sJob.aDone);
+  pthread_mutex_init(&sJob.mutex, 0);
+  pthread_cond_init(&sJob.cond, 0);
+  timeOfDay();  /* So that it finds its VFS before the workers call it */
+  if( nJob>1 && bOwnTxn && !bShared ){
+    eputz("Warning: WAL database is locked, dumping without --jobs\n");
+  }
+  if( nJob>1 && bOwnTxn && bShared && sJob.zFile && sJob.zFile[0]
+   && sqlite3_threadsafe()
+  ){
+    aThread = sqlite3_malloc64(nJob*sizeof(pthread_t));
+    shell_check_oom(aThread);
+    for(i=0; i<nJob && i<sJob.nTable; i++){
+      if( pthread_create(&aThread[nStarted], 0, dump_dir_worker, &sJob)==0 ){
+        nStarted++;
       }
-      sqlite3_reset(pInsert);
-      cnt++;
-      if( (cnt%spinRate)==0 ){
-        printf("%c\b", "|/-\\"[(cnt/spinRate)%4]);
-        fflush(stdout);
+    }
+  }
+  for(i=0; i<sJob.nTable; i++){
+    DumpDirTable *pTab;
+    if( nStarted==0 ){
+      pTab = &sJob.aTable[i];
+      dump_dir_write_table(&sJob, p->db, i);
+      pTab->iEnd = timeOfDay();
+    }else{
+      pTab = &sJob.aTable[dump_dir_wait(&sJob, i)];
+    }
+    dump_dir_report(pTab);
+    nErr += pTab->nErr;
+  }
+  for(i=0; i<nStarted; i++){
+    pthread_join(aThread[i], 0);
+  }
+  pthread_cond_destroy(&sJob.cond);
+  pthread_mutex_destroy(&sJob.mutex);
+
+end_dump_dir:
+  sqlite3_exec(p->db, "PRAGMA writable_schema=OFF;", 0, 0, 0);
+  if( bOwnTxn ) sqlite3_exec(p->db, "ROLLBACK;", 0, 0, 0);
+  dump_dir_free(&sJob);
+  sqlite3_free(aThread);
+  return nErr;
+}
+
+/* Run the SQL in file zFile on the main connection, as ".read" does */
+static int dump_dir_read(ShellState *p, const char *zFile){
+  FILE *inSaved = p->in;
+  int savedLineno = p->lineno;
+  int rc;
+  if( (p->in = openChrSource(zFile))==0 ){
+    eputf("Error: cannot open \"%s\"\n", zFile);
+    rc = 1;
+  }else{
+    rc = process_input(p);
+    fclose(p->in);
+  }
+  p->in = inSaved;
+  p->lineno = savedLineno;
+  return rc;
+}
+
+/* Return the table named on the "-- Table:" line of zFile, or NULL */
+static char *restore_dir_table_name(const char *zFile){
+  FILE *in = fopen(zFile, "rb");
+  char *zLine = in ? local_getline(0, in) : 0;
+  char *zName = 0;
+  if( zLine && cli_strncmp(zLine, "-- Table: '", 11)==0 ){
+    sqlite3_str *pName = sqlite3_str_new(0);
+    int i;
+    for(i=11; zLine[i]; i++){
+      if( zLine[i]=='\'' ){
+        if( zLine[i+1]!='\'' ) break;
+        i++;
       }
-    } /* End while */
-    if( rc==SQLITE_DONE ) break;
-    sqlite3_finalize(pQuery);
-    sqlite3_free(zQuery);
-    zQuery = sqlite3_mprintf("SELECT * FROM \"%w\" ORDER BY rowid DESC;",
-                             zTable);
-    shell_check_oom(zQuery);
-    rc = sqlite3_prepare_v2(p->db, zQuery, -1, &pQuery, 0);
-    if( rc ){
-      eputf("Warning: cannot step \"%s\" backwards", zTable);
-      break;
+      sqlite3_str_appendchar(pName, 1, zLine[i]);
     }
-  } /* End for(k=0...) */
+    zName = sqlite3_str_finish(pName);
+    if( zLine[i]!='\'' || zLine[i+1]!=0 || zName==0 ){
+      sqlite3_free(zName);
+      zName = 0;
+    }
+  }
+  free(zLine);
+  if( in ) fclose(in);
+  return zName;
+}
 
-end_data_xfer:
-  sqlite3_finalize(pQuery);
-  sqlite3_finalize(pInsert);
-  sqlite3_free(zQuery);
-  sqlite3_free(zInsert);
+/* Run zSql on the staging database of pTab */
+static void restore_dir_exec(DumpDirTable *pTab, sqlite3 *db,
+                             const char *zSql){
+  char *zErr = 0;
+  if( sqlite3_exec(db, zSql, 0, 0, &zErr)!=SQLITE_OK ){
+    dump_dir_error(pTab, "%s", zErr ? zErr : sqlite3_errmsg(db));
+  }
+  sqlite3_free(zErr);
+}
+
+/*
+** Create the staging database of pTab and replay its 1-NNNNNN.sql file
+** into it.  This runs on a worker thread, so it splits the file into
+** statements itself, rather than with process_input().
+*/
+static void restore_dir_stage_table(DumpDirTable *pTab){
+  sqlite3 *db = 0;
+  FILE *in;
+  char *zLine = 0;
+  sqlite3_str *pSql;
+  pTab->iStart = timeOfDay();
+  if( seenInterrupt ){
+    dump_dir_error(pTab, "interrupted");
+    return;
+  }
+  in = fopen(pTab->zFile, "rb");
+  if( in==0 ){
+    dump_dir_error(pTab, "cannot open \"%s\"", pTab->zFile);
+    return;
+  }
+  unlink(pTab->zStage);
+  if( sqlite3_open(pTab->zStage, &db)!=SQLITE_OK
+   || sqlite3_exec(db, "PRAGMA journal_mode=OFF; PRAGMA synchronous=OFF;"
+                       "PRAGMA foreign_keys=OFF;"
+                       "PRAGMA ignore_check_constraints=ON;", 0, 0, 0)
+   || sqlite3_exec(db, pTab->zCreate, 0, 0, 0)
+  ){
+    dump_dir_error(pTab, "%s", sqlite3_errmsg(db));
+    sqlite3_close(db);
+    fclose(in);
+    return;
+  }
+  pTab->bStaged = 1;
+  pSql = sqlite3_str_new(0);
+  while( (zLine = local_getline(zLine, in))!=0 ){
+    const char *zStmt;
+    if( sqlite3_str_length(pSql)==0 && sqlite3_complete(zLine) ){
+      zStmt = zLine;
+    }else{
+      sqlite3_str_appendall(pSql, zLine);
+      sqlite3_str_appendchar(pSql, 1, '\n');
+      zStmt = sqlite3_str_value(pSql);
+      if( zStmt==0 || !sqlite3_complete(zStmt) ) continue;
+    }
+    restore_dir_exec(pTab, db, zStmt);
+    sqlite3_str_reset(pSql);
+  }
+  if( sqlite3_str_length(pSql)>0 ){
+    restore_dir_exec(pTab, db, sqlite3_str_value(pSql));
+  }
+  if( sqlite3_str_errcode(pSql) ) dump_dir_error(pTab, "out of memory");
+  sqlite3_free(sqlite3_str_finish(pSql));
+  pTab->nByte = ftell(in);
+  fclose(in);
+  sqlite3_close(db);
 }
 
+/* The body of each worker thread of a ".restore --dir" */
+static void *restore_dir_worker(void *pArg){
+  DumpDirJob *pJob = (DumpDirJob*)pArg;
+  int iTable;
+  while( (iTable = dump_dir_next(pJob))>=0 ){
+    restore_dir_stage_table(&pJob->aTable[iTable]);
+    dump_dir_done(pJob, iTable);
+  }
+  return 0;
+}
 
 /*
-** Try to transfer all rows of the schema that match zWhere.  For
-** each row, invoke xForEach() on the object defined by that row.
-** If an error is encountered while moving forward through the
-** sqlite_schema table, try again moving backwards.
+** Copy the rows of the staged table pTab into the main database.  Use
+** "INSERT INTO ... SELECT *" and, if that fails or does not keep the
+** rowids, copy the columns by name, with the rowid.
 */
-static void tryToCloneSchema(
-  ShellState *p,
-  sqlite3 *newDb,
-  const char *zWhere,
-  void (*xForEach)(ShellState*,sqlite3*,const char*)
-){
-  sqlite3_stmt *pQuery = 0;
-  char *zQuery = 0;
+static void restore_dir_merge(sqlite3 *db, DumpDirTable *pTab){
+  char *zSql;
   int rc;
-  const unsigned char *zName;
-  const unsigned char *zSql;
-  char *zErrMsg = 0;
-
-  zQuery = sqlite3_mprintf("SELECT name, sql FROM sqlite_schema"
-                           " WHERE %s ORDER BY rowid ASC", zWhere);
-  shell_check_oom(zQuery);
-  rc = sqlite3_prepare_v2(p->db, zQuery, -1, &pQuery, 0);
+  zSql = sqlite3_mprintf("ATTACH %Q AS restore_stage;", pTab->zStage);
+  shell_check_oom(zSql);
+  rc = sqlite3_exec(db, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
   if( rc ){
-    eputf("Error: (%d) %s on [%s]\n", sqlite3_extended_errcode(p->db),
-          sqlite3_errmsg(p->db), zQuery);
-    goto end_schema_xfer;
+    dump_dir_error(pTab, "%s", sqlite3_errmsg(db));
+    unlink(pTab->zStage);
+    return;
   }
-  while( (rc = sqlite3_step(pQuery))==SQLITE_ROW ){
-    zName = sqlite3_column_text(pQuery, 0);
-    zSql = sqlite3_column_text(pQuery, 1);
-    if( zName==0 || zSql==0 ) continue;
-    if( sqlite3_stricmp((char*)zName, "sqlite_sequence")!=0 ){
-      sputf(stdout, "%s... ", zName); fflush(stdout);
-      sqlite3_exec(newDb, (const char*)zSql, 0, 0, &zErrMsg);
-      if( zErrMsg ){
-        eputf("Error: %s\nSQL: [%s]\n", zErrMsg, zSql);
-        sqlite3_free(zErrMsg);
-        zErrMsg = 0;
+  zSql = sqlite3_mprintf(
+     "SAVEPOINT restore_merge;"
+     "INSERT INTO main.\"%w\" SELECT * FROM restore_stage.\"%w\";",
+     pTab->zName, pTab->zName);
+  shell_check_oom(zSql);
+  rc = sqlite3_exec(db, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc==SQLITE_OK ){
+    sqlite3_stmt *pStmt = 0;
+    zSql = sqlite3_mprintf(
+       "SELECT (SELECT max(rowid) FROM main.\"%w\")"
+       "    IS (SELECT max(rowid) FROM restore_stage.\"%w\")",
+       pTab->zName, pTab->zName);
+    shell_check_oom(zSql);
+    if( sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0)==SQLITE_OK
+     && sqlite3_step(pStmt)==SQLITE_ROW
+     && sqlite3_column_int(pStmt, 0)==0
+    ){
+      rc = SQLITE_MISMATCH;
+    }
+    sqlite3_finalize(pStmt);
+    sqlite3_free(zSql);
+  }
+  if( rc!=SQLITE_OK ){
+    char *zCols = 0;
+    sqlite3_stmt *pStmt = 0;
+    sqlite3_exec(db, "ROLLBACK TO restore_merge;", 0, 0, 0);
+    if( sqlite3_prepare_v2(db,
+          "SELECT group_concat(format('\"%w\"', name), ',')"
+          "  FROM pragma_table_xinfo(?1, 'restore_stage') WHERE hidden=0",
+          -1, &pStmt, 0)==SQLITE_OK ){
+      sqlite3_bind_text(pStmt, 1, pTab->zName, -1, SQLITE_STATIC);
+      if( sqlite3_step(pStmt)==SQLITE_ROW ){
+        zCols = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 0));
+        shell_check_oom(zCols);
       }
     }
-    if( xForEach ){
-      xForEach(p, newDb, (const char*)zName);
+    sqlite3_finalize(pStmt);
+    zSql = sqlite3_mprintf(
+       "INSERT INTO main.\"%w\"(rowid,%s) SELECT rowid,%s"
+       "  FROM restore_stage.\"%w\";",
+       pTab->zName, zCols, zCols, pTab->zName);
+    shell_check_oom(zSql);
+    rc = sqlite3_exec(db, zSql, 0, 0, 0);
+    sqlite3_free(zSql);
+    if( rc!=SQLITE_OK ){
+      /* A WITHOUT ROWID table, or one with a column named "rowid" */
+      zSql = sqlite3_mprintf(
+         "INSERT INTO main.\"%w\"(%s) SELECT %s FROM restore_stage.\"%w\";",
+         pTab->zName, zCols, zCols, pTab->zName);
+      shell_check_oom(zSql);
+      rc = sqlite3_exec(db, zSql, 0, 0, 0);
+      sqlite3_free(zSql);
     }
-    sputz(stdout, "done\n");
+    sqlite3_free(zCols);
   }
-  if( rc!=SQLITE_DONE ){
-    sqlite3_finalize(pQuery);
-    sqlite3_free(zQuery);
-    zQuery = sqlite3_mprintf("SELECT name, sql FROM sqlite_schema"
-                             " WHERE %s ORDER BY rowid DESC", zWhere);
-    shell_check_oom(zQuery);
-    rc = sqlite3_prepare_v2(p->db, zQuery, -1, &pQuery, 0);
-    if( rc ){
-      eputf("Error: (%d) %s on [%s]\n",
-            sqlite3_extended_errcode(p->db), sqlite3_errmsg(p->db), zQuery);
-      goto end_schema_xfer;
+  if( rc==SQLITE_OK ){
+    pTab->nRow = sqlite3_changes64(db);
+  }else{
+    dump_dir_error(pTab, "%s", sqlite3_errmsg(db));
+    sqlite3_exec(db, "ROLLBACK TO restore_merge;", 0, 0, 0);
+  }
+  sqlite3_exec(db, "RELEASE restore_merge;", 0, 0, 0);
+  sqlite3_exec(db, "DETACH restore_stage;", 0, 0, 0);
+  unlink(pTab->zStage);
+}
+
+/*
+** Implementation of ".restore --dir zDir ?--jobs nJob?".  Return the
+** number of errors.
+*/
+static int restore_dir(ShellState *p, const char *zDir, int nJob){
+  DumpDirJob sJob;
+  pthread_t *aThread = 0;
+  char *zFile;
+  int nAlloc = 0;
+  int nStaged = 0;
+  int nStarted = 0;
+  int nErr = 0;
+  int i;
+
+  if( !sqlite3_get_autocommit(p->db) ){
+    eputz("Error: cannot run .restore --dir within a transaction\n");
+    return 1;
+  }
+  zFile = sqlite3_mprintf("%s/0-schema.sql", zDir);
+  shell_check_oom(zFile);
+  if( access(zFile, 0) ){
+    eputf("Error: \"%s\" holds no dump\n", zDir);
+    sqlite3_free(zFile);
+    return 1;
+  }
+  memset(&sJob, 0, sizeof(sJob));
+  sJob.p = p;
+  if( dump_dir_read(p, zFile) ) nErr++;
+  sqlite3_free(zFile);
+
+  /* The data files, and which of them can be staged */
+  for(i=1; 1; i++){
+    DumpDirTable *pTab;
+    zFile = sqlite3_mprintf("%s/1-%06d.sql", zDir, i);
+    shell_check_oom(zFile);
+    if( access(zFile, 0) ){
+      sqlite3_free(zFile);
+      break;
     }
-    while( sqlite3_step(pQuery)==SQLITE_ROW ){
-      zName = sqlite3_column_text(pQuery, 0);
-      zSql = sqlite3_column_text(pQuery, 1);
-      if( zName==0 || zSql==0 ) continue;
-      if( sqlite3_stricmp((char*)zName, "sqlite_sequence")==0 ) continue;
-      sputf(stdout, "%s... ", zName); fflush(stdout);
-      sqlite3_exec(newDb, (const char*)zSql, 0, 0, &zErrMsg);
-      if( zErrMsg ){
-        eputf("Error: %s\nSQL: [%s]\n", zErrMsg, zSql);
-        sqlite3_free(zErrMsg);
-        zErrMsg = 0;
-      }
-      if( xForEach ){
-        xForEach(p, newDb, (const char*)zName);
+    pTab = dump_dir_add(&sJob, &nAlloc);
+    pTab->zFile = zFile;
+    pTab->zName = restore_dir_table_name(zFile);
+    pTab->bMain = 1;
+    if( nJob>1 && sqlite3_threadsafe() && pTab->zName
+     && cli_strncmp(pTab->zName, "sqlite_", 7)!=0
+    ){
+      sqlite3_stmt *pStmt = 0;
+      char *zSql = sqlite3_mprintf(
+         "SELECT sql FROM main.sqlite_schema"
+         " WHERE type='table' AND name=?1"
+         "   AND sql NOT LIKE 'CREATE VIRTUAL TABLE%%'"
+         "   AND NOT EXISTS(SELECT 1 FROM main.\"%w\")",
+         pTab->zName);
+      shell_check_oom(zSql);
+      if( sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, 0)==SQLITE_OK ){
+        sqlite3_bind_text(pStmt, 1, pTab->zName, -1, SQLITE_STATIC);
+        if( sqlite3_step(pStmt)==SQLITE_ROW ){
+          pTab->zCreate = sqlite3_mprintf("%s", sqlite3_column_text(pStmt,0));
+          pTab->zStage = sqlite3_mprintf("%s/stage-%06d.db", zDir, i);
+          shell_check_oom(pTab->zCreate);
+          shell_check_oom(pTab->zStage);
+          pTab->bMain = 0;
+          nStaged++;
+        }
       }
-      sputz(stdout, "done\n");
+      sqlite3_finalize(pStmt);
+      sqlite3_free(zSql);
     }
   }
-end_schema_xfer:
-  sqlite3_finalize(pQuery);
-  sqlite3_free(zQuery);
-}
 
+  /* Stage on the workers, merge here */
+  sJob.aDone = sqlite3_malloc64((sJob.nTable+1)*sizeof(int));
+  shell_check_oom(sJob.aDone);
+  pthread_mutex_init(&sJob.mutex, 0);
+  pthread_cond_init(&sJob.cond, 0);
+  timeOfDay();  /* So that it finds its VFS before the workers call it */
+  if( nStaged>0 ){
+    aThread = sqlite3_malloc64(nJob*sizeof(pthread_t));
+    shell_check_oom(aThread);
+    for(i=0; i<nJob && i<nStaged; i++){
+      if( pthread_create(&aThread[nStarted], 0, restore_dir_worker, &sJob)==0 ){
+        nStarted++;
+      }
+    }
+  }
+  if( nStarted==0 ){
+    for(i=0; i<sJob.nTable; i++) sJob.aTable[i].bMain = 1;
+    nStaged = 0;
+  }
+  for(i=0; i<nStaged; i++){
+    DumpDirTable *pTab = &sJob.aTable[dump_dir_wait(&sJob, i)];
+    if( pTab->bStaged ) restore_dir_merge(p->db, pTab);
+    pTab->iEnd = timeOfDay();
+    dump_dir_report(pTab);
+    nErr += pTab->nErr;
+  }
+  for(i=0; i<nStarted; i++){
+    pthread_join(aThread[i], 0);
+  }
+  pthread_cond_destroy(&sJob.cond);
+  pthread_mutex_destroy(&sJob.mutex);
+
+  /* The rest of the data files, in order, then 2-post.sql */
+  for(i=0; i<sJob.nTable; i++){
+    DumpDirTable *pTab = &sJob.aTable[i];
+    sqlite3_int64 nChange = sqlite3_total_changes64(p->db);
+    struct stat x;
+    if( !pTab->bMain ) continue;
+    pTab->iStart = timeOfDay();
+    if( dump_dir_read(p, pTab->zFile) ) pTab->nErr++;
+    pTab->iEnd = timeOfDay();
+    pTab->nRow = sqlite3_total_changes64(p->db) - nChange;
+    if( stat(pTab->zFile, &x)==0 ) pTab->nByte = x.st_size;
+    dump_dir_report(pTab);
+    nErr += pTab->nErr;
+  }
+  zFile = sqlite3_mprintf("%s/2-post.sql", zDir);
+  shell_check_oom(zFile);
+  if( access(zFile, 0)==0 && dump_dir_read(p, zFile) ) nErr++;
+  sqlite3_free(zFile);
+  dump_dir_free(&sJob);
+  sqlite3_free(aThread);
+  return nErr;
+}
+#endif /* SHELL_THREADS && SHELL_OUT_BUFFER */
+// End Android Add
 /*
 ** Open a new database file named "zNewDb".  Try to recover as much information
 ** as possible out of the main database (which might be corrupt) and write it
 ** into zNewDb.
 */
-static void tryToClone(ShellState *p, const char *zNewDb){
+// Begin Android Add
+/* If nJob>0, copy the data of the tables on that many threads. */
+static void tryToClone(ShellState *p, const char *zNewDb, int nJob){
+// End Android Add
   int rc;
   sqlite3 *newDb = 0;
   if( access(zNewDb,0)==0 ){
@@ -22984,6 +29453,13 @@ static void tryToClone(ShellState *p, const char *zNewDb){
   }else{
     sqlite3_exec(p->db, "PRAGMA writable_schema=ON;", 0, 0, 0);
     sqlite3_exec(newDb, "BEGIN EXCLUSIVE;", 0, 0, 0);
+// Begin Android Add
+#ifdef SHELL_THREADS
+    if( nJob>0 && clone_with_jobs(p, newDb, nJob) ){
+      /* The tables and their data have been copied */
+    }else
+#endif
+// End Android Add
     tryToCloneSchema(p, newDb, "type='table'", tryToCloneData);
     tryToCloneSchema(p, newDb, "type!='table'", 0);
     sqlite3_exec(newDb, "COMMIT;", 0, 0, 0);
@@ -23708,6 +30184,9 @@ struct ArCommand {
   u8 bAppend;                     /* True if --append */
   u8 bGlob;                       /* True if --glob */
   u8 fromCmdLine;                 /* Run from -A instead of .archive */
+// Begin Android Add
+  int nJob;                       /* --jobs argument, or 0 */
+// End Android Add
   int nArg;                       /* Number of command arguments */
   char *zSrcTable;                /* "sqlar", "zipfile($file)" or "zip" */
   const char *zFile;              /* --file argument, or NULL */
@@ -23765,6 +30244,9 @@ static int arErrorMsg(ArCommand *pAr, const char *zFmt, ...){
 #define AR_SWITCH_APPEND     11
 #define AR_SWITCH_DRYRUN     12
 #define AR_SWITCH_GLOB       13
+// Begin Android Add
+#define AR_SWITCH_JOBS       14
+// End Android Add
 
 static int arProcessSwitch(ArCommand *pAr, int eSwitch, const char *zArg){
   switch( eSwitch ){
@@ -23799,6 +30281,14 @@ static int arProcessSwitch(ArCommand *pAr, int eSwitch, const char *zArg){
     case AR_SWITCH_DIRECTORY:
       pAr->zDir = zArg;
       break;
+// Begin Android Add
+    case AR_SWITCH_JOBS:
+      pAr->nJob = (int)integerValue(zArg);
+      if( pAr->nJob<1 ){
+        return arErrorMsg(pAr, "--jobs requires a positive integer");
+      }
+      break;
+// End Android Add
   }
 
   return SQLITE_OK;
@@ -23834,6 +30324,9 @@ static int arParseCommand(
     { "directory", 'C', AR_SWITCH_DIRECTORY, 1 },
     { "dryrun",    'n', AR_SWITCH_DRYRUN,    0 },
     { "glob",      'g', AR_SWITCH_GLOB,      0 },
+// Begin Android Add
+    { "jobs",      'j', AR_SWITCH_JOBS,      1 },
+// End Android Add
   };
   int nSwitch = sizeof(aSwitch) / sizeof(struct ArSwitch);
   struct ArSwitch *pEnd = &aSwitch[nSwitch];
@@ -24108,11 +30601,100 @@ static int arRemoveCommand(ArCommand *pAr){
       }
     }
   }
-  sqlite3_free(zWhere);
-  sqlite3_free(zSql);
+  sqlite3_free(zWhere);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+// Begin Android Add
+#ifdef SHELL_THREADS
+/*
+** Do the first pass of arExtractCommand() for a ZIP archive with the
+** workers of pPool.  Members are read as raw data, inflated on the
+** workers, and written with writefile() on this thread in archive order.
+*/
+static int arExtractZipJobs(
+  ArCommand *pAr,                 /* Command arguments and options */
+  ZipfilePool *pPool,             /* Workers to inflate members */
+  const char *zDir,               /* Directory prefix, "" or ending in '/' */
+  const char *zWhere              /* WHERE clause from arWhereClause() */
+){
+  const char *zSql =
+    "SELECT ($dir || name), method, sz, rawdata, mode, mtime "
+    "FROM %s WHERE (%s) AND name NOT GLOB '*..[/\\]*'";
+  sqlite3_stmt *pSql = 0;
+  sqlite3_stmt *pWrite = 0;
+  int rc = SQLITE_OK;
+  int bEof = 0;
+
+  shellPreparePrintf(pAr->db, &rc, &pSql, zSql, pAr->zSrcTable, zWhere);
+  shellPrepare(pAr->db, &rc, "SELECT writefile(?1, ?2, ?3, ?4)", &pWrite);
+  if( rc==SQLITE_OK ){
+    int j = sqlite3_bind_parameter_index(pSql, "$dir");
+    sqlite3_bind_text(pSql, j, zDir, -1, SQLITE_STATIC);
+  }
+  while( rc==SQLITE_OK && !bEof ){
+    ZipfileJob *pJob = 0;
+    if( SQLITE_ROW==sqlite3_step(pSql) ){
+      const char *zName = (const char*)sqlite3_column_text(pSql, 0);
+      int iMethod = sqlite3_column_int(pSql, 1);
+      int sz = sqlite3_column_int(pSql, 2);
+      const u8 *aRaw = sqlite3_column_blob(pSql, 3);
+      int nRaw = sqlite3_column_bytes(pSql, 3);
+      int bNoData = sqlite3_column_type(pSql, 3)==SQLITE_NULL
+                 || (iMethod!=0 && iMethod!=8);
+      int eJob = (!bNoData && iMethod==8 && sz>0) ?
+                     ZIPFILE_JOB_INFLATE : ZIPFILE_JOB_NONE;
+      ZipfileEntry *pEntry = zipfileNewEntry(zName ? zName : "");
+      if( pEntry ){
+        pEntry->cds.iExternalAttr = (u32)sqlite3_column_int(pSql, 4)<<16;
+        pEntry->mUnixTime = (u32)sqlite3_column_int64(pSql, 5);
+        pJob = zipfileJobNew(eJob, pEntry, bNoData ? 0 : aRaw,
+                             bNoData ? 0 : nRaw);
+        if( pJob==0 ) zipfileEntryFree(pEntry);
+      }
+      if( pJob==0 ){
+        rc = SQLITE_NOMEM;
+        break;
+      }
+      pJob->bFreeEntry = 1;
+      pJob->bNoData = (u8)bNoData;
+      pJob->nOut = sz;
+      zipfilePoolSubmit(pPool, pJob);
+    }else{
+      bEof = 1;
+    }
+    while( rc==SQLITE_OK && (pJob = zipfilePoolTake(pPool, bEof))!=0 ){
+      ZipfileEntry *pEntry = pJob->pEntry;
+      if( pJob->rc!=SQLITE_OK ){
+        eputf("SQL error: %s\n", pJob->zErr ? pJob->zErr : "out of memory");
+        rc = pJob->rc;
+      }else{
+        sqlite3_bind_text(pWrite, 1, pEntry->cds.zFile, -1, SQLITE_STATIC);
+        if( pJob->bNoData ){
+          sqlite3_bind_null(pWrite, 2);
+        }else if( pJob->eJob==ZIPFILE_JOB_INFLATE ){
+          sqlite3_bind_blob(pWrite, 2, pJob->aOut, pJob->nOut, SQLITE_STATIC);
+        }else{
+          sqlite3_bind_blob(pWrite, 2, pJob->aIn, pJob->nIn, SQLITE_STATIC);
+        }
+        sqlite3_bind_int(pWrite, 3, (int)(pEntry->cds.iExternalAttr>>16));
+        sqlite3_bind_int64(pWrite, 4, pEntry->mUnixTime);
+        if( SQLITE_ROW==sqlite3_step(pWrite) && pAr->bVerbose ){
+          oputf("%s\n", pEntry->cds.zFile);
+        }
+        shellReset(&rc, pWrite);
+      }
+      zipfileJobFree(pJob);
+    }
+  }
+  shellFinalize(&rc, pWrite);
+  shellFinalize(&rc, pSql);
   return rc;
 }
+#endif /* SHELL_THREADS */
 
+// End Android Add
 /*
 ** Implementation of .ar "eXtract" command.
 */
@@ -24134,6 +30716,9 @@ static int arExtractCommand(ArCommand *pAr){
   char *zDir = 0;
   char *zWhere = 0;
   int i, j;
+// Begin Android Add
+  int iFirst = 0;                 /* First pass of the SELECT to run */
+// End Android Add
 
   /* If arguments are specified, check that they actually exist within
   ** the archive before proceeding. And formulate a WHERE clause to
@@ -24150,6 +30735,23 @@ static int arExtractCommand(ArCommand *pAr){
     if( zDir==0 ) rc = SQLITE_NOMEM;
   }
 
+// Begin Android Add
+#ifdef SHELL_THREADS
+  /* Inflate ZIP members on worker threads for the first pass. */
+  if( rc==SQLITE_OK && pAr->bZip && !pAr->bDryRun ){
+    ZipfilePool *pPool;
+    int nSave = zipfileNJob;
+    zipfileNJob = pAr->nJob;
+    pPool = zipfilePoolNew();
+    zipfileNJob = nSave;
+    if( pPool ){
+      rc = arExtractZipJobs(pAr, pPool, zDir, zWhere);
+      zipfilePoolFree(pPool);
+      iFirst = 1;
+    }
+  }
+#endif
+// End Android Add
   shellPreparePrintf(pAr->db, &rc, &pSql, zSql1,
       azExtraArg[pAr->bZip], pAr->zSrcTable, zWhere
   );
@@ -24164,6 +30766,9 @@ static int arExtractCommand(ArCommand *pAr){
     ** extracted directories must be reset after they are populated (as
     ** populating them changes the timestamp).  */
     for(i=0; i<2; i++){
+// Begin Android Add
+      if( i<iFirst ) continue;
+// End Android Add
       j = sqlite3_bind_parameter_index(pSql, "$dirOnly");
       sqlite3_bind_int(pSql, j, i);
       if( pAr->bDryRun ){
@@ -24267,9 +30872,17 @@ static int arCreateOrUpdateCommand(
   char zTemp[50];
   char *zExists = 0;
 
+// Begin Android Add
+#ifdef SHELL_THREADS
+  int nSaveJob = zipfileNJob;     /* Restore zipfileNJob to this */
+  if( pAr->nJob ) zipfileNJob = pAr->nJob;
+#endif
+// End Android Add
   arExecSql(pAr, "PRAGMA page_size=512");
   rc = arExecSql(pAr, "SAVEPOINT ar;");
-  if( rc!=SQLITE_OK ) return rc;
+// Begin Android Add
+  if( rc!=SQLITE_OK ) goto end_ar_command;
+// End Android Add
   zTemp[0] = 0;
   if( pAr->bZip ){
     /* Initialize the zipfile virtual table, if necessary */
@@ -24326,6 +30939,12 @@ end_ar_transaction:
     }
   }
   sqlite3_free(zExists);
+// Begin Android Add
+end_ar_command:
+#ifdef SHELL_THREADS
+  zipfileNJob = nSaveJob;
+#endif
+// End Android Add
   return rc;
 }
 
@@ -24737,6 +31356,401 @@ FROM (\
   }
 }
 
+// Begin Android Add
+/*
+** ".sha3sum --jobs N" hashes every table separately, splitting tables
+** with a wide range of rowids into SHA3_MAX_SEGMENTS ranges at most, and
+** hashes the ranges on N worker threads with their own read-only
+** connections.  The hash of a split table is the hash of the hashes of
+** its ranges, and the hash of the database is the hash of the names and
+** hashes of its tables.  So the result depends on the content only, not
+** on N, but it differs from the hash computed without --jobs, and is
+** labelled "(tree of table hashes)" in the output to make that plain.
+**
+** The hashes of the tables are kept in ShellState.sha3Cache, and reused
+** by the next ".sha3sum --jobs" as long as the data version of the main
+** database is unchanged.
+*/
+#define SHA3_SEGMENT_SPAN (1<<20)   /* Rowids per range, at least */
+#define SHA3_MAX_SEGMENTS 256       /* Ranges per table, at most */
+
+/* One query whose result is hashed by sha3_query() */
+typedef struct Sha3Segment Sha3Segment;
+struct Sha3Segment {
+  char *zSql;                 /* The query */
+  char *zErr;                 /* Error running it, or NULL */
+  unsigned char aHash[64];    /* Its hash */
+};
+
+/* One table to hash */
+typedef struct Sha3Table Sha3Table;
+struct Sha3Table {
+  char *zName;                /* Name of the table, lower case */
+  int iFirst;                 /* Index of its first segment */
+  int nSeg;                   /* Number of segments, or 0 if cached */
+  unsigned char aHash[64];    /* Its hash */
+};
+
+/* State shared by the threads of a ".sha3sum --jobs N" */
+typedef struct Sha3Job Sha3Job;
+struct Sha3Job {
+  const char *zFile;          /* Database file to read */
+  int iSize;                  /* Size of the hashes in bits */
+  Sha3Segment *aSeg;          /* Queries to hash */
+  int nSeg;                   /* Number of entries in aSeg[] */
+#ifdef SHELL_THREADS
+  pthread_mutex_t mutex;      /* Protects iNext */
+#endif
+  int iNext;                  /* Next segment for a worker to start on */
+};
+
+/* Append a segment running zSql, which is freed, to pJob */
+static void sha3_add_segment(Sha3Job *pJob, int *pnAlloc, char *zSql){
+  shell_check_oom(zSql);
+  if( pJob->nSeg>=*pnAlloc ){
+    *pnAlloc = *pnAlloc*2 + 64;
+    pJob->aSeg = sqlite3_realloc64(pJob->aSeg, *pnAlloc*sizeof(Sha3Segment));
+    shell_check_oom(pJob->aSeg);
+  }
+  memset(&pJob->aSeg[pJob->nSeg], 0, sizeof(Sha3Segment));
+  pJob->aSeg[pJob->nSeg++].zSql = zSql;
+}
+
+/*
+** Append the segments of table zTab to pJob.  A table with rowids is
+** split into ranges of at least SHA3_SEGMENT_SPAN rowids.  Others are
+** hashed with the same query as ".sha3sum" without --jobs uses.
+*/
+static void sha3_plan_table(sqlite3 *db, Sha3Job *pJob, int *pnAlloc,
+                            const char *zTab){
+  sqlite3_stmt *pStmt = 0;
+  char *zSql;
+  int nSeg = 1;
+  sqlite3_int64 iMin = 0, iMax = 0;
+  if( cli_strcmp(zTab, "sqlite_schema")==0 ){
+    sha3_add_segment(pJob, pnAlloc, sqlite3_mprintf(
+        "SELECT type,name,tbl_name,sql FROM sqlite_schema ORDER BY name;"));
+    return;
+  }
+  if( cli_strcmp(zTab, "sqlite_sequence")==0 ){
+    sha3_add_segment(pJob, pnAlloc, sqlite3_mprintf(
+        "SELECT name,seq FROM sqlite_sequence ORDER BY name;"));
+    return;
+  }
+  if( cli_strcmp(zTab, "sqlite_stat1")==0 ){
+    sha3_add_segment(pJob, pnAlloc, sqlite3_mprintf(
+        "SELECT tbl,idx,stat FROM sqlite_stat1 ORDER BY tbl,idx;"));
+    return;
+  }
+  if( cli_strcmp(zTab, "sqlite_stat4")==0 ){
+    sha3_add_segment(pJob, pnAlloc, sqlite3_mprintf(
+        "SELECT * FROM sqlite_stat4 ORDER BY tbl, idx, rowid;\n"));
+    return;
+  }
+  if( cli_strncmp(zTab, "sqlite_", 7)==0 ){
+    sha3_add_segment(pJob, pnAlloc, sqlite3_mprintf(""));
+    return;
+  }
+  /* A column named "_rowid_" hides the rowid.  WITHOUT ROWID tables fail
+  ** to prepare the query, and empty tables return NULL. */
+  zSql = sqlite3_mprintf(
+      "SELECT min(_rowid_), max(_rowid_) FROM \"%w\""
+      " WHERE NOT EXISTS(SELECT 1 FROM pragma_table_info(%Q)"
+      "                   WHERE name='_rowid_' COLLATE nocase)", zTab, zTab);
+  shell_check_oom(zSql);
+  if( sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0)==SQLITE_OK
+   && sqlite3_step(pStmt)==SQLITE_ROW
+   && sqlite3_column_type(pStmt, 0)==SQLITE_INTEGER
+  ){
+    sqlite3_uint64 nSpan;
+    iMin = sqlite3_column_int64(pStmt, 0);
+    iMax = sqlite3_column_int64(pStmt, 1);
+    nSpan = (sqlite3_uint64)iMax - (sqlite3_uint64)iMin;
+    if( nSpan/SHA3_SEGMENT_SPAN>=SHA3_MAX_SEGMENTS ){
+      nSeg = SHA3_MAX_SEGMENTS;
+    }else{
+      nSeg = (int)(nSpan/SHA3_SEGMENT_SPAN) + 1;
+    }
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zSql);
+  if( nSeg==1 ){
+    sha3_add_segment(pJob, pnAlloc,
+        sqlite3_mprintf("SELECT * FROM \"%w\" NOT INDEXED;", zTab));
+  }else{
+    sqlite3_uint64 nStep;
+    sqlite3_uint64 iLo = (sqlite3_uint64)iMin;
+    int i;
+    nStep = ((sqlite3_uint64)iMax - (sqlite3_uint64)iMin)/nSeg + 1;
+    for(i=0; i<nSeg; i++){
+      sqlite3_uint64 iHi = i==nSeg-1 ? (sqlite3_uint64)iMax : iLo+nStep-1;
+      sha3_add_segment(pJob, pnAlloc, sqlite3_mprintf(
+          "SELECT * FROM \"%w\" NOT INDEXED WHERE _rowid_ BETWEEN %lld AND %lld;",
+          zTab, (sqlite3_int64)iLo, (sqlite3_int64)iHi));
+      iLo += nStep;
+    }
+  }
+}
+
+/* Hash the segments of pJob not yet taken by another thread on db */
+static void sha3_run_segments(Sha3Job *pJob, sqlite3 *db){
+  sqlite3_stmt *pStmt = 0;
+  if( db ){
+    sqlite3_prepare_v2(db, "SELECT sha3_query(?1,?2)", -1, &pStmt, 0);
+  }
+  while( 1 ){
+    Sha3Segment *pSeg;
+    int iSeg;
+#ifdef SHELL_THREADS
+    pthread_mutex_lock(&pJob->mutex);
+#endif
+    iSeg = pJob->iNext++;
+#ifdef SHELL_THREADS
+    pthread_mutex_unlock(&pJob->mutex);
+#endif
+    if( iSeg>=pJob->nSeg ) break;
+    pSeg = &pJob->aSeg[iSeg];
+    if( pStmt==0 ){
+      pSeg->zErr = sqlite3_mprintf("%s", db ? sqlite3_errmsg(db)
+                                            : "cannot open the database");
+      continue;
+    }
+    sqlite3_bind_text(pStmt, 1, pSeg->zSql, -1, SQLITE_STATIC);
+    sqlite3_bind_int(pStmt, 2, pJob->iSize);
+    if( sqlite3_step(pStmt)==SQLITE_ROW
+     && sqlite3_column_bytes(pStmt, 0)==pJob->iSize/8
+    ){
+      memcpy(pSeg->aHash, sqlite3_column_blob(pStmt, 0), pJob->iSize/8);
+    }else{
+      pSeg->zErr = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+    }
+    sqlite3_reset(pStmt);
+  }
+  sqlite3_finalize(pStmt);
+}
+
+/* Write the n bytes of a[] into zHex[] as 2*n lower case hex digits */
+static void sha3_to_hex(const unsigned char *a, int n, char *zHex){
+  static const char zDigit[] = "0123456789abcdef";
+  int i;
+  for(i=0; i<n; i++){
+    zHex[i*2] = zDigit[a[i]>>4];
+    zHex[i*2+1] = zDigit[a[i]&0xf];
+  }
+  zHex[n*2] = 0;
+}
+
+#ifdef SHELL_THREADS
+static void *sha3_worker(void *pArg){
+  Sha3Job *pJob = (Sha3Job*)pArg;
+  sqlite3 *db = 0;
+  if( sqlite3_open_v2(pJob->zFile, &db, SQLITE_OPEN_READONLY, 0)!=SQLITE_OK ){
+    sqlite3_close(db);
+    db = 0;
+  }else{
+    sqlite3_shathree_init(db, 0, 0);
+  }
+  sha3_run_segments(pJob, db);
+  sqlite3_close(db);
+  return 0;
+}
+#endif
+
+/*
+** Implementation of ".sha3sum --jobs N".  Hash the tables whose names
+** are LIKE zLike, or all of them if zLike is NULL, including the schema
+** tables if bSchema is true, with iSize-bit hashes.  Return 1 on error.
+*/
+static int sha3sum_with_jobs(ShellState *p, const char *zLike, int bSchema,
+                             int iSize, int bDebug, int nJob){
+  Sha3Cache *pCache = &p->sha3Cache;
+  Sha3Job sJob;
+  Sha3Table *aTable = 0;
+  int nTable = 0;
+  int nAlloc = 0;
+  int nSegAlloc = 0;
+  int bSnapshot = 0;
+  int bShared = 0;
+  int bCache;
+  unsigned int iDataVersion = 0;
+  sqlite3_stmt *pStmt = 0;
+  ShellText sOut;
+  int rc = 0;
+  int i, j;
+
+  memset(&sJob, 0, sizeof(sJob));
+  sJob.iSize = iSize;
+  sJob.zFile = sqlite3_db_filename(p->db, "main");
+  bCache = sqlite3_get_autocommit(p->db);
+#ifdef SHELL_THREADS
+  if( sJob.zFile==0 || sJob.zFile[0]==0 || !sqlite3_threadsafe() || !bCache
+   || shell_hold_snapshot(p->db, &bShared)!=SQLITE_OK
+  ){
+    nJob = 0;
+  }else{
+    bSnapshot = 1;
+    if( !bShared ){
+      eputz("Warning: WAL database is locked, hashing without --jobs\n");
+      nJob = 0;
+    }
+  }
+#else
+  nJob = 0;
+#endif
+  if( bCache ){
+    sqlite3_file_control(p->db, "main", SQLITE_FCNTL_DATA_VERSION,
+                         &iDataVersion);
+    if( pCache->db!=p->db || pCache->iDataVersion!=iDataVersion ){
+      sha3_cache_clear(pCache);
+      pCache->db = p->db;
+      pCache->iDataVersion = iDataVersion;
+    }
+  }
+
+  sqlite3_prepare_v2(p->db,
+      "SELECT lower(name) as tname FROM sqlite_schema"
+      " WHERE type='table' AND coalesce(rootpage,0)>1"
+      " AND (?1 OR name NOT LIKE 'sqlite_%')"
+      " UNION ALL SELECT 'sqlite_schema' WHERE ?1"
+      " ORDER BY 1 collate nocase", -1, &pStmt, 0);
+  sqlite3_bind_int(pStmt, 1, bSchema);
+  while( SQLITE_ROW==sqlite3_step(pStmt) ){
+    const char *zTab = (const char*)sqlite3_column_text(pStmt,0);
+    Sha3Table *pTab;
+    if( zTab==0 ) continue;
+    if( zLike && sqlite3_strlike(zLike, zTab, 0)!=0 ) continue;
+    if( nTable>=nAlloc ){
+      nAlloc = nAlloc*2 + 16;
+      aTable = sqlite3_realloc64(aTable, nAlloc*sizeof(Sha3Table));
+      shell_check_oom(aTable);
+    }
+    pTab = &aTable[nTable++];
+    memset(pTab, 0, sizeof(*pTab));
+    pTab->zName = sqlite3_mprintf("%s", zTab);
+    shell_check_oom(pTab->zName);
+    pTab->iFirst = sJob.nSeg;
+    for(j=0; bCache && j<pCache->nEntry; j++){
+      if( pCache->aEntry[j].iSize==iSize
+       && cli_strcmp(pCache->aEntry[j].zName, zTab)==0
+      ){
+        memcpy(pTab->aHash, pCache->aEntry[j].aHash, iSize/8);
+        break;
+      }
+    }
+    if( bCache && j<pCache->nEntry ) continue;
+    sha3_plan_table(p->db, &sJob, &nSegAlloc, zTab);
+    pTab->nSeg = sJob.nSeg - pTab->iFirst;
+  }
+  sqlite3_finalize(pStmt);
+
+  if( bDebug ){
+    for(i=0; i<sJob.nSeg; i++) oputf("%s\n", sJob.aSeg[i].zSql);
+  }else{
+#ifdef SHELL_THREADS
+    pthread_t *aThread = 0;
+    int nStarted = 0;
+    if( nJob>sJob.nSeg ) nJob = sJob.nSeg;
+    if( nJob>0 ){
+      pthread_mutex_init(&sJob.mutex, 0);
+      aThread = sqlite3_malloc64(nJob*sizeof(pthread_t));
+      shell_check_oom(aThread);
+      for(i=0; i<nJob; i++){
+        if( pthread_create(&aThread[nStarted], 0, sha3_worker, &sJob)==0 ){
+          nStarted++;
+        }
+      }
+    }
+    if( nStarted==0 ) sha3_run_segments(&sJob, p->db);
+    for(i=0; i<nStarted; i++) pthread_join(aThread[i], 0);
+    if( nJob>0 ) pthread_mutex_destroy(&sJob.mutex);
+    sqlite3_free(aThread);
+#else
+    sha3_run_segments(&sJob, p->db);
+#endif
+  }
+  /* Nothing was written, and unlike COMMIT, ROLLBACK leaves the data
+  ** version unchanged for the next run */
+  if( bSnapshot ) sqlite3_exec(p->db, "ROLLBACK;", 0, 0, 0);
+
+  /* Combine the hashes of the segments into those of the tables, and
+  ** those into the hash of the database */
+  initText(&sOut);
+  for(i=0; i<nTable && !bDebug; i++){
+    Sha3Table *pTab = &aTable[i];
+    for(j=pTab->iFirst; j<pTab->iFirst+pTab->nSeg; j++){
+      if( sJob.aSeg[j].zErr ){
+        eputf("Error hashing %s: %s\n", pTab->zName, sJob.aSeg[j].zErr);
+        rc = 1;
+      }
+    }
+    if( rc ) continue;
+    if( pTab->nSeg==1 ){
+      memcpy(pTab->aHash, sJob.aSeg[pTab->iFirst].aHash, iSize/8);
+    }else if( pTab->nSeg>1 ){
+      SHA3Context cx;
+      SHA3Init(&cx, iSize);
+      for(j=pTab->iFirst; j<pTab->iFirst+pTab->nSeg; j++){
+        SHA3Update(&cx, sJob.aSeg[j].aHash, iSize/8);
+      }
+      memcpy(pTab->aHash, SHA3Final(&cx), iSize/8);
+    }
+    if( pTab->nSeg>0 && bCache ){
+      struct Sha3CacheEntry *pEntry;
+      if( pCache->nEntry>=pCache->nAlloc ){
+        pCache->nAlloc = pCache->nAlloc*2 + 16;
+        pCache->aEntry = sqlite3_realloc64(pCache->aEntry,
+                                pCache->nAlloc*sizeof(pCache->aEntry[0]));
+        shell_check_oom(pCache->aEntry);
+      }
+      pEntry = &pCache->aEntry[pCache->nEntry++];
+      pEntry->zName = sqlite3_mprintf("%s", pTab->zName);
+      shell_check_oom(pEntry->zName);
+      pEntry->iSize = iSize;
+      memcpy(pEntry->aHash, pTab->aHash, iSize/8);
+    }
+  }
+  if( rc==0 && !bDebug && (zLike==0 || nTable>0) ){
+    char zHex[129];
+    SHA3Context cx;
+    char *zSql;
+    SHA3Init(&cx, iSize);
+    appendText(&sOut, zLike ? "SELECT column1 AS hash, column2 AS label"
+                              " FROM (VALUES" : "", 0);
+    for(i=0; i<nTable; i++){
+      const unsigned char *aHash = aTable[i].aHash;
+      SHA3Update(&cx, (unsigned char*)aTable[i].zName,
+                 (int)strlen(aTable[i].zName)+1);
+      SHA3Update(&cx, aHash, iSize/8);
+      if( zLike ){
+        sha3_to_hex(aHash, iSize/8, zHex);
+        zSql = sqlite3_mprintf("%s(%Q,%Q)", i ? "," : "",
+                               zHex, aTable[i].zName);
+        shell_check_oom(zSql);
+        appendText(&sOut, zSql, 0);
+        sqlite3_free(zSql);
+      }
+    }
+    if( zLike ){
+      appendText(&sOut, ")", 0);
+    }else{
+      sha3_to_hex(SHA3Final(&cx), iSize/8, zHex);
+      appendText(&sOut, "SELECT '", 0);
+      appendText(&sOut, zHex, 0);
+      appendText(&sOut, "' AS hash, '(tree of table hashes)' AS label", 0);
+    }
+    shell_exec(p, sOut.z, 0);
+  }
+  freeText(&sOut);
+  for(i=0; i<sJob.nSeg; i++){
+    sqlite3_free(sJob.aSeg[i].zSql);
+    sqlite3_free(sJob.aSeg[i].zErr);
+  }
+  sqlite3_free(sJob.aSeg);
+  for(i=0; i<nTable; i++) sqlite3_free(aTable[i].zName);
+  sqlite3_free(aTable);
+  return rc;
+}
+// End Android Add
 /*
 ** If an input line begins with "." then invoke this routine to
 ** process that line.
@@ -24976,9 +31990,17 @@ static int do_meta_command(char *zLine, ShellState *p){
   if( c=='c' && cli_strncmp(azArg[0], "clone", n)==0 ){
     failIfSafeMode(p, "cannot run .clone in safe mode");
     if( nArg==2 ){
-      tryToClone(p, azArg[1]);
+// Begin Android Add
+      tryToClone(p, azArg[1], 0);
+    }else if( nArg==4 && (cli_strcmp(azArg[1],"--jobs")==0
+                          || cli_strcmp(azArg[1],"-jobs")==0) ){
+      int nJob = (int)integerValue(azArg[2]);
+      tryToClone(p, azArg[3], nJob>64 ? 64 : nJob);
+// End Android Add
     }else{
-      eputz("Usage: .clone FILENAME\n");
+// Begin Android Add
+      eputz("Usage: .clone ?--jobs N? FILENAME\n");
+// End Android Add
       rc = 1;
     }
   }else
@@ -25141,6 +32163,12 @@ static int do_meta_command(char *zLine, ShellState *p){
     int i;
     int savedShowHeader = p->showHeader;
     int savedShellFlags = p->shellFlgs;
+// Begin Android Add
+#if defined(SHELL_THREADS) && defined(SHELL_OUT_BUFFER)
+    const char *zDir = 0;
+    int nJob = 0;
+#endif
+// End Android Add
     ShellClearFlag(p,
        SHFLG_PreserveRowid|SHFLG_Newlines|SHFLG_Echo
        |SHFLG_DumpDataOnly|SHFLG_DumpNoSys);
@@ -25168,6 +32196,16 @@ static int do_meta_command(char *zLine, ShellState *p){
         if( cli_strcmp(z,"nosys")==0 ){
           ShellSetFlag(p, SHFLG_DumpNoSys);
         }else
+// Begin Android Add
+#if defined(SHELL_THREADS) && defined(SHELL_OUT_BUFFER)
+        if( cli_strcmp(z,"dir")==0 && i+1<nArg ){
+          zDir = azArg[++i];
+        }else
+        if( cli_strcmp(z,"jobs")==0 && i+1<nArg ){
+          nJob = (int)integerValue(azArg[++i]);
+        }else
+#endif
+// End Android Add
         {
           eputf("Unknown option \"%s\" on \".dump\"\n", azArg[i]);
           rc = 1;
@@ -25199,6 +32237,27 @@ static int do_meta_command(char *zLine, ShellState *p){
 
     open_db(p, 0);
 
+// Begin Android Add
+#if defined(SHELL_THREADS) && defined(SHELL_OUT_BUFFER)
+    if( zDir ){
+      failIfSafeMode(p, "cannot run .dump --dir in safe mode");
+      if( zLike==0 ) zLike = sqlite3_mprintf("true");
+      shell_check_oom(zLike);
+      p->showHeader = 0;
+      rc = dump_dir(p, zDir, zLike, nJob)!=0;
+      sqlite3_free(zLike);
+      p->showHeader = savedShowHeader;
+      p->shellFlgs = savedShellFlags;
+      goto meta_command_exit;
+    }else if( nJob ){
+      eputz("Error: --jobs requires --dir on \".dump\"\n");
+      rc = 1;
+      sqlite3_free(zLike);
+      p->shellFlgs = savedShellFlags;
+      goto meta_command_exit;
+    }
+#endif
+// End Android Add
     if( (p->shellFlgs & SHFLG_DumpDataOnly)==0 ){
       /* When playing back a "dump", the content might appear in an order
       ** which causes immediate foreign key constraints to be violated.
@@ -25564,6 +32623,13 @@ static int do_meta_command(char *zLine, ShellState *p){
     char *(SQLITE_CDECL *xRead)(ImportCtx*); /* Func to read one value */
     int eVerbose = 0;           /* Larger for more console output */
     int nSkip = 0;              /* Initial lines to skip */
+// Begin Android Add
+    int nThread = 0;            /* Parse on this many threads, if >0 */
+    int bTyped = 0;             /* Bind numbers per the column types */
+    int nInfer = 0;             /* Rows to infer the column types from */
+    int nCommit = 0;            /* Rows per transaction, if >0 */
+    int bArrow = 0;             /* Read an Arrow IPC stream */
+// End Android Add
     int useOutputMode = 1;      /* Use output mode to determine separators */
     char *zCreate = 0;          /* CREATE TABLE statement text */
 
@@ -25594,6 +32660,21 @@ static int do_meta_command(char *zLine, ShellState *p){
         zSchema = azArg[++i];
       }else if( cli_strcmp(z,"-skip")==0 && i<nArg-1 ){
         nSkip = integerValue(azArg[++i]);
+// Begin Android Add
+      }else if( cli_strcmp(z,"-threads")==0 && i<nArg-1 ){
+        nThread = integerValue(azArg[++i]);
+        if( nThread>64 ) nThread = 64;
+      }else if( cli_strcmp(z,"-typed")==0 ){
+        bTyped = 1;
+      }else if( cli_strcmp(z,"-infer")==0 && i<nArg-1 ){
+        nInfer = integerValue(azArg[++i]);
+        bTyped = 1;
+      }else if( cli_strcmp(z,"-commit")==0 && i<nArg-1 ){
+        nCommit = integerValue(azArg[++i]);
+      }else if( cli_strcmp(z,"-arrow")==0 ){
+        bArrow = 1;
+        useOutputMode = 0;
+// End Android Add
       }else if( cli_strcmp(z,"-ascii")==0 ){
         sCtx.cColSep = SEP_Unit[0];
         sCtx.cRowSep = SEP_Record[0];
@@ -25618,6 +32699,12 @@ static int do_meta_command(char *zLine, ShellState *p){
     }
     seenInterrupt = 0;
     open_db(p, 0);
+// Begin Android Add
+    if( useOutputMode && p->mode==MODE_Arrow ){
+      bArrow = 1;
+      useOutputMode = 0;
+    }
+// End Android Add
     if( useOutputMode ){
       /* If neither the --csv or --ascii options are specified, then set
       ** the column and row separator characters from the output mode. */
@@ -25673,6 +32760,20 @@ static int do_meta_command(char *zLine, ShellState *p){
       eputf("Error: cannot open \"%s\"\n", zFile);
       goto meta_command_exit;
     }
+// Begin Android Add
+    if( bArrow ){
+      if( zSchema!=0 ){
+        zFullTabName = sqlite3_mprintf("\"%w\".\"%w\"", zSchema, zTable);
+      }else{
+        zFullTabName = sqlite3_mprintf("\"%w\"", zTable);
+      }
+      shell_check_oom(zFullTabName);
+      rc = import_arrow(p, &sCtx, zFullTabName, nCommit, eVerbose);
+      sqlite3_free(zFullTabName);
+      import_cleanup(&sCtx);
+      goto meta_command_exit;
+    }
+// End Android Add
     if( eVerbose>=2 || (eVerbose>=1 && useOutputMode) ){
       char zSep[2];
       zSep[1] = 0;
@@ -25710,12 +32811,29 @@ static int do_meta_command(char *zLine, ShellState *p){
       sqlite3 *dbCols = 0;
       char *zRenames = 0;
       char *zColDefs;
+// Begin Android Add
+      char *zCol;
+      int nHdrCol = 0;
+// End Android Add
       zCreate = sqlite3_mprintf("CREATE TABLE %s", zFullTabName);
-      while( xRead(&sCtx) ){
-        zAutoColumn(sCtx.z, &dbCols, 0);
+// Begin Android Add
+      while( (zCol = xRead(&sCtx))!=0 ){
+        zAutoColumn(zCol, &dbCols, 0);
+        nHdrCol++;
+// End Android Add
         if( sCtx.cTerm!=sCtx.cColSep ) break;
       }
       zColDefs = zAutoColumn(0, &dbCols, &zRenames);
+// Begin Android Add
+      if( zColDefs!=0 && nInfer>0 ){
+        const char **azType = sqlite3_malloc64(nHdrCol*sizeof(char*));
+        shell_check_oom(azType);
+        import_infer_types(&sCtx, xRead, nHdrCol, p->mode==MODE_Ascii,
+                           nInfer, azType);
+        zColDefs = import_retype_columns(zColDefs, azType, nHdrCol);
+        sqlite3_free(azType);
+      }
+// End Android Add
       if( zRenames!=0 ){
         sputf((stdin_is_interactive && p->in==stdin)? p->out : stderr,
               "Columns renamed during .import %s due to duplicates:\n"
@@ -25753,6 +32871,15 @@ static int do_meta_command(char *zLine, ShellState *p){
     }
     sqlite3_free(zSql);
     nCol = sqlite3_column_count(pStmt);
+// Begin Android Add
+    if( bTyped && nCol>0 ){
+      sCtx.aAff = sqlite3_malloc64(nCol);
+      shell_check_oom(sCtx.aAff);
+      for(i=0; i<nCol; i++){
+        sCtx.aAff[i] = import_affinity(sqlite3_column_decltype(pStmt, i));
+      }
+    }
+// End Android Add
     sqlite3_finalize(pStmt);
     pStmt = 0;
     if( nCol==0 ) return 0; /* no columns, no error */
@@ -25782,58 +32909,27 @@ static int do_meta_command(char *zLine, ShellState *p){
     sqlite3_free(zFullTabName);
     needCommit = sqlite3_get_autocommit(p->db);
     if( needCommit ) sqlite3_exec(p->db, "BEGIN", 0, 0, 0);
+// Begin Android Add
+    if( needCommit ) sCtx.nCommit = nCommit;
+// End Android Add
+// Begin Android Add
+#ifdef SHELL_THREADS
+    if( nThread>0 && sqlite3_threadsafe() && import_with_threads(&sCtx, xRead, nCol,
+            p->mode==MODE_Ascii, nThread, p->db, pStmt, &rc) ){
+      /* All rows have been inserted */
+    }else
+#endif
     do{
-      int startLine = sCtx.nLine;
-      for(i=0; i<nCol; i++){
-        char *z = xRead(&sCtx);
-        /*
-        ** Did we reach end-of-file before finding any columns?
-        ** If so, stop instead of NULL filling the remaining columns.
-        */
-        if( z==0 && i==0 ) break;
-        /*
-        ** Did we reach end-of-file OR end-of-line before finding any
-        ** columns in ASCII mode?  If so, stop instead of NULL filling
-        ** the remaining columns.
-        */
-        if( p->mode==MODE_Ascii && (z==0 || z[0]==0) && i==0 ) break;
-        /*
-        ** For CSV mode, per RFC 4180, accept EOF in lieu of final
-        ** record terminator but only for last field of multi-field row.
-        ** (If there are too few fields, it's not valid CSV anyway.)
-        */
-        if( z==0 && (xRead==csv_read_one_field) && i==nCol-1 && i>0 ){
-          z = "";
-        }
-        sqlite3_bind_text(pStmt, i+1, z, -1, SQLITE_TRANSIENT);
-        if( i<nCol-1 && sCtx.cTerm!=sCtx.cColSep ){
-          eputf("%s:%d: expected %d columns but found %d"
-                " - filling the rest with NULL\n",
-                sCtx.zFile, startLine, nCol, i+1);
-          i += 2;
-          while( i<=nCol ){ sqlite3_bind_null(pStmt, i); i++; }
-        }
-      }
-      if( sCtx.cTerm==sCtx.cColSep ){
-        do{
-          xRead(&sCtx);
-          i++;
-        }while( sCtx.cTerm==sCtx.cColSep );
-        eputf("%s:%d: expected %d columns but found %d - extras ignored\n",
-              sCtx.zFile, startLine, nCol, i);
-      }
-      if( i>=nCol ){
-        sqlite3_step(pStmt);
-        rc = sqlite3_reset(pStmt);
-        if( rc!=SQLITE_OK ){
-          eputf("%s:%d: INSERT failed: %s\n",
-                sCtx.zFile, startLine, sqlite3_errmsg(p->db));
-          sCtx.nErr++;
-        }else{
-          sCtx.nRow++;
-        }
+      ImportBind sBind;
+      int startLine;
+      sBind.pStmt = pStmt;
+      sBind.aAff = sCtx.aAff;
+      if( import_read_row(&sCtx, xRead, nCol, p->mode==MODE_Ascii,
+                          import_bind_value, &sBind, &startLine) ){
+        rc = import_insert_row(&sCtx, p->db, pStmt, startLine);
       }
     }while( sCtx.cTerm!=EOF );
+// End Android Add
 
     import_cleanup(&sCtx);
     sqlite3_finalize(pStmt);
@@ -26085,6 +33181,9 @@ static int do_meta_command(char *zLine, ShellState *p){
     const char *zTabname = 0;
     int i, n2;
     ColModeOpts cmOpts = ColModeOpts_default;
+// Begin Android Add
+    int nArrowBatch = 0;
+// End Android Add
     for(i=1; i<nArg; i++){
       const char *z = azArg[i];
       if( optionMatch(z,"wrap") && i+1<nArg ){
@@ -26097,6 +33196,10 @@ static int do_meta_command(char *zLine, ShellState *p){
         cmOpts.bQuote = 1;
       }else if( optionMatch(z,"noquote") ){
         cmOpts.bQuote = 0;
+// Begin Android Add
+      }else if( optionMatch(z,"batch") && i+1<nArg ){
+        nArrowBatch = integerValue(azArg[++i]);
+// End Android Add
       }else if( zMode==0 ){
         zMode = z;
         /* Apply defaults for qbox pseudo-mode.  If that
@@ -26112,6 +33215,9 @@ static int do_meta_command(char *zLine, ShellState *p){
       }else if( z[0]=='-' ){
         eputf("unknown option: %s\n", z);
         eputz("options:\n"
+// Begin Android Add
+              "  --batch N\n"
+// End Android Add
               "  --noquote\n"
               "  --quote\n"
               "  --wordwrap on/off\n"
@@ -26133,6 +33239,11 @@ static int do_meta_command(char *zLine, ShellState *p){
               modeDescr[p->mode], p->cmOpts.iWrap,
               p->cmOpts.bWordWrap ? "on" : "off",
               p->cmOpts.bQuote ? "" : "no");
+// Begin Android Add
+      }else if( p->mode==MODE_Arrow ){
+        oputf("current output mode: arrow --batch %d\n",
+              p->nArrowBatch>0 ? p->nArrowBatch : ARROW_BATCH_ROWS);
+// End Android Add
       }else{
         oputf("current output mode: %s\n", modeDescr[p->mode]);
       }
@@ -26192,6 +33303,11 @@ static int do_meta_command(char *zLine, ShellState *p){
       p->mode = MODE_Off;
     }else if( cli_strncmp(zMode,"json",n2)==0 ){
       p->mode = MODE_Json;
+// Begin Android Add
+    }else if( cli_strncmp(zMode,"arrow",n2)==0 ){
+      p->mode = MODE_Arrow;
+      if( nArrowBatch>0 ) p->nArrowBatch = nArrowBatch;
+// End Android Add
     }else{
       eputz("Error: mode should be one of: "
             "ascii box column csv html insert json line list markdown "
@@ -26655,6 +33771,23 @@ static int do_meta_command(char *zLine, ShellState *p){
     int nTimeout = 0;
 
     failIfSafeMode(p, "cannot run .restore in safe mode");
+// Begin Android Add
+#if defined(SHELL_THREADS) && defined(SHELL_OUT_BUFFER)
+    if( nArg>=3 && cli_strcmp(azArg[1], "--dir")==0 ){
+      int nJob = 0;
+      if( nArg==5 && cli_strcmp(azArg[3], "--jobs")==0 ){
+        nJob = (int)integerValue(azArg[4]);
+      }else if( nArg!=3 ){
+        eputz("Usage: .restore --dir D ?--jobs N?\n");
+        rc = 1;
+        goto meta_command_exit;
+      }
+      open_db(p, 0);
+      rc = restore_dir(p, azArg[2], nJob)!=0;
+      goto meta_command_exit;
+    }
+#endif
+// End Android Add
     if( nArg==2 ){
       zSrcFile = azArg[1];
       zDb = "main";
@@ -26707,7 +33840,15 @@ static int do_meta_command(char *zLine, ShellState *p){
       }else
       if( cli_strcmp(azArg[1], "est")==0 ){
         p->scanstatsOn = 2;
+// Begin Android Add
+      }else
+      if( cli_strcmp(azArg[1], "json")==0 ){
+        p->scanstatsOn = 4;
+      }else
+      if( cli_strcmp(azArg[1], "folded")==0 ){
+        p->scanstatsOn = 5;
       }else{
+// End Android Add
         p->scanstatsOn = (u8)booleanValue(azArg[1]);
       }
       open_db(p, 0);
@@ -27223,6 +34364,9 @@ static int do_meta_command(char *zLine, ShellState *p){
     int bSeparate = 0;       /* Hash each table separately */
     int iSize = 224;         /* Hash algorithm to use */
     int bDebug = 0;          /* Only show the query that would have run */
+// Begin Android Add
+    int nJob = 0;            /* Hash on this many threads */
+// End Android Add
     sqlite3_stmt *pStmt;     /* For querying tables names */
     char *zSql;              /* SQL to be run */
     char *zSep;              /* Separator */
@@ -27245,6 +34389,16 @@ static int do_meta_command(char *zLine, ShellState *p){
         if( cli_strcmp(z,"debug")==0 ){
           bDebug = 1;
         }else
+// Begin Android Add
+        if( cli_strcmp(z,"jobs")==0 && i+1<nArg ){
+          nJob = (int)integerValue(azArg[++i]);
+          if( nJob<1 || nJob>64 ){
+            eputz("--jobs must be between 1 and 64\n");
+            rc = 1;
+            goto meta_command_exit;
+          }
+        }else
+// End Android Add
         {
           eputf("Unknown option \"%s\" on \"%s\"\n", azArg[i], azArg[0]);
           showHelp(p->out, azArg[0]);
@@ -27261,6 +34415,13 @@ static int do_meta_command(char *zLine, ShellState *p){
         if( sqlite3_strlike("sqlite\\_%", zLike, '\\')==0 ) bSchema = 1;
       }
     }
+// Begin Android Add
+    if( nJob>0 ){
+      rc = sha3sum_with_jobs(p, zLike, bSchema, iSize, bDebug, nJob);
+      if( rc ) eputz(".sha3sum failed.\n");
+      goto meta_command_exit;
+    }
+// End Android Add
     if( bSchema ){
       zSql = "SELECT lower(name) as tname FROM sqlite_schema"
              " WHERE type='table' AND coalesce(rootpage,0)>1"
@@ -27864,6 +35025,36 @@ static int do_meta_command(char *zLine, ShellState *p){
   }else
 
   if( c=='t' && n>=5 && cli_strncmp(azArg[0], "timer", n)==0 ){
+// Begin Android Add
+    if( nArg>=2 && cli_strcmp(azArg[1], "histogram")==0 ){
+      const char *zCmd = nArg>=3 ? azArg[2] : "on";
+      int bJson = nArg==4 && cli_strcmp(azArg[3], "--json")==0;
+      if( nArg>4 || (nArg==4 && !bJson) ){
+        zCmd = "";
+      }
+      if( cli_strcmp(zCmd, "on")==0 ){
+        stmt_hist_free(p);
+        p->pStmtHist = sqlite3_malloc64(sizeof(StmtHist));
+        shell_check_oom(p->pStmtHist);
+        memset(p->pStmtHist, 0, sizeof(StmtHist));
+        p->pStmtHist->bJson = bJson;
+      }else if( cli_strcmp(zCmd, "off")==0 && nArg==3 ){
+        stmt_hist_free(p);
+      }else if( cli_strcmp(zCmd, "reset")==0 && nArg==3 ){
+        if( p->pStmtHist ) stmt_hist_reset(p->pStmtHist);
+      }else if( cli_strcmp(zCmd, "show")==0 ){
+        if( p->pStmtHist ){
+          stmt_hist_report(p->pStmtHist, bJson || p->pStmtHist->bJson);
+        }else{
+          eputz("Error: \".timer histogram\" is not on\n");
+          rc = 1;
+        }
+      }else{
+        eputz("Usage: .timer histogram ?on|off|reset|show? ?--json?\n");
+        rc = 1;
+      }
+    }else
+// End Android Add
     if( nArg==2 ){
       enableTimer = booleanValue(azArg[1]);
       if( enableTimer && !HAS_TIMER ){
@@ -28262,7 +35453,13 @@ static int runOneSqlLine(ShellState *p, char *zSql, FILE *in, int startline){
   if( ShellHasFlag(p,SHFLG_Backslash) ) resolve_backslashes(zSql);
   if( p->flgProgress & SHELL_PROGRESS_RESET ) p->nProgress = 0;
   BEGIN_TIMER;
+// Begin Android Add
+  p->bStmtHistSql = p->pStmtHist!=0;
+// End Android Add
   rc = shell_exec(p, zSql, &zErrMsg);
+// Begin Android Add
+  p->bStmtHistSql = 0;
+// End Android Add
   END_TIMER;
   if( rc || zErrMsg ){
     char zPrefix[100];
@@ -29384,6 +36581,12 @@ int SQLITE_CDECL wmain(int argc, wchar_t **wargv){
 #ifndef SQLITE_SHELL_FIDDLE
   /* In WASM mode we have to leave the db state in place so that
   ** client code can "push" SQL into it after this call returns. */
+// Begin Android Add
+  if( data.pStmtHist ){
+    stmt_hist_report(data.pStmtHist, data.pStmtHist->bJson);
+    stmt_hist_free(&data);
+  }
+// End Android Add
   free(azCmd);
   set_table_name(&data, 0);
   if( data.db ){
@@ -29407,6 +36610,12 @@ int SQLITE_CDECL wmain(int argc, wchar_t **wargv){
 #endif
   free(data.colWidth);
   free(data.zNonce);
+// Begin Android Add
+  sha3_cache_clear(&data.sha3Cache);
+#ifdef SHELL_OUT_BUFFER
+  sqlite3_free(data.sOut.z);
+#endif
+// End Android Add
   /* Clear the global data structure so that valgrind will detect memory
   ** leaks */
   memset(&data, 0, sizeof(data));